@@ -0,0 +1,443 @@
+/*********************************************************************************
+ *      Copyright:  (C) 2025 Liao Shengli<liaoshengli@gmail.com>
+ *                  All rights reserved.
+ *
+ *       Filename:  frame_reader.c
+ *    Description:  This file reads the camera frames video2lcd publishes to a
+ *                  shared-memory frame ring, and tests the ring throughput
+ *
+ *        Version:  1.0.0(10/17/2026)
+ *         Author:  Liao Shengli <liaoshengli@gmail.com>
+ *      ChangeLog:  1, Release initial version on "10/17/2026 09:30:00 AM"
+ *
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include "frame_ring.h"
+
+/* 程序版本 */
+#define PROG_VERSION    "1.0.0"
+
+/* 吞吐测试：640x480 YUYV 的合成帧，TEST_PATTERNS 帧轮流发布，每帧的每个字都是同一个值，
+ * 和槽数互质，读到的数据混进了别的帧时一定能发现
+ */
+#define TEST_WIDTH      640
+#define TEST_HEIGHT     480
+#define TEST_SLOTS      4
+#define TEST_PATTERNS   7
+#define TEST_BUFS       4               /* -D 时用 memfd 代替采集缓冲区导出 */
+#define TEST_FOURCC     0x56595559      /* V4L2_PIX_FMT_YUYV */
+
+static volatile sig_atomic_t   g_stop = 0;
+
+static void sig_stop(int signum)
+{
+    (void)signum;
+    g_stop = 1;
+}
+
+static double now_ns(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static inline uint32_t test_pattern(uint64_t seq)
+{
+    return 0x9E3779B9U * (uint32_t)(seq % TEST_PATTERNS + 1);
+}
+
+/* 检查一帧的每个字都是 seq 对应的值 */
+static int test_verify(const frame_ring_frame_t *frame)
+{
+    const uint32_t   *w = (const uint32_t *)frame->data;
+    uint32_t         v = test_pattern(frame->seq);
+    unsigned int     i, n = frame->bytesused / 4;
+
+    for(i=0; i<n; i++)
+    {
+        if(w[i] != v)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* 一个读端进程：读 seconds 秒，打印统计，数据错了或一帧也没读到时返回 1 */
+static int test_reader(const char *name, unsigned int id, int zero_copy, int dmabuf, double seconds)
+{
+    frame_ring_t         ring;
+    frame_ring_frame_t   frame;
+    unsigned char        *buf = NULL;
+    unsigned long        torn = 0, bad = 0;
+    double               t0 = 0, now, lat, lat_sum = 0, lat_max = 0, bytes = 0;
+    int                  rv;
+
+    if(frame_ring_open(&ring, name) < 0)
+        return 1;
+    if(dmabuf && frame_ring_open_dmabuf(&ring) < 0)
+    {
+        frame_ring_close(&ring);
+        return 1;
+    }
+    if(!zero_copy && !(buf = malloc(ring.hdr->slot_size)))
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        frame_ring_close(&ring);
+        return 1;
+    }
+
+    while(!g_stop)
+    {
+        rv = frame_ring_wait(&ring, 100);
+        if(rv < 0)
+            break;
+
+        while(frame_ring_read(&ring, &frame, buf, buf ? ring.hdr->slot_size : 0) > 0)
+        {
+            /* 零拷贝时先用数据，再确认用的时候没有被覆盖，被覆盖的帧丢掉 */
+            rv = test_verify(&frame);
+            if(frame_ring_check(&frame) < 0)
+            {
+                torn++;
+                continue;
+            }
+            if(rv < 0)
+                bad++;
+
+            now = now_ns();
+            lat = now - frame.timestamp_ns;
+            lat_sum += lat;
+            lat_max = lat > lat_max ? lat : lat_max;
+            bytes += frame.bytesused;
+            if(!t0)
+                t0 = now;
+        }
+
+        if(t0 && now_ns() - t0 >= seconds * 1e9)
+            break;
+    }
+
+    now = now_ns() - t0;
+    printf("reader %u %s frames=%lu fps=%.1f mb_s=%.1f latency_us=%.1f/%.1f missed=%lu retries=%lu torn=%lu bad=%lu\n", id,
+            dmabuf ? "dmabuf" : (zero_copy ? "in-place" : "copy"), ring.frames, t0 ? ring.frames * 1e9 / now : 0,
+            t0 ? bytes * 1e3 / now : 0, ring.frames ? lat_sum / ring.frames / 1e3 : 0, lat_max / 1e3,
+            ring.missed, ring.retries, torn, bad);
+    fflush(stdout);
+
+    rv = bad || !ring.frames;
+    free(buf);
+    frame_ring_close(&ring);
+    return rv;
+}
+
+/* 吞吐测试：本进程作为写端尽快发布合成帧，readers 个读端进程同时读
+ * -D 时先把帧写进 memfd (代替摄像头 DMA)，发布时带上缓冲区编号，读端映射 memfd 零拷贝读
+ */
+static int run_test(unsigned int readers, int zero_copy, int dmabuf, double seconds)
+{
+    frame_ring_t     ring;
+    char             name[64];
+    unsigned int     frame_size = TEST_WIDTH * TEST_HEIGHT * 2;
+    unsigned int     lens[TEST_BUFS];
+    unsigned char    *pattern[TEST_PATTERNS];
+    unsigned char    *dma[TEST_BUFS];
+    int              fds[TEST_BUFS];
+    pid_t            pid[64];
+    unsigned long    frames = 0;
+    unsigned int     i, k, idx;
+    int              status, failed = 0;
+    double           t0, ns;
+
+    readers = readers > 64 ? 64 : readers;
+    snprintf(name, sizeof(name), "/frame_ring_test.%d", (int)getpid());
+    if(frame_ring_create(&ring, name, TEST_SLOTS, TEST_WIDTH, TEST_HEIGHT, TEST_FOURCC, TEST_WIDTH * 2, frame_size) < 0)
+        return -1;
+
+    for(k=0; k<TEST_PATTERNS; k++)
+    {
+        pattern[k] = malloc(frame_size);
+        if(!pattern[k])
+        {
+            printf("%s : malloc error\n", __FUNCTION__);
+            return -1;
+        }
+        for(i=0; i<frame_size / 4; i++)
+            ((uint32_t *)pattern[k])[i] = test_pattern(k);
+    }
+
+    if(dmabuf)
+    {
+        for(i=0; i<TEST_BUFS; i++)
+        {
+            fds[i] = syscall(SYS_memfd_create, "frame_ring_test", 0);
+            if(fds[i] < 0 || ftruncate(fds[i], frame_size) < 0 ||
+               (dma[i] = mmap(NULL, frame_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[i], 0)) == MAP_FAILED)
+            {
+                printf("%s : memfd error\n", __FUNCTION__);
+                return -1;
+            }
+            lens[i] = frame_size;
+        }
+        if(frame_ring_export(&ring, fds, lens, TEST_BUFS) < 0)
+            return -1;
+    }
+
+    printf("test: %s, %u slots of %ux%u YUYV, %u %s reader(s), %.1f s\n", name, TEST_SLOTS, TEST_WIDTH, TEST_HEIGHT,
+            readers, dmabuf ? "dmabuf" : (zero_copy ? "in-place" : "copy"), seconds);
+    fflush(stdout);
+
+    for(i=0; i<readers; i++)
+    {
+        pid[i] = fork();
+        if(pid[i] == 0)
+            _exit(test_reader(name, i, zero_copy, dmabuf, seconds));
+        if(pid[i] < 0)
+        {
+            printf("%s : fork error\n", __FUNCTION__);
+            readers = i;
+            failed++;
+            break;
+        }
+    }
+
+    /* 读端打开共享内存后才开始计时，多发一会儿保证读端读满 seconds 秒 */
+    usleep(200000);
+    t0 = now_ns();
+    while(!g_stop && now_ns() - t0 < (seconds + 0.5) * 1e9)
+    {
+        k = (frames + 1) % TEST_PATTERNS;
+        if(dmabuf)
+        {
+            idx = frames % TEST_BUFS;
+            frame_ring_release(&ring, idx);
+            memcpy(dma[idx], pattern[k], frame_size);
+            frame_ring_publish(&ring, dma[idx], frame_size, frames, now_ns(), idx);
+        }
+        else
+        {
+            frame_ring_publish(&ring, pattern[k], frame_size, frames, now_ns(), -1);
+        }
+        frames++;
+    }
+    ns = now_ns() - t0;
+
+    for(i=0; i<readers; i++)
+    {
+        if(waitpid(pid[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+            failed++;
+    }
+
+    printf("writer frames=%lu fps=%.1f mb_s=%.1f ns_frame=%.0f\n", frames, frames * 1e9 / ns,
+            (double)frames * frame_size * 1e3 / ns, ns / frames);
+    printf("test: %s\n", failed ? "FAILED" : "passed");
+
+    frame_ring_destroy(&ring);
+    for(k=0; k<TEST_PATTERNS; k++)
+        free(pattern[k]);
+    for(i=0; dmabuf && i<TEST_BUFS; i++)
+        munmap(dma[i], frame_size);
+
+    return failed ? -2 : 0;
+}
+
+/* 读 video2lcd 发布的帧，每秒打印一次统计，可以存成原始文件 */
+static int run_reader(const char *name, int zero_copy, int dmabuf, const char *output, unsigned long count)
+{
+    frame_ring_t         ring;
+    frame_ring_frame_t   frame;
+    unsigned char        *buf = NULL;
+    unsigned char        *save = NULL;
+    unsigned long        frames = 0, torn = 0, window = 0;
+    double               t0;
+    int                  fd = -1;
+    int                  rv;
+
+    if(frame_ring_open(&ring, name) < 0)
+        return -1;
+
+    printf("%s: %ux%u fourcc %.4s stride %u, %u slots of %u bytes, writer pid %d, %u DMABUF\n", name, ring.hdr->width,
+            ring.hdr->height, (char *)&ring.hdr->pixfmt, ring.hdr->stride, ring.hdr->slot_cnt, ring.hdr->slot_size,
+            ring.hdr->writer_pid, ring.hdr->buf_cnt);
+
+    if(dmabuf && frame_ring_open_dmabuf(&ring) < 0)
+        goto cleanup;
+    if(!zero_copy && !(buf = malloc(ring.hdr->slot_size)))
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        goto cleanup;
+    }
+    /* 零拷贝时数据随时会被覆盖，要存的帧先拷到本地，确认完整后再写文件 */
+    if(output && zero_copy && !(save = malloc(ring.hdr->slot_size)))
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        goto cleanup;
+    }
+    if(output && (fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        printf("%s : open '%s' error\n", __FUNCTION__, output);
+        goto cleanup;
+    }
+
+    t0 = now_ns();
+    while(!g_stop && (!count || frames < count))
+    {
+        rv = frame_ring_wait(&ring, 1000);
+        if(rv < 0)
+        {
+            printf("writer pid %d exited\n", ring.hdr->writer_pid);
+            break;
+        }
+
+        while(rv > 0 && (!count || frames < count) && frame_ring_read(&ring, &frame, buf, buf ? ring.hdr->slot_size : 0) > 0)
+        {
+            if(save)
+                memcpy(save, frame.data, frame.bytesused);
+
+            if(frame_ring_check(&frame) < 0)
+            {
+                torn++;
+                continue;
+            }
+
+            if(fd >= 0 && write(fd, save ? save : frame.data, frame.bytesused) != (ssize_t)frame.bytesused)
+                printf("%s : write error\n", __FUNCTION__);
+            frames++;
+            window++;
+        }
+
+        if(now_ns() - t0 >= 1e9)
+        {
+            printf("frames=%lu fps=%.1f missed=%lu retries=%lu torn=%lu\n", frames, window * 1e9 / (now_ns() - t0),
+                    ring.missed, ring.retries, torn);
+            window = 0;
+            t0 = now_ns();
+        }
+    }
+
+cleanup:
+    if(fd >= 0)
+        close(fd);
+    free(save);
+    free(buf);
+    frame_ring_close(&ring);
+    return 0;
+}
+
+static void program_usage(char *progname)
+{
+    printf("Usage: %s [OPTION]...\n", progname);
+    printf(" %s is a program to read the camera frames video2lcd publishes with -S\n", progname);
+
+    printf("\nMandatory arguments to long options are mandatory for short options too:\n");
+    printf(" -n[name    ]  Shared memory name given to video2lcd -S, such as: -n /video2lcd\n");
+    printf(" -z[inplace ]  Use frames in place and check them afterwards instead of copying\n");
+    printf(" -D[dmabuf  ]  Map the DMABUF exported by video2lcd -S name,dmabuf and read frames from it, implies -z\n");
+    printf(" -o[output  ]  Save the frames to a raw file, such as: -o frames.yuv\n");
+    printf(" -c[count   ]  Stop after N frames, such as: -c 100\n");
+    printf(" -t[test    ]  Throughput test: publish synthetic frames and read them with N reader processes, such as: -t 4\n");
+    printf(" -s[seconds ]  Duration of the -t test, such as: -s 3\n");
+    printf(" -h[help    ]  Display this help information\n");
+    printf(" -v[version ]  Display the program version\n");
+
+    printf("\n%s version %s\n", progname, PROG_VERSION);
+    return;
+}
+
+int main(int argc, char **argv)
+{
+    char             *progname = NULL;
+    char             *name = "/video2lcd";
+    char             *output = NULL;
+    unsigned long    count = 0;
+    int              test_readers = 0;
+    int              zero_copy = 0;
+    int              dmabuf = 0;
+    double           seconds = 2;
+    int              opt;
+
+    struct option long_options[] = {
+        {"name", required_argument, NULL, 'n'},
+        {"inplace", no_argument, NULL, 'z'},
+        {"dmabuf", no_argument, NULL, 'D'},
+        {"output", required_argument, NULL, 'o'},
+        {"count", required_argument, NULL, 'c'},
+        {"test", required_argument, NULL, 't'},
+        {"seconds", required_argument, NULL, 's'},
+        {"version", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    progname = basename(argv[0]);
+
+    while ((opt = getopt_long(argc, argv, "n:zDo:c:t:s:vh", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': /* Shared memory name */
+                name = optarg;
+                break;
+
+            case 'z': /* Read in place */
+                zero_copy = 1;
+                break;
+
+            case 'D': /* Map exported DMABUF */
+                dmabuf = 1;
+                zero_copy = 1;
+                break;
+
+            case 'o': /* Save frames */
+                output = optarg;
+                break;
+
+            case 'c': /* Frame count */
+                count = strtoul(optarg, NULL, 0);
+                break;
+
+            case 't': /* Throughput test readers */
+                test_readers = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+
+            case 's': /* Test duration */
+                seconds = atof(optarg) > 0 ? atof(optarg) : 2;
+                break;
+
+            case 'v':  /* Get software version */
+                printf("%s version %s\n", progname, PROG_VERSION);
+                return 0;
+
+            case 'h':  /* Get help information */
+                program_usage(progname);
+                return 0;
+
+            default:
+                break;
+        }
+    }
+
+    signal(SIGINT, sig_stop);
+    signal(SIGTERM, sig_stop);
+
+    if(test_readers)
+        return run_test(test_readers, zero_copy, dmabuf, seconds) < 0 ? 1 : 0;
+
+    return run_reader(name, zero_copy, dmabuf, output, count) < 0 ? 1 : 0;
+}
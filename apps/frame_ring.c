@@ -0,0 +1,624 @@
+/*********************************************************************************
+ *      Copyright:  (C) 2025 Liao Shengli<liaoshengli@gmail.com>
+ *                  All rights reserved.
+ *
+ *       Filename:  frame_ring.c
+ *    Description:  This file is the writer and reader side of the shared-memory
+ *                  frame ring, built into libframe_ring.a
+ *
+ *        Version:  1.0.0(10/17/2026)
+ *         Author:  Liao Shengli <liaoshengli@gmail.com>
+ *      ChangeLog:  1, Release initial version on "10/17/2026 09:30:00 AM"
+ *
+ ********************************************************************************/
+
+#define _GNU_SOURCE             /* struct ucred */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+#include <linux/dma-buf.h>
+
+#include "frame_ring.h"
+
+/* 导出的 DMABUF fd 通过抽象命名空间的 UNIX socket 发给读端，socket 名是 frame_ring 加上共享内存名 */
+static socklen_t frame_ring_sockaddr(const char *name, struct sockaddr_un *addr)
+{
+    int              len;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "frame_ring%s", name);
+    if(len > (int)sizeof(addr->sun_path) - 2)
+        len = sizeof(addr->sun_path) - 2;
+
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+/* CPU 读 DMABUF 前后要通知驱动，缓存不一致的平台上驱动在这里刷新或作废缓存
+ * 测试中代替 DMABUF 的 memfd 不支持，出错时忽略
+ */
+static void frame_ring_dmabuf_sync(int fd, uint64_t flags)
+{
+    struct dma_buf_sync  sync = { flags };
+
+    while(ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) < 0 && (errno == EINTR || errno == EAGAIN))
+        ;
+}
+
+static int frame_ring_futex(_Atomic uint32_t *addr, int op, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/* 已经有同名的共享内存时检查它的写端，写端已经退出返回 0，可以删掉重建；
+ * 写端还在运行或者它不是帧环时返回负数，不能抢走别人的名字
+ */
+static int frame_ring_stale(const char *name)
+{
+    frame_ring_header_t  *hdr;
+    struct stat          st;
+    pid_t                pid = 0;
+    int                  fd, rv = -2;
+
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if(fd < 0 && errno == ENOENT)
+        return 0;
+    if(fd < 0)
+    {
+        printf("%s : shm_open '%s' error: %s\n", __FUNCTION__, name, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(frame_ring_header_t))
+    {
+        hdr = mmap(NULL, sizeof(frame_ring_header_t), PROT_READ, MAP_SHARED, fd, 0);
+        if(hdr != MAP_FAILED)
+        {
+            if(hdr->magic == FRAME_RING_MAGIC)
+            {
+                pid = hdr->writer_pid;
+                rv = kill(pid, 0) < 0 && errno == ESRCH ? 0 : -3;
+            }
+            munmap(hdr, sizeof(frame_ring_header_t));
+        }
+    }
+    close(fd);
+
+    if(rv == -3)
+        printf("%s : '%s' is in use by writer pid %d\n", __FUNCTION__, name, (int)pid);
+    else if(rv < 0)
+        printf("%s : '%s' exists and is not a frame ring\n", __FUNCTION__, name);
+
+    return rv;
+}
+
+/* 创建共享内存并初始化，slots 个槽，每个槽能放 frame_size 字节
+ * 上次异常退出留下的同名共享内存 (写端已经不在) 先删掉，已经打开它的读端要重新打开；
+ * 同名的写端还在运行时返回错误
+ */
+int frame_ring_create(frame_ring_t *ring, const char *name, unsigned int slots, unsigned int width, unsigned int height,
+                      unsigned int pixfmt, unsigned int stride, unsigned int frame_size)
+{
+    frame_ring_header_t  *hdr;
+    size_t               page = sysconf(_SC_PAGESIZE);
+    unsigned int         i;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    ring->listen_fd = -1;
+    ring->writer = 1;
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+
+    slots = slots < 2 ? 2 : (slots > FRAME_RING_SLOTS_MAX ? FRAME_RING_SLOTS_MAX : slots);
+    frame_size = (frame_size + page - 1) / page * page;
+    ring->size = (sizeof(frame_ring_header_t) + page - 1) / page * page + (size_t)slots * frame_size;
+
+    if(frame_ring_stale(ring->name) < 0)
+        return -1;
+
+    shm_unlink(ring->name);
+    ring->fd = shm_open(ring->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0660);
+    if(ring->fd < 0)
+    {
+        printf("%s : shm_open '%s' error: %s\n", __FUNCTION__, ring->name, strerror(errno));
+        return -1;
+    }
+
+    if(ftruncate(ring->fd, ring->size) < 0)
+    {
+        printf("%s : ftruncate %zu error\n", __FUNCTION__, ring->size);
+        frame_ring_destroy(ring);
+        return -2;
+    }
+
+    hdr = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if(hdr == MAP_FAILED)
+    {
+        printf("%s : mmap error\n", __FUNCTION__);
+        frame_ring_destroy(ring);
+        return -3;
+    }
+
+    ring->hdr = hdr;
+    hdr->version = FRAME_RING_VERSION;
+    hdr->width = width;
+    hdr->height = height;
+    hdr->pixfmt = pixfmt;
+    hdr->stride = stride;
+    hdr->slot_cnt = slots;
+    hdr->slot_size = frame_size;
+    hdr->data_offset = ring->size - (size_t)slots * frame_size;
+    hdr->writer_pid = getpid();
+    for(i=0; i<FRAME_RING_SLOTS_MAX; i++)
+        hdr->slot[i].buf_index = -1;
+    ring->data = (unsigned char *)hdr + hdr->data_offset;
+
+    /* 读端看到 magic 才认为初始化完成 */
+    atomic_thread_fence(memory_order_release);
+    hdr->magic = FRAME_RING_MAGIC;
+
+    return 0;
+}
+
+/* 读端连上来时把所有 DMABUF fd 一次发过去，之后就断开
+ * 抽象命名空间的 socket 没有文件权限，按 SO_PEERCRED 只给和共享内存 (0660) 一样能访问的进程：
+ * 同一用户、同一组或 root
+ */
+static void *frame_ring_server(void *arg)
+{
+    frame_ring_t         *ring = arg;
+    char                 ctrl[CMSG_SPACE(sizeof(int) * FRAME_RING_BUFS_MAX)];
+    uint32_t             cnt = ring->hdr->buf_cnt;
+    struct iovec         iov = { &cnt, sizeof(cnt) };
+    struct msghdr        msg;
+    struct cmsghdr       *cmsg;
+    struct ucred         cred;
+    socklen_t            len;
+    int                  fd;
+
+    while((fd = accept(ring->listen_fd, NULL, NULL)) >= 0 || errno == EINTR || errno == ECONNABORTED)
+    {
+        if(fd < 0)
+            continue;
+
+        memset(&cred, 0, sizeof(cred));
+        len = sizeof(cred);
+        if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+           (cred.uid && cred.uid != geteuid() && cred.gid != getegid()))
+        {
+            printf("%s : refuse DMABUF to pid %d uid %u gid %u\n", __FUNCTION__, (int)cred.pid, cred.uid, cred.gid);
+            close(fd);
+            continue;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        memset(ctrl, 0, sizeof(ctrl));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * cnt);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * cnt);
+        memcpy(CMSG_DATA(cmsg), ring->buf_fd, sizeof(int) * cnt);
+
+        if(sendmsg(fd, &msg, MSG_NOSIGNAL) < 0)
+            printf("%s : sendmsg error: %s\n", __FUNCTION__, strerror(errno));
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/* 导出采集缓冲区的 DMABUF，fds 由环接管，frame_ring_destroy 时关闭
+ * 导出时所有缓冲区都当作在驱动手里 (seqlock 为奇数)，发布时才变成有效
+ */
+int frame_ring_export(frame_ring_t *ring, const int *fds, const unsigned int *lens, unsigned int cnt)
+{
+    frame_ring_header_t  *hdr = ring->hdr;
+    struct sockaddr_un   addr;
+    socklen_t            len;
+    unsigned int         i;
+
+    if(!hdr || !cnt || cnt > FRAME_RING_BUFS_MAX)
+        return -1;
+
+    for(i=0; i<cnt; i++)
+    {
+        ring->buf_fd[i] = fds[i];
+        hdr->buf_len[i] = lens[i];
+        atomic_store_explicit(&hdr->buf_lock[i], 1, memory_order_relaxed);
+    }
+    ring->buf_cnt = cnt;
+
+    ring->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(ring->listen_fd < 0)
+    {
+        printf("%s : socket error\n", __FUNCTION__);
+        return -2;
+    }
+
+    len = frame_ring_sockaddr(ring->name, &addr);
+    if(bind(ring->listen_fd, (struct sockaddr *)&addr, len) < 0 || listen(ring->listen_fd, 8) < 0)
+    {
+        printf("%s : bind '@%s' error: %s\n", __FUNCTION__, addr.sun_path + 1, strerror(errno));
+        return -3;
+    }
+
+    atomic_store_explicit(&hdr->buf_cnt, cnt, memory_order_release);
+    if(pthread_create(&ring->server_tid, NULL, frame_ring_server, ring) != 0)
+    {
+        printf("%s : pthread_create error\n", __FUNCTION__);
+        hdr->buf_cnt = 0;
+        return -4;
+    }
+    ring->server_started = 1;
+
+    return 0;
+}
+
+/* 发布一帧：写进下一个槽，更新 head，有读端在等时唤醒，不会因为读端阻塞
+ * buf_index 是帧所在的采集缓冲区，导出了 DMABUF 时这个缓冲区的 seqlock 换成下一个偶数
+ */
+void frame_ring_publish(frame_ring_t *ring, const void *data, unsigned int bytesused, uint32_t sequence,
+                        uint64_t timestamp_ns, int buf_index)
+{
+    frame_ring_header_t  *hdr = ring->hdr;
+    frame_ring_slot_t    *slot;
+    uint64_t             seq;
+    uint32_t             lock, buf_lock = 0;
+
+    seq = atomic_load_explicit(&hdr->head, memory_order_relaxed) + 1;
+    slot = &hdr->slot[seq % hdr->slot_cnt];
+    lock = atomic_load_explicit(&slot->lock, memory_order_relaxed);
+    if(bytesused > hdr->slot_size)
+        bytesused = hdr->slot_size;
+
+    if(buf_index >= 0 && (unsigned int)buf_index < ring->buf_cnt)
+    {
+        buf_lock = (atomic_load_explicit(&hdr->buf_lock[buf_index], memory_order_relaxed) | 1) + 1;
+        atomic_store_explicit(&hdr->buf_lock[buf_index], buf_lock, memory_order_release);
+    }
+    else
+    {
+        buf_index = -1;
+    }
+
+    atomic_store_explicit(&slot->lock, lock + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->bytesused = bytesused;
+    slot->seq = seq;
+    slot->timestamp_ns = timestamp_ns;
+    slot->sequence = sequence;
+    slot->buf_index = buf_index;
+    slot->buf_lock = buf_lock;
+    memcpy(ring->data + (size_t)(seq % hdr->slot_cnt) * hdr->slot_size, data, bytesused);
+
+    atomic_store_explicit(&slot->lock, lock + 2, memory_order_release);
+    atomic_store_explicit(&hdr->head, seq, memory_order_release);
+
+    /* 和 frame_ring_wait 中先加 waiters 再读 notify 对应，两边至少有一边能看到对方 */
+    atomic_fetch_add(&hdr->notify, 1);
+    if(atomic_load(&hdr->waiters))
+        frame_ring_futex(&hdr->notify, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+/* 采集缓冲区还给驱动之前调用，DMABUF 中的这一帧从此无效 */
+void frame_ring_release(frame_ring_t *ring, unsigned int buf_index)
+{
+    uint32_t             lock;
+
+    if(!ring->hdr || buf_index >= ring->buf_cnt)
+        return;
+
+    lock = atomic_load_explicit(&ring->hdr->buf_lock[buf_index], memory_order_relaxed);
+    if(!(lock & 1))
+        atomic_store(&ring->hdr->buf_lock[buf_index], lock + 1);
+}
+
+void frame_ring_destroy(frame_ring_t *ring)
+{
+    unsigned int         i;
+
+    if(ring->server_started)
+    {
+        shutdown(ring->listen_fd, SHUT_RDWR);
+        pthread_join(ring->server_tid, NULL);
+        ring->server_started = 0;
+    }
+    if(ring->listen_fd >= 0)
+        close(ring->listen_fd);
+    for(i=0; i<ring->buf_cnt; i++)
+        close(ring->buf_fd[i]);
+
+    if(ring->hdr)
+        munmap(ring->hdr, ring->size);
+    if(ring->fd >= 0)
+    {
+        close(ring->fd);
+        shm_unlink(ring->name);
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    ring->listen_fd = -1;
+}
+
+/* 读端打开共享内存，只映射头部为可写 (等待时要改 waiters)，帧数据只读
+ * 打开后从最新的一帧开始读
+ */
+int frame_ring_open(frame_ring_t *ring, const char *name)
+{
+    frame_ring_header_t  *hdr;
+    struct stat          st;
+    uint64_t             head;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->listen_fd = -1;
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+
+    ring->fd = shm_open(ring->name, O_RDWR | O_CLOEXEC, 0);
+    if(ring->fd < 0)
+    {
+        printf("%s : shm_open '%s' error: %s\n", __FUNCTION__, ring->name, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(ring->fd, &st) < 0 || (size_t)st.st_size < sizeof(frame_ring_header_t))
+    {
+        printf("%s : '%s' is not a frame ring\n", __FUNCTION__, ring->name);
+        frame_ring_close(ring);
+        return -2;
+    }
+
+    hdr = mmap(NULL, sizeof(frame_ring_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if(hdr == MAP_FAILED)
+    {
+        printf("%s : mmap header error\n", __FUNCTION__);
+        frame_ring_close(ring);
+        return -3;
+    }
+    ring->hdr = hdr;
+
+    if(hdr->magic != FRAME_RING_MAGIC || hdr->version != FRAME_RING_VERSION ||
+       (size_t)st.st_size < hdr->data_offset + (size_t)hdr->slot_cnt * hdr->slot_size)
+    {
+        printf("%s : '%s' is not a frame ring of version %d\n", __FUNCTION__, ring->name, FRAME_RING_VERSION);
+        frame_ring_close(ring);
+        return -2;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    ring->size = (size_t)hdr->slot_cnt * hdr->slot_size;
+    ring->data = mmap(NULL, ring->size, PROT_READ, MAP_SHARED, ring->fd, hdr->data_offset);
+    if(ring->data == MAP_FAILED)
+    {
+        printf("%s : mmap data error\n", __FUNCTION__);
+        ring->data = NULL;
+        frame_ring_close(ring);
+        return -3;
+    }
+
+    head = atomic_load_explicit(&hdr->head, memory_order_acquire);
+    ring->last = head ? head - 1 : 0;
+
+    return 0;
+}
+
+/* 从写端拿到导出的 DMABUF fd 并映射，之后 frame_ring_read 零拷贝时直接指向 DMABUF
+ * 返回映射的缓冲区个数，写端没有导出时返回 -1
+ */
+int frame_ring_open_dmabuf(frame_ring_t *ring)
+{
+    frame_ring_header_t  *hdr = ring->hdr;
+    char                 ctrl[CMSG_SPACE(sizeof(int) * FRAME_RING_BUFS_MAX)];
+    uint32_t             cnt = 0;
+    struct iovec         iov = { &cnt, sizeof(cnt) };
+    struct msghdr        msg;
+    struct cmsghdr       *cmsg;
+    struct sockaddr_un   addr;
+    socklen_t            len;
+    unsigned int         i, n;
+    int                  fd;
+
+    if(!atomic_load_explicit(&hdr->buf_cnt, memory_order_acquire))
+    {
+        printf("%s : '%s' has no DMABUF exported\n", __FUNCTION__, ring->name);
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    len = frame_ring_sockaddr(ring->name, &addr);
+    if(fd < 0 || connect(fd, (struct sockaddr *)&addr, len) < 0)
+    {
+        printf("%s : connect '@%s' error: %s\n", __FUNCTION__, addr.sun_path + 1, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return -2;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    if(recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) < (ssize_t)sizeof(cnt) || !(cmsg = CMSG_FIRSTHDR(&msg)) ||
+       cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        printf("%s : recvmsg error\n", __FUNCTION__);
+        close(fd);
+        return -3;
+    }
+    close(fd);
+
+    n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(ring->buf_fd, CMSG_DATA(cmsg), n * sizeof(int));
+    ring->buf_cnt = n;
+
+    for(i=0; i<n; i++)
+    {
+        ring->buf_map[i] = mmap(NULL, hdr->buf_len[i], PROT_READ, MAP_SHARED, ring->buf_fd[i], 0);
+        if(ring->buf_map[i] == MAP_FAILED)
+        {
+            printf("%s : mmap DMABUF %u error\n", __FUNCTION__, i);
+            ring->buf_map[i] = NULL;
+        }
+    }
+
+    return n;
+}
+
+/* 等到有没读过的帧，返回 1；超时返回 0，写端已经退出返回 -1，timeout_ms 为负数时一直等 */
+int frame_ring_wait(frame_ring_t *ring, int timeout_ms)
+{
+    frame_ring_header_t  *hdr = ring->hdr;
+    struct timespec      ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    uint32_t             n;
+
+    atomic_fetch_add(&hdr->waiters, 1);
+    n = atomic_load(&hdr->notify);
+    if(atomic_load_explicit(&hdr->head, memory_order_acquire) <= ring->last)
+        frame_ring_futex(&hdr->notify, FUTEX_WAIT, n, timeout_ms >= 0 ? &ts : NULL);
+    atomic_fetch_sub(&hdr->waiters, 1);
+
+    if(atomic_load_explicit(&hdr->head, memory_order_acquire) > ring->last)
+        return 1;
+
+    return kill(hdr->writer_pid, 0) < 0 && errno == ESRCH ? -1 : 0;
+}
+
+/* 读下一帧，跟不上时跳到最新的一帧 (跳过的算在 missed 里)
+ * dst 不为 NULL 时拷贝到 dst 中，返回时已经确认拷到的是完整的一帧；
+ * dst 为 NULL 时零拷贝，frame->data 指向 DMABUF (已映射且仍有效时) 或共享内存中的槽，用完后要 frame_ring_check
+ * 读到返回 1，没有新的帧返回 0
+ */
+int frame_ring_read(frame_ring_t *ring, frame_ring_frame_t *frame, void *dst, size_t size)
+{
+    frame_ring_header_t  *hdr = ring->hdr;
+    frame_ring_slot_t    *slot;
+    const unsigned char  *data;
+    uint64_t             head, next;
+    uint32_t             lock;
+    int                  idx;
+
+    while(1)
+    {
+        head = atomic_load_explicit(&hdr->head, memory_order_acquire);
+        if(head <= ring->last)
+            return 0;
+
+        /* 写端正在写 head+1 所在的槽，离它不到一圈的帧随时会被覆盖 */
+        next = ring->last + 1;
+        if(head - next >= hdr->slot_cnt - 1)
+        {
+            ring->missed += head - next;
+            next = head;
+        }
+
+        slot = &hdr->slot[next % hdr->slot_cnt];
+        lock = atomic_load_explicit(&slot->lock, memory_order_acquire);
+        if((lock & 1) || slot->seq != next)
+        {
+            ring->retries++;
+            continue;
+        }
+
+        data = ring->data + (size_t)(next % hdr->slot_cnt) * hdr->slot_size;
+        frame->seq = next;
+        frame->timestamp_ns = slot->timestamp_ns;
+        frame->sequence = slot->sequence;
+        frame->bytesused = slot->bytesused;
+        frame->buf_index = idx = slot->buf_index;
+        frame->lock = &slot->lock;
+        frame->lock_val = lock;
+        frame->sync_fd = -1;
+
+        if(dst)
+        {
+            if(frame->bytesused > size)
+                frame->bytesused = size;
+            memcpy(dst, data, frame->bytesused);
+            frame->data = dst;
+            frame->lock = NULL;
+        }
+        else if(idx >= 0 && (unsigned int)idx < ring->buf_cnt && ring->buf_map[idx] &&
+                atomic_load_explicit(&hdr->buf_lock[idx], memory_order_acquire) == slot->buf_lock)
+        {
+            frame->data = ring->buf_map[idx];
+            frame->lock = &hdr->buf_lock[idx];
+            frame->lock_val = slot->buf_lock;
+            frame->sync_fd = ring->buf_fd[idx];
+            frame_ring_dmabuf_sync(frame->sync_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+        }
+        else
+        {
+            frame->data = data;
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&slot->lock, memory_order_relaxed) != lock)
+        {
+            if(frame->sync_fd >= 0)
+                frame_ring_dmabuf_sync(frame->sync_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+            ring->retries++;
+            continue;
+        }
+
+        ring->last = next;
+        ring->frames++;
+        return 1;
+    }
+}
+
+/* 零拷贝读到的帧用完后调用，返回 0 表示用的过程中数据没有被覆盖
+ * 指向 DMABUF 时同时结束 CPU 读
+ */
+int frame_ring_check(const frame_ring_frame_t *frame)
+{
+    if(!frame->lock)
+        return 0;
+
+    if(frame->sync_fd >= 0)
+        frame_ring_dmabuf_sync(frame->sync_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(frame->lock, memory_order_relaxed) == frame->lock_val ? 0 : -1;
+}
+
+void frame_ring_close(frame_ring_t *ring)
+{
+    unsigned int         i;
+
+    for(i=0; i<ring->buf_cnt; i++)
+    {
+        if(ring->buf_map[i])
+            munmap(ring->buf_map[i], ring->hdr->buf_len[i]);
+        close(ring->buf_fd[i]);
+    }
+    if(ring->data)
+        munmap(ring->data, ring->size);
+    if(ring->hdr)
+        munmap(ring->hdr, sizeof(frame_ring_header_t));
+    if(ring->fd >= 0)
+        close(ring->fd);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    ring->listen_fd = -1;
+}
@@ -0,0 +1,128 @@
+/*********************************************************************************
+ *      Copyright:  (C) 2025 Liao Shengli<liaoshengli@gmail.com>
+ *                  All rights reserved.
+ *
+ *       Filename:  frame_ring.h
+ *    Description:  This file is the shared-memory frame ring between video2lcd
+ *                  and other local processes that need the camera frames
+ *
+ *        Version:  1.0.0(10/17/2026)
+ *         Author:  Liao Shengli <liaoshengli@gmail.com>
+ *      ChangeLog:  1, Release initial version on "10/17/2026 09:30:00 AM"
+ *
+ ********************************************************************************/
+
+#ifndef _FRAME_RING_H_
+#define _FRAME_RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* 共享内存帧环
+ * video2lcd (写端) 把采集到的每一帧拷进 POSIX 共享内存中的 slot_cnt 个槽，轮流覆盖，不等任何读端；
+ * 每个槽有一个 seqlock：写之前加 1 变成奇数，写完再加 1 变成偶数，
+ * 读端拷贝前后各读一次，两次相同且是偶数才说明拷到的是完整的一帧，否则重试或跳到最新的一帧
+ *
+ * 写端还可以用 VIDIOC_EXPBUF 把采集缓冲区导出成 DMABUF，读端通过 UNIX socket 拿到 fd 后直接映射，不用拷贝；
+ * 每个采集缓冲区也有一个 seqlock，还给驱动时变成奇数，取回新的一帧时变成下一个偶数，
+ * DMABUF 中的数据只在取回和还给驱动之间有效，读端用完后要用 frame_ring_check 确认；
+ * 读 DMABUF 前后 frame_ring_read 和 frame_ring_check 用 DMA_BUF_IOCTL_SYNC 通知驱动维护缓存一致
+ */
+#define FRAME_RING_MAGIC        0x474E5246      /* "FRNG" */
+#define FRAME_RING_VERSION      1
+#define FRAME_RING_SLOTS_MAX    16
+#define FRAME_RING_BUFS_MAX     32
+
+/* 一个槽的帧信息，数据在 header 之后的第 index 个 slot_size 中 */
+typedef struct frame_ring_slot_s
+{
+    _Atomic uint32_t     lock;                  /* seqlock，奇数表示正在写 */
+    uint32_t             bytesused;
+    uint64_t             seq;                   /* 发布的第几帧，从 1 开始 */
+    uint64_t             timestamp_ns;          /* 采集时间，CLOCK_MONOTONIC */
+    uint32_t             sequence;              /* 驱动给的帧序号 */
+    int32_t              buf_index;             /* 帧所在的采集缓冲区，-1 表示没有导出 DMABUF */
+    uint32_t             buf_lock;              /* 发布时这个采集缓冲区的 seqlock */
+    uint32_t             reserved;
+} frame_ring_slot_t;
+
+typedef struct frame_ring_header_s
+{
+    uint32_t             magic;
+    uint32_t             version;
+    uint32_t             width;
+    uint32_t             height;
+    uint32_t             pixfmt;                /* V4L2_PIX_FMT_* */
+    uint32_t             stride;                /* 一行的字节数，MJPEG 为 0 */
+    uint32_t             slot_cnt;
+    uint32_t             slot_size;             /* 每个槽能放的字节数 */
+    uint32_t             data_offset;           /* 第 0 个槽的数据在共享内存中的偏移 */
+    int32_t              writer_pid;
+    _Atomic uint64_t     head;                  /* 最新发布的帧号，0 表示还没有 */
+    _Atomic uint32_t     notify;                /* futex，每发布一帧加 1 */
+    _Atomic uint32_t     waiters;               /* 在 notify 上等待的读端个数，为 0 时写端不唤醒 */
+    _Atomic uint32_t     buf_cnt;               /* 导出的 DMABUF 个数，0 表示没有导出 */
+    uint32_t             buf_len[FRAME_RING_BUFS_MAX];
+    _Atomic uint32_t     buf_lock[FRAME_RING_BUFS_MAX];
+    frame_ring_slot_t    slot[FRAME_RING_SLOTS_MAX];
+} frame_ring_header_t;
+
+/* 写端和读端各自的句柄 */
+typedef struct frame_ring_s
+{
+    char                 name[64];
+    int                  fd;
+    frame_ring_header_t  *hdr;
+    size_t               size;
+    unsigned char        *data;
+    int                  writer;
+
+    /* 写端：把 DMABUF fd 发给读端的 socket 和线程 */
+    int                  listen_fd;
+    int                  server_started;
+    pthread_t            server_tid;
+
+    /* 读端 */
+    uint64_t             last;                  /* 最近读到的帧号 */
+    unsigned long        frames;
+    unsigned long        missed;                /* 来不及读被覆盖而跳过的帧 */
+    unsigned long        retries;               /* 读的过程中被写端覆盖而重读的次数 */
+    unsigned int         buf_cnt;
+    int                  buf_fd[FRAME_RING_BUFS_MAX];
+    void                 *buf_map[FRAME_RING_BUFS_MAX];
+} frame_ring_t;
+
+/* 读到的一帧，data 指向调用者的缓冲区，或者零拷贝时指向共享内存或 DMABUF */
+typedef struct frame_ring_frame_s
+{
+    uint64_t             seq;
+    uint64_t             timestamp_ns;
+    uint32_t             sequence;
+    uint32_t             bytesused;
+    int32_t              buf_index;
+    const unsigned char  *data;
+    _Atomic uint32_t     *lock;                 /* 零拷贝时要复查的 seqlock 和它读到的值 */
+    uint32_t             lock_val;
+    int                  sync_fd;               /* 指向 DMABUF 时它的 fd，frame_ring_check 中结束 CPU 读 */
+} frame_ring_frame_t;
+
+/* 写端 */
+int  frame_ring_create(frame_ring_t *ring, const char *name, unsigned int slots, unsigned int width, unsigned int height,
+                       unsigned int pixfmt, unsigned int stride, unsigned int frame_size);
+int  frame_ring_export(frame_ring_t *ring, const int *fds, const unsigned int *lens, unsigned int cnt);
+void frame_ring_publish(frame_ring_t *ring, const void *data, unsigned int bytesused, uint32_t sequence,
+                        uint64_t timestamp_ns, int buf_index);
+void frame_ring_release(frame_ring_t *ring, unsigned int buf_index);
+void frame_ring_destroy(frame_ring_t *ring);
+
+/* 读端 */
+int  frame_ring_open(frame_ring_t *ring, const char *name);
+int  frame_ring_open_dmabuf(frame_ring_t *ring);
+int  frame_ring_wait(frame_ring_t *ring, int timeout_ms);
+int  frame_ring_read(frame_ring_t *ring, frame_ring_frame_t *frame, void *dst, size_t size);
+int  frame_ring_check(const frame_ring_frame_t *frame);
+void frame_ring_close(frame_ring_t *ring);
+
+#endif
@@ -26,18 +26,22 @@
 #include <sys/types.h>
 #include <linux/fb.h>
 #include <sys/mman.h>
+#include <time.h>
 
 
 /*程序版本*/
 #define PROG_VERSION      "1.0.0"
 
-/*RGB565 颜色*/
+/*RGB888 颜色，显示前按屏幕的像素格式 (bpp 和各分量的位宽、偏移) 转换*/
 /*颜色对照表 https://blog.csdn.net/weixin_45020839/article/details/117781108 */
-#define RED     0xF800       //红色
-#define GREED   0x07E0       //绿色
-#define BLUE    0x001f       //蓝色
-#define WTITE   0xFFFF       //白色
-#define BLACK   0x0000       //黑色
+#define RED     0xFF0000     //红色
+#define GREED   0x00FF00     //绿色
+#define BLUE    0x0000FF     //蓝色
+#define WTITE   0xFFFFFF     //白色
+#define BLACK   0x000000     //黑色
+
+/* 旋转显示时按 ROTATE_TILE x ROTATE_TILE 的块拷贝，一块的源数据只有十几行，能留在 cache 中 */
+#define ROTATE_TILE     16
 
 
 enum
@@ -56,8 +60,15 @@ typedef struct fb_ctx_s
 	int							pix_size;
 	struct fb_var_screeninfo	vinfo;
 	char						*fbp;
+	int							rotate;		/* 顺时针旋转角度: 0, 90, 180, 270 */
+	int							bpp_bytes;	/* 每个像素的字节数: 2, 3, 4 */
 } fb_ctx_t;
 
+/* 一行 BMP 像素转换成屏幕格式，源像素每隔 src_step 字节取一个 (旋转时是跨行或倒着取)
+ * BMP 和屏幕格式相同时不旋转直接 memcpy
+ */
+typedef void (*bmp_row_fn)(const fb_ctx_t *fb_ctx, char *dst, const char *src, int src_step, int pixels);
+
 
 typedef struct bmp_file_head_s
 {
@@ -86,10 +97,12 @@ typedef struct bmp_bitmap_info_s
 
 int fb_init(fb_ctx_t *fb_ctx);
 int fb_term(fb_ctx_t *fb_ctx);
-int lcd_show_pixel_rgb565(fb_ctx_t *fb_ctx, unsigned int x, unsigned int y, unsigned short color);
-int lcd_fill_rgb565(fb_ctx_t *fb_ctx, unsigned short color);
+uint32_t lcd_color(fb_ctx_t *fb_ctx, uint32_t rgb);
+int lcd_show_pixel(fb_ctx_t *fb_ctx, unsigned int x, unsigned int y, uint32_t rgb);
+int lcd_fill(fb_ctx_t *fb_ctx, uint32_t rgb);
 int show_example_line_fill(fb_ctx_t *fb_ctx, int times);
 int show_bmp(fb_ctx_t *fb_ctx, char *bmp_file);
+void show_bmp_rotate(fb_ctx_t *fb_ctx, char *d_addr, int src_width, int src_bytes, int width, int height);
 
 
 static void program_usage(char *progname)
@@ -101,6 +114,7 @@ static void program_usage(char *progname)
 	printf(" -d[device  ]  Specify framebuffer device, such as: /dev/fb0\n");
 	printf(" -e[example ]  Display RGB corlor and draw rand line on LCD screen for some times, such as: -c 3\n");
 	printf(" -b[bmp     ]  Display BMP file, such as: -b bg.bmp\n");
+	printf(" -r[rotate  ]  Rotate BMP file clockwise: 0, 90, 180 or 270, such as: -r 90\n");
 	printf(" -h[help    ]  Display this help information\n");
 	printf(" -v[version ]  Display the program version\n");
 
@@ -118,11 +132,13 @@ int main (int argc, char **argv)
 	char		*fb_dev = "/dev/fb0";
 	int			cmd = CMD_SHOW_INFO;
 	int			opt, times;
+	int			rotate = 0;
 
 	struct option long_options[] = {
 		{"device", required_argument, NULL, 'd'},
 		{"example", required_argument, NULL, 'c'},
 		{"bmp", required_argument, NULL, 'b'},
+		{"rotate", required_argument, NULL, 'r'},
 		{"version", no_argument, NULL, 'v'},
 		{"help", no_argument, NULL, 'h'},
 		{NULL, 0, NULL, 0}
@@ -130,7 +146,7 @@ int main (int argc, char **argv)
 
 	progname = (char *)basename(argv[0]);
 
-	while ((opt = getopt_long(argc, argv, "d:c:b:vh", long_options, NULL)) != -1)
+	while ((opt = getopt_long(argc, argv, "d:c:b:r:vh", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -144,6 +160,15 @@ int main (int argc, char **argv)
                 cmd = CMD_SHOW_BMP;
                 break;
 
+            case 'r': /* Rotate BMP file */
+                rotate = atoi(optarg);
+                if( rotate!=0 && rotate!=90 && rotate!=180 && rotate!=270 )
+                {
+                    printf("ERROR: Invalid rotate angle '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
             case 'c': /* Show RGB color */
                 /* 设置RGB颜色循环次数 */
                 times = atoi(optarg);
@@ -166,6 +191,7 @@ int main (int argc, char **argv)
 
 	memset(&fb_ctx, 0, sizeof(fb_ctx));
 	strncpy(fb_ctx.dev, fb_dev, sizeof(fb_ctx.dev));
+	fb_ctx.rotate = rotate;
 
 	if( fb_init(&fb_ctx) < 0 )
     {
@@ -234,6 +260,24 @@ int fb_init(fb_ctx_t *fb_ctx)
 	fb_get_var_screeninfo(fb_ctx->fd, &fb_ctx->vinfo);
 
 	vinfo = &fb_ctx->vinfo;
+	fb_ctx->bpp_bytes = vinfo->bits_per_pixel / 8;
+	if( fb_ctx->bpp_bytes < 2 || fb_ctx->bpp_bytes > 4 )
+	{
+		printf("ERROR: %d bpp framebuffer not supported\n", vinfo->bits_per_pixel);
+		return -3;
+	}
+
+	/* 驱动没有给出分量信息时按 rgb565/rgb888/xrgb8888 处理 */
+	if( !vinfo->red.length || !vinfo->green.length || !vinfo->blue.length )
+	{
+		vinfo->red.length = fb_ctx->bpp_bytes==2 ? 5 : 8;
+		vinfo->green.length = fb_ctx->bpp_bytes==2 ? 6 : 8;
+		vinfo->blue.length = fb_ctx->bpp_bytes==2 ? 5 : 8;
+		vinfo->red.offset = fb_ctx->bpp_bytes==2 ? 11 : 16;
+		vinfo->green.offset = fb_ctx->bpp_bytes==2 ? 5 : 8;
+		vinfo->blue.offset = 0;
+	}
+
 	fb_ctx->fb_size = vinfo->xres * vinfo->yres * vinfo->bits_per_pixel / 8;
     fb_ctx->pix_size = vinfo->xres * vinfo->yres;
 
@@ -265,29 +309,72 @@ int fb_term(fb_ctx_t *fb_ctx)
 }
 
 
-int lcd_show_pixel_rgb565(fb_ctx_t *fb_ctx, unsigned int x, unsigned int y, unsigned short color)
+/* 8 位的 r/g/b 按屏幕各分量的位宽截断后放到各自的偏移上，透明度分量写成不透明
+ * 位宽和偏移是常量时移位和掩码都在编译时算好
+ */
+#define LCD_PACK_BITS(r, g, b, rl, ro, gl, go, bl, bo, al, ao)                     \
+    ( ((uint32_t)(r) >> (8 - (rl))) << (ro) |                                       \
+      ((uint32_t)(g) >> (8 - (gl))) << (go) |                                       \
+      ((uint32_t)(b) >> (8 - (bl))) << (bo) |                                       \
+      ((1U << (al)) - 1) << (ao) )
+
+#define LCD_VINFO_BITS(vinfo)                                                       \
+    (vinfo)->red.length, (vinfo)->red.offset, (vinfo)->green.length, (vinfo)->green.offset, \
+    (vinfo)->blue.length, (vinfo)->blue.offset, (vinfo)->transp.length, (vinfo)->transp.offset
+
+/* 多套一层让 LCD_VINFO_BITS 先展开成 8 个参数 */
+#define LCD_PACK_ARGS(...)          LCD_PACK_BITS(__VA_ARGS__)
+#define LCD_PACK(vinfo, r, g, b)    LCD_PACK_ARGS(r, g, b, LCD_VINFO_BITS(vinfo))
+
+/* 按字节数写一个像素，字节数是常量时编译器展开成一条存储指令 */
+#define LCD_STORE_2(d, v)   (*(uint16_t *)(d) = (v))
+#define LCD_STORE_3(d, v)   ((d)[0] = (v), (d)[1] = (v) >> 8, (d)[2] = (v) >> 16)
+#define LCD_STORE_4(d, v)   (*(uint32_t *)(d) = (v))
+
+
+/* RGB888 颜色转换成屏幕的像素值 */
+uint32_t lcd_color(fb_ctx_t *fb_ctx, uint32_t rgb)
+{
+    return LCD_PACK(&fb_ctx->vinfo, (rgb >> 16) & 0xFF, (rgb >> 8) & 0xFF, rgb & 0xFF);
+}
+
+
+int lcd_show_pixel(fb_ctx_t *fb_ctx, unsigned int x, unsigned int y, uint32_t rgb)
 {
-	char	*color_addr;
+	char		*color_addr;
+	uint32_t	color;
 
-	if( !fb_ctx || x > fb_ctx->vinfo.xres || y > fb_ctx->vinfo.yres)
+	if( !fb_ctx || x >= fb_ctx->vinfo.xres || y >= fb_ctx->vinfo.yres)
     {
         printf("ERROR: Invalid input arguments\n");
         return -1;
     }
 
-	/*计算点的实际地址 起始地址 + (y*一行像素点数量 + x)*Bpp  */
-    color_addr = fb_ctx->fbp + (fb_ctx->vinfo.xres * y + x) * (fb_ctx->vinfo.bits_per_pixel / 8);
-    memcpy(color_addr, &color, fb_ctx->vinfo.bits_per_pixel / 8);
+	/*计算点的实际地址 起始地址 + (y*一行像素点数量 + x)*Bpp，像素值按小端存放  */
+    color = lcd_color(fb_ctx, rgb);
+    color_addr = fb_ctx->fbp + (fb_ctx->vinfo.xres * y + x) * fb_ctx->bpp_bytes;
+    memcpy(color_addr, &color, fb_ctx->bpp_bytes);
     return 0;
 }
 
 
-int lcd_fill_rgb565(fb_ctx_t *fb_ctx, unsigned short color)
+/* 每种像素字节数展开一个填充循环，循环中没有按格式的判断 */
+#define LCD_FILL(name, bytes)                                           \
+static void name(char *fb_addr, uint32_t color, int pixels)             \
+{                                                                       \
+    for( ; pixels>0; pixels--, fb_addr+=bytes)                          \
+        LCD_STORE_##bytes(fb_addr, color);                              \
+}
+
+LCD_FILL(lcd_fill_16, 2)
+LCD_FILL(lcd_fill_24, 3)
+LCD_FILL(lcd_fill_32, 4)
+
+
+int lcd_fill(fb_ctx_t *fb_ctx, uint32_t rgb)
 {
-	struct fb_var_screeninfo	*vinfo;
-	int		i;
-	int		bpp_bytes;
-	char	*fb_addr;
+	uint32_t	color;
+	struct timespec	t0, t1;
 
 	if( !fb_ctx )
     {
@@ -295,22 +382,146 @@ int lcd_fill_rgb565(fb_ctx_t *fb_ctx, unsigned short color)
         return -1;
     }
 
-	vinfo = &fb_ctx->vinfo;
-	//rgb565 = 16 / 8 = 2
-    bpp_bytes = vinfo->bits_per_pixel / 8;
-    fb_addr = fb_ctx->fbp;
-     /* 循环次数=像素点数量 */
-    for(i=0; i<fb_ctx->pix_size; i++)
+    /* 颜色只转换一次，按每像素字节数选好填充循环 */
+    color = lcd_color(fb_ctx, rgb);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    switch( fb_ctx->bpp_bytes )
     {
-        //对显存映射内存进行赋值，颜色为红色，2个字节进行拷贝
-        memcpy(fb_addr, &color, bpp_bytes);
-        //移动赋值地址 偏移为2byte
-        fb_addr += bpp_bytes;
+        case 2:  lcd_fill_16(fb_ctx->fbp, color, fb_ctx->pix_size); break;
+        case 3:  lcd_fill_24(fb_ctx->fbp, color, fb_ctx->pix_size); break;
+        default: lcd_fill_32(fb_ctx->fbp, color, fb_ctx->pix_size); break;
     }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("fill 0x%06x (%d bpp): %.3f ms/frame\n", rgb, fb_ctx->vinfo.bits_per_pixel,
+            (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
     return 0;
 }
 
 
+/* BMP 的像素转换成屏幕格式：16 位按 rgb565，24 位按 B G R，32 位按 B G R X 读取
+ * 常见的屏幕格式每种 BMP 位数各展开一个循环，分量的位宽和偏移都是常量；
+ * 不在表中的排列用通用的循环，位宽和偏移从 vinfo 读取
+ */
+#define BMP_LOAD_2(s, r, g, b)  do { uint16_t _c = *(const uint16_t *)(s);  \
+            r = (_c >> 8) & 0xF8; g = (_c >> 3) & 0xFC; b = (_c << 3) & 0xF8; } while(0)
+#define BMP_LOAD_3(s, r, g, b)  do { b = (uint8_t)(s)[0]; g = (uint8_t)(s)[1]; r = (uint8_t)(s)[2]; } while(0)
+#define BMP_LOAD_4(s, r, g, b)  BMP_LOAD_3(s, r, g, b)
+
+#define BMP_ROW(name, src_bytes, dst_bytes, ...)                                        \
+static void name(const fb_ctx_t *fb_ctx, char *dst, const char *src, int src_step,      \
+                 int pixels)                                                            \
+{                                                                                       \
+    const struct fb_var_screeninfo *vinfo = &fb_ctx->vinfo;                             \
+    uint32_t    r, g, b, c;                                                             \
+                                                                                        \
+    (void)vinfo;                                                                        \
+    for( ; pixels>0; pixels--, src+=src_step, dst+=dst_bytes)                           \
+    {                                                                                   \
+        BMP_LOAD_##src_bytes(src, r, g, b);                                             \
+        c = LCD_PACK_BITS(r, g, b, __VA_ARGS__);                                        \
+        LCD_STORE_##dst_bytes(dst, c);                                                  \
+    }                                                                                   \
+}
+
+/* 一种屏幕格式对 16/24/32 位 BMP 各展开一个循环 */
+#define BMP_FORMAT(fmt, bytes, ...)                                                     \
+    BMP_ROW(bmp_row_16_##fmt, 2, bytes, __VA_ARGS__)                                    \
+    BMP_ROW(bmp_row_24_##fmt, 3, bytes, __VA_ARGS__)                                    \
+    BMP_ROW(bmp_row_32_##fmt, 4, bytes, __VA_ARGS__)
+
+BMP_FORMAT(rgb565,   2, 5, 11, 6, 5, 5, 0,  0, 0)
+BMP_FORMAT(bgr565,   2, 5, 0,  6, 5, 5, 11, 0, 0)
+BMP_FORMAT(rgb888,   3, 8, 16, 8, 8, 8, 0,  0, 0)
+BMP_FORMAT(bgr888,   3, 8, 0,  8, 8, 8, 16, 0, 0)
+BMP_FORMAT(xrgb8888, 4, 8, 16, 8, 8, 8, 0,  0, 0)
+BMP_FORMAT(argb8888, 4, 8, 16, 8, 8, 8, 0,  8, 24)
+BMP_FORMAT(xbgr8888, 4, 8, 0,  8, 8, 8, 16, 0, 0)
+BMP_FORMAT(abgr8888, 4, 8, 0,  8, 8, 8, 16, 8, 24)
+
+typedef struct bmp_format_s
+{
+    unsigned int    bpp;
+    unsigned int    r_len, r_off, g_len, g_off, b_len, b_off, a_len, a_off;
+    bmp_row_fn      row[3];                     /* 16/24/32 位 BMP */
+} bmp_format_t;
+
+#define BMP_FORMAT_ENTRY(fmt, bpp, rl, ro, gl, go, bl, bo, al, ao)                      \
+    { bpp, rl, ro, gl, go, bl, bo, al, ao, { bmp_row_16_##fmt, bmp_row_24_##fmt, bmp_row_32_##fmt } }
+
+static const bmp_format_t bmp_formats[] = {
+    BMP_FORMAT_ENTRY(rgb565,   16, 5, 11, 6, 5, 5, 0,  0, 0),
+    BMP_FORMAT_ENTRY(bgr565,   16, 5, 0,  6, 5, 5, 11, 0, 0),
+    BMP_FORMAT_ENTRY(rgb888,   24, 8, 16, 8, 8, 8, 0,  0, 0),
+    BMP_FORMAT_ENTRY(bgr888,   24, 8, 0,  8, 8, 8, 16, 0, 0),
+    BMP_FORMAT_ENTRY(xrgb8888, 32, 8, 16, 8, 8, 8, 0,  0, 0),
+    BMP_FORMAT_ENTRY(argb8888, 32, 8, 16, 8, 8, 8, 0,  8, 24),
+    BMP_FORMAT_ENTRY(xbgr8888, 32, 8, 0,  8, 8, 8, 16, 0, 0),
+    BMP_FORMAT_ENTRY(abgr8888, 32, 8, 0,  8, 8, 8, 16, 8, 24),
+};
+
+/* 通用的循环，每种 BMP 位数和屏幕字节数的组合一个 */
+BMP_ROW(bmp_row_16_16, 2, 2, LCD_VINFO_BITS(vinfo))
+BMP_ROW(bmp_row_16_24, 2, 3, LCD_VINFO_BITS(vinfo))
+BMP_ROW(bmp_row_16_32, 2, 4, LCD_VINFO_BITS(vinfo))
+BMP_ROW(bmp_row_24_16, 3, 2, LCD_VINFO_BITS(vinfo))
+BMP_ROW(bmp_row_24_24, 3, 3, LCD_VINFO_BITS(vinfo))
+BMP_ROW(bmp_row_24_32, 3, 4, LCD_VINFO_BITS(vinfo))
+BMP_ROW(bmp_row_32_16, 4, 2, LCD_VINFO_BITS(vinfo))
+BMP_ROW(bmp_row_32_24, 4, 3, LCD_VINFO_BITS(vinfo))
+BMP_ROW(bmp_row_32_32, 4, 4, LCD_VINFO_BITS(vinfo))
+
+static const bmp_row_fn bmp_rows[3][3] = {
+    { bmp_row_16_16, bmp_row_16_24, bmp_row_16_32 },
+    { bmp_row_24_16, bmp_row_24_24, bmp_row_24_32 },
+    { bmp_row_32_16, bmp_row_32_24, bmp_row_32_32 },
+};
+
+/* 格式相同时旋转用的一行拷贝，字节数是常量，memcpy 展开成一次读写 */
+#define BMP_COPY(name, bytes)                                                           \
+static void name(const fb_ctx_t *fb_ctx, char *dst, const char *src, int src_step,      \
+                 int pixels)                                                            \
+{                                                                                       \
+    (void)fb_ctx;                                                                       \
+    for( ; pixels>0; pixels--, src+=src_step, dst+=bytes)                               \
+        memcpy(dst, src, bytes);                                                        \
+}
+
+BMP_COPY(bmp_copy_16, 2)
+BMP_COPY(bmp_copy_24, 3)
+BMP_COPY(bmp_copy_32, 4)
+
+static const bmp_row_fn bmp_copies[3] = { bmp_copy_16, bmp_copy_24, bmp_copy_32 };
+
+/* BMP 的位数和屏幕格式完全一样时返回 NULL，直接 memcpy
+ * 否则按屏幕格式在表中找展开的循环，找不到时用通用的循环
+ */
+static bmp_row_fn bmp_row_select(const fb_ctx_t *fb_ctx, int bmp_bits)
+{
+    const struct fb_var_screeninfo *vinfo = &fb_ctx->vinfo;
+    const bmp_format_t             *f;
+    unsigned int                   i;
+
+    if( bmp_bits == (int)vinfo->bits_per_pixel && vinfo->red.length == (bmp_bits==16 ? 5 : 8) &&
+        vinfo->red.offset == (bmp_bits==16 ? 11 : 16) && vinfo->green.offset == (bmp_bits==16 ? 5 : 8) &&
+        vinfo->blue.offset == 0 && !vinfo->transp.length )
+        return NULL;
+
+    for(i=0; i<sizeof(bmp_formats)/sizeof(bmp_formats[0]); i++)
+    {
+        f = &bmp_formats[i];
+        if( f->bpp == vinfo->bits_per_pixel && f->r_len == vinfo->red.length && f->r_off == vinfo->red.offset &&
+            f->g_len == vinfo->green.length && f->g_off == vinfo->green.offset &&
+            f->b_len == vinfo->blue.length && f->b_off == vinfo->blue.offset &&
+            f->a_len == vinfo->transp.length && (!f->a_len || f->a_off == vinfo->transp.offset) )
+            return f->row[bmp_bits/8 - 2];
+    }
+
+    return bmp_rows[bmp_bits/8 - 2][fb_ctx->bpp_bytes - 2];
+}
+
+
 int show_example_line_fill(fb_ctx_t *fb_ctx, int times)
 {
     int                     i;
@@ -322,22 +533,22 @@ int show_example_line_fill(fb_ctx_t *fb_ctx, int times)
         return -1;
     }
 
-    lcd_fill_rgb565(fb_ctx, WTITE);
-    lcd_fill_rgb565(fb_ctx, RED);
+    lcd_fill(fb_ctx, WTITE);
+    lcd_fill(fb_ctx, RED);
     sleep(1);
-    lcd_fill_rgb565(fb_ctx, BLUE);
+    lcd_fill(fb_ctx, BLUE);
     sleep(1);
-    lcd_fill_rgb565(fb_ctx, GREED);
+    lcd_fill(fb_ctx, GREED);
     sleep(1);
-    lcd_fill_rgb565(fb_ctx, WTITE);
+    lcd_fill(fb_ctx, WTITE);
 
     for(i=0; i<times; i++)
     {
-        line_y = rand()%(fb_ctx->vinfo.yres - 0 + 1) + 0;
+        line_y = rand()%fb_ctx->vinfo.yres;
         printf("draw line [y=%d]\n", line_y);
         for(j=0; j<200; j++)
         {
-             lcd_show_pixel_rgb565(fb_ctx, fb_ctx->vinfo.xres/2+j, line_y, BLACK);
+             lcd_show_pixel(fb_ctx, fb_ctx->vinfo.xres/2+j, line_y, BLACK);
         }
     }
     return 0;
@@ -356,8 +567,12 @@ int show_bmp(fb_ctx_t *fb_ctx, char *bmp_file)
     char                       *p_addr;
     int                         fd;
     int                         bpp_bytes;
-    int                         i, j;
+    int                         src_bytes;
+    int                         src_line;
+    bmp_row_fn                  row_fn;
+    int                         i;
     int                         width, height;
+    struct timespec             t0, t1;
 
     if( !fb_ctx || !bmp_file )
     {
@@ -392,29 +607,70 @@ int show_bmp(fb_ctx_t *fb_ctx, char *bmp_file)
 
 	d_addr = f_addr + file_head->bfoffBits;/* 利用bmp文件头的数据偏移数据确定实际位图数据地址 */
 
+	if( bitmap_info->biBitCount!=16 && bitmap_info->biBitCount!=24 && bitmap_info->biBitCount!=32 )
+	{
+		printf("ERROR: %d bpp BMP file not supported\n", bitmap_info->biBitCount);
+		munmap(f_addr, statbuf.st_size);
+		close(fd);
+		return -4;
+	}
+
 	vinfo = &fb_ctx->vinfo;
 	fb_addr = fb_ctx->fbp;
-	bpp_bytes = vinfo->bits_per_pixel / 8;
+	bpp_bytes = fb_ctx->bpp_bytes;
 
-	/* 控制图片大小小于LCD尺寸 */
-    width = bitmap_info->biWidth>vinfo->xres ? vinfo->xres : bitmap_info->biWidth;
-    height = bitmap_info->biHeight>vinfo->yres ? vinfo->yres : bitmap_info->biHeight;
+	/* BMP 每行按 4 字节对齐，格式和屏幕不同时逐行转换 */
+	src_bytes = bitmap_info->biBitCount / 8;
+	src_line = (bitmap_info->biWidth * src_bytes + 3) & ~3;
+	row_fn = bmp_row_select(fb_ctx, bitmap_info->biBitCount);
+
+	/* 控制图片大小小于LCD尺寸，旋转 90/270 度时屏幕宽高互换 */
+    if( fb_ctx->rotate==90 || fb_ctx->rotate==270 )
+    {
+        width = bitmap_info->biWidth>(int)vinfo->yres ? (int)vinfo->yres : bitmap_info->biWidth;
+        height = bitmap_info->biHeight>(int)vinfo->xres ? (int)vinfo->xres : bitmap_info->biHeight;
+    }
+    else
+    {
+        width = bitmap_info->biWidth>(int)vinfo->xres ? (int)vinfo->xres : bitmap_info->biWidth;
+        height = bitmap_info->biHeight>(int)vinfo->yres ? (int)vinfo->yres : bitmap_info->biHeight;
+    }
 
 	 printf("BMP file '%s': %dx%d and display %dx%d\n", bmp_file, bitmap_info->biWidth, bitmap_info->biHeight, width, height);
 
+    if( fb_ctx->rotate )
+    {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        show_bmp_rotate(fb_ctx, d_addr, src_line, src_bytes, width, height);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        printf("rotate %d: %.3f ms/frame\n", fb_ctx->rotate,
+                (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+        goto cleanup;
+    }
+
 	 /* if biHeight is positive, the bitmap is a bottom-up DIB */
+    clock_gettime(CLOCK_MONOTONIC, &t0);
     for(i=0; i<height; i++)
     {
         //由于biHeight为正数，则位图数据排布方式自底至上
         /* 按照一行一行图片进行内存拷贝
          * 第一行显示的数据，为位图数据的最后一行数据
-         * 最后一行位图数据的偏移为 (height-1)*bitmap_info->biWidth*bpp_bytes
+         * 最后一行位图数据的偏移为 (height-1)*src_line
          */
-        p_addr=d_addr+(height-1-i)*bitmap_info->biWidth*bpp_bytes;
-        memcpy(fb_addr, p_addr, bpp_bytes*width);
+        p_addr=d_addr+(height-1-i)*src_line;
+        if( row_fn )
+            row_fn(fb_ctx, fb_addr, p_addr, src_bytes, width);
+        else
+            memcpy(fb_addr, p_addr, bpp_bytes*width);
         fb_addr += bpp_bytes * vinfo->xres;
     }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("BMP %d bpp -> %d bpp %s: %.3f ms/frame\n", bitmap_info->biBitCount, vinfo->bits_per_pixel,
+            row_fn ? "convert" : "copy", (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
 
+cleanup:
     munmap(f_addr, statbuf.st_size);
     close (fd);
 
@@ -422,3 +678,59 @@ int show_bmp(fb_ctx_t *fb_ctx, char *bmp_file)
 }
 
 
+/* 旋转显示自底至上的位图，width x height 为旋转前要显示的大小，src_line 为位图一行的字节数
+ * 按显存上 ROTATE_TILE x ROTATE_TILE 的块拷贝，每块写显存都是一行行连续的写，
+ * 读位图时跨行访问的也只有一块的十几行数据
+ * 屏幕上 (x, y) 的像素在位图数据中的地址是 base + x*step_x + y*step_y，块中的一行由行函数一次写完
+ */
+void show_bmp_rotate(fb_ctx_t *fb_ctx, char *d_addr, int src_line, int src_bytes, int width, int height)
+{
+    struct fb_var_screeninfo    *vinfo = &fb_ctx->vinfo;
+    char                        *fb_addr;
+    int                         bpp_bytes = fb_ctx->bpp_bytes;
+    bmp_row_fn                  row_fn = bmp_row_select(fb_ctx, src_bytes * 8);
+    int                         dst_w, dst_h;
+    int                         tx, ty, y, n;
+    long                        base, step_x, step_y;
+
+    if( !row_fn )
+        row_fn = bmp_copies[bpp_bytes - 2];
+
+    /* 旋转后在屏幕上的大小，和屏幕上的 (x, y) 对应旋转前图片上的 (sx, sy)：
+     * 90: (y, height-1-x)，180: (width-1-x, height-1-y)，270: (width-1-y, x)
+     * 位图数据自底至上，图片上第 sy 行在位图数据的第 height-1-sy 行
+     */
+    switch( fb_ctx->rotate )
+    {
+        case 90:
+            dst_w = height;  dst_h = width;
+            base = 0;
+            step_x = src_line;  step_y = src_bytes;
+            break;
+
+        case 180:
+            dst_w = width;  dst_h = height;
+            base = (long)(width-1) * src_bytes;
+            step_x = -src_bytes;  step_y = src_line;
+            break;
+
+        default:
+            dst_w = height;  dst_h = width;
+            base = (long)(height-1) * src_line + (long)(width-1) * src_bytes;
+            step_x = -src_line;  step_y = -src_bytes;
+            break;
+    }
+
+    for(ty=0; ty<dst_h; ty+=ROTATE_TILE)
+    {
+        for(tx=0; tx<dst_w; tx+=ROTATE_TILE)
+        {
+            n = dst_w - tx < ROTATE_TILE ? dst_w - tx : ROTATE_TILE;
+            for(y=ty; y<dst_h && y<ty+ROTATE_TILE; y++)
+            {
+                fb_addr = fb_ctx->fbp + (y * vinfo->xres + tx) * bpp_bytes;
+                row_fn(fb_ctx, fb_addr, d_addr + base + tx * step_x + y * step_y, step_x, n);
+            }
+        }
+    }
+}
@@ -13,20 +13,63 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
 #include <getopt.h>
+#include <libgen.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
+#include <spawn.h>
 #include <malloc.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/auxv.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 #include <asm/types.h>
 #include <linux/videodev2.h>
+#include <linux/fb.h>
+#include <linux/perf_event.h>
+
+#include "frame_ring.h"
+
+#ifdef HAVE_JPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
+#ifdef HAVE_DRM
+#include <poll.h>
+#include <drm/drm.h>
+#include <drm/drm_mode.h>
+#include <drm/drm_fourcc.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON       1
+#include <arm_neon.h>
+#if defined(__arm__)
+#include <asm/hwcap.h>
+#endif
+#endif
+
+/* 程序版本 */
+#define PROG_VERSION    "1.1.0"
 
 #define Y0              0
 #define U               1
@@ -37,7 +80,15 @@
 #define G               1
 #define B               2
 
-/* 注，屏幕尺寸要大于帧的尺寸 */
+/* 帧缓冲区个数的范围，-n 指定，缓冲区多有利于吞吐，少有利于延迟 */
+#define BUFFER_MIN      2
+#define BUFFER_MAX      32
+
+#define CAMERA_MAX      4           /* 同时显示的摄像头个数，多个摄像头时按布局分屏 */
+
+/* 默认的帧尺寸和屏幕尺寸
+ * 运行时以摄像头枚举出的模式和 framebuffer 报告的尺寸为准，这里只在驱动不支持查询时使用
+ */
 #define FRAME_WIDTH     640
 #define FRAME_HEIGH     480
 
@@ -45,447 +96,8566 @@
 #define LCD_HEIGH       480
 
 
+/* 摄像头的采集模式：帧尺寸和帧间隔 (秒)，帧间隔为 0 表示驱动没有报告 */
+typedef struct v4l2_mode_s
+{
+    unsigned int        width;
+    unsigned int        height;
+    struct v4l2_fract   interval;
+} v4l2_mode_t;
+
+/* 一帧经过各阶段的时间点 (CLOCK_MONOTONIC, ns) */
+typedef struct frame_stamp_s
+{
+    double         capture_ns;     /* 驱动给的采集时间，0 表示驱动的时间戳不是单调时钟 */
+    double         dqbuf_ns;
+    double         convert_ns;
+    double         g2g_ns;         /* 这一帧看到了 LED 变化时，LED 切换的时间 */
+} frame_stamp_t;
+
+/* 屏幕上的一个矩形，单位像素 */
+typedef struct rect_s
+{
+    unsigned int   x, y;
+    unsigned int   w, h;
+} rect_t;
+
 /* 所申请的单个 buffer 结构体
- * 包含 buffer 的起始地址和长度
+ * 包含 buffer 的起始地址和长度，以及最近一帧的有效数据长度 (MJPEG 每帧长度不同) 和时间点
  */
 struct v4l2_buffer_unit {
     void           *start;
     size_t         length;
+    size_t         bytesused;
+    frame_stamp_t  stamp;
+    int            held;            /* 已经取出，还没有还给驱动 */
 };
 
+char                       *camera_dev = "/dev/video2";
+char                       *fb_dev = "/dev/fb0";
 int                        fd_camera = -1;
 int                        fd_lcd = -1;
 void                       *screen_base = NULL;
 struct v4l2_buffer_unit    *buffer_unit = NULL;
-void                       *rgb_buffer = NULL;
+unsigned int               buffer_cnt = 4;                      /* 申请的帧缓冲区个数 */
+int                        low_latency = 0;                     /* 只显示最新的一帧，积压的旧帧直接还给驱动 */
+unsigned int               v4l2_memtype = V4L2_MEMORY_MMAP;     /* 帧缓冲区的内存方式 */
+unsigned int               v4l2_pixfmt = V4L2_PIX_FMT_YUYV;     /* 采集的像素格式 */
+unsigned int               capture_pref = 0;                    /* 指定的采集格式，0 表示自动选择 */
+unsigned int               frame_sizeimage = FRAME_WIDTH * FRAME_HEIGH * 2;
+unsigned int               frame_stride = FRAME_WIDTH * 2;      /* 帧数据一行的字节数 */
+v4l2_mode_t                frame_mode = { FRAME_WIDTH, FRAME_HEIGH, { 0, 0 } };
 
-/* yuv 格式转为 rgb 格式的算法
- * 将 yuv422 格式的帧数据转换为 rgb565 格式，以显示在 lcd 屏幕上
- */
-int yuv422_rgb565(unsigned char *yuv_buf, unsigned char *rgb_buf, unsigned int width, unsigned int height)
-{
-    int              yuvdata[4];
-    int              rgbdata[3];
-    unsigned char    *rgb_temp;
-    unsigned int     i, j;
+/* 帧在屏幕上的显示区域：帧小于屏幕时居中显示，大于屏幕时裁掉四周 */
+unsigned int               view_width = FRAME_WIDTH;
+unsigned int               view_height = FRAME_HEIGH;
+unsigned int               view_src_offset = 0;                 /* 显示区域在帧数据中的起始偏移 */
+unsigned int               view_dst_offset = 0;                 /* 显示区域在一页显存中的起始偏移 */
+rect_t                     frame_roi = { 0, 0, 0, 0 };          /* 只转换帧中的这块区域 (用户空间裁剪)，宽为 0 表示整帧 */
+double                     zoom_level = 0;                      /* 变焦区域为整帧居中的 1/zoom_level，0 表示不变焦 */
+rect_t                     zoom_req;                            /* -Z x,y,w,h 直接指定的区域，宽为 0 表示按 zoom_level */
 
-    rgb_temp = rgb_buf;
-    for (i = 0; i < height * 2; i++)
-    {
-        for (j = 0; j < width; j += 4)
-        {
-            /* get Y0 U Y1 V */
-            yuvdata[Y0] = *(yuv_buf + i * width + j + 0);
-            yuvdata[U]  = *(yuv_buf + i * width + j + 1);
-            yuvdata[Y1] = *(yuv_buf + i * width + j + 2);
-            yuvdata[V]  = *(yuv_buf + i * width + j + 3);
+/* 变焦区域的裁剪方式 */
+enum
+{
+    ZOOM_NONE,
+    ZOOM_SENSOR,        /* 驱动裁剪，传输的字节数减少 */
+    ZOOM_USER,          /* 整帧传输，只转换区域 */
+};
 
-            /* the first pixel */
-            rgbdata[R] = yuvdata[Y0] + (yuvdata[V] - 128) + (((yuvdata[V] - 128) * 104 ) >> 8);
-            rgbdata[G] = yuvdata[Y0] - (((yuvdata[U] - 128) * 89) >> 8) - (((yuvdata[V] - 128) * 183) >> 8);
-            rgbdata[B] = yuvdata[Y0] + (yuvdata[U] - 128) + (((yuvdata[U] - 128) * 199) >> 8);
+static const char *zoom_crop_name[] = { "none", "sensor", "user" };
+unsigned int               area_x = 0;                          /* 当前摄像头在屏幕上占用的区域，宽为 0 表示整个屏幕 */
+unsigned int               area_y = 0;
+unsigned int               area_width = 0;
+unsigned int               area_height = 0;
+rect_t                     view_hole[CAMERA_MAX];               /* 当前摄像头被上层窗口挡住的区域 (屏幕坐标)，不画 */
+unsigned int               view_hole_cnt = 0;
+int                        zc_shown = -1;                       /* 零拷贝时正在显示的 buffer */
+unsigned int               fb_line_length = LCD_WIDTH * 2;
+struct fb_var_screeninfo   fb_vinfo;
+struct fb_var_screeninfo   fb_vinfo_orig;      /* 翻页前的显存参数，退出时恢复 */
+int                        fb_vinfo_changed = 0;
+unsigned int               fb_pages = 1;       /* 显存页数，2 表示双缓冲 */
+unsigned int               fb_back = 0;        /* 当前绘制的显存页 */
+int                        fb_vsync = 0;       /* 翻页后等待垂直同步 */
+int                        fb_fake = 0;        /* 显存是普通文件 (基准测试)，没有翻页 */
+#ifdef HAVE_DRM
+const char                 *drm_dev = NULL;    /* 指定 DRM 设备时用 KMS 输出，不用 fbdev */
+#endif
 
-            if (rgbdata[R] > 255)  rgbdata[R] = 255;
-            if (rgbdata[R] < 0) rgbdata[R] = 0;
-            if (rgbdata[G] > 255)  rgbdata[G] = 255;
-            if (rgbdata[G] < 0) rgbdata[G] = 0;
-            if (rgbdata[B] > 255)  rgbdata[B] = 255;
-            if (rgbdata[B] < 0) rgbdata[B] = 0;
+/* 翻页统计，时间单位 ns */
+struct fb_flip_stat {
+    unsigned long  flips;
+    unsigned long  missed_vsync;
+    double         period_ns;                  /* 屏幕刷新周期 */
+    double         last_ns;                    /* 上一次翻页完成的时间 */
+    double         window_ns;                  /* 当前统计窗口的起点 */
+    double         window_cpu_ns;              /* 统计窗口起点时进程已用的 CPU 时间 */
+    unsigned long  window_flips;
+} flip_stat;
 
-            *(rgb_temp++) =( ((rgbdata[G]& 0x1C) << 3) | (rgbdata[B] >> 3) );
-            *(rgb_temp++) =( (rgbdata[R]& 0xF8) | (rgbdata[G] >> 5) );
+/* 显存像素格式
+ * 转换、缩放、旋转和文字框都直接输出显存的格式，不经过中间的画布
+ * FB_FORMATS 列出可以直接绘制的格式：每像素字节数，R/G/B/透明度分量的位宽和偏移 (透明度写成不透明)，
+ * 输出像素的代码对每种格式用 X 展开一份，循环里没有按格式的分支，arg 原样传给 X
+ * 不在表中的排列画在 rgb565 画布上，显示时由 FB_WRITER 生成的写出函数写进显存
+ */
+#define FB_FORMATS(X, arg)                                  \
+    X(rgb565,   2, 5, 11, 6, 5, 5, 0,  0, 0,  arg)          \
+    X(bgr565,   2, 5, 0,  6, 5, 5, 11, 0, 0,  arg)          \
+    X(rgb888,   3, 8, 16, 8, 8, 8, 0,  0, 0,  arg)          \
+    X(bgr888,   3, 8, 0,  8, 8, 8, 16, 0, 0,  arg)          \
+    X(xrgb8888, 4, 8, 16, 8, 8, 8, 0,  0, 0,  arg)          \
+    X(argb8888, 4, 8, 16, 8, 8, 8, 0,  8, 24, arg)          \
+    X(xbgr8888, 4, 8, 0,  8, 8, 8, 16, 0, 0,  arg)          \
+    X(abgr8888, 4, 8, 0,  8, 8, 8, 16, 8, 24, arg)
 
-            /* the second pixel */
-            rgbdata[R] = yuvdata[Y1] + (yuvdata[V] - 128) + (((yuvdata[V] - 128) * 104 ) >> 8);
-            rgbdata[G] = yuvdata[Y1] - (((yuvdata[U] - 128) * 89) >> 8) - (((yuvdata[V] - 128) * 183) >> 8);
-            rgbdata[B] = yuvdata[Y1] + (yuvdata[U] - 128) + (((yuvdata[U] - 128) * 199) >> 8);
+#define FB_FORMAT_ID(fmt, bytes, rl, ro, gl, go, bl, bo, al, ao, arg)   FB_FMT_##fmt,
 
-            if (rgbdata[R] > 255)  rgbdata[R] = 255;
-            if (rgbdata[R] < 0) rgbdata[R] = 0;
-            if (rgbdata[G] > 255)  rgbdata[G] = 255;
-            if (rgbdata[G] < 0) rgbdata[G] = 0;
-            if (rgbdata[B] > 255)  rgbdata[B] = 255;
-            if (rgbdata[B] < 0) rgbdata[B] = 0;
+enum
+{
+    FB_FORMATS(FB_FORMAT_ID, 0)
+    FB_FMT_CNT
+};
 
-            *(rgb_temp++) =( ((rgbdata[G]& 0x1C) << 3) | (rgbdata[B] >> 3) );
-            *(rgb_temp++) =( (rgbdata[R]& 0xF8) | (rgbdata[G] >> 5) );
+/* 8 位的 R/G/B 截成各分量的位宽，放到各自的偏移上 */
+#define FB_PACK(r, g, b, rl, ro, gl, go, bl, bo, al, ao)                                       \
+    ((unsigned int)(r) >> (8 - (rl)) << (ro) | (unsigned int)(g) >> (8 - (gl)) << (go) |    \
+     (unsigned int)(b) >> (8 - (bl)) << (bo) | ((1U << (al)) - 1) << (ao))
 
-        }
-    }
+#define FB_STORE_2(d, v)    (*(unsigned short *)(d) = (v))
+#define FB_STORE_3(d, v)    ((d)[0] = (v), (d)[1] = (v) >> 8, (d)[2] = (v) >> 16)
+#define FB_STORE_4(d, v)    (*(unsigned int *)(d) = (v))
 
-    return 0;
-}
+typedef void (*fb_write_fn)(const unsigned short *src, unsigned char *dst, unsigned int pixels);
 
-/* 打开屏幕和摄像头的设备节点，并映射 lcd 的用户空间到内核空间 */
-int init_camera_lcd()
+typedef struct fb_format_s
 {
-    fd_camera = open("/dev/video2", O_RDWR | O_NONBLOCK, 0);
-    if(fd_camera < 0)
-    {
-        printf("%s : open camera error\n", __FUNCTION__);
-        return -1;
-    }
+    const char       *name;
+    unsigned int     bpp;
+    unsigned int     r_len, r_off;
+    unsigned int     g_len, g_off;
+    unsigned int     b_len, b_off;
+    unsigned int     a_len, a_off;              /* 透明度分量写成不透明 */
+    unsigned int     id;                        /* 绘制时输出的格式，FB_FMT_xxx */
+    fb_write_fn      write;                     /* NULL 表示直接绘制，不需要画布 */
+} fb_format_t;
 
-    fd_lcd = open("/dev/fb0", O_RDWR);
-    if(fd_lcd < 0)
-    {
-        printf("%s : open lcd error\n", __FUNCTION__);
-        return -2;
-    }
+#define FB_FORMAT_ENTRY(fmt, bytes, rl, ro, gl, go, bl, bo, al, ao, arg)                       \
+    { #fmt, (bytes) * 8, rl, ro, gl, go, bl, bo, al, ao, FB_FMT_##fmt, NULL },
 
-    screen_base = mmap(NULL, LCD_WIDTH*LCD_HEIGH*2, PROT_READ|PROT_WRITE, MAP_SHARED, fd_lcd, 0);
-    if(NULL == screen_base)
-    {
-        printf("%s : framebuffer mmap error\n", __FUNCTION__);
-        return -3;
-    }
+/* 按 FB_FMT_xxx 排列，同一 bpp 的第一项是驱动没有给出分量信息时的默认格式 */
+static const fb_format_t fb_formats[] = {
+    FB_FORMATS(FB_FORMAT_ENTRY, 0)
+};
 
-    rgb_buffer = malloc(FRAME_WIDTH*FRAME_HEIGH*2);
+#define FB_FORMAT_CNT   (sizeof(fb_formats) / sizeof(fb_formats[0]))
 
-    memset(screen_base, 0x0, LCD_WIDTH*LCD_HEIGH*2);
+const fb_format_t          *fb_format = &fb_formats[0];
+unsigned int               fb_fmt = FB_FMT_rgb565;  /* 绘制时输出的格式，用画布时是 rgb565 */
+unsigned int               fb_bytes = 2;            /* 绘制时每个像素的字节数 */
 
-    return 0;
+/* 一个分量的 8 位值放到格式 f 中的位置，以及 f 中不透明的透明度分量 */
+static inline unsigned int fb_channel(unsigned int c, unsigned int len, unsigned int off)
+{
+    return c >> (8 - len) << off;
 }
 
-/* 查询设备功能属性 */
-int v4l2_query_capability()
+static inline unsigned int fb_alpha(const fb_format_t *f)
 {
-    struct v4l2_capability     cap;
-    int                        ret;
+    return ((1U << f->a_len) - 1) << f->a_off;
+}
 
-    ret = ioctl(fd_camera, VIDIOC_QUERYCAP, &cap);
-    if(ret < 0)
-    {
-        printf("%s : VIDIOC_QUERYCAP error\n", __FUNCTION__);
-        return -1;
-    }
+static inline unsigned int fb_pack(const fb_format_t *f, unsigned int r, unsigned int g, unsigned int b)
+{
+    return fb_channel(r, f->r_len, f->r_off) | fb_channel(g, f->g_len, f->g_off) |
+           fb_channel(b, f->b_len, f->b_off) | fb_alpha(f);
+}
 
-    /* #define V4L2_CAP_VIDEO_CAPTURE 0x00000001
-    * 获取到设备的能力
-    * 判断最低位是否为 1，如果为 1，则说明该设备具有视频采集能力
-    */
-    if ((V4L2_CAP_VIDEO_CAPTURE & cap.capabilities) == 0x00)
-    {
-        printf("%s : no capture device\n", __FUNCTION__);
-        return -2;
-    }
+/* 按绘制时每像素的字节数存取一个像素，只在逐个像素无关紧要的地方用 */
+static inline void fb_store(unsigned char *d, unsigned int v)
+{
+    if(fb_bytes == 2)
+        FB_STORE_2(d, v);
+    else if(fb_bytes == 3)
+        FB_STORE_3(d, v);
+    else
+        FB_STORE_4(d, v);
+}
 
-    return 0;
+static inline unsigned int fb_load(const unsigned char *d)
+{
+    if(fb_bytes == 2)
+        return *(const unsigned short *)d;
+    if(fb_bytes == 3)
+        return d[0] | d[1] << 8 | d[2] << 16;
+    return *(const unsigned int *)d;
 }
 
-/* 列举设备支持的数据格式 */
-int v4l2_enum_format()
+/* yuv 转显存格式的转换函数，启动时根据 CPU 能力选择
+ * 源和目的各自带行跨度，输出可以直接写到 framebuffer 中，输出的格式是 fb_fmt
+ */
+typedef int (*yuv_convert_fn)(const unsigned char *yuv_buf, unsigned int yuv_stride,
+                              unsigned char *rgb_buf, unsigned int rgb_stride,
+                              unsigned int width, unsigned int height);
+
+int yuv422_rgb565(const unsigned char *yuv_buf, unsigned int yuv_stride,
+                  unsigned char *rgb_buf, unsigned int rgb_stride,
+                  unsigned int width, unsigned int height);
+yuv_convert_fn             convert_yuv = yuv422_rgb565;
+
+/* 转换时顺便统计亮度，用于自动曝光
+ * 每 LUMA_ROW_STEP 行取一行，把这一行的所有 Y 加进 256 格直方图，取样的行正在或刚刚被转换函数读过，
+ * 还在 L1 cache 中，不需要再读一遍整帧；均值和欠曝/过曝的像素数在一帧结束时由直方图算出
+ * 累加的位置是线程局部的，条带工作线程各自累加，一帧结束时合并
+ * 取哪些行按视图中的行号决定，不按调用次数：有窗口遮挡、文字框或旋转时一行会分成几段转换，
+ * 调用前用 luma_rows_at() 设置这次转换的第一行在视图中的行号
+ */
+#define LUMA_BINS       256
+#define LUMA_ROW_STEP   4
+#define LUMA_CLIP_LOW   4               /* Y 不大于这个值算欠曝 */
+#define LUMA_CLIP_HIGH  251             /* Y 不小于这个值算过曝 */
+
+typedef struct luma_stat_s
 {
-    int                     ret = 0;
-    int                     found = 0;
-    struct v4l2_fmtdesc     fmtdesc;
+    unsigned int     hist[LUMA_BINS];
+    unsigned long    samples;
+    double           mean;              /* 以下在一帧结束时计算 */
+    unsigned long    clip_low;
+    unsigned long    clip_high;
+} luma_stat_t;
 
-    /* 枚举摄像头所支持的所有像素格式以及描述信息 */
-    fmtdesc.index = 0;
-    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+static __thread luma_stat_t *luma_acc = NULL;   /* 当前线程累加的位置，NULL 表示不统计 */
+static __thread unsigned int luma_y = 0;        /* 下一次转换的第一行在视图中的行号 */
 
-    while(found == 0 || ret == 0)
-    {
-        ret = ioctl(fd_camera, VIDIOC_ENUM_FMT, &fmtdesc);
+static inline void luma_rows_at(unsigned int y)
+{
+    luma_y = y;
+}
 
-        if(fmtdesc.pixelformat = V4L2_PIX_FMT_YUYV)
-        {
-            found = 1;
-        }
+/* 视图第 y 行转换前调用，这一行需要取样时返回累加的位置 */
+static inline luma_stat_t *luma_row(unsigned int y)
+{
+    luma_stat_t      *ls = luma_acc;
 
-        fmtdesc.index++;
+    if(!ls || y % LUMA_ROW_STEP)
+        return NULL;
 
-    }
+    return ls;
+}
 
-    if(found != 1)
-    {
-        printf("%s : device don't support V4L2_PIX_FMT_YUYV\n", __FUNCTION__);
-        return -1;
-    }
-    else
-    {
-        printf("device support V4L2_PIX_FMT_YUYV\n");
-    }
+/* 把一行中 count 个 Y 加进直方图，step 为相邻两个 Y 的字节间隔，YUYV 为 2 */
+static inline void luma_add(luma_stat_t *ls, const unsigned char *y, unsigned int step, unsigned int count)
+{
+    unsigned int     i;
 
-    return 0;
+    for (i = 0; i < count; i++, y += step)
+        ls->hist[*y]++;
+    ls->samples += count;
 }
 
-/* 获取帧数据格式
- * 主要获取帧数据的宽和高用于之后的设置
+/* 颜色矩阵：YUV 转 RGB 的系数由 Kr/Kb 决定，BT.601 (标清) 和 BT.709 (高清) 不同
+ * 有限范围 (Y 16~235，U/V 16~240) 还要把 Y 拉伸到 0~255，色度按同样的比例换算
+ * 系数都是编译时算出的 8 位定点数常量，每种矩阵和范围各生成一份转换函数，运行时没有额外的开销
+ * 色度项换算成以 Y 为单位的值，和 Y 相加得到 s，再由 csc_y() 把 s 映射成 0~255：
+ * 全范围时就是钳位，有限范围时为 (s - 16) * 255/219；标量、查表和 NEON 实现用同样的整数运算，结果逐位一致
  */
-void v4l2_get_format()
+#define CSC_KR_BT601            0.299
+#define CSC_KB_BT601            0.114
+#define CSC_KR_BT709            0.2126
+#define CSC_KB_BT709            0.0722
+
+#define CSC_FIX(x)              ((int)((x) * 256 + 0.5))
+#define CSC_SCALE(full)         ((full) ? 1.0 : 219.0 / 224.0)
+#define CSC_RV(kr, kb, full)    CSC_FIX(2 * (1 - (kr)) * CSC_SCALE(full))
+#define CSC_GU(kr, kb, full)    CSC_FIX(2 * (kb) * (1 - (kb)) / (1 - (kr) - (kb)) * CSC_SCALE(full))
+#define CSC_GV(kr, kb, full)    CSC_FIX(2 * (kr) * (1 - (kr)) / (1 - (kr) - (kb)) * CSC_SCALE(full))
+#define CSC_BU(kr, kb, full)    CSC_FIX(2 * (1 - (kb)) * CSC_SCALE(full))
+#define CSC_YL                  CSC_FIX(255.0 / 219.0)     /* 有限范围 Y 的放大倍数 */
+
+/* c * k / 256，k 拆成整数部分和 8 位小数部分，NEON 的 16 位乘法不会溢出 */
+#define CSC_MUL(c, k)           ((c) * ((k) >> 8) + (((c) * ((k) & 0xFF)) >> 8))
+
+static inline int csc_y(int s, int full)
 {
-    int                  ret;
-    struct v4l2_format   format;
+    if (full)
+        return s < 0 ? 0 : (s > 255 ? 255 : s);
 
-    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    s = s < 16 ? 16 : (s > 235 ? 235 : s);
+    return ((s - 16) * CSC_YL + 128) >> 8;
+}
 
-    ret = ioctl(fd_camera, VIDIOC_G_FMT, &format);
-    if(ret < 0)
-    {
-        printf("%s : VIDIOC_G_FMT error\n", __FUNCTION__);
-    }
+/* 每种颜色矩阵的 Kr、Kb 和是否全范围，CSC_COEF 按名字取出系数，m 是 CSC_RV 等 */
+#define CSC_PARAMS_bt601_full       CSC_KR_BT601, CSC_KB_BT601, 1
+#define CSC_PARAMS_bt601_limited    CSC_KR_BT601, CSC_KB_BT601, 0
+#define CSC_PARAMS_bt709_full       CSC_KR_BT709, CSC_KB_BT709, 1
+#define CSC_PARAMS_bt709_limited    CSC_KR_BT709, CSC_KB_BT709, 0
 
-    printf("width:%d height:%d\n", format.fmt.pix.width, format.fmt.pix.height);
+#define CSC_COEF(m, name)           CSC_COEF_(m, CSC_PARAMS_##name)
+#define CSC_COEF_(m, ...)           m(__VA_ARGS__)
+#define CSC_KR(kr, kb, full)        (kr)
+#define CSC_KB(kr, kb, full)        (kb)
+#define CSC_FULL(kr, kb, full)      (full)
+
+/* 标量版本转换一行，也是其他实现的参考，每种颜色矩阵和显存格式各展开一份 */
+#define CSC_SPAN(fmt, bytes, rl, ro, gl, go, bl, bo, al, ao, name)                                        \
+static void yuyv_span_##name##_##fmt(const unsigned char *yuv, unsigned char *rgb, unsigned int pixels)    \
+{                                                                                                          \
+    int              u, v, rv, guv, bu;                                                                    \
+    int              full = CSC_COEF(CSC_FULL, name);                                                      \
+    unsigned int     c;                                                                                    \
+                                                                                                           \
+    for ( ; pixels >= 2; pixels -= 2, yuv += 4, rgb += 2 * (bytes))                                        \
+    {                                                                                                      \
+        u = yuv[U] - 128;                                                                                  \
+        v = yuv[V] - 128;                                                                                  \
+        rv = CSC_MUL(v, CSC_COEF(CSC_RV, name));                                                           \
+        guv = CSC_MUL(u, CSC_COEF(CSC_GU, name)) + CSC_MUL(v, CSC_COEF(CSC_GV, name));                     \
+        bu = CSC_MUL(u, CSC_COEF(CSC_BU, name));                                                           \
+                                                                                                           \
+        c = FB_PACK(csc_y(yuv[Y0] + rv, full), csc_y(yuv[Y0] - guv, full), csc_y(yuv[Y0] + bu, full),      \
+                    rl, ro, gl, go, bl, bo, al, ao);                                                       \
+        FB_STORE_##bytes(rgb, c);                                                                          \
+        c = FB_PACK(csc_y(yuv[Y1] + rv, full), csc_y(yuv[Y1] - guv, full), csc_y(yuv[Y1] + bu, full),      \
+                    rl, ro, gl, go, bl, bo, al, ao);                                                       \
+        FB_STORE_##bytes(rgb + (bytes), c);                                                                \
+    }                                                                                                      \
 }
 
-/* 获取帧数据格式 */
-void v4l2_set_format()
+#ifdef HAVE_NEON
+/* 与 CSC_MUL 逐位一致，k 是常量，整数部分为 0 或 1 时省掉乘法 */
+static inline int16x8_t neon_csc_mul(int16x8_t c, int k)
 {
-    int                   ret;
-    struct v4l2_format    format;
+    int16x8_t        f = vshrq_n_s16(vmulq_n_s16(c, k & 0xFF), 8);
 
-    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    format.fmt.pix.width = FRAME_WIDTH;
-    format.fmt.pix.height = FRAME_HEIGH;
-    format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-    format.fmt.pix.field = V4L2_FIELD_INTERLACED;
-
-    ret = ioctl(fd_camera, VIDIOC_S_FMT, &format);
-    if(ret <  0)
-    {
-        printf("%s : VIDIOC_S_FMT error\n", __FUNCTION__);
-    }
+    if ((k >> 8) == 0)
+        return f;
+    return vaddq_s16((k >> 8) == 1 ? c : vmulq_n_s16(c, k >> 8), f);
 }
 
-/* 申请帧数据缓冲区 */
-void v4l2_require_buffer()
+/* 与 csc_y() 逐位一致：全范围时 vqmovun 的饱和收窄就是钳位，有限范围时先钳位再放大，16 位无符号数不会溢出 */
+static inline uint8x8_t neon_csc_y(int16x8_t s, int full)
 {
-    int                         ret;
-    struct v4l2_requestbuffers  req;
+    uint16x8_t       x;
 
-    req.count = 4;
-    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
+    if (full)
+        return vqmovun_s16(s);
 
-    ret = ioctl(fd_camera, VIDIOC_REQBUFS, &req);
-    if(ret < 0)
-    {
-        printf("%s : VIDIOC_REQBUFS error\n", __FUNCTION__);
-    }
+    s = vminq_s16(vmaxq_s16(s, vdupq_n_s16(16)), vdupq_n_s16(235));
+    x = vreinterpretq_u16_s16(vsubq_s16(s, vdupq_n_s16(16)));
+    return vmovn_u16(vrshrq_n_u16(vmulq_n_u16(x, CSC_YL), 8));
 }
 
-/* 查询申请到的 buffer 信息，并映射到用户空间 */
-int v4l2_query_buffer()
+/* 把 8 个像素的 Y 与色度分量相加，映射到 0~255 */
+static inline uint8x8x3_t neon_csc_rgb(uint8x8_t y, int16x8_t rv, int16x8_t guv, int16x8_t bu, int full)
 {
-    int                  ret;
-    int                  count;
-    struct v4l2_buffer   buf;
+    int16x8_t        ys = vreinterpretq_s16_u16(vmovl_u8(y));
+    uint8x8x3_t      c;
 
-    /* 分配 4 个大小为 v4l2_buffer_unit 结构体大小的 buffer */
-    buffer_unit = calloc(4, sizeof(*buffer_unit));
-    if(!buffer_unit)
-    {
-        printf("%s : calloc buffer_unit error\n", __FUNCTION__);
-    }
+    c.val[R] = neon_csc_y(vaddq_s16(ys, rv), full);
+    c.val[G] = neon_csc_y(vsubq_s16(ys, guv), full);
+    c.val[B] = neon_csc_y(vaddq_s16(ys, bu), full);
 
-    /* 获取之前申请的 v4l2_requestbuffers 的信息
-     * 并将这些信息传给用户空间的 buffer_unit
-     * 然后将 buffer_unit 映射到内核中申请的 buffer 上去
-     * 映射过程是按照，申请 buffer 的编号一个一个映射
-     */
-    for(count=0; count<4; count++)
-    {
-        memset(&buf,0,sizeof(buf));
+    return c;
+}
 
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_BUF_FLAG_MAPPED;
-        buf.index = count;
+/* 打包成 16 位格式，hi/lo 是放在高 5 位和低 5 位的分量 */
+static inline uint16x8_t neon_pack_565(uint8x8_t hi, uint8x8_t g, uint8x8_t lo)
+{
+    uint16x8_t       out;
 
-        ret = ioctl(fd_camera, VIDIOC_QUERYBUF, &buf);
-        if(ret < 0)
-        {
-            printf("%s : VIDIOC_QUERYBUF error\n", __FUNCTION__);
-            return -1;
-        }
+    out = vshll_n_u8(hi, 8);
+    out = vsriq_n_u16(out, vshll_n_u8(g, 8), 5);
+    out = vsriq_n_u16(out, vshll_n_u8(lo, 8), 11);
 
-        buffer_unit[count].length = buf.length;
-        buffer_unit[count].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_camera, buf.m.offset);
+    return out;
+}
 
-        if (NULL == buffer_unit[count].start)
-        {
-            printf("%s : mmap buffer_unit error\n", __FUNCTION__);
-            return -2;
-        }
+/* 写出 16 个像素，e/o 是偶/奇像素的分量
+ * 16 位格式打包后 vst2 交织写回；24/32 位格式先把偶/奇像素交织成顺序的两组，
+ * 各分量按偏移放进 vst3/vst4 的对应字节，透明度分量写成 0xFF，没有透明度时空出的字节写 0
+ */
+#define FB_NEON_STORE_2(d, e, o, ro, go, bo, al, ao)                                                        \
+{                                                                                                           \
+    uint16x8x2_t     px;                                                                                    \
+                                                                                                            \
+    px.val[0] = neon_pack_565((e).val[(ro) ? R : B], (e).val[G], (e).val[(ro) ? B : R]);                    \
+    px.val[1] = neon_pack_565((o).val[(ro) ? R : B], (o).val[G], (o).val[(ro) ? B : R]);                    \
+    vst2q_u16((unsigned short *)(d), px);                                                                   \
+}
 
-    }
+#define FB_NEON_STORE_N(d, e, o, ro, go, bo, al, ao, n)                                                     \
+{                                                                                                           \
+    uint8x8x2_t      r = vzip_u8((e).val[R], (o).val[R]);                                                   \
+    uint8x8x2_t      g = vzip_u8((e).val[G], (o).val[G]);                                                   \
+    uint8x8x2_t      b = vzip_u8((e).val[B], (o).val[B]);                                                   \
+    uint8x8x##n##_t  px;                                                                                    \
+    unsigned int     h;                                                                                     \
+                                                                                                            \
+    for (h = 0; h < n; h++)                                                                                 \
+        px.val[h] = vdup_n_u8(0);                                                                           \
+    if (al)                                                                                                 \
+        px.val[(ao) / 8] = vdup_n_u8(0xFF);                                                                 \
+    for (h = 0; h < 2; h++)                                                                                 \
+    {                                                                                                       \
+        px.val[(ro) / 8] = r.val[h];                                                                        \
+        px.val[(go) / 8] = g.val[h];                                                                        \
+        px.val[(bo) / 8] = b.val[h];                                                                        \
+        vst##n##_u8((d) + h * 8 * (n), px);                                                                 \
+    }                                                                                                       \
+}
 
-    return 0;
+#define FB_NEON_STORE_3(d, e, o, ro, go, bo, al, ao)    FB_NEON_STORE_N(d, e, o, ro, go, bo, al, ao, 3)
+#define FB_NEON_STORE_4(d, e, o, ro, go, bo, al, ao)    FB_NEON_STORE_N(d, e, o, ro, go, bo, al, ao, 4)
+
+/* NEON 版本转换一行，每次循环处理 16 个像素 (32 字节 YUYV)
+ * vld4 把 Y0 U Y1 V 解交织到 4 个向量，偶/奇像素分别算出 R/G/B 后按显存格式写回，剩余的像素用标量版本
+ */
+#define CSC_SPAN_NEON(fmt, bytes, rl, ro, gl, go, bl, bo, al, ao, name)                                     \
+static void yuyv_span_neon_##name##_##fmt(const unsigned char *yuv, unsigned char *rgb, unsigned int pixels) \
+{                                                                                                           \
+    int16x8_t            c128 = vdupq_n_s16(128);                                                           \
+    int                  full = CSC_COEF(CSC_FULL, name);                                                   \
+                                                                                                            \
+    for ( ; pixels >= 16; pixels -= 16, yuv += 32, rgb += 16 * (bytes))                                     \
+    {                                                                                                       \
+        uint8x8x4_t      in = vld4_u8(yuv);                                                                 \
+        int16x8_t        u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[U])), c128);                 \
+        int16x8_t        v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[V])), c128);                 \
+        int16x8_t        rv = neon_csc_mul(v, CSC_COEF(CSC_RV, name));                                      \
+        int16x8_t        guv = vaddq_s16(neon_csc_mul(u, CSC_COEF(CSC_GU, name)),                           \
+                                         neon_csc_mul(v, CSC_COEF(CSC_GV, name)));                          \
+        int16x8_t        bu = neon_csc_mul(u, CSC_COEF(CSC_BU, name));                                      \
+        uint8x8x3_t      even = neon_csc_rgb(in.val[Y0], rv, guv, bu, full);                                \
+        uint8x8x3_t      odd = neon_csc_rgb(in.val[Y1], rv, guv, bu, full);                                 \
+                                                                                                            \
+        FB_NEON_STORE_##bytes(rgb, even, odd, ro, go, bo, al, ao)                                           \
+    }                                                                                                       \
+                                                                                                            \
+    yuyv_span_##name##_##fmt(yuv, rgb, pixels);                                                             \
 }
+#else
+#define CSC_SPAN_NEON(fmt, bytes, rl, ro, gl, go, bl, bo, al, ao, name)
+#endif
 
-/* 开始视频数据采集，并将 buffer 入队 */
-int v4l2_stream_on()
-{
-    int                     i;
-    int                     ret;
-    enum  v4l2_buf_type     type;
-    struct v4l2_buffer      buffer;
+#define CSC_CONVERTER(name)                 \
+    FB_FORMATS(CSC_SPAN, name)              \
+    FB_FORMATS(CSC_SPAN_NEON, name)
 
-    for(i=0; i<4; i++)
-    {
-        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buffer.memory = V4L2_MEMORY_MMAP;
-        buffer.index = i;
+CSC_CONVERTER(bt601_full)
+CSC_CONVERTER(bt601_limited)
+CSC_CONVERTER(bt709_full)
+CSC_CONVERTER(bt709_limited)
 
-        ret=ioctl(fd_camera, VIDIOC_QBUF, &buffer);
-        if(ret < 0)
-        {
-            printf("%s : VIDIOC_QBUF error\n", __FUNCTION__);
-            return -1;
-        }
+typedef void (*yuyv_span_fn)(const unsigned char *yuv, unsigned char *rgb, unsigned int pixels);
 
-    }
+/* 一种颜色矩阵和范围，系数只给查表法生成表和自检用，转换函数里是编译时的常量
+ * 转换一行的函数按显存格式排列，用 fb_fmt 作下标
+ */
+typedef struct csc_s
+{
+    const char       *name;
+    double           kr, kb;
+    int              full;
+    int              rv, gu, gv, bu;
+    yuyv_span_fn     span[FB_FMT_CNT];
+#ifdef HAVE_NEON
+    yuyv_span_fn     span_neon[FB_FMT_CNT];
+#endif
+} csc_t;
 
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ret = ioctl(fd_camera, VIDIOC_STREAMON, &type);
-    if(ret < 0)
-    {
-        printf("%s : VIDIOC_STREAMON error\n", __FUNCTION__);
-        return -2;
-    }
+#define CSC_SPAN_ENTRY(fmt, bytes, rl, ro, gl, go, bl, bo, al, ao, prefix)    prefix##fmt,
 
-    return 0;
-}
+#ifdef HAVE_NEON
+#define CSC_ENTRY_NEON(name)    , { FB_FORMATS(CSC_SPAN_ENTRY, yuyv_span_neon_##name##_) }
+#else
+#define CSC_ENTRY_NEON(name)
+#endif
 
-/* 从帧缓冲队列中取出一个缓冲区数据，并显示到屏幕上 */
-int v4l2_dequeue_buffer()
-{
-    int                  ret;
-    int                  i;
-    struct v4l2_buffer   buffer;
-    unsigned short       *base;
-    unsigned short       *start;
+#define CSC_ENTRY(name, str)                                                                            \
+    { str, CSC_COEF(CSC_KR, name), CSC_COEF(CSC_KB, name), CSC_COEF(CSC_FULL, name),                    \
+      CSC_COEF(CSC_RV, name), CSC_COEF(CSC_GU, name), CSC_COEF(CSC_GV, name), CSC_COEF(CSC_BU, name),   \
+      { FB_FORMATS(CSC_SPAN_ENTRY, yuyv_span_##name##_) } CSC_ENTRY_NEON(name) }
 
-    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buffer.memory = V4L2_MEMORY_MMAP;
+static const csc_t csc_list[] = {
+    CSC_ENTRY(bt601_full,    "bt601-full"),
+    CSC_ENTRY(bt601_limited, "bt601-limited"),
+    CSC_ENTRY(bt709_full,    "bt709-full"),
+    CSC_ENTRY(bt709_limited, "bt709-limited"),
+};
 
-    ret = ioctl(fd_camera, VIDIOC_DQBUF, &buffer);
-    if(ret < 0)
-    {
-        printf("%s : VIDIOC_STREAMON error\n", __FUNCTION__);
-        return -1;
-    }
+#define CSC_CNT         (sizeof(csc_list) / sizeof(csc_list[0]))
 
-    /* 如果 buffer.index < 4 为假，则会打印
-    * 因为，之前只开辟了 4 个 buffer_uint，编号从 0 到 3
-    */
-    assert(buffer.index < 4);
+const csc_t                *csc = &csc_list[0]; /* 当前摄像头的颜色矩阵，默认和以前一样按全范围 BT.601 */
+int                        csc_forced = 0;      /* -C 指定了颜色矩阵，不按驱动报告的选 */
 
-    /* 将数据转换格式后，放到屏幕申请 frame buffer 的空间中 */
-    yuv422_rgb565(buffer_unit[buffer.index].start, rgb_buffer, FRAME_WIDTH, FRAME_HEIGH);
+/* yuv 格式转为 rgb 格式的算法
+ * 将 yuv422 格式的帧数据转换为显存格式，以显示在 lcd 屏幕上
+ * 每行从 yuv_buf + i*yuv_stride 读取，写到 rgb_buf + i*rgb_stride，按当前的颜色矩阵转换
+ */
+int yuv422_rgb565(const unsigned char *yuv_buf, unsigned int yuv_stride,
+                  unsigned char *rgb_buf, unsigned int rgb_stride,
+                  unsigned int width, unsigned int height)
+{
+    yuyv_span_fn         span = csc->span[fb_fmt];
+    unsigned int         i;
+    luma_stat_t          *ls;
 
-    for (i=0, base=screen_base, start=rgb_buffer; i<FRAME_HEIGH; i++)
+    for (i = 0; i < height; i++)
     {
-        memcpy(base, start, FRAME_WIDTH * 2);     // RGB565 一个像素占 2 个字节
-        base += LCD_WIDTH;                        // lcd 显示指向下一行
-        start += FRAME_WIDTH;                     // 指向下一行数据
+        span(yuv_buf + i * yuv_stride, rgb_buf + i * rgb_stride, width);
+        if ((ls = luma_row(luma_y + i)) != NULL)
+            luma_add(ls, yuv_buf + i * yuv_stride, 2, width);
     }
-    memset(rgb_buffer, 0x0, FRAME_WIDTH*FRAME_HEIGH*2);
-
-    ioctl(fd_camera, VIDIOC_QBUF, &buffer);
 
     return 0;
 }
 
-/* 用 select 监听数据
- * 有数据到来，就从缓冲队列中取出数据
+/* 查表法用到的表，每种颜色矩阵一份，用到时才生成，显存格式变了时重新生成
+ * 色度表保存每个 U/V 对各通道的贡献，打包表把 Y+色度 的和直接映射成显存格式中该通道的位，
+ * 16 位格式用 short 的表，24/32 位格式用 int 的表，不透明的透明度分量放在 R 的表里
+ * 打包表的下标范围 [-256, 511] 覆盖了所有可能的和，越界部分即为钳位后的值
  */
-int v4l2_select()
+#define PACK_BIAS       256
+
+typedef struct yuv_tab_s
 {
-    while(1)
-    {
-        int                  ret;
-        struct timeval       tv;
-        fd_set               fds;
+    short            rv[256];                   /* V 对 R 的贡献 */
+    short            gu[256];                   /* U 对 G 的贡献 */
+    short            gv[256];                   /* V 对 G 的贡献 */
+    short            bu[256];                   /* U 对 B 的贡献 */
+    unsigned short   r16[PACK_BIAS * 3];
+    unsigned short   g16[PACK_BIAS * 3];
+    unsigned short   b16[PACK_BIAS * 3];
+    unsigned int     r32[PACK_BIAS * 3];
+    unsigned int     g32[PACK_BIAS * 3];
+    unsigned int     b32[PACK_BIAS * 3];
+    int              ready;
+    unsigned int     fmt;                       /* 打包表对应的显存格式 */
+} yuv_tab_t;
+
+static yuv_tab_t           yuv_tabs[CSC_CNT];
+static yuv_tab_t           *yuv_tab = &yuv_tabs[0];
 
-        tv.tv_sec = 2;
-        tv.tv_usec = 0;
+/* 生成当前颜色矩阵和显存格式的表，算法与标量版本一致 */
+static int yuv_table_init(void)
+{
+    yuv_tab_t          *t = &yuv_tabs[csc - csc_list];
+    const fb_format_t  *f = &fb_formats[fb_fmt];
+    int                i, c;
 
-        FD_ZERO(&fds);
-        FD_SET(fd_camera, &fds);
+    yuv_tab = t;
+    if( t->ready && t->fmt == fb_fmt )
+        return 1;
 
-        ret = select(fd_camera+1, &fds, NULL, NULL, &tv);
-        if(ret < 0)
+    for (i = 0; i < 256; i++)
+    {
+        c = i - 128;
+        t->rv[i] = CSC_MUL(c, csc->rv);
+        t->gu[i] = -CSC_MUL(c, csc->gu);
+        t->gv[i] = -CSC_MUL(c, csc->gv);
+        t->bu[i] = CSC_MUL(c, csc->bu);
+    }
+
+    for (i = 0; i < PACK_BIAS * 3; i++)
+    {
+        c = csc_y(i - PACK_BIAS, csc->full);
+
+        if( fb_bytes == 2 )
         {
-            if(errno = EINTR)
-            {
-                printf("%s : select error\n", __FUNCTION__);
-            }
-            return -1;
+            t->r16[i] = fb_channel(c, f->r_len, f->r_off);
+            t->g16[i] = fb_channel(c, f->g_len, f->g_off);
+            t->b16[i] = fb_channel(c, f->b_len, f->b_off);
         }
-        if(0 == ret)
+        else
         {
-            printf("%s : select timeout\n", __FUNCTION__);
-            return -2;
+            t->r32[i] = fb_channel(c, f->r_len, f->r_off) | fb_alpha(f);
+            t->g32[i] = fb_channel(c, f->g_len, f->g_off);
+            t->b32[i] = fb_channel(c, f->b_len, f->b_off);
         }
-
-        v4l2_dequeue_buffer();
     }
 
-    return 0;
+    t->fmt = fb_fmt;
+    t->ready = 1;
+    return 1;
 }
 
-/* 结束视频数据采集 */
-int v4l2_stream_off()
+/* 切换颜色矩阵，同时切换查表法和缩放用的表 */
+void csc_use(const csc_t *cs)
 {
-    int                   ret;
-    enum v4l2_buf_type    type;
+    csc = cs;
+    yuv_table_init();
+}
 
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ret = ioctl(fd_camera, VIDIOC_STREAMOFF, &type);
-    if(ret < 0)
+const csc_t *csc_find(const char *name)
+{
+    unsigned int     i;
+
+    for (i = 0; i < CSC_CNT; i++)
     {
-        printf("%s : VIDIOC_STREAMOFF error\n", __FUNCTION__);
-        return -1;
+        if( !strcmp(name, csc_list[i].name) )
+            return &csc_list[i];
     }
 
-    return 0;
+    printf("%s : unknown color matrix '%s'\n", __FUNCTION__, name);
+    return NULL;
 }
 
-/* 解除 buffer_unit 到内核中申请 buffer 的映射 */
-void v4l2_unmmap()
-{
-    int         i;
-    int         ret;
+/* 查表法转换一行，每个像素只有查表和或运算，没有乘法和分支
+ * 每个像素对先用 U/V 把三张打包表的指针偏移好，两个 Y 直接作为下标
+ * 打包表已经是显存格式，只按每像素的字节数各展开一份
+ */
+#define TABLE_SPAN(bytes, type, bits)                                                                       \
+static void yuyv_span_table_##bytes(const unsigned char *yuv, unsigned char *rgb, unsigned int pixels)      \
+{                                                                                                           \
+    const yuv_tab_t      *t = yuv_tab;                                                                      \
+    const type           *r, *g, *b;                                                                        \
+    unsigned int         c;                                                                                 \
+                                                                                                            \
+    for ( ; pixels >= 2; pixels -= 2, yuv += 4, rgb += 2 * (bytes))                                         \
+    {                                                                                                       \
+        r = t->r##bits + PACK_BIAS + t->rv[yuv[V]];                                                         \
+        g = t->g##bits + PACK_BIAS + t->gu[yuv[U]] + t->gv[yuv[V]];                                         \
+        b = t->b##bits + PACK_BIAS + t->bu[yuv[U]];                                                         \
+                                                                                                            \
+        c = r[yuv[Y0]] | g[yuv[Y0]] | b[yuv[Y0]];                                                           \
+        FB_STORE_##bytes(rgb, c);                                                                           \
+        c = r[yuv[Y1]] | g[yuv[Y1]] | b[yuv[Y1]];                                                           \
+        FB_STORE_##bytes(rgb + (bytes), c);                                                                 \
+    }                                                                                                       \
+}
 
-    free(rgb_buffer);
+TABLE_SPAN(2, unsigned short, 16)
+TABLE_SPAN(3, unsigned int,   32)
+TABLE_SPAN(4, unsigned int,   32)
 
-    for(i=0; i<4; i++)
-    {
-        ret = munmap(buffer_unit[i].start, buffer_unit[i].length);
-        if (ret < 0)
-        {
-            printf("%s : munmap error\n", __FUNCTION__);
-        }
-    }
+/* 按每像素的字节数选出查表法的一行转换 */
+static yuyv_span_fn table_span(void)
+{
+    return fb_bytes == 2 ? yuyv_span_table_2 : (fb_bytes == 3 ? yuyv_span_table_3 : yuyv_span_table_4);
 }
 
-int main(int argc, char **argv)
+int yuv422_rgb565_table(const unsigned char *yuv_buf, unsigned int yuv_stride,
+                        unsigned char *rgb_buf, unsigned int rgb_stride,
+                        unsigned int width, unsigned int height)
 {
-    init_camera_lcd();
+    yuyv_span_fn         span = table_span();
+    unsigned int         i;
+    luma_stat_t          *ls;
 
-    /* 获取设备的能力和帧数据格式，并设置数据格式 */
-    v4l2_query_capability();
-    v4l2_enum_format();
-    v4l2_set_format();
-    v4l2_get_format();
+    for (i = 0; i < height; i++)
+    {
+        span(yuv_buf + i * yuv_stride, rgb_buf + i * rgb_stride, width);
+        if ((ls = luma_row(luma_y + i)) != NULL)
+            luma_add(ls, yuv_buf + i * yuv_stride, 2, width);
+    }
+
+    return 0;
+}
+
+#ifdef HAVE_NEON
+int yuv422_rgb565_neon(const unsigned char *yuv_buf, unsigned int yuv_stride,
+                       unsigned char *rgb_buf, unsigned int rgb_stride,
+                       unsigned int width, unsigned int height)
+{
+    yuyv_span_fn         span = csc->span_neon[fb_fmt];
+    unsigned int         i;
+    luma_stat_t          *ls;
+
+    for (i = 0; i < height; i++)
+    {
+        span(yuv_buf + i * yuv_stride, rgb_buf + i * rgb_stride, width);
+        if ((ls = luma_row(luma_y + i)) != NULL)
+            luma_add(ls, yuv_buf + i * yuv_stride, 2, width);
+    }
+
+    return 0;
+}
+
+/* 运行时检测 CPU 是否支持 NEON，编译时打开了 NEON 也可能运行在没有 NEON 的核上 */
+static int cpu_has_neon(void)
+{
+#if defined(__aarch64__)
+    return 1;
+#elif defined(HWCAP_NEON)
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) ? 1 : 0;
+#else
+    return 0;
+#endif
+}
+#endif
+
+/* 灰度预览：对焦、对位时只需要黑白画面
+ * 每个像素只读 Y，查 256 项的表直接得到显存格式的灰色像素，U/V 不读也不参与运算
+ */
+static unsigned int        grey_tab[256];
+static int                 grey_fmt = -1;       /* grey_tab 对应的显存格式 */
+
+static int grey_table_init(void)
+{
+    const fb_format_t    *f = &fb_formats[fb_fmt];
+    int                  i;
+
+    if( grey_fmt == (int)fb_fmt )
+        return 1;
+
+    for (i = 0; i < 256; i++)
+        grey_tab[i] = fb_pack(f, i, i, i);
+
+    grey_fmt = fb_fmt;
+    return 1;
+}
+
+#define GREY_SPAN(bytes)                                                                                    \
+static void yuyv_grey_span_##bytes(const unsigned char *yuv, unsigned char *rgb, unsigned int pixels)       \
+{                                                                                                           \
+    for ( ; pixels >= 2; pixels -= 2, yuv += 4, rgb += 2 * (bytes))                                         \
+    {                                                                                                       \
+        FB_STORE_##bytes(rgb, grey_tab[yuv[Y0]]);                                                           \
+        FB_STORE_##bytes(rgb + (bytes), grey_tab[yuv[Y1]]);                                                 \
+    }                                                                                                       \
+}
+
+GREY_SPAN(2)
+GREY_SPAN(3)
+GREY_SPAN(4)
+
+int yuv422_grey565(const unsigned char *yuv_buf, unsigned int yuv_stride,
+                   unsigned char *rgb_buf, unsigned int rgb_stride,
+                   unsigned int width, unsigned int height)
+{
+    yuyv_span_fn         span = fb_bytes == 2 ? yuyv_grey_span_2 : (fb_bytes == 3 ? yuyv_grey_span_3 : yuyv_grey_span_4);
+    unsigned int         i;
+    luma_stat_t          *ls;
+
+    for (i = 0; i < height; i++)
+    {
+        span(yuv_buf + i * yuv_stride, rgb_buf + i * rgb_stride, width);
+        if ((ls = luma_row(luma_y + i)) != NULL)
+            luma_add(ls, yuv_buf + i * yuv_stride, 2, width);
+    }
+
+    return 0;
+}
+
+#ifdef HAVE_NEON
+/* NEON 灰度版本，每次循环处理 16 个像素：vld2q 把 Y 和 U/V 分开，只用 Y，
+ * 同一个 Y 移位插入三次得到 rgb565，与 grey_tab 逐位一致；其他显存格式用查表的版本
+ */
+static inline uint16x8_t neon_pack_grey565(uint8x8_t y)
+{
+    uint16x8_t       y16 = vshll_n_u8(y, 8);
+    uint16x8_t       out = y16;
+
+    out = vsriq_n_u16(out, y16, 5);
+    out = vsriq_n_u16(out, y16, 11);
+
+    return out;
+}
+
+static void yuyv_grey565_span_neon(const unsigned char *yuv, unsigned char *rgb, unsigned int pixels)
+{
+    for ( ; pixels >= 16; pixels -= 16, yuv += 32, rgb += 32)
+    {
+        uint8x16x2_t     in = vld2q_u8(yuv);
+
+        vst1q_u16((unsigned short *)rgb, neon_pack_grey565(vget_low_u8(in.val[0])));
+        vst1q_u16((unsigned short *)rgb + 8, neon_pack_grey565(vget_high_u8(in.val[0])));
+    }
+
+    yuyv_grey_span_2(yuv, rgb, pixels);
+}
+
+int yuv422_grey565_neon(const unsigned char *yuv_buf, unsigned int yuv_stride,
+                        unsigned char *rgb_buf, unsigned int rgb_stride,
+                        unsigned int width, unsigned int height)
+{
+    unsigned int         i;
+    luma_stat_t          *ls;
+
+    if (fb_fmt != FB_FMT_rgb565)
+        return yuv422_grey565(yuv_buf, yuv_stride, rgb_buf, rgb_stride, width, height);
+
+    for (i = 0; i < height; i++)
+    {
+        yuyv_grey565_span_neon(yuv_buf + i * yuv_stride, rgb_buf + i * rgb_stride, width);
+        if ((ls = luma_row(luma_y + i)) != NULL)
+            luma_add(ls, yuv_buf + i * yuv_stride, 2, width);
+    }
+
+    return 0;
+}
+
+static int grey_neon_init(void)
+{
+    return cpu_has_neon() && grey_table_init();
+}
+#endif
+
+/* 可用的转换实现，按优先级排列
+ * probe 为 NULL 表示在任何 CPU 上都可以使用
+ */
+typedef struct converter_s
+{
+    const char       *name;
+    yuv_convert_fn   fn;
+    int              (*probe)(void);            /* 检测 CPU 能力或生成查表，返回 0 表示不可用 */
+    size_t           footprint;                 /* 查表占用的 cache 字节数 (16 位显存格式时) */
+    int              grey;                      /* 只输出灰度，auto 不会选择，用 -c grey 选择 */
+} converter_t;
+
+static const converter_t converters[] = {
+#ifdef HAVE_NEON
+    { "neon",       yuv422_rgb565_neon,  cpu_has_neon,    0,                0 },
+#endif
+    { "table",      yuv422_rgb565_table, yuv_table_init,  offsetof(yuv_tab_t, r32), 0 },
+    { "scalar",     yuv422_rgb565,       NULL,            0,                0 },
+#ifdef HAVE_NEON
+    { "grey-neon",  yuv422_grey565_neon, grey_neon_init,  sizeof(grey_tab), 1 },
+#endif
+    { "grey-table", yuv422_grey565,      grey_table_init, sizeof(grey_tab), 1 },
+};
+
+int                        grey_preview = 0;    /* 选中的是灰度转换，缩放时也只用 Y */
+
+#define CONVERTER_CNT   (sizeof(converters) / sizeof(converters[0]))
+
+static int converter_usable(const converter_t *conv)
+{
+    return !conv->probe || conv->probe();
+}
+
+/* 选择转换函数
+ * name 为 NULL 或 "auto" 时选第一个可用的彩色实现，不支持 NEON 时使用查表法
+ * name 为 "grey" 时同样选第一个可用的灰度实现
+ */
+yuv_convert_fn select_converter(const char *name)
+{
+    int              grey = name && !strcmp(name, "grey");
+    int              any = !name || !strcmp(name, "auto") || grey;
+    unsigned int     i;
+
+    for (i = 0; i < CONVERTER_CNT; i++)
+    {
+        if( any ? converters[i].grey != grey : strcmp(name, converters[i].name) != 0 )
+            continue;
+
+        if( converter_usable(&converters[i]) )
+        {
+            printf("yuv converter: %s\n", converters[i].name);
+            grey_preview = converters[i].grey;
+            return converters[i].fn;
+        }
+
+        if( any )
+            continue;
+
+        printf("%s : converter '%s' not supported by this CPU\n", __FUNCTION__, converters[i].name);
+        return NULL;
+    }
+
+    printf("%s : unknown converter '%s'\n", __FUNCTION__, name);
+    return NULL;
+}
+
+/* 缩放方式 */
+enum
+{
+    SCALE_NONE,                                 /* 不缩放，居中或裁剪 */
+    SCALE_FIT,                                  /* 保持宽高比放大或缩小到屏幕内，留黑边 */
+    SCALE_STRETCH,                              /* 拉伸铺满屏幕 */
+};
+
+/* 缩放时每个输出像素对应的源坐标表，启动时生成一次
+ * 坐标用 8 位小数的定点数，col_y/col_c 是源像素在一行 YUYV 数据中 Y/U 的字节偏移，V 在 U 后面 2 字节
+ * 双线性插值时 col_w/row_w 是右边/下边采样点的权重 (0~255)，最近邻插值时不使用
+ */
+typedef struct scaler_s
+{
+    unsigned int     src_w, src_h;
+    unsigned int     dst_w, dst_h;
+    int              bilinear;
+    unsigned int     *col_y;                    /* 左采样点 Y 偏移，右采样点在其后 2 字节 */
+    unsigned int     *col_c0;                   /* 左采样点 U 偏移 */
+    unsigned int     *col_c1;                   /* 右采样点 U 偏移 */
+    unsigned char    *col_w;
+    unsigned int     *row_y;                    /* 上采样行号，下采样行在其后一行 */
+    unsigned char    *row_w;
+} scaler_t;
+
+int                        scale_mode = SCALE_NONE;
+int                        scale_bilinear = 0;
+scaler_t                   scaler;
+
+/* 旋转角度 (顺时针)，旋转时按块处理，块大小 16x16 个像素，32 位格式时也只占 1K 字节 */
+#define ROTATE_TILE     16
+
+int                        rotate_angle = 0;
+
+/* 当前摄像头可以使用的屏幕区域尺寸 */
+static void area_size(unsigned int *width, unsigned int *height)
+{
+    *width = area_width ? area_width : fb_vinfo.xres;
+    *height = area_width ? area_height : fb_vinfo.yres;
+}
+
+/* out_w x out_h 的输出在屏幕区域中居中时，左上角在一页显存中的偏移 */
+static unsigned int area_offset(unsigned int out_w, unsigned int out_h)
+{
+    unsigned int     w, h;
+
+    area_size(&w, &h);
+    return (area_y + (h - out_h) / 2) * fb_line_length + (area_x + (w - out_w) / 2) * fb_bytes;
+}
+
+/* 旋转前坐标系中的屏幕尺寸，旋转 90/270 度时宽高互换 */
+static void panel_size(unsigned int *width, unsigned int *height)
+{
+    int              swap = rotate_angle == 90 || rotate_angle == 270;
+    unsigned int     w, h;
+
+    area_size(&w, &h);
+    *width = swap ? h : w;
+    *height = swap ? w : h;
+}
+
+/* 计算输出坐标 i 对应的源坐标：像素中心对齐，返回整数部分，小数部分 (0~255) 写到 frac
+ * 双线性插值要读 src+1，所以最后一个源像素按 src_n-2 加权重 255 处理
+ */
+static unsigned int scaler_map(unsigned int i, unsigned int src_n, unsigned int dst_n, int bilinear, unsigned char *frac)
+{
+    long long        pos;
+
+    /* ((i + 0.5) * src_n / dst_n - 0.5)，16 位小数 */
+    pos = (((long long)i * 2 + 1) * src_n << 16) / (dst_n * 2) - (1 << 15);
+    if(pos < 0)
+        pos = 0;
+
+    if(!bilinear)
+    {
+        *frac = 0;
+        pos = (pos + (1 << 15)) >> 16;
+        return pos < src_n ? pos : src_n - 1;
+    }
+
+    if((pos >> 16) >= src_n - 1)
+    {
+        *frac = 255;
+        return src_n - 2;
+    }
+
+    *frac = (pos >> 8) & 0xFF;
+    return pos >> 16;
+}
+
+void scaler_free(scaler_t *sc)
+{
+    free(sc->col_y);
+    free(sc->col_c0);
+    free(sc->col_c1);
+    free(sc->col_w);
+    free(sc->row_y);
+    free(sc->row_w);
+    memset(sc, 0, sizeof(*sc));
+}
+
+/* 生成 src_w x src_h 缩放到 dst_w x dst_h 的坐标表 */
+int scaler_init(scaler_t *sc, unsigned int src_w, unsigned int src_h, unsigned int dst_w, unsigned int dst_h, int bilinear)
+{
+    unsigned int     i, x;
+
+    scaler_free(sc);
+    yuv_table_init();
+    grey_table_init();
+
+    if(src_w < 2 || src_h < 2 || !dst_w || !dst_h)
+    {
+        printf("%s : invalid size %ux%u -> %ux%u\n", __FUNCTION__, src_w, src_h, dst_w, dst_h);
+        return -1;
+    }
+
+    sc->src_w = src_w;
+    sc->src_h = src_h;
+    sc->dst_w = dst_w;
+    sc->dst_h = dst_h;
+    sc->bilinear = bilinear;
+    sc->col_y = malloc(dst_w * sizeof(*sc->col_y));
+    sc->col_c0 = malloc(dst_w * sizeof(*sc->col_c0));
+    sc->col_c1 = malloc(dst_w * sizeof(*sc->col_c1));
+    sc->col_w = malloc(dst_w);
+    sc->row_y = malloc(dst_h * sizeof(*sc->row_y));
+    sc->row_w = malloc(dst_h);
+    if(!sc->col_y || !sc->col_c0 || !sc->col_c1 || !sc->col_w || !sc->row_y || !sc->row_w)
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        scaler_free(sc);
+        return -2;
+    }
+
+    for(i=0; i<dst_w; i++)
+    {
+        x = scaler_map(i, src_w, dst_w, bilinear, &sc->col_w[i]);
+        sc->col_y[i] = x * 2;
+        sc->col_c0[i] = (x & ~1U) * 2 + 1;
+        sc->col_c1[i] = ((x + bilinear) & ~1U) * 2 + 1;
+    }
+
+    for(i=0; i<dst_h; i++)
+    {
+        sc->row_y[i] = scaler_map(i, src_h, dst_h, bilinear, &sc->row_w[i]);
+    }
+
+    return 0;
+}
+
+/* 二维线性插值，权重是 8 位小数 */
+static inline int lerp2(int a, int b, int c, int d, int fx, int fy)
+{
+    int              top = (a << 8) + (b - a) * fx;
+    int              bot = (c << 8) + (d - c) * fx;
+
+    return ((top << 8) + (bot - top) * fy + (1 << 15)) >> 16;
+}
+
+/* 查表把一个 YUV 像素打包成显存格式，与查表法转换使用同一组表 */
+#define YUV_PACK(t, bits, y, u, v)                                                                          \
+    ((t)->r##bits[PACK_BIAS + (y) + (t)->rv[v]] | (t)->g##bits[PACK_BIAS + (y) + (t)->gu[u] + (t)->gv[v]] | \
+     (t)->b##bits[PACK_BIAS + (y) + (t)->bu[u]])
+
+/* 缩放并转换输出第 y 行的 [x0, x1) 列，一次遍历直接得到显存格式的像素
+ * src 指向整帧 YUYV 数据，out 指向输出的第 x0 个像素，打包表已经是显存格式，只按每像素的字节数各展开一份
+ */
+#define SCALER_SPAN(bytes, bits)                                                                            \
+static void scaler_span_##bytes(const scaler_t *sc, const unsigned char *src, unsigned int src_stride,      \
+                                unsigned int y, unsigned int x0, unsigned int x1, unsigned char *out)       \
+{                                                                                                           \
+    const yuv_tab_t      *t = yuv_tab;                                                                      \
+    const unsigned char  *r0 = src + sc->row_y[y] * src_stride;                                             \
+    const unsigned char  *r1 = r0 + src_stride;                                                             \
+    unsigned int         x, c;                                                                              \
+    int                  fx, fy = sc->row_w[y];                                                             \
+    int                  py, pu, pv;                                                                        \
+                                                                                                            \
+    /* 灰度预览只插值 Y */                                                                                  \
+    if(grey_preview)                                                                                        \
+    {                                                                                                       \
+        for(x=x0; x<x1; x++, out += (bytes))                                                                \
+        {                                                                                                   \
+            unsigned int     oy = sc->col_y[x];                                                             \
+                                                                                                            \
+            c = grey_tab[sc->bilinear ? lerp2(r0[oy], r0[oy + 2], r1[oy], r1[oy + 2], sc->col_w[x], fy) : r0[oy]]; \
+            FB_STORE_##bytes(out, c);                                                                       \
+        }                                                                                                   \
+        return;                                                                                             \
+    }                                                                                                       \
+                                                                                                            \
+    if(!sc->bilinear)                                                                                       \
+    {                                                                                                       \
+        for(x=x0; x<x1; x++, out += (bytes))                                                                \
+        {                                                                                                   \
+            c = YUV_PACK(t, bits, r0[sc->col_y[x]], r0[sc->col_c0[x]], r0[sc->col_c0[x] + 2]);              \
+            FB_STORE_##bytes(out, c);                                                                       \
+        }                                                                                                   \
+        return;                                                                                             \
+    }                                                                                                       \
+                                                                                                            \
+    for(x=x0; x<x1; x++, out += (bytes))                                                                    \
+    {                                                                                                       \
+        unsigned int     oy = sc->col_y[x];                                                                 \
+        unsigned int     c0 = sc->col_c0[x];                                                                \
+        unsigned int     c1 = sc->col_c1[x];                                                                \
+                                                                                                            \
+        fx = sc->col_w[x];                                                                                  \
+        py = lerp2(r0[oy],     r0[oy + 2], r1[oy],     r1[oy + 2], fx, fy);                                 \
+        pu = lerp2(r0[c0],     r0[c1],     r1[c0],     r1[c1],     fx, fy);                                 \
+        pv = lerp2(r0[c0 + 2], r0[c1 + 2], r1[c0 + 2], r1[c1 + 2], fx, fy);                                 \
+        c = YUV_PACK(t, bits, py, pu, pv);                                                                  \
+        FB_STORE_##bytes(out, c);                                                                           \
+    }                                                                                                       \
+}
+
+SCALER_SPAN(2, 16)
+SCALER_SPAN(3, 32)
+SCALER_SPAN(4, 32)
+
+/* 按每像素的字节数调用展开的版本，亮度统计和格式无关，在这里取样 */
+static void scaler_span(const scaler_t *sc, const unsigned char *src, unsigned int src_stride,
+                        unsigned int y, unsigned int x0, unsigned int x1, unsigned char *out)
+{
+    const unsigned char  *r0 = src + sc->row_y[y] * src_stride;
+    unsigned int         x;
+    luma_stat_t          *ls = luma_row(y);
+
+    /* 亮度按输出像素对应的源像素取样 */
+    if(ls)
+    {
+        for(x=x0; x<x1; x++)
+            ls->hist[r0[sc->col_y[x]]]++;
+        ls->samples += x1 - x0;
+    }
+
+    if(fb_bytes == 2)
+        scaler_span_2(sc, src, src_stride, y, x0, x1, out);
+    else if(fb_bytes == 3)
+        scaler_span_3(sc, src, src_stride, y, x0, x1, out);
+    else
+        scaler_span_4(sc, src, src_stride, y, x0, x1, out);
+}
+
+/* 缩放并转换输出行 [y0, y1)，dst 指向输出区域左上角 */
+void scaler_rows(const scaler_t *sc, const unsigned char *src, unsigned int src_stride,
+                 unsigned char *dst, unsigned int dst_stride, unsigned int y0, unsigned int y1)
+{
+    unsigned int         y;
+
+    for(y=y0; y<y1; y++)
+    {
+        scaler_span(sc, src, src_stride, y, 0, sc->dst_w, dst + y * dst_stride);
+    }
+}
+
+/* 屏幕叠加文字 (OSD)：时间、帧率和标签，用 -O 打开
+ * 字库是 5x7 点阵，启动时按屏幕大小放大成显存格式的字形条 (所有字形横排成一条，白字黑底)，
+ * 每个文字框的宽度由最长的文字固定，更新文字只改字形编号，不申请内存，框的位置也不变
+ * 文字框在视图坐标 (旋转前) 中，旋转时跟着画面一起转；
+ * 转换时与文字框相交的行逐行拆段，框里的像素直接从字形条复制，不转换也不会被写两次
+ */
+#define OSD_TIME        0x1             /* 左上角的日期时间 */
+#define OSD_FPS         0x2             /* 右上角的帧率 */
+#define OSD_LABEL       0x4             /* 左下角的标签，默认是摄像头设备名 */
+#define OSD_ITEMS       3
+#define OSD_TEXT_MAX    31
+#define OSD_FG          255             /* 字和底色的灰度 */
+#define OSD_BG          0
+
+static const char osd_chars[] = " 0123456789:.-/%?+_ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/* 每个字形 7 行，每行低 5 位，最高位在左 */
+static const unsigned char osd_glyphs[][7] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   /* ' ' */
+    { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },   /* 0 */
+    { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },
+    { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+    { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },
+    { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },
+    { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },
+    { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },   /* 9 */
+    { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 },   /* : */
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C },   /* . */
+    { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 },   /* - */
+    { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },   /* / */
+    { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 },   /* % */
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 },   /* ? */
+    { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 },   /* + */
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F },   /* _ */
+    { 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 },   /* A */
+    { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E },
+    { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E },
+    { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C },
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F },
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },
+    { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F },
+    { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+    { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E },
+    { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F },
+    { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 },
+    { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },
+    { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+    { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },
+    { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D },
+    { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },
+    { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },
+    { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A },
+    { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },
+    { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 },
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F },   /* Z */
+};
+
+#define OSD_GLYPH_CNT   (sizeof(osd_glyphs) / sizeof(osd_glyphs[0]))
+
+/* 一个文字框，glyph[len] 以后都是空格，框右边多出的一列留白取自空格 */
+typedef struct osd_item_s
+{
+    unsigned int     kind;                      /* OSD_TIME/OSD_FPS/OSD_LABEL */
+    unsigned int     x, y, w, h;                /* 视图坐标中的区域 */
+    unsigned int     len;
+    unsigned char    glyph[OSD_TEXT_MAX + 1];
+    unsigned int     dirty;                     /* 按位记录哪些显存页上还是旧的文字，局部重画时用 */
+} osd_item_t;
+
+/* 每个摄像头的文字框按 x 排序，同一行上的框互不重叠 */
+typedef struct osd_s
+{
+    osd_item_t       item[OSD_ITEMS];
+    unsigned int     cnt;
+    time_t           shown_sec;                 /* 显示的时间 */
+    double           fps_ns;                    /* 帧率统计窗口的起点 */
+    unsigned long    fps_frames;
+} osd_t;
+
+unsigned int               osd_items = 0;       /* 打开的文字框，OSD_TIME|OSD_FPS|OSD_LABEL */
+char                       osd_label[OSD_TEXT_MAX + 1];     /* 空表示用摄像头设备名 */
+osd_t                      osd_ctx[CAMERA_MAX];
+osd_t                      *osd = &osd_ctx[0];
+
+static struct
+{
+    unsigned char    *strip;                    /* cell_h 行，每行 OSD_GLYPH_CNT * cell_w 个像素 */
+    unsigned int     fmt;                       /* 字形条的显存格式 */
+    unsigned int     scale;
+    unsigned int     cell_w, cell_h;            /* 放大后一个字占的格子，字形左边和上下各留一点 */
+    unsigned int     strip_w;
+    unsigned char    map[256];                  /* 字符到字形编号，小写按大写，不认识的画成 '?' */
+} osd_font;
+
+static double now_ns(void);
+
+/* 解析 -O 的参数：time、fps、label 或 label=文字，用逗号分隔 */
+int osd_parse(const char *arg)
+{
+    const char       *p = arg;
+    size_t           n;
+
+    osd_items = 0;
+    while(*p)
+    {
+        n = strcspn(p, ",");
+        if(n == 4 && !strncmp(p, "time", 4))
+            osd_items |= OSD_TIME;
+        else if(n == 3 && !strncmp(p, "fps", 3))
+            osd_items |= OSD_FPS;
+        else if(n >= 5 && !strncmp(p, "label", 5) && (n == 5 || p[5] == '='))
+        {
+            osd_items |= OSD_LABEL;
+            if(n > 6)
+                snprintf(osd_label, sizeof(osd_label), "%.*s", (int)(n - 6), p + 6);
+        }
+        else
+            return -1;
+
+        p += n;
+        if(*p == ',')
+            p++;
+    }
+
+    return osd_items ? 0 : -1;
+}
+
+/* 按屏幕大小选放大倍数，把 5x7 的字库画成字形条，只在第一次时做 */
+static int osd_font_init(void)
+{
+    unsigned int     short_side = fb_vinfo.xres < fb_vinfo.yres ? fb_vinfo.xres : fb_vinfo.yres;
+    const fb_format_t    *f = &fb_formats[fb_fmt];
+    unsigned int     s, g, x, y, i, fg, bg;
+    unsigned char    *p;
+
+    if(osd_font.strip && osd_font.fmt == fb_fmt)
+        return 0;
+    free(osd_font.strip);
+
+    s = short_side / 240;
+    s = s < 1 ? 1 : (s > 4 ? 4 : s);
+    osd_font.scale = s;
+    osd_font.cell_w = 6 * s;
+    osd_font.cell_h = 9 * s;
+    osd_font.strip_w = OSD_GLYPH_CNT * osd_font.cell_w;
+    osd_font.strip = malloc(osd_font.strip_w * osd_font.cell_h * fb_bytes);
+    if(!osd_font.strip)
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        return -1;
+    }
+    osd_font.fmt = fb_fmt;
+
+    fg = fb_pack(f, OSD_FG, OSD_FG, OSD_FG);
+    bg = fb_pack(f, OSD_BG, OSD_BG, OSD_BG);
+    for(y=0; y<osd_font.cell_h; y++)
+    {
+        p = osd_font.strip + y * osd_font.strip_w * fb_bytes;
+        for(g=0; g<OSD_GLYPH_CNT; g++)
+        {
+            for(x=0; x<osd_font.cell_w; x++)
+            {
+                /* 字形在格子中偏右下一个点，第 0 列和第 0、8 行是底色 */
+                unsigned int gx = x / s, gy = y / s;
+
+                fb_store(p, gx >= 1 && gy >= 1 && gy <= 7 && (osd_glyphs[g][gy - 1] >> (5 - gx) & 1) ? fg : bg);
+                p += fb_bytes;
+            }
+        }
+    }
+
+    memset(osd_font.map, strchr(osd_chars, '?') - osd_chars, sizeof(osd_font.map));
+    for(i=0; osd_chars[i]; i++)
+    {
+        osd_font.map[(unsigned char)osd_chars[i]] = i;
+        if(osd_chars[i] >= 'A' && osd_chars[i] <= 'Z')
+            osd_font.map[osd_chars[i] - 'A' + 'a'] = i;
+    }
+
+    return 0;
+}
+
+/* 更新一个框的文字，不足 len 个字时补空格，超出的截掉 */
+static void osd_text(osd_item_t *it, const char *text)
+{
+    unsigned int     i;
+    unsigned char    g;
+
+    for(i=0; i<it->len; i++)
+    {
+        g = *text ? osd_font.map[(unsigned char)*text++] : 0;
+        if(g != it->glyph[i])
+        {
+            it->glyph[i] = g;
+            it->dirty = ~0U;
+        }
+    }
+}
+
+/* 在视图中放一个 len 个字的框，和已有的框重叠或放不下时不显示 */
+static void osd_add(unsigned int kind, unsigned int len, int right, int bottom)
+{
+    unsigned int     margin = osd_font.cell_h / 2;
+    unsigned int     w = (len * osd_font.cell_w + osd_font.scale + 1) & ~1U;
+    unsigned int     h = osd_font.cell_h;
+    unsigned int     x, y, i;
+    osd_item_t       *it;
+
+    if(w + 2 * margin > view_width || h + 2 * margin > view_height)
+        return;
+
+    x = (right ? view_width - margin - w : margin) & ~1U;
+    y = bottom ? view_height - margin - h : margin;
+
+    for(i=0; i<osd->cnt; i++)
+    {
+        it = &osd->item[i];
+        if(x < it->x + it->w && it->x < x + w && y < it->y + it->h && it->y < y + h)
+            return;
+    }
+
+    /* 插入时保持按 x 排序 */
+    for(i=osd->cnt; i>0 && osd->item[i - 1].x > x; i--)
+        osd->item[i] = osd->item[i - 1];
+
+    it = &osd->item[i];
+    memset(it, 0, sizeof(*it));
+    it->kind = kind;
+    it->x = x;
+    it->y = y;
+    it->w = w;
+    it->h = h;
+    it->len = len;
+    it->dirty = ~0U;
+    osd->cnt++;
+}
+
+/* 视图尺寸确定后为当前摄像头排好文字框 */
+void osd_layout(void)
+{
+    char             label[OSD_TEXT_MAX + 1];
+    unsigned int     i;
+
+    osd->cnt = 0;
+    if(!osd_items)
+        return;
+
+    if(osd_font_init() < 0)
+    {
+        osd_items = 0;
+        return;
+    }
+
+    snprintf(label, sizeof(label), "%s", osd_label[0] ? osd_label : camera_dev);
+
+    if(osd_items & OSD_TIME)
+        osd_add(OSD_TIME, 19, 0, 0);
+    if(osd_items & OSD_FPS)
+        osd_add(OSD_FPS, 10, 1, 0);
+    if(osd_items & OSD_LABEL)
+        osd_add(OSD_LABEL, strlen(label), 0, 1);
+
+    osd->shown_sec = 0;
+    osd->fps_ns = 0;
+    osd->fps_frames = 0;
+
+    /* 标签不变，排好后就写上，时间在画第一帧前写，帧率统计满一秒后写 */
+    for(i=0; i<osd->cnt; i++)
+        osd_text(&osd->item[i], osd->item[i].kind == OSD_LABEL ? label : (osd->item[i].kind == OSD_FPS ? "  --.- FPS" : ""));
+}
+
+/* 每画一帧前调用，秒数变化时更新时间，每秒更新一次帧率 */
+void osd_update(void)
+{
+    char             text[OSD_TEXT_MAX + 1];
+    double           now;
+    time_t           sec;
+    struct tm        tm;
+    unsigned int     i;
+
+    if(!osd->cnt)
+        return;
+
+    now = now_ns();
+    sec = time(NULL);
+    if(!osd->fps_ns)
+        osd->fps_ns = now;
+    osd->fps_frames++;
+
+    for(i=0; i<osd->cnt; i++)
+    {
+        osd_item_t   *it = &osd->item[i];
+
+        if(it->kind == OSD_TIME && sec != osd->shown_sec)
+        {
+            localtime_r(&sec, &tm);
+            strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm);
+            osd_text(it, text);
+        }
+        else if(it->kind == OSD_FPS && now - osd->fps_ns >= 1e9)
+        {
+            snprintf(text, sizeof(text), "%6.1f FPS", (osd->fps_frames - 1) * 1e9 / (now - osd->fps_ns));
+            osd_text(it, text);
+        }
+    }
+
+    osd->shown_sec = sec;
+    if(now - osd->fps_ns >= 1e9)
+    {
+        osd->fps_ns = now;
+        osd->fps_frames = 1;
+    }
+}
+
+/* 复制一个框第 r 行的 [c, c+n) 列，每个字形一段连续的像素 */
+static void osd_item_row(const osd_item_t *it, unsigned int r, unsigned int c, unsigned int n, unsigned char *out)
+{
+    const unsigned char  *row = osd_font.strip + r * osd_font.strip_w * fb_bytes;
+    unsigned int         k, off, m;
+
+    while(n > 0)
+    {
+        k = c / osd_font.cell_w;
+        off = c % osd_font.cell_w;
+        m = osd_font.cell_w - off < n ? osd_font.cell_w - off : n;
+        memcpy(out, row + (it->glyph[k] * osd_font.cell_w + off) * fb_bytes, m * fb_bytes);
+        out += m * fb_bytes;
+        c += m;
+        n -= m;
+    }
+}
+
+static inline int osd_hit_row(const osd_item_t *it, unsigned int y)
+{
+    return y >= it->y && y < it->y + it->h;
+}
+
+/* 从第 y 行开始、到 y1 为止，和第 y 行同样有 (或没有) 文字框的连续行的结尾 */
+static unsigned int osd_band(unsigned int y, unsigned int y1, int *in)
+{
+    unsigned int     end = y1;
+    unsigned int     i;
+    int              grown;
+
+    *in = 0;
+    for(i=0; i<osd->cnt; i++)
+    {
+        if(osd_hit_row(&osd->item[i], y))
+            *in = 1;
+        else if(osd->item[i].y > y && osd->item[i].y < end)
+            end = osd->item[i].y;
+    }
+
+    if(*in)
+    {
+        /* 上下相接或重叠的框连成一段 */
+        end = y;
+        do
+        {
+            grown = 0;
+            for(i=0; i<osd->cnt; i++)
+            {
+                if(osd->item[i].y <= end && osd->item[i].y + osd->item[i].h > end)
+                {
+                    end = osd->item[i].y + osd->item[i].h;
+                    grown = 1;
+                }
+            }
+        } while(grown);
+    }
+
+    return end < y1 ? end : y1;
+}
+
+/* 把视图第 y 行 [x0, x1) 中文字框的像素写到 out 中，out 对应第 x0 列，框外的像素不动 */
+static void osd_fill(unsigned int y, unsigned int x0, unsigned int x1, unsigned char *out)
+{
+    const osd_item_t *it;
+    unsigned int     i, a, b;
+
+    for(i=0; i<osd->cnt; i++)
+    {
+        it = &osd->item[i];
+        if(!osd_hit_row(it, y))
+            continue;
+
+        a = it->x > x0 ? it->x : x0;
+        b = it->x + it->w < x1 ? it->x + it->w : x1;
+        if(a < b)
+            osd_item_row(it, y - it->y, a - it->x, b - a, out + (a - x0) * fb_bytes);
+    }
+}
+
+/* 局部重画时只重画文字变了的框，view 指向一页显存中视图的左上角 */
+static void osd_redraw(unsigned char *view, unsigned int bit)
+{
+    osd_item_t       *it;
+    unsigned int     i, r;
+
+    for(i=0; i<osd->cnt; i++)
+    {
+        it = &osd->item[i];
+        if(!(it->dirty & bit))
+            continue;
+
+        for(r=0; r<it->h; r++)
+            osd_item_row(it, r, 0, it->w, view + (it->y + r) * fb_line_length + it->x * fb_bytes);
+        it->dirty &= ~bit;
+    }
+}
+
+/* 转换旋转前坐标系中 [tx, tx+tw) x [ty, ty+th) 的一块到 tile 中，tile 每行 ROTATE_TILE 个像素 */
+static void render_tile(const unsigned char *frame, unsigned char *tile,
+                        unsigned int tx, unsigned int ty, unsigned int tw, unsigned int th)
+{
+    unsigned int         j;
+
+    if(scale_mode != SCALE_NONE && scaler.dst_w)
+    {
+        for(j=0; j<th; j++)
+        {
+            scaler_span(&scaler, frame + view_src_offset, frame_stride, ty + j, tx, tx + tw, tile + j * ROTATE_TILE * fb_bytes);
+        }
+        return;
+    }
+
+    luma_rows_at(ty);
+    convert_yuv(frame + view_src_offset + ty * frame_stride + tx * 2, frame_stride,
+                tile, ROTATE_TILE * fb_bytes, tw, th);
+}
+
+/* 24 位格式的一个像素，结构体赋值就是复制 3 个字节 */
+typedef struct fb_pixel3_s
+{
+    unsigned char    c[3];
+} fb_pixel3_t;
+
+/* 把一块转置写进显存，out 指向旋转后输出区域的左上角，按每像素的字节数各展开一份 */
+#define ROTATE_COPY(bytes, type)                                                                            \
+static void rotate_copy_##bytes(const unsigned char *tile, unsigned char *out, unsigned int tx, unsigned int ty, \
+                                unsigned int tw, unsigned int th)                                           \
+{                                                                                                           \
+    const type           *t = (const type *)tile;                                                           \
+    type                 *d;                                                                                \
+    unsigned int         i, j;                                                                              \
+                                                                                                            \
+    switch(rotate_angle)                                                                                    \
+    {                                                                                                       \
+        case 90:  /* (x, y) -> (H-1-y, x) */                                                                \
+            for(i=0; i<tw; i++)                                                                             \
+            {                                                                                               \
+                d = (type *)(out + (tx + i) * fb_line_length) + (view_height - 1 - ty);                     \
+                for(j=0; j<th; j++)                                                                         \
+                    d[-(int)j] = t[j * ROTATE_TILE + i];                                                    \
+            }                                                                                               \
+            break;                                                                                          \
+                                                                                                            \
+        case 180: /* (x, y) -> (W-1-x, H-1-y) */                                                            \
+            for(j=0; j<th; j++)                                                                             \
+            {                                                                                               \
+                d = (type *)(out + (view_height - 1 - ty - j) * fb_line_length) + (view_width - 1 - tx);    \
+                for(i=0; i<tw; i++)                                                                         \
+                    d[-(int)i] = t[j * ROTATE_TILE + i];                                                    \
+            }                                                                                               \
+            break;                                                                                          \
+                                                                                                            \
+        case 270: /* (x, y) -> (y, W-1-x) */                                                                \
+            for(i=0; i<tw; i++)                                                                             \
+            {                                                                                               \
+                d = (type *)(out + (view_width - 1 - tx - i) * fb_line_length) + ty;                        \
+                for(j=0; j<th; j++)                                                                         \
+                    d[j] = t[j * ROTATE_TILE + i];                                                          \
+            }                                                                                               \
+            break;                                                                                          \
+    }                                                                                                       \
+}
+
+ROTATE_COPY(2, unsigned short)
+ROTATE_COPY(3, fb_pixel3_t)
+ROTATE_COPY(4, unsigned int)
+
+/* 旋转显示旋转前坐标系中的行 [y0, y1)，out 指向旋转后输出区域的左上角
+ * 按 ROTATE_TILE x ROTATE_TILE 的块处理：先把一块转换到栈上的小缓冲区 (留在 L1 cache 中)，
+ * 再转置写进显存，写显存时每行都是连续的一段，不会每个像素跨一整行
+ */
+static void rotate_rows(const unsigned char *frame, unsigned char *out, unsigned int y0, unsigned int y1)
+{
+    unsigned int         tile[ROTATE_TILE * ROTATE_TILE];
+    unsigned int         tx, ty, tw, th, j;
+
+    for(ty=y0; ty<y1; ty+=ROTATE_TILE)
+    {
+        th = y1 - ty < ROTATE_TILE ? y1 - ty : ROTATE_TILE;
+
+        for(tx=0; tx<view_width; tx+=ROTATE_TILE)
+        {
+            tw = view_width - tx < ROTATE_TILE ? view_width - tx : ROTATE_TILE;
+            render_tile(frame, (unsigned char *)tile, tx, ty, tw, th);
+
+            /* 文字框的像素在块缓冲区里替换掉，转置写显存时一起写 */
+            for(j=0; osd->cnt && j<th; j++)
+                osd_fill(ty + j, tx, tx + tw, (unsigned char *)tile + j * ROTATE_TILE * fb_bytes);
+
+            if(fb_bytes == 2)
+                rotate_copy_2((unsigned char *)tile, out, tx, ty, tw, th);
+            else if(fb_bytes == 3)
+                rotate_copy_3((unsigned char *)tile, out, tx, ty, tw, th);
+            else
+                rotate_copy_4((unsigned char *)tile, out, tx, ty, tw, th);
+        }
+    }
+}
+
+/* 显示区域第 y 行中没有被上层窗口挡住的段 [span[i][0], span[i][1])，按 x 排序，返回段数
+ * align 为 2 时段的边界向内取偶数，YUYV 两个像素共用一组色度
+ */
+static unsigned int view_row_spans(unsigned int y, unsigned int span[][2], unsigned int align)
+{
+    int              ox = view_dst_offset % fb_line_length / fb_bytes;
+    int              sy = view_dst_offset / fb_line_length + y;
+    int              hx0, hx1;
+    unsigned int     cnt = 1;
+    unsigned int     i, j, n;
+
+    span[0][0] = 0;
+    span[0][1] = view_width;
+
+    for(i=0; i<view_hole_cnt; i++)
+    {
+        const rect_t     *h = &view_hole[i];
+
+        if(sy < (int)h->y || sy >= (int)(h->y + h->h))
+            continue;
+
+        hx0 = (int)h->x - ox;
+        hx1 = (int)(h->x + h->w) - ox;
+
+        /* 每一段减去 [hx0, hx1)，最多分成两段 */
+        for(j=0, n=cnt; j<n; j++)
+        {
+            if(hx1 <= (int)span[j][0] || hx0 >= (int)span[j][1])
+                continue;
+
+            if(hx0 > (int)span[j][0] && hx1 < (int)span[j][1])
+            {
+                memmove(span[j + 2], span[j + 1], (cnt - j - 1) * sizeof(span[0]));
+                span[j + 1][0] = hx1;
+                span[j + 1][1] = span[j][1];
+                span[j][1] = hx0;
+                cnt++;
+                n++;
+                j++;
+            }
+            else if(hx0 > (int)span[j][0])
+                span[j][1] = hx0;
+            else if(hx1 < (int)span[j][1])
+                span[j][0] = hx1;
+            else
+                span[j][0] = span[j][1];
+        }
+    }
+
+    for(i=0, n=0; i<cnt; i++)
+    {
+        span[n][0] = (span[i][0] + align - 1) / align * align;
+        span[n][1] = span[i][1] / align * align;
+        if(span[n][0] < span[n][1])
+            n++;
+    }
+
+    return n;
+}
+
+/* 缩放或转换视图第 y 行的 [x0, x1)，row 指向显存中视图的这一行 */
+static inline void render_plain(const unsigned char *frame, unsigned char *row, unsigned int y,
+                                unsigned int x0, unsigned int x1, int scaled)
+{
+    if(scaled)
+        scaler_span(&scaler, frame + view_src_offset, frame_stride, y, x0, x1, row + x0 * fb_bytes);
+    else
+    {
+        luma_rows_at(y);
+        convert_yuv(frame + view_src_offset + y * frame_stride + x0 * 2, frame_stride,
+                    row + x0 * fb_bytes, fb_line_length, x1 - x0, 1);
+    }
+}
+
+/* 画视图第 y 行的 [x0, x1)，与文字框相交的部分从字形条复制，其余部分缩放或转换
+ * 文字框的 x 和宽度都是偶数，拆开的段仍然按 YUYV 的两个像素对齐
+ */
+static void render_span(const unsigned char *frame, unsigned char *row, unsigned int y,
+                        unsigned int x0, unsigned int x1, int scaled)
+{
+    const osd_item_t     *it;
+    unsigned int         i, a, b;
+
+    for(i=0; i<osd->cnt && x0<x1; i++)
+    {
+        it = &osd->item[i];
+        if(!osd_hit_row(it, y) || it->x + it->w <= x0 || it->x >= x1)
+            continue;
+
+        a = it->x > x0 ? it->x : x0;
+        b = it->x + it->w < x1 ? it->x + it->w : x1;
+        if(a > x0)
+            render_plain(frame, row, y, x0, a, scaled);
+        osd_item_row(it, y - it->y, a - it->x, b - a, row + a * fb_bytes);
+        x0 = b;
+    }
+
+    if(x0 < x1)
+        render_plain(frame, row, y, x0, x1, scaled);
+}
+
+/* 有上层窗口挡住时逐行画，每行只画露出来的段 */
+static void render_rows_holes(const unsigned char *frame, unsigned char *page, unsigned int y0, unsigned int y1)
+{
+    unsigned int         span[CAMERA_MAX + 1][2];
+    unsigned int         scaled = scale_mode != SCALE_NONE && scaler.dst_w;
+    unsigned int         y, i, n;
+    unsigned char        *dst;
+
+    for(y=y0; y<y1; y++)
+    {
+        dst = page + view_dst_offset + y * fb_line_length;
+        n = view_row_spans(y, span, scaled ? 1 : 2);
+        for(i=0; i<n; i++)
+            render_span(frame, dst, y, span[i][0], span[i][1], scaled);
+    }
+}
+
+/* 画视图中 [x0, x1) x [y0, y1) 的一块
+ * 不缩放时没有文字框的行整块交给转换函数，缩放和有文字框的行逐行画
+ */
+static void render_block(const unsigned char *frame, unsigned char *page, unsigned int x0, unsigned int x1,
+                         unsigned int y0, unsigned int y1)
+{
+    int                  scaled = scale_mode != SCALE_NONE && scaler.dst_w;
+    unsigned int         y, end;
+    int                  in;
+
+    for(y=y0; y<y1; y=end)
+    {
+        end = osd_band(y, y1, &in);
+        if(!in && !scaled)
+        {
+            luma_rows_at(y);
+            convert_yuv(frame + view_src_offset + y * frame_stride + x0 * 2, frame_stride,
+                        page + view_dst_offset + y * fb_line_length + x0 * fb_bytes, fb_line_length, x1 - x0, end - y);
+            continue;
+        }
+
+        for( ; y<end; y++)
+            render_span(frame, page + view_dst_offset + y * fb_line_length, y, x0, x1, scaled);
+    }
+}
+
+/* 把一帧的输出行 [y0, y1) 画到一页显存上，行号是旋转前坐标系中的
+ * 不缩放时直接调用转换函数，缩放时用坐标表边缩放边转换，旋转时按块转换后转置写入
+ * 打开 OSD 时文字框的像素在同一遍中替换转换出的像素
+ */
+void render_rows(const unsigned char *frame, unsigned char *page, unsigned int y0, unsigned int y1)
+{
+    if(rotate_angle)
+    {
+        rotate_rows(frame, page + view_dst_offset, y0, y1);
+        return;
+    }
+
+    if(view_hole_cnt)
+    {
+        render_rows_holes(frame, page, y0, y1);
+        return;
+    }
+
+    render_block(frame, page, 0, view_width, y0, y1);
+}
+
+#ifdef HAVE_JPEG
+/* MJPEG 解码：libjpeg-turbo 直接输出显存格式的行到显存，不经过中间缓冲区
+ * 帧比屏幕大时用 DCT 域缩小 (scale_denom 1/2/4/8)，只做 1/N 大小的反变换，比解码后再缩放省得多
+ * UVC 摄像头的 MJPEG 帧通常不带 Huffman 表，libjpeg-turbo 会使用标准表
+ */
+#define MJPEG_ROWS      16
+
+typedef struct mjpeg_s
+{
+    struct jpeg_error_mgr          jerr;        /* 必须放在最前面，出错回调里转换回 mjpeg_t */
+    jmp_buf                        jmpbuf;
+    struct jpeg_decompress_struct  cinfo;
+    int                            inited;
+    unsigned int                   scale_denom;
+    unsigned int                   out_width;   /* DCT 缩小后的帧尺寸 */
+    unsigned int                   out_height;
+    unsigned int                   crop_x;      /* 缩小后仍比屏幕大时裁掉的左边和上边 */
+    unsigned int                   crop_y;
+    unsigned char                  *line;       /* 需要水平裁剪时解码一行的临时缓冲区 */
+    unsigned long                  errors;      /* 解码失败丢掉的帧数 */
+} mjpeg_t;
+
+mjpeg_t                    mjpeg_ctx[CAMERA_MAX];    /* 每个摄像头一个解码器 */
+mjpeg_t                    *mjpeg = &mjpeg_ctx[0];
+
+/* 解码出错时跳回 mjpeg_decode，不让 libjpeg 调用 exit() */
+static void mjpeg_error_exit(j_common_ptr cinfo)
+{
+    mjpeg_t          *mj = (mjpeg_t *)cinfo->err;
+
+    longjmp(mj->jmpbuf, 1);
+}
+
+/* 摄像头偶尔输出不完整的帧，告警太多，不打印 */
+static void mjpeg_output_message(j_common_ptr cinfo)
+{
+    (void)cinfo;
+}
+
+/* 按帧尺寸选出 DCT 缩小倍数，计算显示区域
+ * 选最小的倍数让帧能放进屏幕，/8 仍放不下时裁掉四周
+ */
+int mjpeg_setup(void)
+{
+    unsigned int         denom;
+    unsigned int         area_w, area_h;
+
+    if(!mjpeg->inited)
+    {
+        mjpeg->cinfo.err = jpeg_std_error(&mjpeg->jerr);
+        mjpeg->jerr.error_exit = mjpeg_error_exit;
+        mjpeg->jerr.output_message = mjpeg_output_message;
+        jpeg_create_decompress(&mjpeg->cinfo);
+        mjpeg->inited = 1;
+    }
+
+    area_size(&area_w, &area_h);
+    for(denom=1; denom<8; denom*=2)
+    {
+        if(frame_mode.width <= denom * area_w && frame_mode.height <= denom * area_h)
+            break;
+    }
+
+    mjpeg->scale_denom = denom;
+    mjpeg->out_width = (frame_mode.width + denom - 1) / denom;
+    mjpeg->out_height = (frame_mode.height + denom - 1) / denom;
+
+    view_width = mjpeg->out_width < area_w ? mjpeg->out_width : area_w;
+    view_height = mjpeg->out_height < area_h ? mjpeg->out_height : area_h;
+    mjpeg->crop_x = (mjpeg->out_width - view_width) / 2;
+    mjpeg->crop_y = (mjpeg->out_height - view_height) / 2;
+    view_src_offset = 0;
+    view_dst_offset = area_offset(view_width, view_height);
+    osd_layout();
+
+    free(mjpeg->line);
+    mjpeg->line = NULL;
+    if(mjpeg->crop_x || view_hole_cnt || osd->cnt)
+    {
+        mjpeg->line = malloc(mjpeg->out_width * fb_bytes);
+        if(!mjpeg->line)
+        {
+            printf("%s : malloc error\n", __FUNCTION__);
+            return -1;
+        }
+    }
+
+    printf("mjpeg %ux%u -> 1/%u %ux%u, show %ux%u\n", frame_mode.width, frame_mode.height, denom,
+            mjpeg->out_width, mjpeg->out_height, view_width, view_height);
+
+    return 0;
+}
+
+/* 显存格式对应的 libjpeg-turbo 输出格式，32/24 位格式按内存中的字节顺序对应
+ * bgr565 没有对应的输出格式，解码成 RGB565 后由 mjpeg_swap_rb 交换 R 和 B
+ */
+static J_COLOR_SPACE mjpeg_color_space(void)
+{
+    switch(fb_fmt)
+    {
+        case FB_FMT_rgb888:     return JCS_EXT_BGR;
+        case FB_FMT_bgr888:     return JCS_EXT_RGB;
+        case FB_FMT_xrgb8888:   return JCS_EXT_BGRX;
+        case FB_FMT_argb8888:   return JCS_EXT_BGRA;
+        case FB_FMT_xbgr8888:   return JCS_EXT_RGBX;
+        case FB_FMT_abgr8888:   return JCS_EXT_RGBA;
+        default:                return JCS_RGB565;
+    }
+}
+
+static void mjpeg_swap_rb(JSAMPROW *rows, unsigned int n)
+{
+    unsigned short       *p;
+    unsigned int         i, x, c;
+
+    for(i=0; i<n; i++)
+    {
+        p = (unsigned short *)rows[i];
+        for(x=0; x<mjpeg->out_width; x++)
+        {
+            c = p[x];
+            p[x] = (c >> 11) | (c & 0x07E0) | (c << 11);
+        }
+    }
+}
+
+/* 解码一帧 MJPEG 到一页显存上，出错时丢掉这一帧返回 -1 */
+int mjpeg_decode(const unsigned char *data, unsigned long size, unsigned char *page)
+{
+    struct jpeg_decompress_struct  *cinfo = &mjpeg->cinfo;
+    JSAMPROW                       rows[MJPEG_ROWS];
+    unsigned char                  *out = page + view_dst_offset;
+    unsigned int                   span[CAMERA_MAX + 1][2];
+    unsigned int                   y, i, n, k, end;
+    int                            in;
+
+    if(setjmp(mjpeg->jmpbuf))
+    {
+        jpeg_abort_decompress(cinfo);
+        mjpeg->errors++;
+        return -1;
+    }
+
+    jpeg_mem_src(cinfo, (unsigned char *)data, size);
+    jpeg_read_header(cinfo, TRUE);
+
+    /* 最快的整数 IDCT，不做平滑的色度上采样，输出 16 位格式时不抖动 */
+    cinfo->out_color_space = mjpeg_color_space();
+    cinfo->dither_mode = JDITHER_NONE;
+    cinfo->dct_method = JDCT_IFAST;
+    cinfo->do_fancy_upsampling = FALSE;
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = mjpeg->scale_denom;
+
+    jpeg_start_decompress(cinfo);
+    if(cinfo->output_width != mjpeg->out_width || cinfo->output_height < view_height)
+    {
+        /* 帧尺寸和协商的不一致，丢掉 */
+        jpeg_abort_decompress(cinfo);
+        mjpeg->errors++;
+        return -1;
+    }
+
+    if(mjpeg->crop_y)
+        jpeg_skip_scanlines(cinfo, mjpeg->crop_y);
+
+    /* 不需要水平裁剪、也没有被挡住时每行直接解码到显存里，否则解码到一行的缓冲区再拷贝露出来的段
+     * 有文字框的行也解码到缓冲区，在缓冲区里换上文字框的像素再拷贝，显存只写一次
+     */
+    for(y=0; y<view_height; y+=n)
+    {
+        end = osd_band(y, view_height, &in);
+        if(mjpeg->crop_x || view_hole_cnt || in)
+        {
+            rows[0] = mjpeg->line;
+            n = jpeg_read_scanlines(cinfo, rows, 1);
+            if(n && fb_fmt == FB_FMT_bgr565)
+                mjpeg_swap_rb(rows, n);
+            if(n && in)
+                osd_fill(y, 0, view_width, mjpeg->line + mjpeg->crop_x * fb_bytes);
+            for(k=n ? view_row_spans(y, span, 1) : 0; k>0; k--)
+            {
+                memcpy(out + y * fb_line_length + span[k - 1][0] * fb_bytes,
+                       mjpeg->line + (mjpeg->crop_x + span[k - 1][0]) * fb_bytes, (span[k - 1][1] - span[k - 1][0]) * fb_bytes);
+            }
+        }
+        else
+        {
+            for(i=0; i<MJPEG_ROWS && y + i < end; i++)
+                rows[i] = out + (y + i) * fb_line_length;
+            n = jpeg_read_scanlines(cinfo, rows, i);
+            if(fb_fmt == FB_FMT_bgr565)
+                mjpeg_swap_rb(rows, n);
+        }
+
+        if(!n)
+            break;
+    }
+
+    /* 裁掉了下边的行时不再解码，直接结束这一帧 */
+    if(cinfo->output_scanline < cinfo->output_height)
+        jpeg_abort_decompress(cinfo);
+    else
+        jpeg_finish_decompress(cinfo);
+
+    return 0;
+}
+#endif
+
+/* 每个摄像头的采集状态
+ * 采集和显示的代码都使用全局变量，处理某个摄像头之前由 camera_switch 把它的状态换到全局变量中，
+ * 只有事件循环在一个线程里轮流处理多个摄像头，流水线模式只支持一个摄像头
+ * 多页翻页时一页上只画了当前摄像头，画之前由 fb_sync_cameras 从前台页补上其他摄像头过时的区域
+ */
+typedef struct camera_s
+{
+    char                       *dev;
+    int                        fd;
+    struct v4l2_buffer_unit    *unit;
+    unsigned int               buffer_cnt;
+    unsigned int               memtype;
+    unsigned int               pixfmt;
+    unsigned int               sizeimage;
+    unsigned int               stride;
+    v4l2_mode_t                mode;
+    unsigned int               view_width, view_height;
+    unsigned int               view_src_offset, view_dst_offset;
+    unsigned int               area_x, area_y, area_width, area_height;
+    rect_t                     hole[CAMERA_MAX];
+    unsigned int               hole_cnt;
+    int                        zc_shown;
+    scaler_t                   scaler;
+    const csc_t                *csc;
+    osd_t                      *osd;
+#ifdef HAVE_JPEG
+    mjpeg_t                    *mjpeg;
+#endif
+    long long                  last_sequence;
+
+    /* 自动曝光，ae_target 为 0 表示不调整 */
+    int                        ae_target;
+    long                       exposure;
+    long                       exposure_min, exposure_max, exposure_step;
+    unsigned long              ae_frames;
+    unsigned long              ae_changes;
+    luma_stat_t                luma_last;       /* 最近一帧的亮度统计 */
+    unsigned long              luma_frames;
+
+    /* 变焦裁剪，设置格式时写入，只用于统计 */
+    int                        zoom_crop;
+    double                     zoom;            /* 实际的倍数 */
+    rect_t                     zoom_roi;        /* 整帧坐标中的区域 */
+    unsigned int               zoom_bytes;      /* 裁剪后每帧传输的字节数 */
+    unsigned int               full_bytes;      /* 不裁剪时每帧的字节数 */
+
+    /* 以下只由事件循环使用，不换到全局变量 */
+    int                        streaming;
+    int                        polled;          /* fd 在 epoll 中 */
+    double                     last_frame_ns;   /* 最近一次取到帧的时间，看门狗用 */
+    unsigned long              frames;
+    unsigned long              recoveries;
+    unsigned long              shown;           /* 显示过的帧数 */
+    unsigned long              page_shown[BUFFER_MAX];  /* 每页显存上的画面是第几次显示的 */
+} camera_t;
+
+camera_t                   cameras[CAMERA_MAX];
+unsigned int               camera_cnt = 0;
+unsigned int               camera_cur = 0;      /* 状态在全局变量中的摄像头 */
+
+static double now_ns(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+unsigned char *fb_page_buffer(unsigned int page);
+
+/* 局部重画：画面大部分静止时，只转换和写入变化了的块
+ * 按 DAMAGE_TILE x DAMAGE_TILE 的块比较这一帧和屏幕上内容的亮度 (Y) 的绝对差之和 (SAD)，
+ * 超过阈值的块才重画，并更新参考亮度；没重画的块参考亮度不变，缓慢的变化累积起来也会触发重画
+ * 多页显存时每页的内容不同，按位记录每个块在哪些页上还没画过
+ * 变化块的比例作为运动检测：超过 MOTION_RATIO 时产生开始事件，持续 MOTION_HOLD_MS 低于后产生结束事件
+ */
+#define DAMAGE_TILE     16
+#define MOTION_RATIO    0.05
+#define MOTION_HOLD_MS  1000
+#define MOTION_CHILDREN 4           /* 同时在后台运行的事件命令个数 */
+
+/* 计算一块的 SAD，同时把这一帧的 Y 取出来放到 luma 中 (每行 DAMAGE_TILE 个)，块变化时用来更新参考亮度 */
+typedef unsigned int (*tile_sad_fn)(const unsigned char *yuv, unsigned int yuv_stride,
+                                    const unsigned char *ref, unsigned int ref_stride,
+                                    unsigned char *luma, unsigned int width, unsigned int height);
+
+static struct
+{
+    int              threshold;        /* 每像素平均亮度差的阈值，-1 表示不使用局部重画 */
+    unsigned int     cols, rows;
+    unsigned char    *ref;             /* 屏幕上内容的亮度，每行 view_width 个 */
+    unsigned int     *dirty;           /* 每块还需要重画的显存页，按位表示 */
+    tile_sad_fn      sad;
+    unsigned long    frames;
+    unsigned long    tiles;            /* 累计检测的块数 */
+    unsigned long    changed;          /* 累计变化的块数 */
+    double           ratio;            /* 最近一帧变化块的比例 */
+    int              motion;
+    double           quiet_ns;         /* 运动状态下开始低于阈值的时间 */
+    unsigned long    events;
+    const char       *motion_cmd;
+    pid_t            motion_pid[MOTION_CHILDREN];   /* 在后台运行的事件命令 */
+} damage = { .threshold = -1 };
+
+static unsigned int tile_sad_scalar(const unsigned char *yuv, unsigned int yuv_stride,
+                                    const unsigned char *ref, unsigned int ref_stride,
+                                    unsigned char *luma, unsigned int width, unsigned int height)
+{
+    unsigned int     x, y, sad = 0;
+
+    for(y=0; y<height; y++, yuv+=yuv_stride, ref+=ref_stride, luma+=DAMAGE_TILE)
+    {
+        for(x=0; x<width; x++)
+        {
+            luma[x] = yuv[x * 2];
+            sad += abs(luma[x] - ref[x]);
+        }
+    }
+
+    return sad;
+}
+
+#ifdef HAVE_NEON
+/* 整块 16 像素宽时一次取 32 字节 YUYV，vld2q 把 Y 分到一个寄存器里，
+ * vabal 把绝对差累加到 16 位，16 行最多 16*2*255 不会溢出
+ */
+static unsigned int tile_sad_neon(const unsigned char *yuv, unsigned int yuv_stride,
+                                  const unsigned char *ref, unsigned int ref_stride,
+                                  unsigned char *luma, unsigned int width, unsigned int height)
+{
+    uint16x8_t       acc = vdupq_n_u16(0);
+    uint8x16x2_t     p;
+    uint8x16_t       r;
+    uint64x2_t       sum;
+    unsigned int     y;
+
+    if(width != DAMAGE_TILE)
+        return tile_sad_scalar(yuv, yuv_stride, ref, ref_stride, luma, width, height);
+
+    for(y=0; y<height; y++, yuv+=yuv_stride, ref+=ref_stride, luma+=DAMAGE_TILE)
+    {
+        p = vld2q_u8(yuv);
+        r = vld1q_u8(ref);
+        vst1q_u8(luma, p.val[0]);
+        acc = vabal_u8(acc, vget_low_u8(p.val[0]), vget_low_u8(r));
+        acc = vabal_u8(acc, vget_high_u8(p.val[0]), vget_high_u8(r));
+    }
+
+    sum = vpaddlq_u32(vpaddlq_u16(acc));
+    return vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+}
+#endif
+
+/* 回收已经结束的事件命令，不等待还在运行的，收到 SIGCHLD 和启动新命令前调用
+ * 只等自己启动的进程，不影响进程中别的子进程
+ */
+void motion_reap(void)
+{
+    unsigned int     i;
+
+    for(i=0; i<MOTION_CHILDREN; i++)
+    {
+        if(damage.motion_pid[i] > 0 && waitpid(damage.motion_pid[i], NULL, WNOHANG) != 0)
+            damage.motion_pid[i] = 0;
+    }
+}
+
+/* 默认的运动事件处理：输出一行事件，并在后台运行 -k 指定的命令，
+ * 命令的参数 $1 为 start 或 end，$2 为变化块的比例
+ * 在绘制路径上调用，用 posix_spawn 而不是 fork，不复制整个进程的页表
+ */
+extern char **environ;
+
+static void motion_event(int start, double ratio)
+{
+    char                 arg[16];
+    char                 *argv[] = { "sh", "-c", (char *)damage.motion_cmd, "sh", start ? "start" : "end", arg, NULL };
+    posix_spawnattr_t    attr;
+    sigset_t             mask;
+    unsigned int         i;
+    int                  err;
+
+    printf("event motion=%s ratio=%.3f\n", start ? "start" : "end", ratio);
+    fflush(stdout);
+
+    if(!damage.motion_cmd)
+        return;
+
+    motion_reap();
+    for(i=0; i<MOTION_CHILDREN && damage.motion_pid[i] > 0; i++)
+        ;
+    if(i == MOTION_CHILDREN)
+    {
+        printf("%s : %d motion commands still running, skip this one\n", __FUNCTION__, MOTION_CHILDREN);
+        return;
+    }
+
+    /* 子进程会继承屏蔽字，运行命令前恢复所有信号 */
+    sigemptyset(&mask);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    snprintf(arg, sizeof(arg), "%.3f", ratio);
+    err = posix_spawn(&damage.motion_pid[i], "/bin/sh", NULL, &attr, argv, environ);
+    if(err)
+    {
+        printf("%s : posix_spawn error: %s\n", __FUNCTION__, strerror(err));
+        damage.motion_pid[i] = 0;
+    }
+    posix_spawnattr_destroy(&attr);
+}
+
+/* 运动事件的回调，可以换成其他动作 */
+void (*motion_hook)(int start, double ratio) = motion_event;
+
+/* 显示区域确定后调用，只支持不缩放、不旋转的 YUYV
+ * 不支持时返回 -1，内存不够时返回 -2，失败时局部重画都是关闭的
+ */
+int damage_init(int threshold)
+{
+    unsigned int     i;
+
+    if(v4l2_pixfmt != V4L2_PIX_FMT_YUYV || v4l2_memtype != V4L2_MEMORY_MMAP || scale_mode != SCALE_NONE || rotate_angle ||
+       camera_cnt > 1)
+    {
+        printf("%s : damage redraw needs one unscaled, unrotated YUYV camera, disabled\n", __FUNCTION__);
+        damage.threshold = -1;
+        return -1;
+    }
+
+    damage.threshold = -1;
+    free(damage.ref);
+    free(damage.dirty);
+    damage.cols = (view_width + DAMAGE_TILE - 1) / DAMAGE_TILE;
+    damage.rows = (view_height + DAMAGE_TILE - 1) / DAMAGE_TILE;
+    damage.ref = calloc(view_width, view_height);
+    damage.dirty = malloc(damage.cols * damage.rows * sizeof(*damage.dirty));
+    if(!damage.ref || !damage.dirty)
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        free(damage.ref);
+        free(damage.dirty);
+        damage.ref = NULL;
+        damage.dirty = NULL;
+        return -2;
+    }
+
+    /* 第一帧每页都要整页画 */
+    for(i=0; i<damage.cols * damage.rows; i++)
+        damage.dirty[i] = ~0U;
+
+    damage.sad = tile_sad_scalar;
+#ifdef HAVE_NEON
+    if(cpu_has_neon())
+        damage.sad = tile_sad_neon;
+#endif
+
+    damage.threshold = threshold;
+    return 0;
+}
+
+/* 局部重画一帧到第 page 页显存 */
+void damage_render(const unsigned char *frame, unsigned int page)
+{
+    const unsigned char  *src = frame + view_src_offset;
+    unsigned char        *dst = fb_page_buffer(page) + view_dst_offset;
+    unsigned char        *ref;
+    unsigned char        luma[DAMAGE_TILE * DAMAGE_TILE];
+    unsigned int         bit = 1U << page;
+    unsigned int         *dirty;
+    unsigned int         tx, ty, x, y, tw, th, run;
+    unsigned int         changed = 0;
+    double               now;
+    luma_stat_t          *ls = luma_acc;
+
+    /* 只转换变化的块，亮度改由参考亮度 (就是屏幕上显示的亮度) 取样 */
+    luma_acc = NULL;
+
+    for(ty=0; ty<damage.rows; ty++)
+    {
+        y = ty * DAMAGE_TILE;
+        th = view_height - y < DAMAGE_TILE ? view_height - y : DAMAGE_TILE;
+        dirty = damage.dirty + ty * damage.cols;
+
+        for(tx=0; tx<damage.cols; tx++)
+        {
+            x = tx * DAMAGE_TILE;
+            tw = view_width - x < DAMAGE_TILE ? view_width - x : DAMAGE_TILE;
+            ref = damage.ref + y * view_width + x;
+
+            if(damage.sad(src + y * frame_stride + x * 2, frame_stride, ref, view_width, luma, tw, th) >
+               (unsigned int)damage.threshold * tw * th)
+            {
+                unsigned int     j;
+
+                for(j=0; j<th; j++)
+                    memcpy(ref + j * view_width, luma + j * DAMAGE_TILE, tw);
+
+                dirty[tx] = ~0U;
+                changed++;
+            }
+        }
+
+        /* 这一行块中需要在本页重画的，相邻的合成一段一起转换 */
+        for(tx=0; tx<damage.cols; tx+=run)
+        {
+            for(run=0; tx+run<damage.cols && (dirty[tx + run] & bit); run++)
+                dirty[tx + run] &= ~bit;
+
+            if(!run)
+            {
+                run = 1;
+                continue;
+            }
+
+            x = tx * DAMAGE_TILE;
+            tw = (tx + run) * DAMAGE_TILE < view_width ? run * DAMAGE_TILE : view_width - x;
+            render_block(frame, fb_page_buffer(page), x, x + tw, y, y + th);
+        }
+    }
+
+    /* 变化的块跳过文字框，文字变了的框在这一页上整个重画 */
+    osd_redraw(dst, bit);
+
+    luma_acc = ls;
+    for(y=0; ls && y<view_height; y+=LUMA_ROW_STEP)
+        luma_add(ls, damage.ref + y * view_width, 1, view_width);
+
+    damage.frames++;
+    damage.tiles += damage.cols * damage.rows;
+    damage.changed += changed;
+    damage.ratio = (double)changed / (damage.cols * damage.rows);
+
+    now = now_ns();
+    if(damage.ratio >= MOTION_RATIO)
+    {
+        damage.quiet_ns = 0;
+        if(!damage.motion)
+        {
+            damage.motion = 1;
+            damage.events++;
+            motion_hook(1, damage.ratio);
+        }
+    }
+    else if(damage.motion)
+    {
+        if(!damage.quiet_ns)
+            damage.quiet_ns = now;
+        else if(now - damage.quiet_ns >= MOTION_HOLD_MS * 1e6)
+        {
+            damage.motion = 0;
+            motion_hook(0, damage.ratio);
+        }
+    }
+}
+
+/* 每帧的亮度统计和自动曝光
+ * 转换一帧前 luma_begin() 让当前线程开始累加，转换完 luma_end() 算出均值和欠曝/过曝的像素数，
+ * 结果存在当前摄像头中，交给 luma_hook，默认的处理是调整当前摄像头的曝光
+ * MJPEG 由 libjpeg 直接解码成显存格式，没有亮度统计
+ */
+#define AE_PERIOD       4               /* 新的曝光要过几帧才生效，每 AE_PERIOD 帧调整一次 */
+#define AE_GAIN         0.5
+#define AE_DEADBAND     6               /* 均值和目标相差不到这个值时不调整 */
+#define AE_CLIP_MAX     0.02            /* 过曝像素超过 2% 时不再增加曝光 */
+
+int                        luma_enabled = 0;
+unsigned int               luma_bins = 64;      /* 统计输出的直方图格数，64 或 256 */
+luma_stat_t                luma_frame;          /* 正在转换的一帧 */
+
+void luma_begin(void)
+{
+    if(!luma_enabled)
+        return;
+
+    memset(&luma_frame, 0, sizeof(luma_frame));
+    luma_acc = &luma_frame;
+}
+
+static void luma_merge(luma_stat_t *dst, const luma_stat_t *src)
+{
+    unsigned int     i;
+
+    for(i=0; i<LUMA_BINS; i++)
+        dst->hist[i] += src->hist[i];
+    dst->samples += src->samples;
+}
+
+/* 打开当前摄像头的手动曝光，读出曝光范围，target 为目标亮度均值 */
+int exposure_init(int target)
+{
+    camera_t                 *cam = &cameras[camera_cur];
+    struct v4l2_queryctrl    qc;
+    struct v4l2_control      ctrl;
+
+    memset(&qc, 0, sizeof(qc));
+    qc.id = V4L2_CID_EXPOSURE_ABSOLUTE;
+    if(ioctl(fd_camera, VIDIOC_QUERYCTRL, &qc) < 0 || (qc.flags & V4L2_CTRL_FLAG_DISABLED))
+    {
+        printf("%s : '%s' has no V4L2_CID_EXPOSURE_ABSOLUTE, auto exposure disabled\n", __FUNCTION__, camera_dev);
+        return -1;
+    }
+
+    /* 摄像头自己的自动曝光打开时手动设置的曝光不生效 */
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.id = V4L2_CID_EXPOSURE_AUTO;
+    ctrl.value = V4L2_EXPOSURE_MANUAL;
+    if(ioctl(fd_camera, VIDIOC_S_CTRL, &ctrl) < 0)
+        printf("%s : set V4L2_EXPOSURE_MANUAL error\n", __FUNCTION__);
+
+    ctrl.id = V4L2_CID_EXPOSURE_ABSOLUTE;
+    if(ioctl(fd_camera, VIDIOC_G_CTRL, &ctrl) < 0)
+        ctrl.value = qc.default_value;
+
+    cam->exposure = ctrl.value;
+    cam->exposure_min = qc.minimum;
+    cam->exposure_max = qc.maximum;
+    cam->exposure_step = qc.step > 0 ? qc.step : 1;
+    cam->ae_target = target;
+    luma_enabled = 1;
+
+    printf("exposure: %ld (%ld~%ld step %ld), target mean luma %d\n", cam->exposure, cam->exposure_min,
+            cam->exposure_max, cam->exposure_step, target);
+    return 0;
+}
+
+/* 比例控制：新曝光 = 旧曝光 * (1 + AE_GAIN * (目标/均值 - 1))，目标/均值限制在 1/2~2 倍 */
+static void exposure_update(const luma_stat_t *ls)
+{
+    camera_t             *cam = &cameras[camera_cur];
+    struct v4l2_control  ctrl;
+    double               ratio;
+    long                 value;
+
+    if(!cam->ae_target || ++cam->ae_frames % AE_PERIOD)
+        return;
+
+    if(ls->mean > cam->ae_target - AE_DEADBAND && ls->mean < cam->ae_target + AE_DEADBAND)
+        return;
+
+    ratio = cam->ae_target / (ls->mean > 1 ? ls->mean : 1);
+    ratio = ratio > 2 ? 2 : (ratio < 0.5 ? 0.5 : ratio);
+    if(ratio > 1 && ls->clip_high > ls->samples * AE_CLIP_MAX)
+        return;
+
+    value = cam->exposure * (1 + AE_GAIN * (ratio - 1));
+    value = cam->exposure_min + (value - cam->exposure_min) / cam->exposure_step * cam->exposure_step;
+
+    /* 曝光很小时比例变化不到一个步长，至少走一步 */
+    if(value == cam->exposure)
+        value += ratio > 1 ? cam->exposure_step : -cam->exposure_step;
+    value = value > cam->exposure_max ? cam->exposure_max : (value < cam->exposure_min ? cam->exposure_min : value);
+    if(value == cam->exposure)
+        return;
+
+    memset(&ctrl, 0, sizeof(ctrl));
+    ctrl.id = V4L2_CID_EXPOSURE_ABSOLUTE;
+    ctrl.value = value;
+    if(ioctl(fd_camera, VIDIOC_S_CTRL, &ctrl) < 0)
+    {
+        printf("%s : set exposure %ld error, stop auto exposure\n", __FUNCTION__, value);
+        cam->ae_target = 0;
+        return;
+    }
+
+    cam->exposure = value;
+    cam->ae_changes++;
+}
+
+/* 每帧亮度统计的回调，可以换成其他动作 */
+void (*luma_hook)(const luma_stat_t *stat) = exposure_update;
+
+void luma_end(void)
+{
+    camera_t         *cam = &cameras[camera_cur];
+    unsigned long    sum = 0;
+    unsigned int     i;
+
+    if(!luma_enabled)
+        return;
+
+    luma_acc = NULL;
+    if(!luma_frame.samples)
+        return;
+
+    luma_frame.clip_low = 0;
+    luma_frame.clip_high = 0;
+    for(i=0; i<LUMA_BINS; i++)
+    {
+        sum += (unsigned long)i * luma_frame.hist[i];
+        if(i <= LUMA_CLIP_LOW)
+            luma_frame.clip_low += luma_frame.hist[i];
+        if(i >= LUMA_CLIP_HIGH)
+            luma_frame.clip_high += luma_frame.hist[i];
+    }
+    luma_frame.mean = (double)sum / luma_frame.samples;
+
+    cam->luma_last = luma_frame;
+    cam->luma_frames++;
+    luma_hook(&cam->luma_last);
+}
+
+/* 把一个帧缓冲区中的一帧画到第 page 页显存上 */
+int render_frame(const struct v4l2_buffer_unit *unit, unsigned int page)
+{
+    int              rv = 0;
+
+    osd_update();
+    luma_begin();
+
+#ifdef HAVE_JPEG
+    if(v4l2_pixfmt == V4L2_PIX_FMT_MJPEG)
+        rv = mjpeg_decode(unit->start, unit->bytesused, fb_page_buffer(page));
+    else
+#endif
+    if(damage.threshold >= 0)
+        damage_render(unit->start, page);
+    else
+        render_rows(unit->start, fb_page_buffer(page), 0, view_height);
+
+    luma_end();
+    return rv;
+}
+
+/* 由 var screeninfo 的时序计算屏幕刷新周期，驱动没有给出像素时钟时按 60Hz 计算 */
+static double fb_refresh_period_ns(const struct fb_var_screeninfo *vinfo)
+{
+    double           htotal = vinfo->xres + vinfo->left_margin + vinfo->right_margin + vinfo->hsync_len;
+    double           vtotal = vinfo->yres + vinfo->upper_margin + vinfo->lower_margin + vinfo->vsync_len;
+
+    if( !vinfo->pixclock )
+        return 1e9 / 60;
+
+    /* pixclock 的单位是 ps */
+    return vinfo->pixclock * 1e-3 * htotal * vtotal;
+}
+
+/* 进程已用的用户态和内核态 CPU 时间 */
+static double cpu_time_ns(void)
+{
+    struct rusage    ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e9 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e3;
+}
+
+/* 每帧的分阶段延迟统计
+ * sensor_to_dqbuf:    驱动采集时间到 DQBUF，包括传感器曝光结束后的传输和在队列中的等待
+ * dqbuf_to_convert:   DQBUF 到转换 (或解码) 完成，流水线模式下包括等待空闲显存页
+ * convert_to_display: 转换完成到翻页显示
+ * sensor_to_display:  采集到显示的总延迟，驱动时间戳不可用时从 DQBUF 算起
+ * glass_to_glass:     点亮或熄灭 LED 到画面上看到变化的那一帧显示出来，见 g2g_check()
+ * 延迟按 STAT_BUCKET_US 一格记入直方图，超过范围的记入最后一格
+ */
+#define STAT_BUCKET_US  100
+#define STAT_BUCKETS    1000
+
+enum
+{
+    STAGE_SENSOR,
+    STAGE_CONVERT,
+    STAGE_DISPLAY,
+    STAGE_TOTAL,
+    STAGE_G2G,
+    STAGE_CNT,
+};
+
+typedef struct stage_hist_s
+{
+    const char     *name;
+    unsigned long  count;
+    double         sum_ns;
+    double         max_ns;
+    unsigned long  bucket[STAT_BUCKETS + 1];
+} stage_hist_t;
+
+static struct
+{
+    stage_hist_t   stage[STAGE_CNT];
+    frame_stamp_t  *page;              /* 每页显存上正在显示的帧的时间点 */
+    unsigned int   pages;
+    double         start_ns;
+    unsigned long  captured;
+    unsigned long  displayed;
+    unsigned long  dropped;            /* buffer.sequence 不连续，驱动丢掉的帧 */
+    unsigned long  skipped;            /* 低延迟模式下被更新的帧顶替、没有显示的帧 */
+    long long      last_sequence;
+} frame_stat = {
+    .stage = { { .name = "sensor_to_dqbuf" }, { .name = "dqbuf_to_convert" },
+               { .name = "convert_to_display" }, { .name = "sensor_to_display" }, { .name = "glass_to_glass" } },
+    .last_sequence = -1,
+};
+
+volatile sig_atomic_t      stat_dump_request = 0;     /* SIGUSR1 请求输出统计 */
+volatile sig_atomic_t      stop_request = 0;          /* SIGINT/SIGTERM 请求退出 */
+int                        signal_fd = -1;            /* 这几个信号都由 signalfd 读出 */
+
+/* 测量 glass-to-glass 延迟：摄像头对准一个 LED，每隔 G2G_PERIOD_MS 切换一次 LED，
+ * 在画面中心 G2G_BLOCK x G2G_BLOCK 的区域里检测亮度跳变，从切换 LED 到这一帧翻页显示就是整条链路的延迟
+ * (不含屏幕扫描到该位置的时间)，LED 由 sysfs 文件控制，比如 /sys/class/leds/xxx/brightness
+ */
+#define G2G_PERIOD_MS   500
+#define G2G_BLOCK       32
+#define G2G_THRESHOLD   8          /* 绿色分量 (0~63) 的平均值变化超过这个值认为看到了切换 */
+
+static struct
+{
+    int            fd;
+    int            on;
+    int            pending;        /* 已经切换 LED，还没在画面上看到 */
+    double         toggle_ns;
+    int            before;         /* 切换前画面中心的亮度 */
+    int            last;
+} g2g = { .fd = -1 };
+
+int g2g_open(const char *path)
+{
+    g2g.fd = open(path, O_WRONLY);
+    if(g2g.fd < 0)
+    {
+        printf("%s : open '%s' error: %s\n", __FUNCTION__, path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* 一页显存上显示区域中心的平均亮度，用绿色分量的高 6 位近似
+ * 显示区域小于 G2G_BLOCK 时只取显示区域内的像素
+ */
+static int g2g_luma(const unsigned char *page)
+{
+    const fb_format_t    *f = &fb_formats[fb_fmt];
+    const unsigned char  *p;
+    unsigned int         x, y, sum = 0;
+    unsigned int         w = view_width < G2G_BLOCK ? view_width : G2G_BLOCK;
+    unsigned int         h = view_height < G2G_BLOCK ? view_height : G2G_BLOCK;
+    unsigned int         x0 = (view_width - w) / 2;
+    unsigned int         y0 = (view_height - h) / 2;
+
+    if(!w || !h)
+        return 0;
+
+    for(y=0; y<h; y++)
+    {
+        p = page + view_dst_offset + (y0 + y) * fb_line_length + x0 * fb_bytes;
+        for(x=0; x<w; x++, p += fb_bytes)
+            sum += (fb_load(p) >> f->g_off & ((1U << f->g_len) - 1)) >> (f->g_len - 6);
+    }
+
+    return sum / (w * h);
+}
+
+/* 每帧转换完调用：检测画面是否已经出现 LED 的变化，没有等待的切换时按周期切换 LED */
+static void g2g_check(frame_stamp_t *st, const unsigned char *page, double now)
+{
+    int                  luma;
+
+    if(g2g.fd < 0)
+        return;
+
+    luma = g2g_luma(page);
+    st->g2g_ns = 0;
+
+    /* 只认切换之后才开始采集的帧 */
+    if(g2g.pending && (st->capture_ns ? st->capture_ns : st->dqbuf_ns) > g2g.toggle_ns &&
+       (g2g.on ? luma - g2g.before : g2g.before - luma) >= G2G_THRESHOLD)
+    {
+        st->g2g_ns = g2g.toggle_ns;
+        g2g.pending = 0;
+    }
+
+    /* 画面一直没有变化 (LED 不在画面中心) 时也按周期重试 */
+    if(now - g2g.toggle_ns >= G2G_PERIOD_MS * 1e6 * (g2g.pending ? 4 : 1))
+    {
+        g2g.on = !g2g.on;
+        g2g.before = g2g.last;
+        if(write(g2g.fd, g2g.on ? "1" : "0", 1) == 1)
+        {
+            g2g.toggle_ns = now_ns();
+            g2g.pending = 1;
+        }
+    }
+
+    g2g.last = luma;
+}
+
+static void stage_add(stage_hist_t *h, double ns)
+{
+    unsigned int     i;
+
+    if(ns < 0)
+        ns = 0;
+
+    i = ns >= STAT_BUCKETS * STAT_BUCKET_US * 1e3 ? STAT_BUCKETS : (unsigned int)(ns / (STAT_BUCKET_US * 1e3));
+    h->bucket[i]++;
+    h->count++;
+    h->sum_ns += ns;
+    if(ns > h->max_ns)
+        h->max_ns = ns;
+}
+
+/* 直方图中第 p 百分位所在格的上界，不超过最大值，单位 ms */
+static double stage_percentile(const stage_hist_t *h, double p)
+{
+    unsigned long    sum = 0;
+    unsigned int     i;
+    double           ms;
+
+    for(i=0; i<STAT_BUCKETS; i++)
+    {
+        sum += h->bucket[i];
+        if(sum >= h->count * p)
+        {
+            ms = (i + 1) * STAT_BUCKET_US / 1e3;
+            return ms < h->max_ns / 1e6 ? ms : h->max_ns / 1e6;
+        }
+    }
+
+    return h->max_ns / 1e6;
+}
+
+int frame_stat_init(unsigned int pages)
+{
+    frame_stat.page = calloc(pages, sizeof(*frame_stat.page));
+    if(!frame_stat.page)
+    {
+        printf("%s : calloc error\n", __FUNCTION__);
+        return -1;
+    }
+
+    frame_stat.pages = pages;
+    frame_stat.start_ns = now_ns();
+    return 0;
+}
+
+/* DQBUF 时记录时间点，并由 buffer.sequence 的间隔检测丢帧 */
+static void frame_stat_dqbuf(const struct v4l2_buffer *buffer)
+{
+    frame_stamp_t    *st = &buffer_unit[buffer->index].stamp;
+
+    st->dqbuf_ns = now_ns();
+    st->capture_ns = 0;
+    if((buffer->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+    {
+        st->capture_ns = buffer->timestamp.tv_sec * 1e9 + buffer->timestamp.tv_usec * 1e3;
+        stage_add(&frame_stat.stage[STAGE_SENSOR], st->dqbuf_ns - st->capture_ns);
+    }
+
+    if(frame_stat.last_sequence >= 0 && buffer->sequence > frame_stat.last_sequence + 1)
+        frame_stat.dropped += buffer->sequence - frame_stat.last_sequence - 1;
+    frame_stat.last_sequence = buffer->sequence;
+    frame_stat.captured++;
+}
+
+/* 第 index 个 buffer 的帧已经转换到第 page 页显存上 */
+static void frame_stat_converted(unsigned int index, unsigned int page)
+{
+    frame_stamp_t    *st;
+
+    if(page >= frame_stat.pages)
+        return;
+
+    st = &frame_stat.page[page];
+    *st = buffer_unit[index].stamp;
+    st->convert_ns = now_ns();
+    stage_add(&frame_stat.stage[STAGE_CONVERT], st->convert_ns - st->dqbuf_ns);
+    g2g_check(st, fb_page_buffer(page), st->convert_ns);
+}
+
+/* 第 page 页显存已经显示出来 */
+static void frame_stat_displayed(unsigned int page, double now)
+{
+    frame_stamp_t    *st;
+
+    if(page >= frame_stat.pages || !frame_stat.page[page].dqbuf_ns)
+        return;
+
+    st = &frame_stat.page[page];
+    stage_add(&frame_stat.stage[STAGE_DISPLAY], now - st->convert_ns);
+    stage_add(&frame_stat.stage[STAGE_TOTAL], now - (st->capture_ns ? st->capture_ns : st->dqbuf_ns));
+    if(st->g2g_ns)
+        stage_add(&frame_stat.stage[STAGE_G2G], now - st->g2g_ns);
+    frame_stat.displayed++;
+}
+
+#ifdef HAVE_DRM
+void drm_stat_dump(void);
+#endif
+
+/* 输出统计，每行以 "stat " 开头，字段为 key=value，方便脚本解析
+ * hist 行列出非空的直方图格: 格号:帧数，第 i 格表示 [i, i+1) * bucket_us
+ */
+void frame_stat_dump(const char *reason)
+{
+    const stage_hist_t   *h;
+    double               elapsed = (now_ns() - frame_stat.start_ns) / 1e9;
+    unsigned int         i, n, k;
+
+    printf("stat reason=%s mode=%s buffers=%u elapsed_s=%.3f captured=%lu displayed=%lu dropped=%lu skipped=%lu "
+            "capture_fps=%.2f display_fps=%.2f\n", reason, low_latency ? "latest" : "fifo", buffer_cnt, elapsed,
+            frame_stat.captured, frame_stat.displayed, frame_stat.dropped, frame_stat.skipped,
+            elapsed > 0 ? frame_stat.captured / elapsed : 0.0, elapsed > 0 ? frame_stat.displayed / elapsed : 0.0);
+
+    for(n=0; n<STAGE_CNT; n++)
+    {
+        h = &frame_stat.stage[n];
+        printf("stat stage=%s count=%lu mean_ms=%.3f p50_ms=%.3f p90_ms=%.3f p99_ms=%.3f max_ms=%.3f\n",
+                h->name, h->count, h->count ? h->sum_ns / h->count / 1e6 : 0.0,
+                stage_percentile(h, 0.5), stage_percentile(h, 0.9), stage_percentile(h, 0.99), h->max_ns / 1e6);
+    }
+
+    for(n=0; n<camera_cnt; n++)
+    {
+        printf("stat camera=%u dev=%s frames=%lu recoveries=%lu\n", n, cameras[n].dev, cameras[n].frames,
+                cameras[n].recoveries);
+    }
+
+    for(n=0; n<camera_cnt && zoom_level; n++)
+    {
+        const rect_t     *r = &cameras[n].zoom_roi;
+
+        printf("stat zoom camera=%u level=%.2f roi=%ux%u+%u+%u crop=%s bytes_frame=%u full_bytes_frame=%u\n", n,
+                cameras[n].zoom, r->w, r->h, r->x, r->y,
+                zoom_crop_name[cameras[n].zoom_crop], cameras[n].zoom_bytes, cameras[n].full_bytes);
+    }
+
+    if(damage.threshold >= 0)
+    {
+        printf("stat damage threshold=%d frames=%lu changed_tile_ratio=%.4f last_ratio=%.4f motion=%d motion_events=%lu\n",
+                damage.threshold, damage.frames, damage.tiles ? (double)damage.changed / damage.tiles : 0.0,
+                damage.ratio, damage.motion, damage.events);
+    }
+
+    if(luma_enabled)
+    {
+        for(n=0; n<camera_cnt; n++)
+        {
+            const luma_stat_t    *ls = &cameras[n].luma_last;
+
+            printf("stat luma camera=%u frames=%lu mean=%.2f clip_low=%.4f clip_high=%.4f samples=%lu\n", n,
+                    cameras[n].luma_frames, ls->mean, ls->samples ? (double)ls->clip_low / ls->samples : 0.0,
+                    ls->samples ? (double)ls->clip_high / ls->samples : 0.0, ls->samples);
+            if(cameras[n].ae_target)
+                printf("stat exposure camera=%u value=%ld target=%d changes=%lu\n", n, cameras[n].exposure,
+                        cameras[n].ae_target, cameras[n].ae_changes);
+        }
+    }
+
+#ifdef HAVE_DRM
+    if(drm_dev)
+        drm_stat_dump();
+#endif
+
+    for(n=0; n<STAGE_CNT; n++)
+    {
+        h = &frame_stat.stage[n];
+        printf("stat hist=%s bucket_us=%u", h->name, STAT_BUCKET_US);
+        for(i=0; i<=STAT_BUCKETS; i++)
+        {
+            if(h->bucket[i])
+                printf(" %u:%lu", i, h->bucket[i]);
+        }
+        printf("\n");
+    }
+
+    /* 亮度直方图按 luma_bins 格合并，格号 i 表示亮度 [i, i+1) * 256 / luma_bins */
+    for(k=0; luma_enabled && k<camera_cnt; k++)
+    {
+        unsigned int     fold = LUMA_BINS / luma_bins;
+        unsigned long    count;
+
+        printf("stat hist=luma camera=%u bins=%u", k, luma_bins);
+        for(n=0; n<luma_bins; n++)
+        {
+            for(i=0, count=0; i<fold; i++)
+                count += cameras[k].luma_last.hist[n * fold + i];
+            if(count)
+                printf(" %u:%lu", n, count);
+        }
+        printf("\n");
+    }
+
+    fflush(stdout);
+}
+
+/* 在采集循环中调用，处理 SIGUSR1 的输出请求 */
+void frame_stat_poll(void)
+{
+    if(stat_dump_request)
+    {
+        stat_dump_request = 0;
+        frame_stat_dump("sigusr1");
+    }
+}
+
+/* 读出 signalfd 中待处理的信号，转换成请求标志 */
+static void signal_read(void)
+{
+    struct signalfd_siginfo  si;
+
+    while(read(signal_fd, &si, sizeof(si)) == sizeof(si))
+    {
+        if(si.ssi_signo == SIGUSR1)
+            stat_dump_request = 1;
+        else if(si.ssi_signo == SIGCHLD)
+            motion_reap();
+        else
+            stop_request = 1;
+    }
+}
+
+/* 在创建任何线程之前调用：屏蔽 SIGUSR1/SIGINT/SIGTERM/SIGCHLD，之后创建的线程继承屏蔽字，
+ * 信号留在进程的待处理集合中，由事件循环 (流水线模式是采集线程) 从 signalfd 读出，
+ * SIGCHLD 用来回收 -k 的事件命令
+ */
+int install_signal(void)
+{
+    sigset_t         mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGCHLD);
+
+    if(sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+    {
+        printf("%s : sigprocmask error: %s\n", __FUNCTION__, strerror(errno));
+        return -1;
+    }
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(signal_fd < 0)
+    {
+        printf("%s : signalfd error: %s\n", __FUNCTION__, strerror(errno));
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        return -2;
+    }
+
+    return 0;
+}
+
+/* 申请多页显存：把虚拟分辨率的高度扩大到 pages 屏，并确认驱动能用 FBIOPAN_DISPLAY 翻页
+ * 任何一步失败都返回负数，由调用者退回单缓冲
+ */
+static int fb_setup_pages(unsigned int pages, struct fb_fix_screeninfo *finfo)
+{
+    struct fb_var_screeninfo   vinfo = fb_vinfo;
+
+    fb_vinfo_orig = fb_vinfo;
+    if( vinfo.yres_virtual < vinfo.yres * pages )
+    {
+        vinfo.yres_virtual = vinfo.yres * pages;
+        if( ioctl(fd_lcd, FBIOPUT_VSCREENINFO, &vinfo) < 0 )
+        {
+            printf("%s : FBIOPUT_VSCREENINFO yres_virtual=%u error\n", __FUNCTION__, vinfo.yres_virtual);
+            return -1;
+        }
+        fb_vinfo_changed = 1;
+    }
+
+    if( ioctl(fd_lcd, FBIOGET_VSCREENINFO, &vinfo) < 0 || vinfo.yres_virtual < vinfo.yres * pages )
+    {
+        printf("%s : driver keeps yres_virtual=%u\n", __FUNCTION__, vinfo.yres_virtual);
+        return -2;
+    }
+
+    if( ioctl(fd_lcd, FBIOGET_FSCREENINFO, finfo) < 0 || finfo->ypanstep == 0 ||
+        finfo->smem_len < finfo->line_length * vinfo.yres * pages )
+    {
+        printf("%s : driver can't pan in y direction\n", __FUNCTION__);
+        return -3;
+    }
+
+    vinfo.xoffset = 0;
+    vinfo.yoffset = 0;
+    if( ioctl(fd_lcd, FBIOPAN_DISPLAY, &vinfo) < 0 )
+    {
+        printf("%s : FBIOPAN_DISPLAY error: %s\n", __FUNCTION__, strerror(errno));
+        return -4;
+    }
+
+    fb_vinfo = vinfo;
+    fb_vinfo_changed = 1;
+    return 0;
+}
+
+/* 恢复翻页前的虚拟分辨率和显示位置，否则退出后控制台可能停在别的页上 */
+static void fb_restore_pages(void)
+{
+    if( !fb_vinfo_changed )
+        return;
+
+    if( ioctl(fd_lcd, FBIOPUT_VSCREENINFO, &fb_vinfo_orig) < 0 || ioctl(fd_lcd, FBIOPAN_DISPLAY, &fb_vinfo_orig) < 0 )
+        printf("%s : restore yres_virtual=%u yoffset=%u error\n", __FUNCTION__, fb_vinfo_orig.yres_virtual,
+                fb_vinfo_orig.yoffset);
+    fb_vinfo_changed = 0;
+}
+
+/* 不在 FB_FORMATS 中的排列 (比如分量位宽不是 5/6/8) 画在同样大小的 rgb565 画布上，
+ * 显示时由写出函数把变化的区域写进显存，位宽和偏移取自 fb_any，每帧不变
+ * 写出函数由 FB_WRITER 按每像素字节数展开，循环里没有按格式的分支
+ */
+static fb_format_t         fb_any;
+
+/* rgb565 的分量扩展到 8 位 (低位用高位补齐)，再截成目标位宽放到目标偏移 */
+#define FB_WRITER(name, bytes, rl, ro, gl, go, bl, bo, al, ao)                                      \
+static void name(const unsigned short *src, unsigned char *dst, unsigned int pixels)               \
+{                                                                                                   \
+    unsigned int     c, r, g, b;                                                                    \
+                                                                                                    \
+    for ( ; pixels > 0; pixels--, src++, dst += bytes)                                              \
+    {                                                                                               \
+        c = *src;                                                                                   \
+        r = ((c >> 8) & 0xF8) | (c >> 13);                                                          \
+        g = ((c >> 3) & 0xFC) | ((c >> 9) & 0x03);                                                  \
+        b = ((c << 3) & 0xF8) | ((c >> 2) & 0x07);                                                  \
+        c = FB_PACK(r, g, b, rl, ro, gl, go, bl, bo, al, ao);                                       \
+        FB_STORE_##bytes(dst, c);                                                                   \
+    }                                                                                               \
+}
+
+FB_WRITER(fb_write_any16, 2, fb_any.r_len, fb_any.r_off, fb_any.g_len, fb_any.g_off,
+          fb_any.b_len, fb_any.b_off, fb_any.a_len, fb_any.a_off)
+FB_WRITER(fb_write_any24, 3, fb_any.r_len, fb_any.r_off, fb_any.g_len, fb_any.g_off,
+          fb_any.b_len, fb_any.b_off, fb_any.a_len, fb_any.a_off)
+FB_WRITER(fb_write_any32, 4, fb_any.r_len, fb_any.r_off, fb_any.g_len, fb_any.g_off,
+          fb_any.b_len, fb_any.b_off, fb_any.a_len, fb_any.a_off)
+
+unsigned char              *fb_mem = NULL;      /* 使用画布时真正的显存，NULL 表示直接画在显存上 */
+unsigned int               fb_mem_line = 0;     /* 真正的显存一行的字节数 */
+size_t                     fb_mem_size = 0;
+
+/* 使用格式 f：绘制时输出 f->id 的格式，查表法、缩放和灰度的表随之重新生成 */
+void fb_format_use(const fb_format_t *f)
+{
+    fb_format = f;
+    fb_fmt = f->id;
+    fb_bytes = fb_formats[f->id].bpp / 8;
+    yuv_table_init();
+    grey_table_init();
+}
+
+const fb_format_t *fb_format_find(const char *name)
+{
+    unsigned int     i;
+
+    for(i=0; i<FB_FORMAT_CNT; i++)
+    {
+        if(!strcmp(name, fb_formats[i].name))
+            return &fb_formats[i];
+    }
+
+    printf("%s : unknown framebuffer format '%s'\n", __FUNCTION__, name);
+    return NULL;
+}
+
+/* 按 fb_var_screeninfo 中的 bpp 和各分量的位宽、偏移选择格式，不在表中的用画布和 fb_any 的写出函数 */
+const fb_format_t *fb_format_select(const struct fb_var_screeninfo *vinfo)
+{
+    const fb_format_t    *f;
+    unsigned int         i;
+
+    for(i=0; i<FB_FORMAT_CNT; i++)
+    {
+        f = &fb_formats[i];
+        if(f->bpp != vinfo->bits_per_pixel)
+            continue;
+
+        if(!vinfo->red.length && !vinfo->green.length && !vinfo->blue.length)
+            return f;
+
+        if(vinfo->red.length == f->r_len && vinfo->red.offset == f->r_off &&
+           vinfo->green.length == f->g_len && vinfo->green.offset == f->g_off &&
+           vinfo->blue.length == f->b_len && vinfo->blue.offset == f->b_off &&
+           vinfo->transp.length == f->a_len && (!f->a_len || vinfo->transp.offset == f->a_off))
+            return f;
+    }
+
+    if((vinfo->bits_per_pixel != 16 && vinfo->bits_per_pixel != 24 && vinfo->bits_per_pixel != 32) ||
+       !vinfo->red.length || vinfo->red.length > 8 || !vinfo->green.length || vinfo->green.length > 8 ||
+       !vinfo->blue.length || vinfo->blue.length > 8 || vinfo->transp.length > 8)
+    {
+        printf("%s : %u bpp framebuffer not supported\n", __FUNCTION__, vinfo->bits_per_pixel);
+        return NULL;
+    }
+
+    memset(&fb_any, 0, sizeof(fb_any));
+    fb_any.name = "custom";
+    fb_any.bpp = vinfo->bits_per_pixel;
+    fb_any.r_len = vinfo->red.length;
+    fb_any.r_off = vinfo->red.offset;
+    fb_any.g_len = vinfo->green.length;
+    fb_any.g_off = vinfo->green.offset;
+    fb_any.b_len = vinfo->blue.length;
+    fb_any.b_off = vinfo->blue.offset;
+    fb_any.a_len = vinfo->transp.length;
+    fb_any.a_off = vinfo->transp.offset;
+    fb_any.id = FB_FMT_rgb565;
+    fb_any.write = fb_any.bpp == 16 ? fb_write_any16 : (fb_any.bpp == 24 ? fb_write_any24 : fb_write_any32);
+
+    return &fb_any;
+}
+
+/* 当前摄像头的输出区域在屏幕上的位置和大小，旋转 90/270 度时宽高互换 */
+static void fb_view_rect(unsigned int *x, unsigned int *y, unsigned int *w, unsigned int *h)
+{
+    *x = view_dst_offset % fb_line_length / fb_bytes;
+    *y = view_dst_offset / fb_line_length;
+    *w = rotate_angle == 90 || rotate_angle == 270 ? view_height : view_width;
+    *h = rotate_angle == 90 || rotate_angle == 270 ? view_width : view_height;
+}
+
+/* 把画布第 page 页中 [x, x+w) x [y, y+h) 的区域写进显存的第 page 页 */
+static void fb_write_rect(unsigned int page, unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+{
+    const unsigned char  *src = (const unsigned char *)screen_base + page * fb_line_length * fb_vinfo.yres;
+    unsigned char        *dst = fb_mem + page * fb_mem_line * fb_vinfo.yres;
+    unsigned int         bytes = fb_format->bpp / 8;
+
+    for( ; h > 0; h--, y++)
+        fb_format->write((const unsigned short *)(src + y * fb_line_length) + x, dst + y * fb_mem_line + x * bytes, w);
+}
+
+/* 显存映射好以后调用：需要画布时把 screen_base 换成 rgb565 画布，fb_line_length 换成画布一行的字节数
+ * 直接绘制时显存已经清零，只有带透明度分量的格式要把每页填成不透明的黑色
+ */
+int fb_canvas_setup(void)
+{
+    void             *canvas;
+    unsigned char    *p;
+    unsigned int     i, x, black;
+
+    if(!fb_format->write)
+    {
+        black = fb_alpha(fb_format);
+        for(i=0; black && i<fb_pages * fb_vinfo.yres; i++)
+        {
+            p = (unsigned char *)screen_base + i * fb_line_length;
+            for(x=0; x<fb_vinfo.xres; x++, p += fb_bytes)
+                fb_store(p, black);
+        }
+        return 0;
+    }
+
+    canvas = calloc(fb_pages, fb_vinfo.xres * 2 * fb_vinfo.yres);
+    if(!canvas)
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        return -1;
+    }
+
+    fb_mem = screen_base;
+    fb_mem_line = fb_line_length;
+    fb_mem_size = (size_t)fb_line_length * fb_vinfo.yres * fb_pages;
+    screen_base = canvas;
+    fb_line_length = fb_vinfo.xres * 2;
+
+    /* 之后只写出变化的区域，先把每页整个写一遍，显存其余部分是画布的黑色 (透明度分量不透明) */
+    for(i=0; i<fb_pages; i++)
+        fb_write_rect(i, 0, 0, fb_vinfo.xres, fb_vinfo.yres);
+
+    printf("lcd: %s framebuffer, draw on a rgb565 canvas and write out on display\n", fb_format->name);
+    return 0;
+}
+
+/* 把画布的第 page 页写进显存的第 page 页
+ * 每次显示只有当前摄像头的输出区域 (包括其中的文字框) 画过，只写出这一块
+ */
+void fb_write_page(unsigned int page)
+{
+    unsigned int         x, y, w, h;
+
+    fb_view_rect(&x, &y, &w, &h);
+    fb_write_rect(page, x, y, w, h);
+}
+
+#ifdef HAVE_DRM
+/* DRM/KMS 输出，用 -D 代替 /dev/fb0
+ * 申请一块高度为 fb_pages 倍屏幕高度的 dumb buffer，每页在其中偏移一整屏各建一个 framebuffer，
+ * 映射后和 fbdev 多页显存的布局一样，绘制和画布的代码都不用改
+ * 显示时提交带完成事件的翻页，在垂直消隐时生效，完成事件从 drm fd 读出 (事件循环中和摄像头一起用 epoll 监听)
+ * 驱动支持原子接口时用主平面翻页，只有一个摄像头时主平面只扫描出画面所在的区域 (平面裁剪)，
+ * 不支持时用传统的 PAGE_FLIP 翻整屏
+ */
+#define DRM_PAGES           3           /* 默认三页轮流：一页在扫描出，一页等待翻页，一页在绘制 */
+#define DRM_FLIP_TIMEOUT_MS 500         /* 翻页完成事件超过这个时间没来，认为丢失 */
+#define DRM_PLANE_PRIMARY   1           /* 平面 "type" 属性的值 */
+
+enum
+{
+    DRM_PROP_FB_ID,
+    DRM_PROP_CRTC_ID,
+    DRM_PROP_SRC_X,
+    DRM_PROP_SRC_Y,
+    DRM_PROP_SRC_W,
+    DRM_PROP_SRC_H,
+    DRM_PROP_CRTC_X,
+    DRM_PROP_CRTC_Y,
+    DRM_PROP_CRTC_W,
+    DRM_PROP_CRTC_H,
+    DRM_PROP_CNT,
+};
+
+static const char *drm_prop_name[DRM_PROP_CNT] = {
+    "FB_ID", "CRTC_ID", "SRC_X", "SRC_Y", "SRC_W", "SRC_H", "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H",
+};
+
+static struct
+{
+    int                      fd;
+    unsigned int             crtc_id;
+    unsigned int             crtc_index;
+    unsigned int             conn_id;
+    struct drm_mode_modeinfo mode;
+    unsigned int             plane_id;          /* 原子接口的主平面，0 表示用传统接口翻页 */
+    __u32                    prop[DRM_PROP_CNT];
+    unsigned int             handle;            /* 所有页共用的一块 dumb buffer */
+    void                     *map;
+    size_t                   size;
+    unsigned int             fb_id[BUFFER_MAX];
+    rect_t                   crop;              /* 主平面扫描出的区域 */
+    int                      monotonic;         /* 事件的时间戳是 CLOCK_MONOTONIC */
+    int                      sync;              /* 等翻页完成后 fb_present 才返回 */
+    int                      pending;           /* 已提交还没完成的页，-1 表示没有 */
+    double                   submit_ns;
+    unsigned long            flips;
+    unsigned long            waits;             /* 提交时上一次翻页还没完成，要先等它 */
+    unsigned long            lost;
+    double                   latency_sum;       /* 提交到开始扫描出，ms */
+    double                   latency_max;
+} drm = { .fd = -1, .pending = -1 };
+
+static int drm_ioctl(unsigned long request, void *arg)
+{
+    int              rv;
+
+    do {
+        rv = ioctl(drm.fd, request, arg);
+    } while(rv < 0 && errno == EINTR);
+
+    return rv;
+}
+
+/* 找第一个已连接的接口，用它的首选模式，以及它的编码器能用的 CRTC */
+static int drm_find_output(void)
+{
+    struct drm_mode_card_res        res;
+    struct drm_mode_get_connector   conn;
+    struct drm_mode_get_encoder     enc;
+    struct drm_mode_modeinfo        *modes = NULL;
+    __u32                           *conn_ids = NULL;
+    __u32                           *crtc_ids = NULL;
+    __u32                           *enc_ids = NULL;
+    unsigned int                    i, k;
+    int                             rv = -1;
+
+    memset(&res, 0, sizeof(res));
+    if(drm_ioctl(DRM_IOCTL_MODE_GETRESOURCES, &res) < 0 || !res.count_connectors || !res.count_crtcs)
+    {
+        printf("%s : '%s' has no connector or crtc\n", __FUNCTION__, drm_dev);
+        return -1;
+    }
+
+    conn_ids = calloc(res.count_connectors, sizeof(*conn_ids));
+    crtc_ids = calloc(res.count_crtcs, sizeof(*crtc_ids));
+    if(!conn_ids || !crtc_ids)
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        goto cleanup;
+    }
+
+    res.count_fbs = 0;
+    res.count_encoders = 0;
+    res.connector_id_ptr = (uintptr_t)conn_ids;
+    res.crtc_id_ptr = (uintptr_t)crtc_ids;
+    if(drm_ioctl(DRM_IOCTL_MODE_GETRESOURCES, &res) < 0)
+    {
+        printf("%s : DRM_IOCTL_MODE_GETRESOURCES error: %s\n", __FUNCTION__, strerror(errno));
+        goto cleanup;
+    }
+
+    for(i=0; i<res.count_connectors && rv < 0; i++)
+    {
+        free(modes);
+        free(enc_ids);
+        modes = NULL;
+        enc_ids = NULL;
+
+        memset(&conn, 0, sizeof(conn));
+        conn.connector_id = conn_ids[i];
+        if(drm_ioctl(DRM_IOCTL_MODE_GETCONNECTOR, &conn) < 0 || conn.connection != DRM_MODE_CONNECTED ||
+           !conn.count_modes || !conn.count_encoders)
+            continue;
+
+        modes = calloc(conn.count_modes, sizeof(*modes));
+        enc_ids = calloc(conn.count_encoders, sizeof(*enc_ids));
+        if(!modes || !enc_ids)
+            continue;
+
+        conn.count_props = 0;
+        conn.modes_ptr = (uintptr_t)modes;
+        conn.encoders_ptr = (uintptr_t)enc_ids;
+        if(drm_ioctl(DRM_IOCTL_MODE_GETCONNECTOR, &conn) < 0 || !conn.count_modes)
+            continue;
+
+        drm.mode = modes[0];
+        for(k=0; k<conn.count_modes; k++)
+        {
+            if(modes[k].type & DRM_MODE_TYPE_PREFERRED)
+            {
+                drm.mode = modes[k];
+                break;
+            }
+        }
+
+        /* 编码器已经接到 CRTC 上时沿用，否则选它能用的第一个 */
+        memset(&enc, 0, sizeof(enc));
+        enc.encoder_id = conn.encoder_id ? conn.encoder_id : enc_ids[0];
+        if(drm_ioctl(DRM_IOCTL_MODE_GETENCODER, &enc) < 0)
+            continue;
+
+        for(k=0; k<res.count_crtcs; k++)
+        {
+            if(enc.crtc_id ? crtc_ids[k] == enc.crtc_id : (enc.possible_crtcs & (1U << k)) != 0)
+                break;
+        }
+        if(k == res.count_crtcs)
+            continue;
+
+        drm.conn_id = conn_ids[i];
+        drm.crtc_id = crtc_ids[k];
+        drm.crtc_index = k;
+        rv = 0;
+    }
+
+    if(rv < 0)
+        printf("%s : no connected output on '%s'\n", __FUNCTION__, drm_dev);
+
+cleanup:
+    free(modes);
+    free(enc_ids);
+    free(conn_ids);
+    free(crtc_ids);
+    return rv;
+}
+
+/* 读出平面的属性，记下原子提交要用的属性 id，返回平面的类型 */
+static int drm_plane_props(unsigned int plane_id, __u32 *prop)
+{
+    struct drm_mode_obj_get_properties  obj;
+    struct drm_mode_get_property        p;
+    __u32                               *ids = NULL;
+    __u64                               *values = NULL;
+    unsigned int                        i, k;
+    int                                 type = -1;
+
+    memset(&obj, 0, sizeof(obj));
+    obj.obj_id = plane_id;
+    obj.obj_type = DRM_MODE_OBJECT_PLANE;
+    if(drm_ioctl(DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &obj) < 0 || !obj.count_props)
+        return -1;
+
+    ids = calloc(obj.count_props, sizeof(*ids));
+    values = calloc(obj.count_props, sizeof(*values));
+    if(!ids || !values)
+        goto cleanup;
+
+    obj.props_ptr = (uintptr_t)ids;
+    obj.prop_values_ptr = (uintptr_t)values;
+    if(drm_ioctl(DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &obj) < 0)
+        goto cleanup;
+
+    for(i=0; i<obj.count_props; i++)
+    {
+        memset(&p, 0, sizeof(p));
+        p.prop_id = ids[i];
+        if(drm_ioctl(DRM_IOCTL_MODE_GETPROPERTY, &p) < 0)
+            continue;
+
+        if(!strcmp(p.name, "type"))
+            type = values[i];
+        for(k=0; k<DRM_PROP_CNT; k++)
+        {
+            if(!strcmp(p.name, drm_prop_name[k]))
+                prop[k] = ids[i];
+        }
+    }
+
+cleanup:
+    free(ids);
+    free(values);
+    return type;
+}
+
+/* 打开原子接口，找接在我们的 CRTC 上的主平面，找不到时用传统接口翻页 */
+static void drm_find_plane(void)
+{
+    struct drm_set_client_cap       cap;
+    struct drm_mode_get_plane_res   res;
+    struct drm_mode_get_plane       plane;
+    __u32                           prop[DRM_PROP_CNT];
+    __u32                           *plane_ids = NULL;
+    unsigned int                    i, k;
+
+    cap.capability = DRM_CLIENT_CAP_UNIVERSAL_PLANES;
+    cap.value = 1;
+    if(drm_ioctl(DRM_IOCTL_SET_CLIENT_CAP, &cap) < 0)
+        return;
+
+    cap.capability = DRM_CLIENT_CAP_ATOMIC;
+    if(drm_ioctl(DRM_IOCTL_SET_CLIENT_CAP, &cap) < 0)
+        return;
+
+    memset(&res, 0, sizeof(res));
+    if(drm_ioctl(DRM_IOCTL_MODE_GETPLANERESOURCES, &res) < 0 || !res.count_planes)
+        return;
+
+    plane_ids = calloc(res.count_planes, sizeof(*plane_ids));
+    if(!plane_ids)
+        return;
+
+    res.plane_id_ptr = (uintptr_t)plane_ids;
+    if(drm_ioctl(DRM_IOCTL_MODE_GETPLANERESOURCES, &res) < 0)
+        res.count_planes = 0;
+
+    for(i=0; i<res.count_planes && !drm.plane_id; i++)
+    {
+        memset(&plane, 0, sizeof(plane));
+        plane.plane_id = plane_ids[i];
+        if(drm_ioctl(DRM_IOCTL_MODE_GETPLANE, &plane) < 0 || !(plane.possible_crtcs & (1U << drm.crtc_index)))
+            continue;
+
+        memset(prop, 0, sizeof(prop));
+        if(drm_plane_props(plane_ids[i], prop) != DRM_PLANE_PRIMARY)
+            continue;
+
+        for(k=0; k<DRM_PROP_CNT && prop[k]; k++)
+            ;
+        if(k == DRM_PROP_CNT)
+        {
+            memcpy(drm.prop, prop, sizeof(prop));
+            drm.plane_id = plane_ids[i];
+        }
+    }
+
+    free(plane_ids);
+}
+
+/* 原子提交：主平面显示第 page 页的 crop 区域，位置不变，不缩放 */
+static int drm_atomic_commit(unsigned int page, unsigned int flags)
+{
+    struct drm_mode_atomic   req;
+    __u32                    obj = drm.plane_id;
+    __u32                    count = DRM_PROP_CNT;
+    __u64                    value[DRM_PROP_CNT];
+
+    value[DRM_PROP_FB_ID] = drm.fb_id[page];
+    value[DRM_PROP_CRTC_ID] = drm.crtc_id;
+    value[DRM_PROP_SRC_X] = (__u64)drm.crop.x << 16;   /* 源矩形是 16.16 定点数 */
+    value[DRM_PROP_SRC_Y] = (__u64)drm.crop.y << 16;
+    value[DRM_PROP_SRC_W] = (__u64)drm.crop.w << 16;
+    value[DRM_PROP_SRC_H] = (__u64)drm.crop.h << 16;
+    value[DRM_PROP_CRTC_X] = drm.crop.x;
+    value[DRM_PROP_CRTC_Y] = drm.crop.y;
+    value[DRM_PROP_CRTC_W] = drm.crop.w;
+    value[DRM_PROP_CRTC_H] = drm.crop.h;
+
+    memset(&req, 0, sizeof(req));
+    req.flags = flags;
+    req.count_objs = 1;
+    req.objs_ptr = (uintptr_t)&obj;
+    req.count_props_ptr = (uintptr_t)&count;
+    req.props_ptr = (uintptr_t)drm.prop;
+    req.prop_values_ptr = (uintptr_t)value;
+    req.user_data = page;
+
+    return drm_ioctl(DRM_IOCTL_MODE_ATOMIC, &req);
+}
+
+static void drm_destroy_buffers(void)
+{
+    struct drm_mode_destroy_dumb     destroy;
+    unsigned int                     i;
+
+    if(drm.map)
+        munmap(drm.map, drm.size);
+    drm.map = NULL;
+
+    for(i=0; i<BUFFER_MAX; i++)
+    {
+        if(drm.fb_id[i])
+            drm_ioctl(DRM_IOCTL_MODE_RMFB, &drm.fb_id[i]);
+        drm.fb_id[i] = 0;
+    }
+
+    if(drm.handle)
+    {
+        destroy.handle = drm.handle;
+        drm_ioctl(DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+    }
+    drm.handle = 0;
+}
+
+/* 申请 pages 页的 dumb buffer 并映射，fb_line_length 为驱动给出的行跨度 */
+static int drm_create_buffers(unsigned int pages, unsigned int bpp, __u32 fourcc)
+{
+    struct drm_mode_create_dumb  create;
+    struct drm_mode_map_dumb     map;
+    struct drm_mode_fb_cmd2      fb;
+    unsigned int                 i;
+
+    memset(&create, 0, sizeof(create));
+    create.width = drm.mode.hdisplay;
+    create.height = drm.mode.vdisplay * pages;
+    create.bpp = bpp;
+    if(drm_ioctl(DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0)
+    {
+        printf("%s : create %ux%u dumb buffer error: %s\n", __FUNCTION__, create.width, create.height, strerror(errno));
+        return -1;
+    }
+    drm.handle = create.handle;
+    drm.size = create.size;
+    fb_line_length = create.pitch;
+
+    for(i=0; i<pages; i++)
+    {
+        memset(&fb, 0, sizeof(fb));
+        fb.width = drm.mode.hdisplay;
+        fb.height = drm.mode.vdisplay;
+        fb.pixel_format = fourcc;
+        fb.handles[0] = drm.handle;
+        fb.pitches[0] = create.pitch;
+        fb.offsets[0] = i * create.pitch * drm.mode.vdisplay;
+        if(drm_ioctl(DRM_IOCTL_MODE_ADDFB2, &fb) < 0)
+        {
+            printf("%s : add %u bpp framebuffer error: %s\n", __FUNCTION__, bpp, strerror(errno));
+            drm_destroy_buffers();
+            return -2;
+        }
+        drm.fb_id[i] = fb.fb_id;
+    }
+
+    memset(&map, 0, sizeof(map));
+    map.handle = drm.handle;
+    if(drm_ioctl(DRM_IOCTL_MODE_MAP_DUMB, &map) < 0 ||
+       MAP_FAILED == (drm.map = mmap(NULL, drm.size, PROT_READ|PROT_WRITE, MAP_SHARED, drm.fd, map.offset)))
+    {
+        printf("%s : map dumb buffer error: %s\n", __FUNCTION__, strerror(errno));
+        drm.map = NULL;
+        drm_destroy_buffers();
+        return -3;
+    }
+
+    return 0;
+}
+
+/* 打开 DRM 设备，设置显示模式，代替 init_lcd 中 fbdev 的部分
+ * 优先用 RGB565，驱动不支持时用 XRGB8888，都直接绘制
+ */
+int drm_open(void)
+{
+    static const struct
+    {
+        unsigned int     bpp;
+        __u32            fourcc;
+        const char       *name;
+    } formats[] = {
+        { 16, DRM_FORMAT_RGB565,   "rgb565" },
+        { 32, DRM_FORMAT_XRGB8888, "xrgb8888" },
+    };
+    struct drm_get_cap   cap;
+    struct drm_mode_crtc crtc;
+    unsigned int         i;
+    int                  rv;
+
+    drm.fd = open(drm_dev, O_RDWR | O_CLOEXEC);
+    if(drm.fd < 0)
+    {
+        printf("%s : open '%s' error: %s\n", __FUNCTION__, drm_dev, strerror(errno));
+        return -1;
+    }
+
+    memset(&cap, 0, sizeof(cap));
+    cap.capability = DRM_CAP_DUMB_BUFFER;
+    if(drm_ioctl(DRM_IOCTL_GET_CAP, &cap) < 0 || !cap.value)
+    {
+        printf("%s : '%s' has no dumb buffer\n", __FUNCTION__, drm_dev);
+        rv = -2;
+        goto failed;
+    }
+
+    cap.capability = DRM_CAP_TIMESTAMP_MONOTONIC;
+    drm.monotonic = drm_ioctl(DRM_IOCTL_GET_CAP, &cap) == 0 && cap.value;
+
+    if(drm_find_output() < 0)
+    {
+        rv = -3;
+        goto failed;
+    }
+
+    if(fb_pages > BUFFER_MAX)
+        fb_pages = BUFFER_MAX;
+
+    for(i=0; i<sizeof(formats)/sizeof(formats[0]); i++)
+    {
+        if(drm_create_buffers(fb_pages, formats[i].bpp, formats[i].fourcc) < 0)
+            continue;
+
+        memset(&crtc, 0, sizeof(crtc));
+        crtc.crtc_id = drm.crtc_id;
+        crtc.fb_id = drm.fb_id[0];
+        crtc.set_connectors_ptr = (uintptr_t)&drm.conn_id;
+        crtc.count_connectors = 1;
+        crtc.mode = drm.mode;
+        crtc.mode_valid = 1;
+        if(drm_ioctl(DRM_IOCTL_MODE_SETCRTC, &crtc) == 0)
+            break;
+
+        printf("%s : set %s mode error: %s\n", __FUNCTION__, formats[i].name, strerror(errno));
+        drm_destroy_buffers();
+    }
+    if(i == sizeof(formats)/sizeof(formats[0]))
+    {
+        rv = -4;
+        goto failed;
+    }
+
+    memset(&fb_vinfo, 0, sizeof(fb_vinfo));
+    fb_vinfo.xres = drm.mode.hdisplay;
+    fb_vinfo.yres = drm.mode.vdisplay;
+    fb_vinfo.yres_virtual = drm.mode.vdisplay * fb_pages;
+    fb_vinfo.bits_per_pixel = formats[i].bpp;
+    fb_format_use(fb_format_find(formats[i].name));
+    screen_base = drm.map;
+    memset(screen_base, 0x0, drm.size);
+
+    /* 翻页本来就在垂直消隐时生效，不用再等垂直同步 */
+    fb_vsync = 0;
+    fb_back = fb_pages > 1 ? 1 : 0;
+    flip_stat.period_ns = drm.mode.clock ? (double)drm.mode.htotal * drm.mode.vtotal * 1e6 / drm.mode.clock : 0;
+
+    /* 只有两页时，要等翻页完成后旧的一页才能重新绘制 */
+    drm.sync = drm.sync || fb_pages < 3;
+    drm.crop.w = drm.mode.hdisplay;
+    drm.crop.h = drm.mode.vdisplay;
+    drm_find_plane();
+
+    printf("drm: %s %ux%u@%u, %u pages %s, %s page flip\n", drm_dev, drm.mode.hdisplay, drm.mode.vdisplay,
+            drm.mode.vrefresh, fb_pages, formats[i].name, drm.plane_id ? "atomic" : "legacy");
+    return 0;
+
+failed:
+    close(drm.fd);
+    drm.fd = -1;
+    return rv;
+}
+
+/* 只有一个摄像头时，主平面只扫描出画面所在的区域，画面外本来就是黑色，看起来没有区别，
+ * 但少读了显存；驱动不接受 (原子提交测试失败) 时仍然扫描出整屏
+ */
+void drm_crop_setup(void)
+{
+    rect_t           crop;
+    int              swap = rotate_angle == 90 || rotate_angle == 270;
+
+    if(!drm.plane_id || camera_cnt > 1)
+        return;
+
+    crop.x = view_dst_offset % fb_line_length / fb_bytes;
+    crop.y = view_dst_offset / fb_line_length;
+    crop.w = swap ? view_height : view_width;
+    crop.h = swap ? view_width : view_height;
+    if(crop.w == drm.mode.hdisplay && crop.h == drm.mode.vdisplay)
+        return;
+
+    drm.crop = crop;
+    if(drm_atomic_commit(0, DRM_MODE_ATOMIC_TEST_ONLY) < 0)
+    {
+        printf("drm: plane can't scan out %ux%u+%u+%u only, scan out full screen\n", crop.w, crop.h, crop.x, crop.y);
+        drm.crop.x = 0;
+        drm.crop.y = 0;
+        drm.crop.w = drm.mode.hdisplay;
+        drm.crop.h = drm.mode.vdisplay;
+        return;
+    }
+
+    printf("drm: plane scans out %ux%u+%u+%u\n", crop.w, crop.h, crop.x, crop.y);
+}
+
+/* 读出翻页完成事件，统计从提交到开始扫描出的时间 */
+void drm_handle_events(void)
+{
+    __u64                    buf[64];
+    struct drm_event         *ev;
+    struct drm_event_vblank  *vb;
+    ssize_t                  len, i;
+    double                   t, ms;
+
+    len = read(drm.fd, buf, sizeof(buf));
+    for(i=0; len > 0 && i + (ssize_t)sizeof(*ev) <= len; i += ev->length)
+    {
+        ev = (struct drm_event *)((char *)buf + i);
+        if(ev->length < sizeof(*ev))
+            break;
+        if(ev->type != DRM_EVENT_FLIP_COMPLETE || ev->length < sizeof(*vb))
+            continue;
+
+        vb = (struct drm_event_vblank *)ev;
+        t = drm.monotonic ? vb->tv_sec * 1e9 + vb->tv_usec * 1e3 : now_ns();
+        ms = t > drm.submit_ns ? (t - drm.submit_ns) / 1e6 : 0;
+
+        drm.latency_sum += ms;
+        if(ms > drm.latency_max)
+            drm.latency_max = ms;
+        drm.flips++;
+        drm.pending = -1;
+    }
+}
+
+static void drm_wait_flip(void)
+{
+    struct pollfd    pfd;
+    int              rv;
+
+    pfd.fd = drm.fd;
+    pfd.events = POLLIN;
+    while(drm.pending >= 0)
+    {
+        rv = poll(&pfd, 1, DRM_FLIP_TIMEOUT_MS);
+        if(rv > 0)
+        {
+            drm_handle_events();
+        }
+        else if(rv == 0 || errno != EINTR)
+        {
+            printf("%s : no flip event for page %d\n", __FUNCTION__, drm.pending);
+            drm.lost++;
+            drm.pending = -1;
+        }
+    }
+}
+
+/* 提交翻页到第 page 页，上一次翻页还没完成时先等它 (驱动一次只接受一个) */
+int drm_present(unsigned int page)
+{
+    struct drm_mode_crtc_page_flip   flip;
+    double                           t;
+    int                              rv;
+
+    /* 单页时直接画在扫描出的页上 */
+    if(fb_pages < 2)
+        return 0;
+
+    if(drm.pending >= 0)
+    {
+        drm.waits++;
+        drm_wait_flip();
+    }
+
+    t = now_ns();
+    if(drm.plane_id)
+    {
+        rv = drm_atomic_commit(page, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK);
+    }
+    else
+    {
+        memset(&flip, 0, sizeof(flip));
+        flip.crtc_id = drm.crtc_id;
+        flip.fb_id = drm.fb_id[page];
+        flip.flags = DRM_MODE_PAGE_FLIP_EVENT;
+        flip.user_data = page;
+        rv = drm_ioctl(DRM_IOCTL_MODE_PAGE_FLIP, &flip);
+    }
+    if(rv < 0)
+    {
+        printf("%s : flip to page %u error: %s\n", __FUNCTION__, page, strerror(errno));
+        return -1;
+    }
+
+    drm.submit_ns = t;
+    drm.pending = page;
+    if(drm.sync)
+        drm_wait_flip();
+
+    return 0;
+}
+
+void drm_stat_dump(void)
+{
+    printf("stat drm flips=%lu waits=%lu lost=%lu flip_latency_mean_ms=%.3f flip_latency_max_ms=%.3f "
+            "scanout=%ux%u+%u+%u api=%s\n", drm.flips, drm.waits, drm.lost,
+            drm.flips ? drm.latency_sum / drm.flips : 0.0, drm.latency_max,
+            drm.crop.w, drm.crop.h, drm.crop.x, drm.crop.y, drm.plane_id ? "atomic" : "legacy");
+}
+
+void drm_close(void)
+{
+    if(drm.fd < 0)
+        return;
+
+    drm_wait_flip();
+    drm_destroy_buffers();
+    screen_base = NULL;
+    close(drm.fd);
+    drm.fd = -1;
+}
+#endif
+
+/* 第 page 页显存的起始地址 */
+unsigned char *fb_page_buffer(unsigned int page)
+{
+    return (unsigned char *)screen_base + page * fb_line_length * fb_vinfo.yres;
+}
+
+/* 当前用来绘制的显存页，单缓冲时就是可见的那一页 */
+unsigned char *fb_back_buffer(void)
+{
+    return fb_page_buffer(fb_back);
+}
+
+/* 显示第 page 页：双缓冲时把它翻到前台，并按需等待垂直同步
+ * 同时统计每秒翻页次数和错过的垂直同步次数
+ */
+int fb_present(unsigned int page)
+{
+    __u32            crtc = 0;
+    double           now;
+    double           periods;
+
+    if( fb_mem )
+        fb_write_page(page);
+
+#ifdef HAVE_DRM
+    if( drm_dev )
+    {
+        if( drm_present(page) < 0 )
+            return -1;
+    }
+    else
+#endif
+    if( fb_pages > 1 && !fb_fake )
+    {
+        fb_vinfo.yoffset = page * fb_vinfo.yres;
+        if( ioctl(fd_lcd, FBIOPAN_DISPLAY, &fb_vinfo) < 0 )
+        {
+            printf("%s : FBIOPAN_DISPLAY error: %s\n", __FUNCTION__, strerror(errno));
+            return -1;
+        }
+
+        /* 等到新页开始扫描后，旧的前台页才可以作为后台页重新绘制 */
+        if( fb_vsync && ioctl(fd_lcd, FBIO_WAITFORVSYNC, &crtc) < 0 )
+        {
+            printf("%s : FBIO_WAITFORVSYNC not supported, stop waiting for vsync\n", __FUNCTION__);
+            fb_vsync = 0;
+        }
+    }
+
+    now = now_ns();
+    frame_stat_displayed(page, now);
+    if( !flip_stat.window_ns )
+    {
+        flip_stat.window_ns = now;
+        flip_stat.window_cpu_ns = cpu_time_ns();
+    }
+
+    /* 相邻两次翻页之间超过一个刷新周期，说明同一画面被重复扫描，计为错过的垂直同步 */
+    if( fb_vsync && flip_stat.last_ns )
+    {
+        periods = (now - flip_stat.last_ns) / flip_stat.period_ns + 0.5;
+        if( periods >= 2 )
+            flip_stat.missed_vsync += (unsigned long)periods - 1;
+    }
+    flip_stat.last_ns = now;
+    flip_stat.flips++;
+    flip_stat.window_flips++;
+
+    if( now - flip_stat.window_ns >= 5e9 )
+    {
+        double       cpu = cpu_time_ns();
+
+        printf("display: %.1f flips/s, %lu flips, %lu missed vsync, cpu %.1f%%, %s\n",
+                flip_stat.window_flips * 1e9 / (now - flip_stat.window_ns), flip_stat.flips, flip_stat.missed_vsync,
+                (cpu - flip_stat.window_cpu_ns) * 100 / (now - flip_stat.window_ns),
+                v4l2_memtype == V4L2_MEMORY_USERPTR ? "userptr" : "mmap");
+        flip_stat.window_ns = now;
+        flip_stat.window_cpu_ns = cpu;
+        flip_stat.window_flips = 0;
+    }
+
+    return 0;
+}
+
+/* 一帧绘制完成，显示后台页并交换前后台 */
+int fb_flip(void)
+{
+    int              rv;
+
+    rv = fb_present(fb_back);
+    if( fb_pages > 1 )
+        fb_back = (fb_back + 1) % fb_pages;
+
+    return rv;
+}
+
+/* 多个摄像头翻页时每次只画一个摄像头，第 page 页上其他摄像头的区域可能还是几帧以前的
+ * 画之前从前台页 (所有摄像头都是最新的) 把过时的区域复制过来，使用画布时同时写进显存
+ */
+void fb_sync_cameras(unsigned int page)
+{
+    unsigned int     front = (page + fb_pages - 1) % fb_pages;
+    const camera_t   *cam;
+    unsigned int     i, y, offset;
+
+    if(camera_cnt < 2 || fb_pages < 2)
+        return;
+
+    for(i=0; i<camera_cnt; i++)
+    {
+        cam = &cameras[i];
+        if(i == camera_cur || cam->page_shown[page] == cam->shown)
+            continue;
+
+        for(y=0; y<cam->area_height; y++)
+        {
+            offset = (cam->area_y + y) * fb_line_length + cam->area_x * fb_bytes;
+            memcpy(fb_page_buffer(page) + offset, fb_page_buffer(front) + offset, cam->area_width * fb_bytes);
+        }
+        if(fb_mem)
+            fb_write_rect(page, cam->area_x, cam->area_y, cam->area_width, cam->area_height);
+        cameras[i].page_shown[page] = cam->shown;
+    }
+}
+
+/* 全局变量和 cameras[] 之间存取一个摄像头的状态，camera_switch 切换到第 index 个摄像头 */
+static void camera_store(camera_t *cam)
+{
+    cam->dev = camera_dev;
+    cam->fd = fd_camera;
+    cam->unit = buffer_unit;
+    cam->buffer_cnt = buffer_cnt;
+    cam->memtype = v4l2_memtype;
+    cam->pixfmt = v4l2_pixfmt;
+    cam->sizeimage = frame_sizeimage;
+    cam->stride = frame_stride;
+    cam->mode = frame_mode;
+    cam->view_width = view_width;
+    cam->view_height = view_height;
+    cam->view_src_offset = view_src_offset;
+    cam->view_dst_offset = view_dst_offset;
+    cam->area_x = area_x;
+    cam->area_y = area_y;
+    cam->area_width = area_width;
+    cam->area_height = area_height;
+    memcpy(cam->hole, view_hole, sizeof(view_hole));
+    cam->hole_cnt = view_hole_cnt;
+    cam->zc_shown = zc_shown;
+    cam->scaler = scaler;
+    cam->csc = csc;
+    cam->osd = osd;
+#ifdef HAVE_JPEG
+    cam->mjpeg = mjpeg;
+#endif
+    cam->last_sequence = frame_stat.last_sequence;
+}
+
+static void camera_load(const camera_t *cam)
+{
+    camera_dev = cam->dev;
+    fd_camera = cam->fd;
+    buffer_unit = cam->unit;
+    buffer_cnt = cam->buffer_cnt;
+    v4l2_memtype = cam->memtype;
+    v4l2_pixfmt = cam->pixfmt;
+    frame_sizeimage = cam->sizeimage;
+    frame_stride = cam->stride;
+    frame_mode = cam->mode;
+    view_width = cam->view_width;
+    view_height = cam->view_height;
+    view_src_offset = cam->view_src_offset;
+    view_dst_offset = cam->view_dst_offset;
+    area_x = cam->area_x;
+    area_y = cam->area_y;
+    area_width = cam->area_width;
+    area_height = cam->area_height;
+    memcpy(view_hole, cam->hole, sizeof(view_hole));
+    view_hole_cnt = cam->hole_cnt;
+    zc_shown = cam->zc_shown;
+    scaler = cam->scaler;
+    csc_use(cam->csc);
+    osd = cam->osd;
+#ifdef HAVE_JPEG
+    mjpeg = cam->mjpeg;
+#endif
+    frame_stat.last_sequence = cam->last_sequence;
+}
+
+void camera_switch(unsigned int index)
+{
+    if(index == camera_cur)
+        return;
+
+    camera_store(&cameras[camera_cur]);
+    camera_cur = index;
+    camera_load(&cameras[index]);
+}
+
+/* 多个摄像头的窗口布局，后面的摄像头画在前面的上面
+ * side: 屏幕平分成竖条
+ * pip:  第 0 个铺满屏幕，其余缩小成画中画窗口，沿右边从下往上排列
+ * 也可以直接给出每个摄像头窗口的 x,y,w,h，用冒号分隔，比如 0,0,800,480:528,304,256,160
+ * 窗口的 x 和宽度按偶数像素对齐，YUYV 两个像素一组
+ */
+#define PIP_MARGIN      16
+
+static int layout_parse(const char *layout, rect_t *rect)
+{
+    unsigned int     xres = fb_vinfo.xres;
+    unsigned int     yres = fb_vinfo.yres;
+    unsigned int     x, y, w, h, i;
+    unsigned int     div = camera_cnt > 3 ? 4 : 3;
+    const char       *p = layout;
+    int              n;
+
+    for(i=0; i<camera_cnt; i++)
+    {
+        if(!strcmp(layout, "side"))
+        {
+            w = xres / camera_cnt;
+            x = i * w;
+            y = 0;
+            h = yres;
+        }
+        else if(!strcmp(layout, "pip"))
+        {
+            /* 屏幕太小时画中画窗口排不下，不能让无符号数减成很大的坐标 */
+            w = i ? xres / div : xres;
+            h = i ? yres / div : yres;
+            if(i && (xres < PIP_MARGIN + w || yres < i * (h + PIP_MARGIN) || w < 2 || !h))
+            {
+                printf("%s : %ux%u screen has no room for %u pip windows\n", __FUNCTION__, xres, yres, camera_cnt - 1);
+                return -1;
+            }
+            x = i ? xres - PIP_MARGIN - w : 0;
+            y = i ? yres - i * (h + PIP_MARGIN) : 0;
+        }
+        else if(sscanf(p, "%u,%u,%u,%u%n", &x, &y, &w, &h, &n) != 4 || w < 2 || !h || x + w > xres || y + h > yres)
+        {
+            printf("%s : invalid layout '%s', camera %u needs x,y,w,h inside %ux%u\n", __FUNCTION__, layout, i, xres, yres);
+            return -1;
+        }
+        else
+        {
+            p += n;
+            if(*p == ':' && i + 1 < camera_cnt)
+                p++;
+        }
+
+        rect[i].x = x & ~1U;
+        rect[i].y = y;
+        rect[i].w = w & ~1U;
+        rect[i].h = h;
+    }
+
+    /* 给出的窗口比摄像头多时不能悄悄忽略 */
+    if(strcmp(layout, "side") && strcmp(layout, "pip") && *p)
+    {
+        printf("%s : invalid layout '%s', %u window(s) for %u camera(s) expected\n", __FUNCTION__, layout, camera_cnt,
+                camera_cnt);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* 两个矩形是否重叠 */
+static int rect_overlap(const rect_t *a, const rect_t *b)
+{
+    return a->x < b->x + b->w && b->x < a->x + a->w && a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+/* 屏幕打开后调用，所有摄像头从选项给出的默认状态开始
+ * 多个摄像头时按布局给每个摄像头分配窗口，帧一次缩放转换到窗口中，
+ * 被上层窗口挡住的部分记为 hole，画的时候跳过，这样每个窗口收到自己的帧就可以马上更新，不用等其他摄像头
+ */
+int camera_setup(const char *layout)
+{
+    rect_t           rect[CAMERA_MAX];
+    char             *dev;
+    unsigned int     i, j;
+
+    if(camera_cnt > 1)
+    {
+        if(layout_parse(layout, rect) < 0)
+            return -1;
+
+        if(scale_mode == SCALE_NONE)
+            scale_mode = SCALE_FIT;
+    }
+
+    camera_store(&cameras[0]);
+    for(i=0; i<camera_cnt; i++)
+    {
+        if(i)
+        {
+            dev = cameras[i].dev;
+            cameras[i] = cameras[0];
+            cameras[i].dev = dev;
+        }
+        cameras[i].osd = &osd_ctx[i];
+#ifdef HAVE_JPEG
+        cameras[i].mjpeg = &mjpeg_ctx[i];
+#endif
+        if(camera_cnt < 2)
+            continue;
+
+        cameras[i].area_x = rect[i].x;
+        cameras[i].area_y = rect[i].y;
+        cameras[i].area_width = rect[i].w;
+        cameras[i].area_height = rect[i].h;
+
+        cameras[i].hole_cnt = 0;
+        for(j=i+1; j<camera_cnt; j++)
+        {
+            if(rect_overlap(&rect[i], &rect[j]))
+                cameras[i].hole[cameras[i].hole_cnt++] = rect[j];
+        }
+
+        /* 旋转按块转置写入，不支持跳过被挡住的部分 */
+        if(cameras[i].hole_cnt && rotate_angle)
+        {
+            printf("%s : overlapping windows can't rotate, use side layout\n", __FUNCTION__);
+            return -2;
+        }
+
+        printf("camera %s: window %ux%u at %u,%u, %u window(s) above\n", cameras[i].dev, rect[i].w, rect[i].h,
+                rect[i].x, rect[i].y, cameras[i].hole_cnt);
+    }
+
+    camera_cur = 0;
+    camera_load(&cameras[0]);
+    return 0;
+}
+
+/* 打开当前摄像头的设备节点，以非阻塞方式打开，由事件循环等待帧 */
+int v4l2_open()
+{
+    fd_camera = open(camera_dev, O_RDWR | O_NONBLOCK, 0);
+    if(fd_camera < 0)
+    {
+        printf("%s : open camera '%s' error\n", __FUNCTION__, camera_dev);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* 打开屏幕的设备节点，并映射 lcd 的用户空间到内核空间 */
+int init_lcd()
+{
+    struct fb_fix_screeninfo   finfo;
+    const fb_format_t          *f;
+
+#ifdef HAVE_DRM
+    if(drm_dev)
+        return drm_open() < 0 ? -6 : (fb_canvas_setup() < 0 ? -5 : 0);
+#endif
+
+    fd_lcd = open(fb_dev, O_RDWR);
+    if(fd_lcd < 0)
+    {
+        printf("%s : open lcd '%s' error\n", __FUNCTION__, fb_dev);
+        return -2;
+    }
+
+    if(ioctl(fd_lcd, FBIOGET_VSCREENINFO, &fb_vinfo) < 0 || !fb_vinfo.xres || !fb_vinfo.yres)
+    {
+        printf("%s : FBIOGET_VSCREENINFO error, assume %dx%d\n", __FUNCTION__, LCD_WIDTH, LCD_HEIGH);
+        memset(&fb_vinfo, 0, sizeof(fb_vinfo));
+        fb_vinfo.xres = LCD_WIDTH;
+        fb_vinfo.yres = LCD_HEIGH;
+        fb_vinfo.bits_per_pixel = 16;
+    }
+
+    f = fb_format_select(&fb_vinfo);
+    if(!f)
+        return -4;
+    fb_format_use(f);
+
+    /* 一行像素在显存中实际占用的字节数，可能大于 xres*bpp/8 */
+    fb_line_length = fb_vinfo.xres * fb_format->bpp / 8;
+    if(ioctl(fd_lcd, FBIOGET_FSCREENINFO, &finfo) == 0 && finfo.line_length >= fb_line_length)
+    {
+        fb_line_length = finfo.line_length;
+    }
+    printf("lcd: %ux%u, %u bpp %s, line length %u\n", fb_vinfo.xres, fb_vinfo.yres, fb_vinfo.bits_per_pixel,
+            fb_format->name, fb_line_length);
+
+    /* 多页显存申请失败时退回单缓冲，直接在可见的显存上绘制 */
+    if(fb_pages > 1)
+    {
+        if(fb_setup_pages(fb_pages, &finfo) < 0)
+        {
+            printf("%s : %u framebuffer pages unavailable, draw on visible framebuffer\n", __FUNCTION__, fb_pages);
+            fb_pages = 1;
+        }
+        else
+        {
+            fb_line_length = finfo.line_length;
+            fb_back = 1;
+        }
+    }
+
+    /* 单缓冲时没有翻页，也就不等待垂直同步 */
+    if(fb_pages < 2)
+        fb_vsync = 0;
+    flip_stat.period_ns = fb_refresh_period_ns(&fb_vinfo);
+
+    screen_base = mmap(NULL, fb_line_length*fb_vinfo.yres*fb_pages, PROT_READ|PROT_WRITE, MAP_SHARED, fd_lcd, 0);
+    if(MAP_FAILED == screen_base)
+    {
+        printf("%s : framebuffer mmap error\n", __FUNCTION__);
+        return -3;
+    }
+
+    memset(screen_base, 0x0, fb_line_length*fb_vinfo.yres*fb_pages);
+
+    return fb_canvas_setup() < 0 ? -5 : 0;
+}
+
+/* 查询设备功能属性 */
+int v4l2_query_capability()
+{
+    struct v4l2_capability     cap;
+    int                        ret;
+
+    ret = ioctl(fd_camera, VIDIOC_QUERYCAP, &cap);
+    if(ret < 0)
+    {
+        printf("%s : VIDIOC_QUERYCAP error\n", __FUNCTION__);
+        return -1;
+    }
+
+    /* #define V4L2_CAP_VIDEO_CAPTURE 0x00000001
+    * 获取到设备的能力
+    * 判断最低位是否为 1，如果为 1，则说明该设备具有视频采集能力
+    */
+    if ((V4L2_CAP_VIDEO_CAPTURE & cap.capabilities) == 0x00)
+    {
+        printf("%s : no capture device\n", __FUNCTION__);
+        return -2;
+    }
+
+    return 0;
+}
+
+/* 查询设备是否支持某种像素格式 */
+int v4l2_support_format(unsigned int pixelformat)
+{
+    struct v4l2_fmtdesc     fmtdesc;
+
+    memset(&fmtdesc, 0, sizeof(fmtdesc));
+    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    for(fmtdesc.index=0; ioctl(fd_camera, VIDIOC_ENUM_FMT, &fmtdesc) == 0; fmtdesc.index++)
+    {
+        if(fmtdesc.pixelformat == pixelformat)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* 某个帧尺寸下的最短帧间隔，驱动不支持 VIDIOC_ENUM_FRAMEINTERVALS 时返回 0/0 */
+static struct v4l2_fract v4l2_min_interval(unsigned int pixelformat, unsigned int width, unsigned int height)
+{
+    struct v4l2_frmivalenum  fival;
+    struct v4l2_fract        best = { 0, 0 };
+
+    memset(&fival, 0, sizeof(fival));
+    fival.pixel_format = pixelformat;
+    fival.width = width;
+    fival.height = height;
+
+    for(fival.index=0; ioctl(fd_camera, VIDIOC_ENUM_FRAMEINTERVALS, &fival) == 0; fival.index++)
+    {
+        struct v4l2_fract    cur;
+
+        /* 连续或步进的帧间隔只需要看最小值 */
+        cur = fival.type == V4L2_FRMIVAL_TYPE_DISCRETE ? fival.discrete : fival.stepwise.min;
+
+        /* 比较 num/den 的大小，间隔越短帧率越高 */
+        if(cur.denominator && (!best.denominator ||
+           (unsigned long long)cur.numerator * best.denominator < (unsigned long long)best.numerator * cur.denominator))
+        {
+            best = cur;
+        }
+
+        if(fival.type != V4L2_FRMIVAL_TYPE_DISCRETE)
+        {
+            break;
+        }
+    }
+
+    return best;
+}
+
+/* 比较两个模式，帧率高的优先，帧率相同时面积大的优先 */
+static int v4l2_mode_better(const v4l2_mode_t *a, const v4l2_mode_t *b)
+{
+    unsigned long long   fa = (unsigned long long)a->interval.denominator * (b->interval.numerator ? b->interval.numerator : 1);
+    unsigned long long   fb = (unsigned long long)b->interval.denominator * (a->interval.numerator ? a->interval.numerator : 1);
+
+    if(fa != fb)
+    {
+        return fa > fb;
+    }
+
+    return a->width * a->height > b->width * b->height;
+}
+
+/* 枚举摄像头在某种像素格式下的帧尺寸和帧间隔，选出能放进屏幕且帧率最高的模式
+ * 缩放和 MJPEG (DCT 缩小一半) 时允许最大到屏幕的两倍，再大只是浪费带宽
+ * 驱动不支持 VIDIOC_ENUM_FRAMESIZES 时返回 -1，保留默认的帧尺寸
+ */
+int v4l2_find_mode(unsigned int pixelformat, v4l2_mode_t *best)
+{
+    struct v4l2_frmsizeenum  fsize;
+    v4l2_mode_t              mode;
+    int                      found = 0;
+    unsigned int             max_w, max_h;
+
+    /* 旋转 90/270 度时按转过来的屏幕尺寸选择 */
+    panel_size(&max_w, &max_h);
+    if(scale_mode != SCALE_NONE || pixelformat == V4L2_PIX_FMT_MJPEG)
+    {
+        max_w *= 2;
+        max_h *= 2;
+    }
+    memset(&fsize, 0, sizeof(fsize));
+    fsize.pixel_format = pixelformat;
+
+    for(fsize.index=0; ioctl(fd_camera, VIDIOC_ENUM_FRAMESIZES, &fsize) == 0; fsize.index++)
+    {
+        if(fsize.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+        {
+            mode.width = fsize.discrete.width;
+            mode.height = fsize.discrete.height;
+        }
+        else
+        {
+            /* 连续或步进的尺寸，取屏幕能放下的最大尺寸 */
+            struct v4l2_frmsize_stepwise  *sw = &fsize.stepwise;
+
+            mode.width = max_w < sw->max_width ? max_w : sw->max_width;
+            mode.height = max_h < sw->max_height ? max_h : sw->max_height;
+            if(sw->step_width > 1)
+                mode.width -= (mode.width - sw->min_width) % sw->step_width;
+            if(sw->step_height > 1)
+                mode.height -= (mode.height - sw->min_height) % sw->step_height;
+        }
+
+        if(mode.width <= max_w && mode.height <= max_h)
+        {
+            mode.interval = v4l2_min_interval(pixelformat, mode.width, mode.height);
+            if(!found || v4l2_mode_better(&mode, best))
+            {
+                *best = mode;
+                found = 1;
+            }
+        }
+
+        if(fsize.type != V4L2_FRMSIZE_TYPE_DISCRETE)
+        {
+            break;
+        }
+    }
+
+    if(!found)
+    {
+        return -1;
+    }
+
+    printf("camera mode %.4s: %ux%u @ %.2f fps\n", (char *)&pixelformat, best->width, best->height,
+            best->interval.numerator ? (double)best->interval.denominator / best->interval.numerator : 0.0);
+
+    return 0;
+}
+
+/* 列举设备支持的数据格式，选出采集格式
+ * 自动选择时优先 MJPEG：USB2 带宽下 640x480 以上只有 MJPEG 能到 30 fps，
+ * 但缩放和旋转只支持 YUYV，指定了缩放或旋转时优先 YUYV
+ */
+int v4l2_enum_format()
+{
+    int                     has_yuyv = 0;
+    int                     has_mjpeg = 0;
+    struct v4l2_fmtdesc     fmtdesc;
+
+    /* 枚举摄像头所支持的所有像素格式以及描述信息 */
+    memset(&fmtdesc, 0, sizeof(fmtdesc));
+    fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    for(fmtdesc.index=0; ioctl(fd_camera, VIDIOC_ENUM_FMT, &fmtdesc) == 0; fmtdesc.index++)
+    {
+        printf("format %u: %.4s %s\n", fmtdesc.index, (char *)&fmtdesc.pixelformat, fmtdesc.description);
+
+        if(fmtdesc.pixelformat == V4L2_PIX_FMT_YUYV)
+        {
+            has_yuyv = 1;
+        }
+        else if(fmtdesc.pixelformat == V4L2_PIX_FMT_MJPEG)
+        {
+            has_mjpeg = 1;
+        }
+    }
+
+#ifndef HAVE_JPEG
+    has_mjpeg = 0;
+#endif
+
+    if(capture_pref == V4L2_PIX_FMT_YUYV && has_yuyv)
+        v4l2_pixfmt = V4L2_PIX_FMT_YUYV;
+    else if(capture_pref == V4L2_PIX_FMT_MJPEG && has_mjpeg)
+        v4l2_pixfmt = V4L2_PIX_FMT_MJPEG;
+    else if(has_mjpeg && (!has_yuyv || (scale_mode == SCALE_NONE && !rotate_angle)))
+        v4l2_pixfmt = V4L2_PIX_FMT_MJPEG;
+    else if(has_yuyv)
+        v4l2_pixfmt = V4L2_PIX_FMT_YUYV;
+    else
+    {
+        printf("%s : device don't support V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_MJPEG\n", __FUNCTION__);
+        return -1;
+    }
+
+    if(v4l2_pixfmt == V4L2_PIX_FMT_MJPEG && (scale_mode != SCALE_NONE || rotate_angle))
+    {
+        printf("scale and rotate only work with YUYV, ignored\n");
+        scale_mode = SCALE_NONE;
+        rotate_angle = 0;
+    }
+
+    printf("capture format %.4s\n", (char *)&v4l2_pixfmt);
+
+    return 0;
+}
+
+/* 按 VIDIOC_G_FMT 报告的颜色空间选颜色矩阵
+ * 驱动没有填 ycbcr_enc/quantization (priv 不是 V4L2_PIX_FMT_PRIV_MAGIC 或者是 DEFAULT) 时按 V4L2 的规则由 colorspace 推出，
+ * BT.2020 和 SMPTE 240M 没有专门的实现，用最接近的 BT.709
+ */
+static const csc_t *csc_from_format(const struct v4l2_pix_format *pix)
+{
+    unsigned int         enc = V4L2_YCBCR_ENC_DEFAULT;
+    unsigned int         quant = V4L2_QUANTIZATION_DEFAULT;
+    int                  bt709, full;
+
+    if(pix->priv == V4L2_PIX_FMT_PRIV_MAGIC)
+    {
+        enc = pix->ycbcr_enc;
+        quant = pix->quantization;
+    }
+    if(enc == V4L2_YCBCR_ENC_DEFAULT)
+        enc = V4L2_MAP_YCBCR_ENC_DEFAULT(pix->colorspace);
+    if(quant == V4L2_QUANTIZATION_DEFAULT)
+        quant = V4L2_MAP_QUANTIZATION_DEFAULT(0, pix->colorspace, enc);
+
+    bt709 = enc != V4L2_YCBCR_ENC_601 && enc != V4L2_YCBCR_ENC_XV601;
+    full = quant == V4L2_QUANTIZATION_FULL_RANGE;
+    return csc_find(bt709 ? (full ? "bt709-full" : "bt709-limited") : (full ? "bt601-full" : "bt601-limited"));
+}
+
+/* 获取帧数据格式
+ * 主要获取帧数据的宽和高用于之后的设置
+ */
+void v4l2_get_format()
+{
+    int                  ret;
+    struct v4l2_format   format;
+
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    ret = ioctl(fd_camera, VIDIOC_G_FMT, &format);
+    if(ret < 0)
+    {
+        printf("%s : VIDIOC_G_FMT error\n", __FUNCTION__);
+    }
+
+    printf("width:%d height:%d\n", format.fmt.pix.width, format.fmt.pix.height);
+
+    /* MJPEG 由 libjpeg 转换，零拷贝时摄像头直接输出 RGB565，都用不到颜色矩阵 */
+    if(ret == 0 && v4l2_pixfmt == V4L2_PIX_FMT_YUYV)
+    {
+        if(!csc_forced)
+            csc_use(csc_from_format(&format.fmt.pix));
+        printf("color matrix: %s%s, colorspace %u\n", csc->name, csc_forced ? " (-C)" : "", format.fmt.pix.colorspace);
+    }
+}
+
+/* 计算帧在屏幕上的显示区域：帧小于屏幕时居中，大于屏幕时裁掉四周
+ * YUYV 两个像素共用一组色度，源的水平偏移和宽度都按偶数像素对齐
+ */
+void compute_view()
+{
+    unsigned int         src_x, src_y;
+    unsigned int         src_w, src_h, roi_offset;
+    unsigned int         panel_w, panel_h;
+    unsigned int         out_w, out_h;
+
+    panel_size(&panel_w, &panel_h);
+
+    /* 用户空间裁剪时只把 frame_roi 当作源，其余部分不读 */
+    src_w = frame_roi.w ? frame_roi.w : frame_mode.width;
+    src_h = frame_roi.w ? frame_roi.h : frame_mode.height;
+    roi_offset = frame_roi.y * frame_stride + frame_roi.x * 2;
+
+    /* 缩放时输出区域由缩放方式决定，整帧作为源 */
+    if(scale_mode != SCALE_NONE)
+    {
+        view_width = panel_w;
+        view_height = panel_h;
+        if(scale_mode == SCALE_FIT)
+        {
+            if(src_w * panel_h > src_h * panel_w)
+                view_height = src_h * panel_w / src_w;
+            else
+                view_width = src_w * panel_h / src_h;
+        }
+        view_src_offset = roi_offset;
+
+        if(scaler_init(&scaler, src_w, src_h, view_width, view_height, scale_bilinear) == 0)
+        {
+            printf("scale %ux%u -> %ux%u, %s\n", src_w, src_h, view_width, view_height,
+                    scale_bilinear ? "bilinear" : "nearest");
+        }
+        else
+        {
+            scale_mode = SCALE_NONE;
+        }
+    }
+
+    if(scale_mode == SCALE_NONE)
+    {
+        view_width = (src_w < panel_w ? src_w : panel_w) & ~1U;
+        view_height = src_h < panel_h ? src_h : panel_h;
+
+        src_x = ((src_w - view_width) / 2) & ~1U;
+        src_y = (src_h - view_height) / 2;
+        view_src_offset = roi_offset + src_y * frame_stride + src_x * 2;
+    }
+
+    /* 输出区域在屏幕上居中，旋转 90/270 度时宽高互换 */
+    if(rotate_angle == 90 || rotate_angle == 270)
+    {
+        out_w = view_height;
+        out_h = view_width;
+    }
+    else
+    {
+        out_w = view_width;
+        out_h = view_height;
+    }
+    view_dst_offset = area_offset(out_w, out_h);
+    osd_layout();
+}
+
+/* 填充要设置的帧格式，RGB565 零拷贝时每行跨度要和显存一致 */
+static void v4l2_fill_format(struct v4l2_format *format, unsigned int pixelformat)
+{
+    memset(format, 0, sizeof(*format));
+    format->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format->fmt.pix.width = frame_mode.width;
+    format->fmt.pix.height = frame_mode.height;
+    format->fmt.pix.pixelformat = pixelformat;
+    format->fmt.pix.field = V4L2_FIELD_INTERLACED;
+
+    if(pixelformat == V4L2_PIX_FMT_RGB565)
+    {
+        format->fmt.pix.bytesperline = fb_line_length;
+    }
+}
+
+/* 数字变焦/感兴趣区域 (-Z)：只要帧中的一块区域
+ * 先让驱动裁剪 (VIDIOC_S_SELECTION，旧驱动用 VIDIOC_S_CROP)，再把格式设成区域的大小，驱动直接传小帧；
+ * 驱动不能裁剪，或者裁剪后帧并没有变小时，恢复整帧，转换时只读区域内的行和列 (用户空间裁剪)
+ */
+/* 解析 -Z 的参数：倍数 (比如 2)，或者整帧坐标中的区域 x,y,w,h */
+int zoom_parse(const char *arg)
+{
+    memset(&zoom_req, 0, sizeof(zoom_req));
+    if(sscanf(arg, "%u,%u,%u,%u", &zoom_req.x, &zoom_req.y, &zoom_req.w, &zoom_req.h) == 4)
+    {
+        if(zoom_req.w < 2 || !zoom_req.h)
+            return -1;
+        zoom_level = 1;
+        return 0;
+    }
+
+    memset(&zoom_req, 0, sizeof(zoom_req));
+    zoom_level = atof(arg);
+    return zoom_level >= 1 ? 0 : -1;
+}
+
+/* 整帧为 width x height 时要的区域，x 和宽度按偶数像素对齐 (YUYV 两个像素一组) */
+static void zoom_roi(rect_t *roi, unsigned int width, unsigned int height)
+{
+    if(zoom_req.w)
+    {
+        *roi = zoom_req;
+        if(roi->x >= width)
+            roi->x = 0;
+        if(roi->y >= height)
+            roi->y = 0;
+        if(roi->w > width - roi->x)
+            roi->w = width - roi->x;
+        if(roi->h > height - roi->y)
+            roi->h = height - roi->y;
+    }
+    else
+    {
+        roi->w = width / zoom_level;
+        roi->h = height / zoom_level;
+        roi->x = (width - roi->w) / 2;
+        roi->y = (height - roi->h) / 2;
+    }
+
+    roi->x &= ~1U;
+    roi->w &= ~1U;
+    if(roi->w < 2)
+        roi->w = 2;
+    if(!roi->h)
+        roi->h = 1;
+}
+
+/* 读当前的采集裁剪区域，坐标是感光器的 */
+static int v4l2_get_crop(rect_t *r)
+{
+    struct v4l2_selection    sel;
+    struct v4l2_crop         crop;
+
+    memset(&sel, 0, sizeof(sel));
+    sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    sel.target = V4L2_SEL_TGT_CROP;
+    if(ioctl(fd_camera, VIDIOC_G_SELECTION, &sel) == 0)
+    {
+        r->x = sel.r.left;
+        r->y = sel.r.top;
+        r->w = sel.r.width;
+        r->h = sel.r.height;
+        return 0;
+    }
+
+    memset(&crop, 0, sizeof(crop));
+    crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if(ioctl(fd_camera, VIDIOC_G_CROP, &crop) == 0)
+    {
+        r->x = crop.c.left;
+        r->y = crop.c.top;
+        r->w = crop.c.width;
+        r->h = crop.c.height;
+        return 0;
+    }
+
+    return -1;
+}
+
+static int v4l2_set_crop(const rect_t *r)
+{
+    struct v4l2_selection    sel;
+    struct v4l2_crop         crop;
+
+    memset(&sel, 0, sizeof(sel));
+    sel.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    sel.target = V4L2_SEL_TGT_CROP;
+    sel.r.left = r->x;
+    sel.r.top = r->y;
+    sel.r.width = r->w;
+    sel.r.height = r->h;
+    if(ioctl(fd_camera, VIDIOC_S_SELECTION, &sel) == 0)
+        return 0;
+
+    memset(&crop, 0, sizeof(crop));
+    crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    crop.c = sel.r;
+    return ioctl(fd_camera, VIDIOC_S_CROP, &crop);
+}
+
+/* 按帧尺寸 width x height 设置格式，更新帧的宽高、行跨度和大小，返回 ioctl 的结果 */
+static int v4l2_set_size(unsigned int width, unsigned int height)
+{
+    struct v4l2_format    format;
+
+    frame_mode.width = width;
+    frame_mode.height = height;
+    v4l2_fill_format(&format, v4l2_pixfmt);
+    if(ioctl(fd_camera, VIDIOC_S_FMT, &format) < 0)
+        return -1;
+
+    frame_mode.width = format.fmt.pix.width;
+    frame_mode.height = format.fmt.pix.height;
+    frame_stride = format.fmt.pix.bytesperline ? format.fmt.pix.bytesperline : frame_mode.width * 2;
+    frame_sizeimage = format.fmt.pix.sizeimage;
+    return 0;
+}
+
+/* 在 VIDIOC_S_FMT 之后、申请帧缓冲区之前调用，结果记在当前摄像头的统计中 */
+void v4l2_set_zoom(void)
+{
+    camera_t         *cam = &cameras[camera_cur];
+    unsigned int     full_w = frame_mode.width;
+    unsigned int     full_h = frame_mode.height;
+    rect_t           roi, cur, crop;
+
+    zoom_roi(&roi, full_w, full_h);
+    cam->zoom = (double)full_w / roi.w;
+    cam->zoom_roi = roi;
+    cam->full_bytes = frame_sizeimage;
+    cam->zoom_crop = ZOOM_NONE;
+
+    if(v4l2_memtype != V4L2_MEMORY_MMAP)
+    {
+        printf("%s : zoom needs mmap capture, show the whole frame\n", __FUNCTION__);
+        goto done;
+    }
+
+    /* 当前帧可能是感光器区域缩小得到的，区域按同样的比例换算到感光器坐标 */
+    if(v4l2_get_crop(&cur) == 0 && cur.w && cur.h)
+    {
+        crop.x = cur.x + (unsigned long long)roi.x * cur.w / full_w;
+        crop.y = cur.y + (unsigned long long)roi.y * cur.h / full_h;
+        crop.w = (unsigned long long)roi.w * cur.w / full_w;
+        crop.h = (unsigned long long)roi.h * cur.h / full_h;
+
+        if(v4l2_set_crop(&crop) == 0)
+        {
+            /* 帧确实变小了才算驱动裁剪，驱动可能把格式调回整帧并缩小裁剪区域 */
+            if(v4l2_set_size(roi.w, roi.h) == 0 && frame_mode.width * frame_mode.height < full_w * full_h)
+            {
+                cam->zoom_crop = ZOOM_SENSOR;
+                if(v4l2_get_crop(&crop) < 0)
+                    crop.w = crop.h = 0;
+                printf("zoom %.2f: sensor crop %ux%u+%u+%u, frame %ux%u, %u of %u bytes/frame\n", cam->zoom,
+                        crop.w, crop.h, crop.x, crop.y, frame_mode.width, frame_mode.height, frame_sizeimage, cam->full_bytes);
+                goto done;
+            }
+
+            v4l2_set_crop(&cur);
+            if(v4l2_set_size(full_w, full_h) < 0)
+                printf("%s : restore %ux%u format error\n", __FUNCTION__, full_w, full_h);
+        }
+    }
+
+    /* MJPEG 是整帧压缩的，没法只解码一块 */
+    if(v4l2_pixfmt != V4L2_PIX_FMT_YUYV)
+    {
+        printf("%s : %.4s frames can only be cropped by the driver, show the whole frame\n", __FUNCTION__,
+                (char *)&v4l2_pixfmt);
+        goto done;
+    }
+
+    frame_roi = roi;
+    cam->zoom_crop = ZOOM_USER;
+    printf("zoom %.2f: driver can't crop, convert %ux%u+%u+%u of %ux%u, %u bytes/frame\n", cam->zoom,
+            roi.w, roi.h, roi.x, roi.y, full_w, full_h, frame_sizeimage);
+
+done:
+    cam->zoom_bytes = frame_sizeimage;
+}
+
+/* 设置帧数据格式 */
+void v4l2_set_format()
+{
+    int                   ret;
+    struct v4l2_format    format;
+
+    v4l2_fill_format(&format, v4l2_pixfmt);
+
+    ret = ioctl(fd_camera, VIDIOC_S_FMT, &format);
+    if(ret <  0)
+    {
+        printf("%s : VIDIOC_S_FMT error\n", __FUNCTION__);
+        return;
+    }
+
+    /* 驱动可能调整尺寸，以实际设置的为准 */
+    frame_mode.width = format.fmt.pix.width;
+    frame_mode.height = format.fmt.pix.height;
+    frame_stride = format.fmt.pix.bytesperline ? format.fmt.pix.bytesperline : frame_mode.width * 2;
+    frame_sizeimage = format.fmt.pix.sizeimage;
+
+    memset(&frame_roi, 0, sizeof(frame_roi));
+    if(zoom_level)
+        v4l2_set_zoom();
+
+    /* 按选中模式的帧间隔设置帧率 */
+    if(frame_mode.interval.denominator)
+    {
+        struct v4l2_streamparm  parm;
+
+        memset(&parm, 0, sizeof(parm));
+        parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        parm.parm.capture.timeperframe = frame_mode.interval;
+        if(ioctl(fd_camera, VIDIOC_S_PARM, &parm) < 0)
+        {
+            printf("%s : VIDIOC_S_PARM error\n", __FUNCTION__);
+        }
+    }
+
+#ifdef HAVE_JPEG
+    if(v4l2_pixfmt == V4L2_PIX_FMT_MJPEG)
+    {
+        mjpeg_setup();
+        return;
+    }
+#endif
+
+    compute_view();
+}
+
+/* 检查能否零拷贝：摄像头直接输出 RGB565，用 USERPTR 方式把显存页作为帧缓冲区
+ * 要求摄像头支持 RGB565 和 USERPTR，帧不大于屏幕，每行跨度等于显存行跨度，
+ * 并且显存有和帧缓冲区一样多的页可以翻页显示
+ */
+int v4l2_setup_zero_copy()
+{
+    struct v4l2_format          format;
+    struct v4l2_requestbuffers  req;
+    v4l2_mode_t                 mode;
+
+    if(fb_pages < buffer_cnt)
+    {
+        printf("%s : need %u framebuffer pages, got %u\n", __FUNCTION__, buffer_cnt, fb_pages);
+        return -1;
+    }
+
+    /* 摄像头写的是 rgb565，显存也必须是 rgb565 */
+    if(fb_fmt != FB_FMT_rgb565)
+    {
+        printf("%s : framebuffer format %s isn't rgb565\n", __FUNCTION__, fb_format->name);
+        return -1;
+    }
+
+    if(!v4l2_support_format(V4L2_PIX_FMT_RGB565))
+    {
+        printf("%s : device don't support V4L2_PIX_FMT_RGB565\n", __FUNCTION__);
+        return -2;
+    }
+
+    mode = frame_mode;
+    v4l2_find_mode(V4L2_PIX_FMT_RGB565, &mode);
+    v4l2_fill_format(&format, V4L2_PIX_FMT_RGB565);
+    format.fmt.pix.width = mode.width;
+    format.fmt.pix.height = mode.height;
+    if(ioctl(fd_camera, VIDIOC_TRY_FMT, &format) < 0 ||
+       format.fmt.pix.pixelformat != V4L2_PIX_FMT_RGB565 ||
+       format.fmt.pix.width > fb_vinfo.xres || format.fmt.pix.height > fb_vinfo.yres ||
+       format.fmt.pix.bytesperline != fb_line_length)
+    {
+        printf("%s : RGB565 %ux%u stride %u doesn't fit framebuffer stride %u\n", __FUNCTION__,
+                format.fmt.pix.width, format.fmt.pix.height, format.fmt.pix.bytesperline, fb_line_length);
+        return -3;
+    }
+
+    /* count 为 0 只检查驱动是否支持 USERPTR，不分配缓冲区 */
+    memset(&req, 0, sizeof(req));
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_USERPTR;
+    if(ioctl(fd_camera, VIDIOC_REQBUFS, &req) < 0)
+    {
+        printf("%s : device don't support V4L2_MEMORY_USERPTR\n", __FUNCTION__);
+        return -4;
+    }
+
+    v4l2_pixfmt = V4L2_PIX_FMT_RGB565;
+    v4l2_memtype = V4L2_MEMORY_USERPTR;
+    frame_mode = mode;
+
+    return 0;
+}
+
+/* 申请帧数据缓冲区 */
+void v4l2_require_buffer()
+{
+    int                         ret;
+    struct v4l2_requestbuffers  req;
+
+    memset(&req, 0, sizeof(req));
+    req.count = buffer_cnt;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = v4l2_memtype;
+
+    ret = ioctl(fd_camera, VIDIOC_REQBUFS, &req);
+    if(ret < 0)
+    {
+        printf("%s : VIDIOC_REQBUFS error\n", __FUNCTION__);
+        return;
+    }
+
+    /* 驱动可能调整 buffer 个数，MMAP 方式按实际分配的个数使用 */
+    if(req.count && req.count != buffer_cnt && req.count <= BUFFER_MAX && v4l2_memtype == V4L2_MEMORY_MMAP)
+    {
+        buffer_cnt = req.count;
+    }
+}
+
+/* 查询申请到的 buffer 信息，并映射到用户空间 */
+int v4l2_query_buffer()
+{
+    int                  ret;
+    unsigned int         count;
+    struct v4l2_buffer   buf;
+
+    /* 分配 buffer_cnt 个大小为 v4l2_buffer_unit 结构体大小的 buffer */
+    buffer_unit = calloc(buffer_cnt, sizeof(*buffer_unit));
+    if(!buffer_unit)
+    {
+        printf("%s : calloc buffer_unit error\n", __FUNCTION__);
+        return -3;
+    }
+
+    /* USERPTR 方式不需要映射，第 i 个 buffer 就是第 i 页显存 */
+    if(v4l2_memtype == V4L2_MEMORY_USERPTR)
+    {
+        for(count=0; count<buffer_cnt; count++)
+        {
+            buffer_unit[count].start = fb_page_buffer(count) + view_dst_offset;
+            buffer_unit[count].length = frame_sizeimage;
+        }
+
+        return 0;
+    }
+
+    /* 获取之前申请的 v4l2_requestbuffers 的信息
+     * 并将这些信息传给用户空间的 buffer_unit
+     * 然后将 buffer_unit 映射到内核中申请的 buffer 上去
+     * 映射过程是按照，申请 buffer 的编号一个一个映射
+     */
+    for(count=0; count<buffer_cnt; count++)
+    {
+        memset(&buf,0,sizeof(buf));
+
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = count;
+
+        ret = ioctl(fd_camera, VIDIOC_QUERYBUF, &buf);
+        if(ret < 0)
+        {
+            printf("%s : VIDIOC_QUERYBUF error\n", __FUNCTION__);
+            return -1;
+        }
+
+        buffer_unit[count].length = buf.length;
+        buffer_unit[count].start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_camera, buf.m.offset);
+
+        if (MAP_FAILED == buffer_unit[count].start)
+        {
+            printf("%s : mmap buffer_unit error\n", __FUNCTION__);
+            return -2;
+        }
+
+    }
+
+    return 0;
+}
+
+int v4l2_qbuf(unsigned int index);
+static int v4l2_qbuf_unlocked(unsigned int index);
+
+/* 开始视频数据采集，并将 buffer 入队
+ * 看门狗重启采集时，零拷贝正在显示的页和流水线中正在转换的 buffer 还在用，不入队，由持有者用完后再还给驱动
+ * 调用者要持有 qbuf_lock，或者还没有别的线程在还 buffer
+ */
+int v4l2_stream_on()
+{
+    unsigned int            i;
+    int                     ret;
+    enum  v4l2_buf_type     type;
+
+    for(i=0; i<buffer_cnt; i++)
+    {
+        if(!buffer_unit[i].held && v4l2_qbuf_unlocked(i) < 0)
+        {
+            return -1;
+        }
+    }
+
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ret = ioctl(fd_camera, VIDIOC_STREAMON, &type);
+    if(ret < 0)
+    {
+        printf("%s : VIDIOC_STREAMON error\n", __FUNCTION__);
+        return -2;
+    }
+
+    return 0;
+}
+
+#ifdef HAVE_JPEG
+void recorder_submit(const struct v4l2_buffer *buffer);
+#endif
+
+/* 共享内存帧环：把每个摄像头取到的帧拷进 POSIX 共享内存，给本机的其他进程用 (见 frame_ring.h 和 frame_reader.c)，
+ * 发布不等读端，读端跟不上时自己跳帧；第 i (>0) 个摄像头的名字加上 ".i"
+ */
+#define SHM_SLOTS        4
+
+char                       *shm_name = NULL;    /* -S 指定的共享内存名，NULL 表示不发布 */
+int                        shm_dmabuf = 0;      /* 同时用 VIDIOC_EXPBUF 导出采集缓冲区的 DMABUF */
+frame_ring_t               shm_ring[CAMERA_MAX];
+int                        shm_ready[CAMERA_MAX];
+
+/* 为当前摄像头创建帧环，在 v4l2_query_buffer 之后调用
+ * 导出 DMABUF 失败不算错误，读端仍然可以读共享内存中的拷贝
+ */
+int shm_setup(void)
+{
+    frame_ring_t               *ring = &shm_ring[camera_cur];
+    struct v4l2_exportbuffer   exp;
+    char                       name[64];
+    int                        fds[BUFFER_MAX];
+    unsigned int               lens[BUFFER_MAX];
+    unsigned int               i, j;
+
+    if(camera_cur)
+        snprintf(name, sizeof(name), "%s.%u", shm_name, camera_cur);
+    else
+        snprintf(name, sizeof(name), "%s", shm_name);
+
+    if(frame_ring_create(ring, name, SHM_SLOTS, frame_mode.width, frame_mode.height, v4l2_pixfmt,
+                v4l2_pixfmt == V4L2_PIX_FMT_MJPEG ? 0 : frame_stride, frame_sizeimage) < 0)
+        return -1;
+    shm_ready[camera_cur] = 1;
+
+    if(shm_dmabuf && v4l2_memtype != V4L2_MEMORY_MMAP)
+    {
+        printf("DMABUF export needs mmap capture buffers, share copies only\n");
+    }
+    else if(shm_dmabuf)
+    {
+        for(i=0; i<buffer_cnt; i++)
+        {
+            memset(&exp, 0, sizeof(exp));
+            exp.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            exp.index = i;
+            exp.flags = O_RDONLY | O_CLOEXEC;
+            if(ioctl(fd_camera, VIDIOC_EXPBUF, &exp) < 0)
+            {
+                printf("%s : VIDIOC_EXPBUF error, share copies only\n", __FUNCTION__);
+                for(j=0; j<i; j++)
+                    close(fds[j]);
+                break;
+            }
+            fds[i] = exp.fd;
+            lens[i] = buffer_unit[i].length;
+        }
+
+        if(i == buffer_cnt)
+            frame_ring_export(ring, fds, lens, buffer_cnt);
+    }
+
+    printf("share '%s' frames in %s, %d slots%s\n", camera_dev, name, ring->hdr->slot_cnt,
+            ring->hdr->buf_cnt ? " and DMABUF" : "");
+
+    return 0;
+}
+
+void shm_destroy(void)
+{
+    unsigned int         i;
+
+    for(i=0; i<CAMERA_MAX; i++)
+    {
+        if(shm_ready[i])
+            frame_ring_destroy(&shm_ring[i]);
+        shm_ready[i] = 0;
+    }
+}
+
+/* 从帧缓冲队列中取出一个填好数据的 buffer */
+int v4l2_dqbuf(struct v4l2_buffer *buffer)
+{
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer->memory = v4l2_memtype;
+
+    if(ioctl(fd_camera, VIDIOC_DQBUF, buffer) < 0)
+    {
+        /* 摄像头以非阻塞方式打开，没有就绪的 buffer 时返回 EAGAIN */
+        if(errno != EAGAIN)
+            printf("%s : VIDIOC_DQBUF error\n", __FUNCTION__);
+        return -1;
+    }
+
+    /* 如果 buffer.index < buffer_cnt 为假，则会打印
+    * 因为，之前只开辟了 buffer_cnt 个 buffer_uint，编号从 0 开始
+    */
+    assert(buffer->index < buffer_cnt);
+    buffer_unit[buffer->index].bytesused = buffer->bytesused;
+    buffer_unit[buffer->index].held = 1;
+    cameras[camera_cur].frames++;
+    frame_stat_dqbuf(buffer);
+    if(shm_ready[camera_cur])
+        frame_ring_publish(&shm_ring[camera_cur], buffer_unit[buffer->index].start, buffer->bytesused, buffer->sequence,
+                buffer->timestamp.tv_sec * 1000000000ULL + buffer->timestamp.tv_usec * 1000ULL, buffer->index);
+#ifdef HAVE_JPEG
+    if(camera_cur == 0)
+        recorder_submit(buffer);
+#endif
+
+    return 0;
+}
+
+/* 低延迟模式：取出一个 buffer 后，继续用非阻塞的 DQBUF 取出所有已经就绪的 buffer，
+ * 只留下最新的一帧，其余的马上还给驱动，避免慢了一帧之后一直显示积压的旧帧
+ */
+int v4l2_dqbuf_latest(struct v4l2_buffer *buffer)
+{
+    struct v4l2_buffer   next;
+
+    if(v4l2_dqbuf(buffer) < 0)
+    {
+        return -1;
+    }
+
+    while(low_latency && v4l2_dqbuf(&next) == 0)
+    {
+        v4l2_qbuf(buffer->index);
+        *buffer = next;
+        frame_stat.skipped++;
+    }
+
+    return 0;
+}
+
+/* 流水线中转换线程还 buffer 和采集线程重启采集互斥，重启时知道哪些 buffer 还在用户空间 */
+pthread_mutex_t            qbuf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 把用完的 buffer 还给驱动 */
+static int v4l2_qbuf_unlocked(unsigned int index)
+{
+    struct v4l2_buffer   buffer;
+
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = v4l2_memtype;
+    buffer.index = index;
+
+    if(v4l2_memtype == V4L2_MEMORY_USERPTR)
+    {
+        buffer.m.userptr = (unsigned long)buffer_unit[index].start;
+        buffer.length = buffer_unit[index].length;
+    }
+
+    /* 驱动要往这个 buffer 里写了，导出的 DMABUF 中的帧从此无效 */
+    if(shm_ready[camera_cur])
+        frame_ring_release(&shm_ring[camera_cur], index);
+
+    if(ioctl(fd_camera, VIDIOC_QBUF, &buffer) < 0)
+    {
+        printf("%s : VIDIOC_QBUF error\n", __FUNCTION__);
+        return -1;
+    }
+    buffer_unit[index].held = 0;
+
+    return 0;
+}
+
+int v4l2_qbuf(unsigned int index)
+{
+    int                  ret;
+
+    pthread_mutex_lock(&qbuf_lock);
+    ret = v4l2_qbuf_unlocked(index);
+    pthread_mutex_unlock(&qbuf_lock);
+
+    return ret;
+}
+
+/* 从帧缓冲队列中取出一个缓冲区数据，并显示到屏幕上 */
+int v4l2_dequeue_buffer()
+{
+    struct v4l2_buffer   buffer;
+    unsigned int         page;
+
+    if(v4l2_dqbuf_latest(&buffer) < 0)
+    {
+        return -1;
+    }
+
+    /* 零拷贝：摄像头已经把帧写进了第 index 页显存，直接翻页显示
+     * 上一帧所在的页离开屏幕后才还给驱动，等待垂直同步 (-w) 可以避免还回去的页还在扫描
+     */
+    if(v4l2_memtype == V4L2_MEMORY_USERPTR)
+    {
+        frame_stat_converted(buffer.index, buffer.index);
+        fb_present(buffer.index);
+        if(zc_shown >= 0)
+        {
+            v4l2_qbuf(zc_shown);
+        }
+        zc_shown = buffer.index;
+
+        return 0;
+    }
+
+    /* 将数据转换格式后，直接按显存的行跨度写到屏幕 frame buffer 中
+     * RGB565 一个像素占 2 个字节，YUYV 一行占 frame_stride 字节
+     * 需要缩放时边缩放边转换，MJPEG 直接解码成 RGB565，双缓冲时写入后台页，写完再翻页显示
+     * 解码失败的帧不翻页，屏幕上保留上一帧
+     */
+    page = fb_back;
+    fb_sync_cameras(page);
+    if(render_frame(&buffer_unit[buffer.index], page) == 0)
+    {
+        frame_stat_converted(buffer.index, page);
+        fb_flip();
+        cameras[camera_cur].page_shown[page] = ++cameras[camera_cur].shown;
+    }
+    else
+    {
+        /* 这一页上画了一半，其他摄像头画这一页前要从前台页补上 */
+        cameras[camera_cur].page_shown[page] = cameras[camera_cur].shown - 1;
+    }
+
+    v4l2_qbuf(buffer.index);
+
+    return 0;
+}
+
+/* 事件循环：epoll 同时等待所有摄像头的帧、定时器和信号
+ * 定时器每 TICK_MS 触发一次看门狗，摄像头超过 WATCHDOG_MS 没有新帧时重启它的采集，而不是退出
+ * 流水线模式的采集线程用同样的 epoll 集合和看门狗
+ */
+#define TICK_MS         500
+#define WATCHDOG_MS     2000
+
+enum
+{
+    EVENT_TIMER = CAMERA_MAX,       /* epoll 事件的 data.u32，小于 CAMERA_MAX 的是摄像头编号 */
+    EVENT_SIGNAL,
+    EVENT_DRM,                      /* DRM 翻页完成事件 */
+};
+
+int v4l2_stream_off();
+
+static int event_watch(int epfd, int fd, unsigned int id)
+{
+    struct epoll_event   ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = id;
+
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* 重启当前摄像头的采集：STREAMOFF 让驱动中的 buffer 都回到用户空间，再把它们入队并 STREAMON
+ * 还在用户空间用着的 buffer (零拷贝正在显示的页，流水线中正在转换的帧) 不入队，驱动不会写它们
+ * 失败时 (比如设备暂时不可用) 等下一个看门狗周期再试
+ */
+static void camera_recover(int epfd)
+{
+    camera_t             *cam = &cameras[camera_cur];
+    int                  ret;
+
+    cam->recoveries++;
+    printf("%s : no frame from '%s' for %.1f s, restart streaming (%lu)\n", __FUNCTION__, camera_dev,
+            (now_ns() - cam->last_frame_ns) / 1e9, cam->recoveries);
+
+    cam->last_frame_ns = now_ns();
+
+    /* 上次重启失败时可能已经有一部分 buffer 入队了，不管是否在采集都先 STREAMOFF 收回来
+     * 驱动重新从 0 开始编号
+     */
+    pthread_mutex_lock(&qbuf_lock);
+    v4l2_stream_off();
+    frame_stat.last_sequence = -1;
+    ret = v4l2_stream_on();
+    pthread_mutex_unlock(&qbuf_lock);
+
+    cam->streaming = ret == 0;
+    if(ret < 0)
+        return;
+
+    if(!cam->polled && event_watch(epfd, fd_camera, camera_cur) == 0)
+        cam->polled = 1;
+}
+
+/* 收到 SIGINT/SIGTERM 时返回 0，由调用者停止采集并释放资源 */
+int v4l2_event_loop()
+{
+    struct epoll_event   events[CAMERA_MAX + 3];
+    struct itimerspec    its;
+    unsigned long long   ticks;
+    camera_t             *cam;
+    unsigned int         i, id;
+    int                  epfd, tfd;
+    int                  n, k;
+    int                  rv = -1;
+    double               now;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(epfd < 0 || tfd < 0)
+    {
+        printf("%s : epoll/timerfd create error: %s\n", __FUNCTION__, strerror(errno));
+        goto cleanup;
+    }
+
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_nsec = TICK_MS * 1000000L;
+    its.it_value = its.it_interval;
+    if(timerfd_settime(tfd, 0, &its, NULL) < 0 || event_watch(epfd, tfd, EVENT_TIMER) < 0 ||
+       (signal_fd >= 0 && event_watch(epfd, signal_fd, EVENT_SIGNAL) < 0))
+    {
+        printf("%s : watch timer/signal error: %s\n", __FUNCTION__, strerror(errno));
+        goto cleanup;
+    }
+
+#ifdef HAVE_DRM
+    /* 三页轮流时不等翻页完成，完成事件在这里读出 */
+    if(drm.fd >= 0 && event_watch(epfd, drm.fd, EVENT_DRM) < 0)
+    {
+        printf("%s : watch drm error: %s\n", __FUNCTION__, strerror(errno));
+        goto cleanup;
+    }
+#endif
+
+    /* 只有一个摄像头时没有切换过，当前摄像头的 fd 等还只在全局变量中 */
+    camera_store(&cameras[camera_cur]);
+
+    now = now_ns();
+    for(i=0; i<camera_cnt; i++)
+    {
+        cameras[i].last_frame_ns = now;
+        cameras[i].polled = event_watch(epfd, cameras[i].fd, i) == 0;
+    }
+
+    while(!stop_request)
+    {
+        n = epoll_wait(epfd, events, CAMERA_MAX + 3, -1);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            printf("%s : epoll_wait error: %s\n", __FUNCTION__, strerror(errno));
+            goto cleanup;
+        }
+
+        for(k=0; k<n; k++)
+        {
+            id = events[k].data.u32;
+            if(id == EVENT_SIGNAL)
+            {
+                signal_read();
+            }
+#ifdef HAVE_DRM
+            else if(id == EVENT_DRM)
+            {
+                drm_handle_events();
+            }
+#endif
+            else if(id == EVENT_TIMER)
+            {
+                if(read(tfd, &ticks, sizeof(ticks)) < 0 && errno != EAGAIN)
+                    printf("%s : read timerfd error\n", __FUNCTION__);
+
+                now = now_ns();
+                for(i=0; i<camera_cnt; i++)
+                {
+                    if(now - cameras[i].last_frame_ns >= WATCHDOG_MS * 1e6)
+                    {
+                        camera_switch(i);
+                        camera_recover(epfd);
+                    }
+                }
+            }
+            else
+            {
+                cam = &cameras[id];
+                camera_switch(id);
+
+                /* 出错时 (比如 USB 摄像头掉线) fd 会一直就绪，先不再监听，由看门狗重启采集 */
+                if(events[k].events & (EPOLLERR | EPOLLHUP))
+                {
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, fd_camera, NULL);
+                    cam->polled = 0;
+                    continue;
+                }
+
+                if(v4l2_dequeue_buffer() == 0)
+                    cam->last_frame_ns = now_ns();
+            }
+        }
+
+        frame_stat_poll();
+    }
+    rv = 0;
+
+cleanup:
+    if(tfd >= 0)
+        close(tfd);
+    if(epfd >= 0)
+        close(epfd);
+
+    return rv;
+}
+
+/* 单生产者单消费者的有界队列，元素是 V4L2 buffer 或显存页的编号
+ * 生产者只写 tail，消费者只写 head，不需要加锁；items 信号量用来让消费者睡眠等待
+ * 队列里流动的编号总数不超过 buffer 数和显存页数，所以不会写满
+ */
+#define QUEUE_SIZE      32
+
+typedef struct spsc_queue_s
+{
+    int              slot[QUEUE_SIZE];
+    atomic_uint      head;
+    atomic_uint      tail;
+    sem_t            items;
+} spsc_queue_t;
+
+static void queue_init(spsc_queue_t *q)
+{
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    sem_init(&q->items, 0, 0);
+}
+
+static void queue_push(spsc_queue_t *q, int value)
+{
+    unsigned int     tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    assert(tail - atomic_load_explicit(&q->head, memory_order_acquire) < QUEUE_SIZE);
+
+    q->slot[tail % QUEUE_SIZE] = value;
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    sem_post(&q->items);
+}
+
+/* 不等待的出队，队列为空时返回 -1 */
+static int queue_trypop(spsc_queue_t *q, int *value)
+{
+    unsigned int     head;
+
+    if(sem_trywait(&q->items) < 0)
+        return -1;
+
+    head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    *value = q->slot[head % QUEUE_SIZE];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    return 0;
+}
+
+static int queue_pop(spsc_queue_t *q)
+{
+    unsigned int     head;
+    int              value;
+
+    while(sem_wait(&q->items) < 0 && errno == EINTR)
+        ;
+
+    head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    assert(head != atomic_load_explicit(&q->tail, memory_order_acquire));
+
+    value = q->slot[head % QUEUE_SIZE];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    return value;
+}
+
+/* 转换线程池的一个工作线程，每帧负责一段水平条带 */
+typedef struct stripe_worker_s
+{
+    pthread_t            tid;
+    sem_t                start;
+    const unsigned char  *frame;
+    unsigned char        *page;
+    unsigned int         y0, y1;
+    luma_stat_t          luma;          /* 本线程条带的亮度统计 */
+} stripe_worker_t;
+
+/* 流水线的三个阶段之间通过队列传递编号
+ * captured: 采集 -> 转换，已填好数据的 V4L2 buffer
+ * display:  转换 -> 显示，已画好的显存页
+ * free:     显示 -> 转换，可以重新绘制的显存页
+ * 编号为 -1 表示流水线结束
+ */
+static struct
+{
+    spsc_queue_t         captured;
+    spsc_queue_t         display;
+    spsc_queue_t         free;
+    stripe_worker_t      *workers;
+    unsigned int         worker_cnt;
+    sem_t                stripes_done;
+    int                  quit;
+} pipe_ctx;
+
+static void *stripe_worker_thread(void *arg)
+{
+    stripe_worker_t      *worker = arg;
+
+    if(luma_enabled)
+        luma_acc = &worker->luma;
+
+    while(1)
+    {
+        while(sem_wait(&worker->start) < 0 && errno == EINTR)
+            ;
+
+        if(pipe_ctx.quit)
+            break;
+
+        render_rows(worker->frame, worker->page, worker->y0, worker->y1);
+        sem_post(&pipe_ctx.stripes_done);
+    }
+
+    return NULL;
+}
+
+/* 把一帧按行分成 worker_cnt+1 个条带，工作线程各转一段，转换线程自己转最后一段 */
+static void convert_frame_striped(const unsigned char *frame, unsigned char *page)
+{
+    unsigned int         stripes = pipe_ctx.worker_cnt + 1;
+    unsigned int         rows = view_height / stripes;
+    unsigned int         row = 0;
+    unsigned int         i;
+
+    /* 文字在分出条带前更新，工作线程画的时候不会变 */
+    osd_update();
+
+    for(i=0; i<pipe_ctx.worker_cnt; i++, row += rows)
+    {
+        pipe_ctx.workers[i].frame = frame;
+        pipe_ctx.workers[i].page = page;
+        pipe_ctx.workers[i].y0 = row;
+        pipe_ctx.workers[i].y1 = row + rows;
+        if(luma_enabled)
+            memset(&pipe_ctx.workers[i].luma, 0, sizeof(luma_stat_t));
+        sem_post(&pipe_ctx.workers[i].start);
+    }
+
+    luma_begin();
+    render_rows(frame, page, row, view_height);
+
+    for(i=0; i<pipe_ctx.worker_cnt; i++)
+    {
+        while(sem_wait(&pipe_ctx.stripes_done) < 0 && errno == EINTR)
+            ;
+    }
+
+    for(i=0; luma_enabled && i<pipe_ctx.worker_cnt; i++)
+        luma_merge(&luma_frame, &pipe_ctx.workers[i].luma);
+    luma_end();
+}
+
+/* 采集阶段：等待并取出帧，交给转换阶段
+ * 和事件循环一样用 epoll 等待摄像头、定时器和信号，摄像头没有帧时由看门狗重启采集，而不是退出
+ */
+static void *capture_thread(void *arg)
+{
+    struct epoll_event   events[3];
+    struct itimerspec    its;
+    struct v4l2_buffer   buffer;
+    unsigned long long   ticks;
+    camera_t             *cam = &cameras[camera_cur];
+    int                  epfd, tfd;
+    int                  n, k;
+
+    (void)arg;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(epfd < 0 || tfd < 0)
+    {
+        printf("%s : epoll/timerfd create error: %s\n", __FUNCTION__, strerror(errno));
+        goto cleanup;
+    }
+
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_nsec = TICK_MS * 1000000L;
+    its.it_value = its.it_interval;
+    if(timerfd_settime(tfd, 0, &its, NULL) < 0 || event_watch(epfd, tfd, EVENT_TIMER) < 0 ||
+       (signal_fd >= 0 && event_watch(epfd, signal_fd, EVENT_SIGNAL) < 0))
+    {
+        printf("%s : watch timer/signal error: %s\n", __FUNCTION__, strerror(errno));
+        goto cleanup;
+    }
+
+    cam->last_frame_ns = now_ns();
+    cam->polled = event_watch(epfd, fd_camera, camera_cur) == 0;
+
+    while(!stop_request)
+    {
+        n = epoll_wait(epfd, events, 3, -1);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            printf("%s : epoll_wait error: %s\n", __FUNCTION__, strerror(errno));
+            break;
+        }
+
+        for(k=0; k<n; k++)
+        {
+            if(events[k].data.u32 == EVENT_SIGNAL)
+            {
+                signal_read();
+            }
+            else if(events[k].data.u32 == EVENT_TIMER)
+            {
+                if(read(tfd, &ticks, sizeof(ticks)) < 0 && errno != EAGAIN)
+                    printf("%s : read timerfd error\n", __FUNCTION__);
+
+                if(now_ns() - cam->last_frame_ns >= WATCHDOG_MS * 1e6)
+                    camera_recover(epfd);
+            }
+            else if(events[k].events & (EPOLLERR | EPOLLHUP))
+            {
+                /* 出错的 fd 会一直就绪，先不再监听，由看门狗重启采集 */
+                epoll_ctl(epfd, EPOLL_CTL_DEL, fd_camera, NULL);
+                cam->polled = 0;
+            }
+            else if(v4l2_dqbuf(&buffer) == 0)
+            {
+                cam->last_frame_ns = now_ns();
+                queue_push(&pipe_ctx.captured, buffer.index);
+            }
+        }
+
+        frame_stat_poll();
+    }
+
+cleanup:
+    if(tfd >= 0)
+        close(tfd);
+    if(epfd >= 0)
+        close(epfd);
+
+    queue_push(&pipe_ctx.captured, -1);
+    return NULL;
+}
+
+/* 转换阶段：拿到一个空闲显存页后转换，转换完立刻把 buffer 还给驱动 */
+static void *convert_thread(void *arg)
+{
+    int                  index;
+    int                  next;
+    int                  page;
+    int                  ret;
+    int                  end = 0;
+
+    (void)arg;
+
+    while((index = queue_pop(&pipe_ctx.captured)) >= 0)
+    {
+        page = queue_pop(&pipe_ctx.free);
+
+        /* 低延迟模式：等到空闲页后，队列里积压的帧只转换最新的一帧，其余还给驱动 */
+        while(low_latency && queue_trypop(&pipe_ctx.captured, &next) == 0)
+        {
+            if(next < 0)
+            {
+                end = 1;
+                break;
+            }
+            v4l2_qbuf(index);
+            index = next;
+            frame_stat.skipped++;
+        }
+
+        /* JPEG 的熵解码是串行的，MJPEG 帧不分条带，解码失败的帧不显示
+         * 局部重画只转换变化的块，也不分条带
+         */
+        if(v4l2_pixfmt == V4L2_PIX_FMT_MJPEG || damage.threshold >= 0)
+        {
+            ret = render_frame(&buffer_unit[index], page);
+        }
+        else
+        {
+            convert_frame_striped(buffer_unit[index].start, fb_page_buffer(page));
+            ret = 0;
+        }
+        if(ret == 0)
+            frame_stat_converted(index, page);
+        v4l2_qbuf(index);
+
+        queue_push(ret == 0 ? &pipe_ctx.display : &pipe_ctx.free, page);
+        if(end)
+            break;
+    }
+
+    queue_push(&pipe_ctx.display, -1);
+    return NULL;
+}
+
+/* 显示阶段：翻页显示，之前的前台页交回转换阶段重新绘制 */
+static void *display_thread(void *arg)
+{
+    int                  page;
+    int                  front = 0;
+
+    (void)arg;
+
+    while((page = queue_pop(&pipe_ctx.display)) >= 0)
+    {
+        fb_present(page);
+
+        /* 单缓冲时只有一页，显示后就可以继续绘制 */
+        if(fb_pages > 1)
+        {
+            queue_push(&pipe_ctx.free, front);
+            front = page;
+        }
+        else
+        {
+            queue_push(&pipe_ctx.free, page);
+        }
+    }
+
+    return NULL;
+}
+
+/* 流水线模式：采集、转换、显示分别在独立线程中运行
+ * threads 为转换线程总数，0 表示每个在线 CPU 一个
+ */
+int v4l2_pipeline(int threads)
+{
+    pthread_t            tid[3];
+    unsigned int         i;
+
+    if(threads <= 0)
+    {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if(threads <= 0)
+            threads = 1;
+    }
+
+    queue_init(&pipe_ctx.captured);
+    queue_init(&pipe_ctx.display);
+    queue_init(&pipe_ctx.free);
+    sem_init(&pipe_ctx.stripes_done, 0, 0);
+    pipe_ctx.quit = 0;
+
+    /* 多缓冲时第 0 页在前台，其余的页可以先画 */
+    if(fb_pages > 1)
+    {
+        for(i=1; i<fb_pages; i++)
+            queue_push(&pipe_ctx.free, i);
+    }
+    else
+    {
+        queue_push(&pipe_ctx.free, 0);
+    }
+
+    pipe_ctx.worker_cnt = threads - 1;
+    pipe_ctx.workers = calloc(threads, sizeof(*pipe_ctx.workers));
+    if(!pipe_ctx.workers)
+    {
+        printf("%s : calloc workers error\n", __FUNCTION__);
+        return -1;
+    }
+
+    for(i=0; i<pipe_ctx.worker_cnt; i++)
+    {
+        sem_init(&pipe_ctx.workers[i].start, 0, 0);
+        pthread_create(&pipe_ctx.workers[i].tid, NULL, stripe_worker_thread, &pipe_ctx.workers[i]);
+    }
+
+    printf("pipeline: %d convert thread(s)\n", threads);
+
+    pthread_create(&tid[0], NULL, capture_thread, NULL);
+    pthread_create(&tid[1], NULL, convert_thread, NULL);
+    pthread_create(&tid[2], NULL, display_thread, NULL);
+
+    for(i=0; i<3; i++)
+        pthread_join(tid[i], NULL);
+
+    pipe_ctx.quit = 1;
+    for(i=0; i<pipe_ctx.worker_cnt; i++)
+    {
+        sem_post(&pipe_ctx.workers[i].start);
+        pthread_join(pipe_ctx.workers[i].tid, NULL);
+        sem_destroy(&pipe_ctx.workers[i].start);
+    }
+
+    free(pipe_ctx.workers);
+    sem_destroy(&pipe_ctx.stripes_done);
+
+    return 0;
+}
+
+#ifdef HAVE_JPEG
+/* 后台录像：预览的同时把帧压缩成 MJPEG 写进 AVI 文件
+ * 取出帧后复制到一个空闲的录像槽，经有界队列交给编码线程，预览的 buffer 马上还给驱动；
+ * 没有空闲槽时丢掉这一帧的录像，预览不受影响
+ * YUYV 帧由编码线程压缩成 4:2:2 的 JPEG，MJPEG 帧原样写入
+ * 文件按 REC_WRITE_SIZE 大小的对齐缓冲区整块写入，结束时补写索引和文件头
+ */
+#define REC_SLOTS       8
+#define REC_QUALITY     80
+#define REC_WRITE_SIZE  (256 * 1024)
+#define REC_MAX_BYTES   (2000UL * 1024 * 1024)   /* AVI 1.0 的 RIFF 大小是 32 位，留出余量 */
+
+/* 队列中的元素个数 */
+static unsigned int queue_depth(spsc_queue_t *q)
+{
+    return atomic_load_explicit(&q->tail, memory_order_acquire) - atomic_load_explicit(&q->head, memory_order_acquire);
+}
+
+typedef struct avi_header_s
+{
+    char        riff[4];
+    uint32_t    riff_size;
+    char        avi[4];
+    char        list_hdrl[4];
+    uint32_t    hdrl_size;
+    char        hdrl[4];
+
+    char        avih[4];
+    uint32_t    avih_size;
+    uint32_t    us_per_frame;
+    uint32_t    max_bytes_per_sec;
+    uint32_t    padding;
+    uint32_t    flags;
+    uint32_t    total_frames;
+    uint32_t    initial_frames;
+    uint32_t    streams;
+    uint32_t    suggested_buffer;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    reserved[4];
+
+    char        list_strl[4];
+    uint32_t    strl_size;
+    char        strl[4];
+    char        strh[4];
+    uint32_t    strh_size;
+    char        fcc_type[4];
+    char        fcc_handler[4];
+    uint32_t    strh_flags;
+    uint16_t    priority;
+    uint16_t    language;
+    uint32_t    strh_initial_frames;
+    uint32_t    scale;
+    uint32_t    rate;
+    uint32_t    start;
+    uint32_t    length;
+    uint32_t    strh_suggested_buffer;
+    uint32_t    quality;
+    uint32_t    sample_size;
+    int16_t     frame[4];
+
+    char        strf[4];
+    uint32_t    strf_size;
+    uint32_t    bi_size;
+    int32_t     bi_width;
+    int32_t     bi_height;
+    uint16_t    bi_planes;
+    uint16_t    bi_bitcount;
+    char        bi_compression[4];
+    uint32_t    bi_size_image;
+    int32_t     bi_xppm;
+    int32_t     bi_yppm;
+    uint32_t    bi_clr_used;
+    uint32_t    bi_clr_important;
+
+    char        list_movi[4];
+    uint32_t    movi_size;
+    char        movi[4];
+}__attribute__((packed)) avi_header_t;
+
+/* idx1 中的一项，offset 从 'movi' 开始算 */
+typedef struct avi_index_s
+{
+    char        id[4];
+    uint32_t    flags;
+    uint32_t    offset;
+    uint32_t    size;
+}__attribute__((packed)) avi_index_t;
+
+typedef struct rec_slot_s
+{
+    unsigned char    *data;
+    unsigned long    size;
+} rec_slot_t;
+
+static struct
+{
+    int                          fd;
+    const char                   *path;
+    pthread_t                    tid;
+    rec_slot_t                   slot[REC_SLOTS];
+    spsc_queue_t                 free;          /* 空闲的录像槽 */
+    spsc_queue_t                 filled;        /* 等待编码的录像槽，-1 表示结束 */
+    unsigned int                 pixfmt;
+    unsigned int                 width, height, stride;
+    struct v4l2_fract            interval;
+
+    struct jpeg_compress_struct  cinfo;
+    struct jpeg_error_mgr        jerr;
+    jmp_buf                      jmpbuf;        /* 编码出错时从 libjpeg 跳回 recorder_encode */
+    int                          encoder;       /* 压缩器已创建 */
+    unsigned char                *row;          /* 一行展开成 YCbCr 4:4:4 */
+    unsigned char                *jpeg;
+    unsigned long                jpeg_size;
+
+    unsigned char                *wbuf;         /* 对齐的写缓冲区 */
+    unsigned int                 wlen;
+    unsigned long                file_size;
+    avi_index_t                  *index;
+    unsigned long                index_cap;
+    unsigned long                frames;
+    unsigned long                dropped;       /* 没有空闲槽丢掉的帧 */
+    unsigned int                 max_depth;
+    double                       start_ns;
+    int                          full;          /* 文件写满或写出错，停止录像 */
+} recorder = { .fd = -1 };
+
+/* 把数据追加到写缓冲区，写满一整块才写文件 */
+static int recorder_append(const void *data, unsigned int len)
+{
+    const unsigned char  *p = data;
+    unsigned int         n;
+
+    while(len)
+    {
+        n = REC_WRITE_SIZE - recorder.wlen < len ? REC_WRITE_SIZE - recorder.wlen : len;
+        memcpy(recorder.wbuf + recorder.wlen, p, n);
+        recorder.wlen += n;
+        p += n;
+        len -= n;
+
+        if(recorder.wlen == REC_WRITE_SIZE)
+        {
+            if(write(recorder.fd, recorder.wbuf, REC_WRITE_SIZE) != REC_WRITE_SIZE)
+            {
+                printf("%s : write '%s' error: %s\n", __FUNCTION__, recorder.path, strerror(errno));
+                return -1;
+            }
+            recorder.wlen = 0;
+        }
+    }
+
+    return 0;
+}
+
+/* 写入一帧 JPEG 作为 '00dc' 数据块，并记下索引 */
+static int recorder_write_frame(const unsigned char *jpeg, unsigned long size)
+{
+    static const unsigned char   pad = 0;
+    uint32_t                     chunk[2];
+    avi_index_t                  *idx;
+
+    if(recorder.file_size + size + 8 + sizeof(avi_index_t) * (recorder.frames + 1) > REC_MAX_BYTES)
+    {
+        printf("%s : '%s' reached %lu MiB, stop recording\n", __FUNCTION__, recorder.path, REC_MAX_BYTES >> 20);
+        return -1;
+    }
+
+    if(recorder.frames == recorder.index_cap)
+    {
+        idx = realloc(recorder.index, (recorder.index_cap + 1024) * sizeof(*idx));
+        if(!idx)
+        {
+            printf("%s : realloc index error\n", __FUNCTION__);
+            return -1;
+        }
+        recorder.index = idx;
+        recorder.index_cap += 1024;
+    }
+
+    idx = &recorder.index[recorder.frames];
+    memcpy(idx->id, "00dc", 4);
+    idx->flags = 0x10;      /* AVIIF_KEYFRAME */
+    idx->offset = recorder.file_size - (sizeof(avi_header_t) - 4);
+    idx->size = size;
+
+    memcpy(&chunk[0], "00dc", 4);
+    chunk[1] = size;
+    if(recorder_append(chunk, sizeof(chunk)) < 0 || recorder_append(jpeg, size) < 0 ||
+       ((size & 1) && recorder_append(&pad, 1) < 0))
+    {
+        return -1;
+    }
+
+    recorder.file_size += 8 + ((size + 1) & ~1UL);
+    recorder.frames++;
+
+    return 0;
+}
+
+/* 填写 AVI 文件头，结束时用实际的帧数和大小再写一次 */
+static void recorder_fill_header(avi_header_t *h, unsigned long movi_size)
+{
+    unsigned int         num = recorder.interval.denominator ? recorder.interval.numerator : 1;
+    unsigned int         den = recorder.interval.denominator ? recorder.interval.denominator : 30;
+
+    memset(h, 0, sizeof(*h));
+    memcpy(h->riff, "RIFF", 4);
+    h->riff_size = sizeof(*h) - 8 + movi_size - 4 + (recorder.frames ? 8 + recorder.frames * sizeof(avi_index_t) : 0);
+    memcpy(h->avi, "AVI ", 4);
+    memcpy(h->list_hdrl, "LIST", 4);
+    h->hdrl_size = offsetof(avi_header_t, list_movi) - offsetof(avi_header_t, hdrl);
+    memcpy(h->hdrl, "hdrl", 4);
+
+    memcpy(h->avih, "avih", 4);
+    h->avih_size = offsetof(avi_header_t, list_strl) - offsetof(avi_header_t, us_per_frame);
+    h->us_per_frame = 1000000ULL * num / den;
+    h->flags = 0x10;        /* AVIF_HASINDEX */
+    h->total_frames = recorder.frames;
+    h->streams = 1;
+    h->suggested_buffer = recorder.width * recorder.height * 2;
+    h->width = recorder.width;
+    h->height = recorder.height;
+
+    memcpy(h->list_strl, "LIST", 4);
+    h->strl_size = offsetof(avi_header_t, list_movi) - offsetof(avi_header_t, strl);
+    memcpy(h->strl, "strl", 4);
+    memcpy(h->strh, "strh", 4);
+    h->strh_size = offsetof(avi_header_t, strf) - offsetof(avi_header_t, fcc_type);
+    memcpy(h->fcc_type, "vids", 4);
+    memcpy(h->fcc_handler, "MJPG", 4);
+    h->scale = num;
+    h->rate = den;
+    h->length = recorder.frames;
+    h->strh_suggested_buffer = h->suggested_buffer;
+    h->quality = -1;
+    h->frame[2] = recorder.width;
+    h->frame[3] = recorder.height;
+
+    memcpy(h->strf, "strf", 4);
+    h->strf_size = offsetof(avi_header_t, list_movi) - offsetof(avi_header_t, bi_size);
+    h->bi_size = h->strf_size;
+    h->bi_width = recorder.width;
+    h->bi_height = recorder.height;
+    h->bi_planes = 1;
+    h->bi_bitcount = 24;
+    memcpy(h->bi_compression, "MJPG", 4);
+    h->bi_size_image = recorder.width * recorder.height * 3;
+
+    memcpy(h->list_movi, "LIST", 4);
+    h->movi_size = movi_size;
+    memcpy(h->movi, "movi", 4);
+}
+
+/* libjpeg 默认出错时 exit()，会把预览也一起结束，改成跳回 recorder_encode */
+static void recorder_error_exit(j_common_ptr cinfo)
+{
+    char             msg[JMSG_LENGTH_MAX];
+
+    cinfo->err->format_message(cinfo, msg);
+    printf("%s : jpeg error: %s\n", __FUNCTION__, msg);
+    longjmp(recorder.jmpbuf, 1);
+}
+
+/* 把一帧 YUYV 压缩成 JPEG，返回 JPEG 数据的长度，出错时返回 0 */
+static unsigned long recorder_encode(const unsigned char *yuv, unsigned char **out)
+{
+    struct jpeg_compress_struct  *cinfo = &recorder.cinfo;
+    const unsigned char          *src;
+    unsigned char                *dst;
+    unsigned long                size = recorder.jpeg_size;
+    JSAMPROW                     row = recorder.row;
+    unsigned int                 x;
+
+    *out = recorder.jpeg;
+    if(setjmp(recorder.jmpbuf))
+    {
+        jpeg_abort_compress(cinfo);
+        return 0;
+    }
+
+    jpeg_mem_dest(cinfo, out, &size);
+    jpeg_start_compress(cinfo, TRUE);
+
+    /* 每行 YUYV 展开成 YCbCr，两个像素共用一组色度，编码时按 4:2:2 采样不会丢信息 */
+    while(cinfo->next_scanline < recorder.height)
+    {
+        src = yuv + cinfo->next_scanline * recorder.stride;
+        dst = recorder.row;
+        for(x=0; x<recorder.width; x+=2, src+=4, dst+=6)
+        {
+            dst[0] = src[Y0];
+            dst[1] = src[U];
+            dst[2] = src[V];
+            dst[3] = src[Y1];
+            dst[4] = src[U];
+            dst[5] = src[V];
+        }
+        jpeg_write_scanlines(cinfo, &row, 1);
+    }
+
+    jpeg_finish_compress(cinfo);
+    return size;
+}
+
+/* 编码线程：取出录像槽编码写文件，每 5 秒报告一次编码帧率、队列深度和写入速度 */
+static void *recorder_thread(void *arg)
+{
+    rec_slot_t           *slot;
+    unsigned char        *jpeg;
+    unsigned long        size;
+    unsigned long        window_frames = 0;
+    unsigned long        window_bytes = recorder.file_size;
+    double               window_ns = now_ns();
+    double               now;
+    int                  n;
+
+    (void)arg;
+
+    while((n = queue_pop(&recorder.filled)) >= 0)
+    {
+        slot = &recorder.slot[n];
+
+        if(!recorder.full)
+        {
+            if(recorder.pixfmt == V4L2_PIX_FMT_MJPEG)
+            {
+                jpeg = slot->data;
+                size = slot->size;
+            }
+            else
+            {
+                size = recorder_encode(slot->data, &jpeg);
+            }
+
+            if(!size)
+            {
+                printf("%s : encode '%s' error, stop recording\n", __FUNCTION__, recorder.path);
+                recorder.full = 1;
+            }
+            else if(recorder_write_frame(jpeg, size) < 0)
+            {
+                recorder.full = 1;
+            }
+
+            /* 输出比预留的大时 libjpeg 会另外分配 */
+            if(jpeg != slot->data && jpeg != recorder.jpeg)
+                free(jpeg);
+            window_frames++;
+        }
+
+        queue_push(&recorder.free, n);
+
+        now = now_ns();
+        if(now - window_ns >= 5e9)
+        {
+            printf("record: %.1f fps encoded, queue depth %u (max %u), %lu dropped, %.1f KiB/s\n",
+                    window_frames * 1e9 / (now - window_ns), queue_depth(&recorder.filled), recorder.max_depth,
+                    recorder.dropped, (recorder.file_size - window_bytes) * 1e9 / (now - window_ns) / 1024);
+            window_ns = now;
+            window_frames = 0;
+            window_bytes = recorder.file_size;
+        }
+    }
+
+    return NULL;
+}
+
+/* 开始录像，要在设置好采集格式之后调用 */
+/* 释放录像用的缓冲区和压缩器，recorder_start 失败时也用它回退 */
+static void recorder_free(void)
+{
+    unsigned int         i;
+
+    if(recorder.encoder)
+        jpeg_destroy_compress(&recorder.cinfo);
+    recorder.encoder = 0;
+    for(i=0; i<REC_SLOTS; i++)
+    {
+        free(recorder.slot[i].data);
+        recorder.slot[i].data = NULL;
+    }
+    free(recorder.row);
+    free(recorder.jpeg);
+    free(recorder.wbuf);
+    free(recorder.index);
+    recorder.row = NULL;
+    recorder.jpeg = NULL;
+    recorder.wbuf = NULL;
+    recorder.index = NULL;
+}
+
+int recorder_start(const char *path)
+{
+    avi_header_t         header;
+    unsigned int         i;
+    int                  rv;
+
+    recorder.path = path;
+    recorder.pixfmt = v4l2_pixfmt;
+    recorder.width = frame_mode.width;
+    recorder.height = frame_mode.height;
+    recorder.stride = frame_stride;
+    recorder.interval = frame_mode.interval;
+
+    if(recorder.pixfmt != V4L2_PIX_FMT_YUYV && recorder.pixfmt != V4L2_PIX_FMT_MJPEG)
+    {
+        printf("%s : can't record %.4s frames\n", __FUNCTION__, (char *)&recorder.pixfmt);
+        return -1;
+    }
+
+    if(posix_memalign((void **)&recorder.wbuf, 4096, REC_WRITE_SIZE))
+    {
+        printf("%s : posix_memalign error\n", __FUNCTION__);
+        recorder.wbuf = NULL;
+        rv = -2;
+        goto failed;
+    }
+
+    queue_init(&recorder.free);
+    queue_init(&recorder.filled);
+    for(i=0; i<REC_SLOTS; i++)
+    {
+        recorder.slot[i].data = malloc(frame_sizeimage);
+        if(!recorder.slot[i].data)
+        {
+            printf("%s : malloc slot error\n", __FUNCTION__);
+            rv = -2;
+            goto failed;
+        }
+        queue_push(&recorder.free, i);
+    }
+
+    if(recorder.pixfmt == V4L2_PIX_FMT_YUYV)
+    {
+        recorder.row = malloc(recorder.width * 3);
+        recorder.jpeg_size = recorder.width * recorder.height * 2;
+        recorder.jpeg = malloc(recorder.jpeg_size);
+        if(!recorder.row || !recorder.jpeg)
+        {
+            printf("%s : malloc error\n", __FUNCTION__);
+            rv = -2;
+            goto failed;
+        }
+
+        recorder.cinfo.err = jpeg_std_error(&recorder.jerr);
+        recorder.jerr.error_exit = recorder_error_exit;
+        jpeg_create_compress(&recorder.cinfo);
+        recorder.encoder = 1;
+        recorder.cinfo.image_width = recorder.width;
+        recorder.cinfo.image_height = recorder.height;
+        recorder.cinfo.input_components = 3;
+        recorder.cinfo.in_color_space = JCS_YCbCr;
+        jpeg_set_defaults(&recorder.cinfo);
+        jpeg_set_quality(&recorder.cinfo, REC_QUALITY, TRUE);
+        recorder.cinfo.dct_method = JDCT_IFAST;
+        recorder.cinfo.comp_info[0].h_samp_factor = 2;
+        recorder.cinfo.comp_info[0].v_samp_factor = 1;
+    }
+
+    recorder.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(recorder.fd < 0)
+    {
+        printf("%s : open '%s' error: %s\n", __FUNCTION__, path, strerror(errno));
+        rv = -3;
+        goto failed;
+    }
+
+    /* 先占住文件头的位置，结束时再写入实际的值 */
+    recorder_fill_header(&header, 4);
+    recorder_append(&header, sizeof(header));
+    recorder.file_size = sizeof(header);
+
+    recorder.start_ns = now_ns();
+    if(pthread_create(&recorder.tid, NULL, recorder_thread, NULL) != 0)
+    {
+        printf("%s : pthread_create error\n", __FUNCTION__);
+        rv = -4;
+        goto failed;
+    }
+    printf("record %.4s %ux%u to '%s'\n", (char *)&recorder.pixfmt, recorder.width, recorder.height, path);
+
+    return 0;
+
+failed:
+    if(recorder.fd >= 0)
+        close(recorder.fd);
+    recorder.fd = -1;
+    recorder_free();
+    return rv;
+}
+
+/* 取出一帧后调用，复制到空闲的录像槽交给编码线程，没有空闲槽时丢掉 */
+void recorder_submit(const struct v4l2_buffer *buffer)
+{
+    unsigned int         depth;
+    int                  n;
+
+    if(recorder.fd < 0 || recorder.full)
+        return;
+
+    if(queue_trypop(&recorder.free, &n) < 0)
+    {
+        recorder.dropped++;
+        return;
+    }
+
+    recorder.slot[n].size = recorder.pixfmt == V4L2_PIX_FMT_MJPEG ? buffer->bytesused : recorder.stride * recorder.height;
+    if(recorder.slot[n].size > frame_sizeimage)
+        recorder.slot[n].size = frame_sizeimage;
+    memcpy(recorder.slot[n].data, buffer_unit[buffer->index].start, recorder.slot[n].size);
+    queue_push(&recorder.filled, n);
+
+    depth = queue_depth(&recorder.filled);
+    if(depth > recorder.max_depth)
+        recorder.max_depth = depth;
+}
+
+/* 结束录像：等编码线程处理完队列，写入剩下的数据、索引，再回写文件头 */
+void recorder_stop(void)
+{
+    avi_header_t         header;
+    uint32_t             chunk[2];
+    unsigned long        movi_size;
+    double               elapsed;
+
+    if(recorder.fd < 0)
+        return;
+
+    queue_push(&recorder.filled, -1);
+    pthread_join(recorder.tid, NULL);
+
+    movi_size = recorder.file_size - (sizeof(avi_header_t) - 4);
+    if(recorder.frames)
+    {
+        memcpy(&chunk[0], "idx1", 4);
+        chunk[1] = recorder.frames * sizeof(avi_index_t);
+        recorder_append(chunk, sizeof(chunk));
+        recorder_append(recorder.index, chunk[1]);
+    }
+
+    if(recorder.wlen && write(recorder.fd, recorder.wbuf, recorder.wlen) != recorder.wlen)
+    {
+        printf("%s : write '%s' error: %s\n", __FUNCTION__, recorder.path, strerror(errno));
+    }
+
+    recorder_fill_header(&header, movi_size);
+    if(pwrite(recorder.fd, &header, sizeof(header), 0) != sizeof(header))
+    {
+        printf("%s : write '%s' header error: %s\n", __FUNCTION__, recorder.path, strerror(errno));
+    }
+
+    close(recorder.fd);
+    recorder.fd = -1;
+
+    elapsed = (now_ns() - recorder.start_ns) / 1e9;
+    printf("stat record=%s frames=%lu dropped=%lu max_queue_depth=%u bytes=%lu encode_fps=%.2f bytes_per_s=%.0f\n",
+            recorder.path, recorder.frames, recorder.dropped, recorder.max_depth,
+            recorder.file_size + 8 + recorder.frames * sizeof(avi_index_t),
+            elapsed > 0 ? recorder.frames / elapsed : 0.0, elapsed > 0 ? recorder.file_size / elapsed : 0.0);
+
+    recorder_free();
+}
+#endif
+
+/* 结束视频数据采集 */
+int v4l2_stream_off()
+{
+    int                   ret;
+    enum v4l2_buf_type    type;
+
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    ret = ioctl(fd_camera, VIDIOC_STREAMOFF, &type);
+    if(ret < 0)
+    {
+        printf("%s : VIDIOC_STREAMOFF error\n", __FUNCTION__);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* 解除 buffer_unit 到内核中申请 buffer 的映射 */
+void v4l2_unmmap()
+{
+    unsigned int    i;
+    int             ret;
+
+    if(v4l2_memtype != V4L2_MEMORY_MMAP)
+    {
+        return;
+    }
+
+    for(i=0; i<buffer_cnt; i++)
+    {
+        ret = munmap(buffer_unit[i].start, buffer_unit[i].length);
+        if (ret < 0)
+        {
+            printf("%s : munmap error\n", __FUNCTION__);
+        }
+    }
+}
+
+/* 不依赖摄像头和屏幕的基准测试
+ * 帧来自 YUYV 原始文件 (尺寸由 -z 指定) 或合成的画面，显存是一个普通文件，
+ * 每帧按实际运行时的路径处理：拷进采集缓冲区 (代替驱动的 DMA)、render_frame 画到后台页、fb_flip 显示，
+ * 分阶段统计耗时和读写的字节数，结果可以存成基准文件，之后的运行与之比较
+ */
+#define BENCH_FRAMES     300            /* 至少回放的帧数和秒数，文件中的帧至少回放一遍 */
+#define BENCH_SECONDS    2
+#define BENCH_WARMUP     16             /* 先不计时地跑几帧，触发缓冲区和显存的缺页 */
+#define BENCH_SYNTHETIC  8              /* 合成帧的个数，循环使用 */
+#define BENCH_TOLERANCE  0.10           /* 帧率比基准低 10% 以上认为性能退化 */
+#define BENCH_FB         "video2lcd_bench.fb"
+
+enum
+{
+    BENCH_CAPTURE,
+    BENCH_CONVERT,
+    BENCH_DISPLAY,
+    BENCH_CNT,
+};
+
+/* 每个阶段累计的耗时和读写字节数，字节数是按访问的数据量估算的 */
+static struct
+{
+    const char     *name;
+    double         ns;
+    double         bytes;
+} bench_stage[BENCH_CNT] = { { "capture", 0, 0 }, { "convert", 0, 0 }, { "display", 0, 0 } };
+
+/* 用普通文件模拟 LCD_WIDTH x LCD_HEIGH 的显存，格式由 -F 指定，多页时不翻页，只轮流绘制 */
+static int bench_fb_open(void)
+{
+    struct stat      st;
+    size_t           size;
+
+    if(!strcmp(fb_dev, "/dev/fb0"))
+        fb_dev = BENCH_FB;
+
+    fd_lcd = open(fb_dev, O_RDWR | O_CREAT, 0644);
+    if(fd_lcd < 0 || fstat(fd_lcd, &st) < 0)
+    {
+        printf("%s : open fake framebuffer '%s' error\n", __FUNCTION__, fb_dev);
+        return -1;
+    }
+
+    if(!S_ISREG(st.st_mode))
+    {
+        printf("%s : '%s' is not a regular file\n", __FUNCTION__, fb_dev);
+        return -2;
+    }
+
+    memset(&fb_vinfo, 0, sizeof(fb_vinfo));
+    fb_vinfo.xres = LCD_WIDTH;
+    fb_vinfo.yres = LCD_HEIGH;
+    fb_vinfo.yres_virtual = LCD_HEIGH * fb_pages;
+    fb_vinfo.bits_per_pixel = fb_format->bpp;
+    fb_vinfo.red.length = fb_format->r_len;
+    fb_vinfo.red.offset = fb_format->r_off;
+    fb_vinfo.green.length = fb_format->g_len;
+    fb_vinfo.green.offset = fb_format->g_off;
+    fb_vinfo.blue.length = fb_format->b_len;
+    fb_vinfo.blue.offset = fb_format->b_off;
+    fb_vinfo.transp.length = fb_format->a_len;
+    fb_vinfo.transp.offset = fb_format->a_off;
+    fb_line_length = LCD_WIDTH * fb_format->bpp / 8;
+    fb_fake = 1;
+    fb_vsync = 0;
+    fb_back = fb_pages > 1 ? 1 : 0;
+    flip_stat.period_ns = fb_refresh_period_ns(&fb_vinfo);
+
+    size = fb_line_length * fb_vinfo.yres * fb_pages;
+    if(ftruncate(fd_lcd, size) < 0)
+    {
+        printf("%s : ftruncate error: %s\n", __FUNCTION__, strerror(errno));
+        return -3;
+    }
+
+    screen_base = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd_lcd, 0);
+    if(MAP_FAILED == screen_base)
+    {
+        printf("%s : framebuffer mmap error\n", __FUNCTION__);
+        screen_base = NULL;
+        return -4;
+    }
+
+    memset(screen_base, 0x0, size);
+    return fb_canvas_setup() < 0 ? -5 : 0;
+}
+
+/* 合成一帧：静止的渐变背景上有一个移动的亮块，局部重画时只有亮块附近变化 */
+static void bench_synthetic(unsigned char *yuv, unsigned int k)
+{
+    unsigned int     w = frame_mode.width;
+    unsigned int     h = frame_mode.height;
+    unsigned int     box = h / 8;
+    unsigned int     bx = k * box / 2 % (w > box ? w - box : 1);     /* 很窄的帧亮块就停在左边 */
+    unsigned int     by = (h - box) / 2;
+    unsigned int     x, y;
+    unsigned char    *p;
+
+    for(y=0; y<h; y++)
+    {
+        p = yuv + y * frame_stride;
+        for(x=0; x<w; x+=2, p+=4)
+        {
+            p[Y0] = (x + y) / 4 & 0xFF;
+            p[Y1] = (x + 1 + y) / 4 & 0xFF;
+            p[U] = x * 255 / w;
+            p[V] = y * 255 / h;
+
+            if(x >= bx && x < bx + box && y >= by && y < by + box)
+                p[Y0] = p[Y1] = 235;
+        }
+    }
+}
+
+/* 载入要回放的帧，返回帧数据，*size 非 0 表示是映射的文件 */
+static unsigned char *bench_load(const char *src, unsigned int *frames, size_t *size)
+{
+    unsigned char    *data;
+    struct stat      st;
+    unsigned int     k;
+    int              fd;
+
+    *size = 0;
+    if(!strcmp(src, "synthetic"))
+    {
+        data = malloc((size_t)frame_sizeimage * BENCH_SYNTHETIC);
+        if(!data)
+        {
+            printf("%s : malloc error\n", __FUNCTION__);
+            return NULL;
+        }
+
+        for(k=0; k<BENCH_SYNTHETIC; k++)
+            bench_synthetic(data + (size_t)k * frame_sizeimage, k);
+        *frames = BENCH_SYNTHETIC;
+        return data;
+    }
+
+    fd = open(src, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) < 0)
+    {
+        printf("%s : open '%s' error\n", __FUNCTION__, src);
+        if(fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    *frames = st.st_size / frame_sizeimage;
+    if(!*frames)
+    {
+        printf("%s : '%s' is smaller than one %ux%u YUYV frame\n", __FUNCTION__, src, frame_mode.width, frame_mode.height);
+        close(fd);
+        return NULL;
+    }
+
+    *size = (size_t)*frames * frame_sizeimage;
+    data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(MAP_FAILED == data)
+    {
+        printf("%s : mmap '%s' error\n", __FUNCTION__, src);
+        return NULL;
+    }
+
+    return data;
+}
+
+/* 和基准文件比较，基准文件不存在时把这次的结果存为基准
+ * 基准文件每行一个 key=value，config 不同的结果不作比较
+ */
+static int bench_baseline(const char *path, const char *config, const char **key, const double *value, unsigned int cnt)
+{
+    FILE             *fp;
+    char             line[256];
+    char             name[64];
+    char             text[128];
+    double           base[8] = { 0 };
+    double           change;
+    int              same = 0;
+    int              regress = 0;
+    unsigned int     i;
+
+    fp = fopen(path, "r");
+    if(!fp)
+    {
+        fp = fopen(path, "w");
+        if(!fp)
+        {
+            printf("%s : create baseline '%s' error\n", __FUNCTION__, path);
+            return -1;
+        }
+
+        fprintf(fp, "config=%s\n", config);
+        for(i=0; i<cnt; i++)
+            fprintf(fp, "%s=%.3f\n", key[i], value[i]);
+        fclose(fp);
+
+        printf("bench baseline saved to %s\n", path);
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        if(sscanf(line, "%63[^=]=%127s", name, text) != 2)
+            continue;
+
+        if(!strcmp(name, "config"))
+            same = !strcmp(text, config);
+        for(i=0; i<cnt && i<sizeof(base)/sizeof(base[0]); i++)
+        {
+            if(!strcmp(name, key[i]))
+                base[i] = atof(text);
+        }
+    }
+    fclose(fp);
+
+    if(!same)
+    {
+        printf("bench baseline %s was measured with another config, not compared\n", path);
+        return 0;
+    }
+
+    /* 第一项是帧率，越高越好，其余是耗时，越低越好，只由帧率判断是否退化 */
+    for(i=0; i<cnt; i++)
+    {
+        if(base[i] <= 0)
+            continue;
+
+        change = (value[i] - base[i]) / base[i];
+        printf("bench compare key=%s baseline=%.3f now=%.3f change=%+.1f%%\n", key[i], base[i], value[i], change * 100);
+        if(i == 0 && change < -BENCH_TOLERANCE)
+            regress = 1;
+    }
+
+    if(regress)
+    {
+        printf("bench : frame rate regressed more than %.0f%% against %s\n", BENCH_TOLERANCE * 100, path);
+        return -2;
+    }
+
+    return 0;
+}
+
+/* 回放 src 中的帧 (文件名或 "synthetic")，baseline 为 NULL 时不比较 */
+int run_bench(const char *src, const char *baseline, int damage_threshold)
+{
+    struct v4l2_buffer   buffer;
+    unsigned char        *frames = NULL;
+    size_t               map_size = 0;
+    unsigned int         frame_cnt = 0;
+    unsigned int         loops = 0;
+    unsigned int         pixels, i, k;
+    unsigned long        changed;
+    double               t0, t1, t2, t3, start, elapsed;
+    double               read_bytes;
+    const char           *conv_name = "?";
+    const char           *key[] = { "fps", "capture_ns_pixel", "convert_ns_pixel", "display_ns_pixel" };
+    double               value[4];
+    char                 config[128];
+    int                  rv = 0;
+
+    v4l2_pixfmt = V4L2_PIX_FMT_YUYV;
+    v4l2_memtype = V4L2_MEMORY_MMAP;
+    frame_stride = frame_mode.width * 2;
+    frame_sizeimage = frame_stride * frame_mode.height;
+
+    /* 指定 -D 时回放到 DRM 设备上，显示阶段是真正的翻页，格式由 drm_open 选择 */
+#ifdef HAVE_DRM
+    if(drm_dev)
+        rv = drm_open() < 0 ? -1 : 0;
+    else
+#endif
+    rv = bench_fb_open() < 0 ? -1 : 0;
+    if(rv < 0)
+        goto cleanup;
+
+    frames = bench_load(src, &frame_cnt, &map_size);
+    buffer_unit = calloc(buffer_cnt, sizeof(*buffer_unit));
+    if(!frames || !buffer_unit)
+    {
+        rv = -2;
+        goto cleanup;
+    }
+
+    for(i=0; i<buffer_cnt; i++)
+    {
+        buffer_unit[i].start = malloc(frame_sizeimage);
+        buffer_unit[i].length = frame_sizeimage;
+        if(!buffer_unit[i].start)
+        {
+            printf("%s : malloc error\n", __FUNCTION__);
+            rv = -3;
+            goto cleanup;
+        }
+        memset(buffer_unit[i].start, 0x0, frame_sizeimage);
+    }
+
+    /* 回放没有驱动可以裁剪，只能用户空间裁剪 */
+    if(zoom_level)
+        zoom_roi(&frame_roi, frame_mode.width, frame_mode.height);
+    compute_view();
+#ifdef HAVE_DRM
+    if(drm_dev)
+        drm_crop_setup();
+#endif
+
+    /* 不支持局部重画的配置只是关掉它 (已经打印)，内存不够时退出 */
+    if(damage_threshold >= 0 && damage_init(damage_threshold) < -1)
+    {
+        rv = -6;
+        goto cleanup;
+    }
+
+    /* 预热时还没有初始化帧统计，翻页不计入统计 */
+    for(k=0; k<BENCH_WARMUP; k++)
+    {
+        i = k % buffer_cnt;
+        memcpy(buffer_unit[i].start, frames + (size_t)(k % frame_cnt) * frame_sizeimage, frame_sizeimage);
+        render_frame(&buffer_unit[i], fb_back);
+        fb_flip();
+    }
+
+    if(frame_stat_init(fb_pages) < 0)
+    {
+        rv = -4;
+        goto cleanup;
+    }
+
+    for(i=0; i<CONVERTER_CNT; i++)
+    {
+        if(converters[i].fn == convert_yuv)
+            conv_name = converters[i].name;
+    }
+
+    /* 不缩放时只读显示区域，缩放时按整帧 (或变焦区域) 估算 */
+    pixels = view_width * view_height;
+    read_bytes = scale_mode == SCALE_NONE ? pixels * 2.0 : (frame_roi.w ? frame_roi.w * frame_roi.h * 2.0 : frame_sizeimage);
+
+    start = now_ns();
+    for(k=0; k<frame_cnt || k<BENCH_FRAMES || now_ns() - start < BENCH_SECONDS * 1e9; k++, loops++)
+    {
+        i = k % buffer_cnt;
+
+        /* 采集：拷进采集缓冲区，和 DQBUF 一样记录时间点 */
+        t0 = now_ns();
+        memcpy(buffer_unit[i].start, frames + (size_t)(k % frame_cnt) * frame_sizeimage, frame_sizeimage);
+        buffer_unit[i].bytesused = frame_sizeimage;
+        memset(&buffer, 0, sizeof(buffer));
+        buffer.index = i;
+        buffer.sequence = k;
+        frame_stat_dqbuf(&buffer);
+        t1 = now_ns();
+
+        changed = damage.changed;
+        render_frame(&buffer_unit[i], fb_back);
+        frame_stat_converted(i, fb_back);
+        t2 = now_ns();
+
+        fb_flip();
+        t3 = now_ns();
+
+        bench_stage[BENCH_CAPTURE].ns += t1 - t0;
+        bench_stage[BENCH_CONVERT].ns += t2 - t1;
+        bench_stage[BENCH_DISPLAY].ns += t3 - t2;
+        bench_stage[BENCH_CAPTURE].bytes += frame_sizeimage * 2.0;
+
+        /* 局部重画：读 YUYV 和参考亮度算 SAD，变化的块更新参考亮度，再读 YUYV 写显存 */
+        if(damage.threshold >= 0)
+            bench_stage[BENCH_CONVERT].bytes += pixels * 3.0 + (damage.changed - changed) * DAMAGE_TILE * DAMAGE_TILE * 5.0;
+        else
+            bench_stage[BENCH_CONVERT].bytes += read_bytes + pixels * fb_bytes;
+
+        /* 用画布时显示阶段读画布中的输出区域，写进显存 */
+        if(fb_mem)
+            bench_stage[BENCH_DISPLAY].bytes += view_width * view_height * (2.0 + fb_format->bpp / 8);
+    }
+    elapsed = now_ns() - start;
+
+    printf("bench source=%s frames=%u size=%ux%u view=%ux%u pages=%u fb=%s converter=%s scale=%s rotate=%d damage=%d "
+            "zoom=%.2f roi=%ux%u+%u+%u csc=%s osd=%u\n", src, loops, frame_mode.width, frame_mode.height, view_width, view_height, fb_pages,
+            fb_format->name, conv_name, scale_mode == SCALE_NONE ? "none" : (scale_bilinear ? "bilinear" : "nearest"),
+            rotate_angle, damage.threshold, frame_roi.w ? (double)frame_mode.width / frame_roi.w : 1.0,
+            frame_roi.w ? frame_roi.w : frame_mode.width, frame_roi.w ? frame_roi.h : frame_mode.height, frame_roi.x, frame_roi.y, csc->name, osd->cnt);
+
+    /* ns_pixel 都按显示的像素数计算，直接绘制时显示阶段只翻页，用画布时还要把画布写进显存 */
+    for(i=0; i<BENCH_CNT; i++)
+    {
+        printf("bench stage=%s ns_frame=%.0f ns_pixel=%.3f bytes_frame=%.0f mb_s=%.1f\n", bench_stage[i].name,
+                bench_stage[i].ns / loops, bench_stage[i].ns / loops / pixels, bench_stage[i].bytes / loops,
+                bench_stage[i].ns > 0 ? bench_stage[i].bytes * 1e3 / bench_stage[i].ns : 0);
+    }
+
+    value[0] = loops * 1e9 / elapsed;
+    for(i=0; i<BENCH_CNT; i++)
+        value[i + 1] = bench_stage[i].ns / loops / pixels;
+    printf("bench fps=%.2f ns_pixel=%.3f\n", value[0], elapsed / loops / pixels);
+    frame_stat_dump("bench");
+
+    /* 回放到 DRM 设备的结果受刷新率限制，和回放到文件的基准分开 */
+    snprintf(config, sizeof(config), "%ux%u,%s,%d,%d,%d,%d,%u,%d,%s,%ux%u+%u+%u,%s,%u%s", frame_mode.width, frame_mode.height,
+            conv_name, scale_mode, scale_bilinear, rotate_angle, damage.threshold, fb_pages, luma_enabled, fb_format->name,
+            frame_roi.w, frame_roi.h, frame_roi.x, frame_roi.y, csc->name, osd_items, fb_fake ? "" : ",drm");
+    if(baseline && bench_baseline(baseline, config, key, value, 4) < 0)
+        rv = -5;
+
+cleanup:
+    if(buffer_unit)
+    {
+        for(i=0; i<buffer_cnt; i++)
+            free(buffer_unit[i].start);
+        free(buffer_unit);
+        buffer_unit = NULL;
+    }
+    if(map_size)
+        munmap(frames, map_size);
+    else
+        free(frames);
+#ifdef HAVE_DRM
+    if(drm_dev)
+    {
+        drm_close();
+        return rv;
+    }
+#endif
+    if(fb_mem)
+    {
+        munmap(fb_mem, fb_mem_size);
+        free(screen_base);
+    }
+    else if(screen_base)
+        munmap(screen_base, fb_line_length * fb_vinfo.yres * fb_pages);
+    if(fd_lcd >= 0)
+        close(fd_lcd);
+
+    return rv;
+}
+
+/* 打开当前线程的 CPU 周期计数器，内核或硬件不支持时返回 -1 */
+static int perf_cycles_open(void)
+{
+    struct perf_event_attr   attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long perf_cycles_read(int fd)
+{
+    long long        cycles;
+
+    if( fd < 0 || read(fd, &cycles, sizeof(cycles)) != sizeof(cycles) )
+        return -1;
+
+    return cycles;
+}
+
+/* 没有周期计数器时，用 cpufreq 的当前频率估算周期数，单位 GHz */
+static double cpu_freq_ghz(void)
+{
+    FILE             *fp;
+    long             khz = 0;
+
+    fp = fopen("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq", "r");
+    if( !fp )
+        return 0;
+
+    if( fscanf(fp, "%ld", &khz) != 1 )
+        khz = 0;
+    fclose(fp);
+
+    return khz / 1e6;
+}
+
+/* 灰度实现只看 Y：随机的 U/V 下，每个 Y 的输出都必须是按 Y 直接截位得到的灰色 */
+static int selftest_grey(const converter_t *conv)
+{
+    unsigned char    yuv[256 * 2 + 64];
+    unsigned short   out[256 + 32];
+    unsigned short   expect;
+    unsigned int     i, w;
+
+    /* 不同宽度覆盖 NEON 主循环和剩余像素的处理 */
+    for (w = 2; w <= 256 + 32; w += 30)
+    {
+        for (i = 0; i < w * 2; i += 2)
+        {
+            yuv[i] = (i / 2) & 0xFF;
+            yuv[i + 1] = rand() & 0xFF;
+        }
+        memset(out, 0xAA, sizeof(out));
+        conv->fn(yuv, w * 2, (unsigned char *)out, w * 2, w, 1);
+
+        for (i = 0; i < w; i++)
+        {
+            expect = ((yuv[i * 2] >> 3) << 11) | ((yuv[i * 2] >> 2) << 5) | (yuv[i * 2] >> 3);
+            if( out[i] != expect )
+            {
+                printf("%s : %s mismatch at width %u pixel %u: Y=%u got 0x%04x expect 0x%04x\n", __FUNCTION__,
+                        conv->name, w, i, yuv[i * 2], out[i], expect);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* 逐位比对所有转换实现和标量参考版本
+ * 每个像素只依赖自身的 (Y, U, V)，所以遍历 256*256*256 种组合即可覆盖全部输入
+ */
+static int selftest_exact(const converter_t *conv)
+{
+    unsigned char    *yuv;
+    unsigned short   *ref;
+    unsigned short   *out;
+    unsigned int     u, v, y, i;
+    int              rv = 0;
+
+    /* 每轮固定 U：256 个 V，每个 V 有 128 个像素对覆盖 Y=0~255 */
+    yuv = malloc(256 * 128 * 4);
+    ref = malloc(256 * 256 * 2);
+    out = malloc(256 * 256 * 2);
+    if( !yuv || !ref || !out )
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        rv = -1;
+        goto cleanup;
+    }
+
+    for (u = 0; u < 256 && !rv; u++)
+    {
+        for (v = 0, i = 0; v < 256; v++)
+        {
+            for (y = 0; y < 256; y += 2, i += 4)
+            {
+                yuv[i + Y0] = y;
+                yuv[i + U]  = u;
+                yuv[i + Y1] = y + 1;
+                yuv[i + V]  = v;
+            }
+        }
+
+        yuv422_rgb565(yuv, 512, (unsigned char *)ref, 512, 256, 256);
+        memset(out, 0xAA, 256 * 256 * 2);
+        conv->fn(yuv, 512, (unsigned char *)out, 512, 256, 256);
+
+        for (i = 0; i < 256 * 256; i++)
+        {
+            if( ref[i] != out[i] )
+            {
+                printf("%s : %s mismatch Y=%u U=%u V=%u: 0x%04x != 0x%04x\n", __FUNCTION__, conv->name,
+                        i & 0xFF, u, i >> 8, out[i], ref[i]);
+                rv = -2;
+                break;
+            }
+        }
+    }
+
+cleanup:
+    free(yuv);
+    free(ref);
+    free(out);
+    return rv;
+}
+
+/* 每种颜色矩阵：和浮点公式比较标量参考版本的精度 (rgb565 各通道的误差，单位为最低位)，
+ * 其他彩色实现逐位比对标量参考版本，再测速度
+ * 每个像素只依赖自身的 (Y, U, V)，精度也遍历全部 256*256*256 种组合
+ */
+static int selftest_csc(const unsigned char *yuv, unsigned int loops)
+{
+    const csc_t      *saved = csc;
+    const csc_t      *cs;
+    unsigned char    line[256 * 2];
+    unsigned short   out[256];
+    unsigned int     pixels = FRAME_WIDTH * FRAME_HEIGH;
+    unsigned int     n, k, i, u, v, y;
+    unsigned int     err, max_err[3];
+    unsigned long    exact, total;
+    unsigned short   *rgb;
+    double           yf, cb, cr, c[3], scale_y, scale_c, kg, t0, ns;
+    int              failed = 0;
+
+    rgb = malloc(pixels * 2);
+    if( !rgb )
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        return -1;
+    }
+
+    for (n = 0; n < CSC_CNT; n++)
+    {
+        cs = &csc_list[n];
+        csc_use(cs);
+
+        kg = 1 - cs->kr - cs->kb;
+        scale_y = cs->full ? 1.0 : 255.0 / 219.0;
+        scale_c = cs->full ? 1.0 : 255.0 / 224.0;
+        memset(max_err, 0, sizeof(max_err));
+        exact = total = 0;
+
+        for (u = 0; u < 256; u++)
+        {
+            for (v = 0; v < 256; v++)
+            {
+                for (i = 0; i < 256 * 2; i += 4)
+                {
+                    line[i + Y0] = i / 2;
+                    line[i + U]  = u;
+                    line[i + Y1] = i / 2 + 1;
+                    line[i + V]  = v;
+                }
+                yuv422_rgb565(line, 512, (unsigned char *)out, 512, 256, 1);
+
+                cb = ((int)u - 128) * scale_c;
+                cr = ((int)v - 128) * scale_c;
+                for (y = 0; y < 256; y++)
+                {
+                    yf = cs->full ? y : ((int)y - 16) * scale_y;
+                    c[0] = yf + 2 * (1 - cs->kr) * cr;
+                    c[1] = yf - 2 * cs->kb * (1 - cs->kb) / kg * cb - 2 * cs->kr * (1 - cs->kr) / kg * cr;
+                    c[2] = yf + 2 * (1 - cs->kb) * cb;
+
+                    for (k = 0; k < 3; k++)
+                    {
+                        int      e = (int)(c[k] < 0 ? 0 : (c[k] > 255 ? 255 : c[k] + 0.5));
+                        int      got = k == 0 ? out[y] >> 11 : (k == 1 ? (out[y] >> 5) & 0x3F : out[y] & 0x1F);
+
+                        e >>= k == 1 ? 2 : 3;
+                        err = got > e ? got - e : e - got;
+                        if( err > max_err[k] )
+                            max_err[k] = err;
+                        exact += !err;
+                        total++;
+                    }
+                }
+            }
+        }
+
+        printf("csc %-14s coef %3d/%3d/%3d/%3d  max error r/g/b %u/%u/%u lsb  exact %6.2f%%\n", cs->name,
+                cs->rv, cs->gu, cs->gv, cs->bu, max_err[0], max_err[1], max_err[2], exact * 100.0 / total);
+        if( max_err[0] > 1 || max_err[1] > 1 || max_err[2] > 1 )
+        {
+            printf("%s : %s is off by more than one lsb\n", __FUNCTION__, cs->name);
+            failed++;
+        }
+
+        for (k = 0; k < CONVERTER_CNT; k++)
+        {
+            const converter_t  *conv = &converters[k];
+
+            if( conv->grey || !converter_usable(conv) )
+                continue;
+            if( conv->fn != yuv422_rgb565 && selftest_exact(conv) < 0 )
+            {
+                failed++;
+                continue;
+            }
+
+            conv->fn(yuv, FRAME_WIDTH * 2, (unsigned char *)rgb, FRAME_WIDTH * 2, FRAME_WIDTH, FRAME_HEIGH);
+            t0 = now_ns();
+            for (i = 0; i < loops; i++)
+                conv->fn(yuv, FRAME_WIDTH * 2, (unsigned char *)rgb, FRAME_WIDTH * 2, FRAME_WIDTH, FRAME_HEIGH);
+            ns = (now_ns() - t0) / loops;
+
+            printf("csc %-14s %-10s %s  %7.3f ms/frame  %6.2f ns/pixel\n", cs->name, conv->name,
+                    conv->fn == yuv422_rgb565 ? "reference" : "bit-exact", ns / 1e6, ns / pixels);
+        }
+    }
+
+    csc_use(saved);
+    free(rgb);
+    return failed ? -1 : 0;
+}
+
+/* 测量一帧显示路径的访存量和带宽
+ * copy:   转换到中间 rgb_buffer，逐行 memcpy 到显存，再 memset 清零 rgb_buffer
+ * direct: 转换结果按显存行跨度直接写入显存
+ * 显存用普通内存模拟，行跨度为 LCD_WIDTH*2
+ */
+static void selftest_display(const unsigned char *yuv, unsigned int loops)
+{
+    unsigned int     frame = FRAME_WIDTH * FRAME_HEIGH * 2;
+    unsigned char    *fb;
+    unsigned char    *tmp;
+    unsigned int     i, k;
+    double           t0, ns;
+
+    fb = malloc(LCD_WIDTH * 2 * LCD_HEIGH);
+    tmp = malloc(frame);
+    if( !fb || !tmp )
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        goto cleanup;
+    }
+
+    /* 先触发缺页，避免计入第一次访问的开销 */
+    memset(fb, 0x0, LCD_WIDTH * 2 * LCD_HEIGH);
+    memset(tmp, 0x0, frame);
+
+    t0 = now_ns();
+    for (k = 0; k < loops; k++)
+    {
+        convert_yuv(yuv, FRAME_WIDTH * 2, tmp, FRAME_WIDTH * 2, FRAME_WIDTH, FRAME_HEIGH);
+        for (i = 0; i < FRAME_HEIGH; i++)
+            memcpy(fb + i * LCD_WIDTH * 2, tmp + i * FRAME_WIDTH * 2, FRAME_WIDTH * 2);
+        memset(tmp, 0x0, frame);
+    }
+    ns = (now_ns() - t0) / loops;
+
+    /* 读 yuv + 写 tmp + 读 tmp + 写显存 + 清零 tmp */
+    printf("display copy    %7.3f ms/frame  %6u KiB/frame  %7.1f MB/s\n",
+            ns / 1e6, 5 * frame / 1024, 5.0 * frame / ns * 1e3);
+
+    t0 = now_ns();
+    for (k = 0; k < loops; k++)
+        convert_yuv(yuv, FRAME_WIDTH * 2, fb, LCD_WIDTH * 2, FRAME_WIDTH, FRAME_HEIGH);
+    ns = (now_ns() - t0) / loops;
+
+    /* 读 yuv + 写显存 */
+    printf("display direct  %7.3f ms/frame  %6u KiB/frame  %7.1f MB/s\n",
+            ns / 1e6, 2 * frame / 1024, 2.0 * frame / ns * 1e3);
+
+cleanup:
+    free(fb);
+    free(tmp);
+}
+
+/* 按格式描述逐个分量计算一个 rgb565 像素在显存中的值，作为写出函数的参考 */
+static unsigned int selftest_fb_pixel(const fb_format_t *f, unsigned int c)
+{
+    unsigned int     r = (c >> 11) << 3 | (c >> 13);
+    unsigned int     g = ((c >> 5) & 0x3F) << 2 | ((c >> 9) & 0x03);
+    unsigned int     b = (c & 0x1F) << 3 | ((c >> 2) & 0x07);
+
+    return (r >> (8 - f->r_len)) << f->r_off | (g >> (8 - f->g_len)) << f->g_off |
+           (b >> (8 - f->b_len)) << f->b_off | ((1U << f->a_len) - 1) << f->a_off;
+}
+
+/* 显存像素 v 中的一个分量截到 bits 位，用来和 rgb565 的同一分量比较 */
+static unsigned int selftest_fb_channel(unsigned int v, unsigned int len, unsigned int off, unsigned int bits)
+{
+    return (v >> off & ((1U << len) - 1)) >> (len - bits);
+}
+
+/* 显存格式的自检和性能测试
+ * 可以直接绘制的格式：标量版本的各分量截到 rgb565 的位宽后应等于 rgb565 的输出，透明度分量不透明，
+ * 其他彩色实现和最近邻 1:1 缩放与标量版本逐位一致，灰度实现等于 Y 按格式打包，再测转换一帧的耗时；
+ * 不在表中的排列用画布：65536 种 rgb565 像素经 fb_any 的通用写出函数写一遍，和参考值逐个比较
+ */
+static int selftest_fb_format(const unsigned char *yuv, unsigned int loops)
+{
+    unsigned int     pixels = FRAME_WIDTH * FRAME_HEIGH;
+    unsigned short   *base;
+    unsigned char    *ref;
+    unsigned char    *out;
+    const fb_format_t *f;
+    const converter_t *conv;
+    scaler_t         sc;
+    fb_write_fn      fn;
+    unsigned int     i, k, n, v, c, y, bytes, mask;
+    double           t0, ns;
+    int              rv = 0;
+
+    memset(&sc, 0, sizeof(sc));
+    base = malloc(pixels * 2);
+    ref = malloc(pixels * 4);
+    out = malloc(pixels * 4);
+    if( !base || !ref || !out )
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        rv = -1;
+        goto cleanup;
+    }
+
+    fb_format_use(&fb_formats[FB_FMT_rgb565]);
+    yuv422_rgb565(yuv, FRAME_WIDTH * 2, (unsigned char *)base, FRAME_WIDTH * 2, FRAME_WIDTH, FRAME_HEIGH);
+
+    for (n = 0; n < FB_FORMAT_CNT && !rv; n++)
+    {
+        f = &fb_formats[n];
+        bytes = f->bpp / 8;
+        mask = (1U << f->a_len) - 1;
+        fb_format_use(f);
+
+        yuv422_rgb565(yuv, FRAME_WIDTH * 2, ref, FRAME_WIDTH * bytes, FRAME_WIDTH, FRAME_HEIGH);
+        for (i = 0; i < pixels; i++)
+        {
+            v = fb_load(ref + i * bytes);
+            c = selftest_fb_channel(v, f->r_len, f->r_off, 5) << 11 | selftest_fb_channel(v, f->g_len, f->g_off, 6) << 5 |
+                selftest_fb_channel(v, f->b_len, f->b_off, 5);
+            if( c != base[i] || (v >> f->a_off & mask) != mask )
+            {
+                printf("%s : %s mismatch at pixel %u: got 0x%08x, rgb565 0x%04x\n", __FUNCTION__, f->name, i, v, base[i]);
+                rv = -2;
+                break;
+            }
+        }
+
+        for (k = 0; k < CONVERTER_CNT && !rv; k++)
+        {
+            conv = &converters[k];
+            if( conv->fn == yuv422_rgb565 || !converter_usable(conv) )
+                continue;
+
+            memset(out, 0xAA, pixels * bytes);
+            conv->fn(yuv, FRAME_WIDTH * 2, out, FRAME_WIDTH * bytes, FRAME_WIDTH, FRAME_HEIGH);
+            for (i = 0; i < pixels; i++)
+            {
+                y = yuv[i * 2];
+                v = conv->grey ? fb_pack(f, y, y, y) : fb_load(ref + i * bytes);
+                if( fb_load(out + i * bytes) != v )
+                {
+                    printf("%s : %s %s mismatch at pixel %u: 0x%08x != 0x%08x\n", __FUNCTION__, f->name, conv->name,
+                            i, fb_load(out + i * bytes), v);
+                    rv = -2;
+                    break;
+                }
+            }
+        }
+        if( rv )
+            break;
+
+        scaler_init(&sc, FRAME_WIDTH, FRAME_HEIGH, FRAME_WIDTH, FRAME_HEIGH, 0);
+        memset(out, 0xAA, pixels * bytes);
+        scaler_rows(&sc, yuv, FRAME_WIDTH * 2, out, FRAME_WIDTH * bytes, 0, FRAME_HEIGH);
+        if( memcmp(out, ref, pixels * bytes) )
+        {
+            printf("%s : %s nearest 1:1 scale mismatch with reference\n", __FUNCTION__, f->name);
+            rv = -2;
+            break;
+        }
+
+        t0 = now_ns();
+        for (k = 0; k < loops; k++)
+            convert_yuv(yuv, FRAME_WIDTH * 2, out, FRAME_WIDTH * bytes, FRAME_WIDTH, FRAME_HEIGH);
+        ns = (now_ns() - t0) / loops;
+
+        /* 读 yuv + 写显存 */
+        printf("fb %-8s  %u bpp  direct    %7.3f ms/frame  %6.2f ns/pixel  %7.1f MB/s\n", f->name, f->bpp,
+                ns / 1e6, ns / pixels, pixels * (2.0 + bytes) / ns * 1e3);
+    }
+
+    /* 画布上是 rgb565，每种排列都当作不在表中，用通用写出函数 */
+    fb_format_use(&fb_formats[FB_FMT_rgb565]);
+    for (n = 0; n < FB_FORMAT_CNT && !rv; n++)
+    {
+        f = &fb_formats[n];
+        bytes = f->bpp / 8;
+        fb_any = *f;
+        fb_any.id = FB_FMT_rgb565;
+        fn = bytes == 2 ? fb_write_any16 : (bytes == 3 ? fb_write_any24 : fb_write_any32);
+
+        for (i = 0; i < 65536; i++)
+            base[i] = i;
+        fn(base, out, 65536);
+
+        for (i = 0; i < 65536; i++)
+        {
+            for (k = 0, v = 0; k < bytes; k++)
+                v |= (unsigned int)out[i * bytes + k] << (k * 8);
+            if( v != (selftest_fb_pixel(f, i) & (bytes == 4 ? 0xFFFFFFFFU : (1U << bytes * 8) - 1)) )
+            {
+                printf("%s : %s (custom) mismatch at 0x%04x: got 0x%08x expect 0x%08x\n", __FUNCTION__, f->name,
+                        i, v, selftest_fb_pixel(f, i));
+                rv = -1;
+                break;
+            }
+        }
+        if( rv )
+            break;
+
+        for (i = 0; i < pixels; i++)
+            base[i] = rand();
+
+        t0 = now_ns();
+        for (k = 0; k < loops; k++)
+        {
+            for (i = 0; i < FRAME_HEIGH; i++)
+                fn(base + i * FRAME_WIDTH, out + i * FRAME_WIDTH * bytes, FRAME_WIDTH);
+        }
+        ns = (now_ns() - t0) / loops;
+
+        /* 读画布 + 写显存，不含画到画布上的时间 */
+        printf("fb %-8s  %u bpp  custom    %7.3f ms/frame  %6.2f ns/pixel  %7.1f MB/s\n", f->name, f->bpp,
+                ns / 1e6, ns / pixels, pixels * (2.0 + bytes) / ns * 1e3);
+    }
+
+cleanup:
+    fb_format_use(&fb_formats[FB_FMT_rgb565]);
+    scaler_free(&sc);
+    free(base);
+    free(ref);
+    free(out);
+    return rv;
+}
+
+/* 缩放的自检和性能测试
+ * 最近邻 1:1 缩放应与标量参考版本逐位一致，再测常见尺寸下两种插值的耗时
+ */
+static int selftest_scale(unsigned int loops)
+{
+    static const unsigned int sizes[][4] = {
+        {  640, 480, 800, 480 },
+        { 1280, 720, 800, 450 },
+        { 1280, 720, 800, 480 },
+    };
+    scaler_t         sc;
+    unsigned char    *yuv;
+    unsigned char    *ref;
+    unsigned char    *out;
+    unsigned int     i, k, n;
+    int              bilinear;
+    int              rv = 0;
+    double           t0, ns;
+
+    memset(&sc, 0, sizeof(sc));
+    yuv = malloc(1280 * 720 * 2);
+    ref = malloc(800 * 480 * 2);
+    out = malloc(800 * 480 * 2);
+    if( !yuv || !ref || !out )
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        rv = -1;
+        goto cleanup;
+    }
+
+    for (i = 0; i < 1280 * 720 * 2; i++)
+        yuv[i] = rand() & 0xFF;
+
+    scaler_init(&sc, 640, 480, 640, 480, 0);
+    scaler_rows(&sc, yuv, 640 * 2, out, 640 * 2, 0, 480);
+    yuv422_rgb565(yuv, 640 * 2, ref, 640 * 2, 640, 480);
+    if( memcmp(ref, out, 640 * 480 * 2) )
+    {
+        printf("%s : nearest 1:1 scale mismatch with reference\n", __FUNCTION__);
+        rv = -2;
+    }
+
+    for (n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++)
+    {
+        for (bilinear = 0; bilinear < 2; bilinear++)
+        {
+            scaler_init(&sc, sizes[n][0], sizes[n][1], sizes[n][2], sizes[n][3], bilinear);
+
+            t0 = now_ns();
+            for (k = 0; k < loops; k++)
+                scaler_rows(&sc, yuv, sizes[n][0] * 2, out, sizes[n][2] * 2, 0, sizes[n][3]);
+            ns = (now_ns() - t0) / loops;
+
+            printf("scale %4ux%-4u -> %ux%u %-8s  %7.3f ms/frame  %6.2f ns/pixel\n", sizes[n][0], sizes[n][1],
+                    sizes[n][2], sizes[n][3], bilinear ? "bilinear" : "nearest", ns / 1e6, ns / (sizes[n][2] * sizes[n][3]));
+        }
+    }
+
+cleanup:
+    scaler_free(&sc);
+    free(yuv);
+    free(ref);
+    free(out);
+    return rv;
+}
+
+/* 旋转的自检和性能测试
+ * 先用宽高都不是块大小整数倍的帧逐像素核对每个角度，再测 FRAME_WIDTH x FRAME_HEIGH 的帧在屏幕上每个角度的耗时
+ */
+static int selftest_rotate(const unsigned char *yuv, unsigned int loops)
+{
+    static const int angles[] = { 0, 90, 180, 270 };
+    unsigned short   *page;
+    unsigned short   *ref;
+    unsigned short   *out, pix;
+    unsigned int     x, y, k, n, dx, dy;
+    int              saved_angle = rotate_angle;
+    int              saved_scale = scale_mode;
+    int              rv = 0;
+    double           t0, ns;
+
+    fb_vinfo.xres = LCD_WIDTH;
+    fb_vinfo.yres = LCD_HEIGH;
+    fb_line_length = LCD_WIDTH * 2;
+    scale_mode = SCALE_NONE;
+
+    page = malloc(LCD_WIDTH * 2 * LCD_HEIGH);
+    ref = malloc(FRAME_WIDTH * 2 * FRAME_HEIGH);
+    if( !page || !ref )
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        rv = -1;
+        goto cleanup;
+    }
+    memset(page, 0x0, LCD_WIDTH * 2 * LCD_HEIGH);
+
+    for (n = 0; n < sizeof(angles) / sizeof(angles[0]); n++)
+    {
+        rotate_angle = angles[n];
+
+        /* 470x330 的帧保证右边和下边都有不完整的块 */
+        frame_mode.width = 470;
+        frame_mode.height = 330;
+        frame_stride = FRAME_WIDTH * 2;
+        compute_view();
+        yuv422_rgb565(yuv + view_src_offset, frame_stride, (unsigned char *)ref, view_width * 2, view_width, view_height);
+        render_rows(yuv, (unsigned char *)page, 0, view_height);
+
+        out = (unsigned short *)((unsigned char *)page + view_dst_offset);
+        for (y = 0; y < view_height && !rv; y++)
+        {
+            for (x = 0; x < view_width; x++)
+            {
+                switch(rotate_angle)
+                {
+                    case 90:  dx = view_height - 1 - y; dy = x;                   break;
+                    case 180: dx = view_width - 1 - x;  dy = view_height - 1 - y; break;
+                    case 270: dx = y;                   dy = view_width - 1 - x;  break;
+                    default:  dx = x;                   dy = y;                   break;
+                }
+
+                pix = out[dy * LCD_WIDTH + dx];
+                if( pix != ref[y * view_width + x] )
+                {
+                    printf("%s : rotate %d mismatch at %u,%u: 0x%04x != 0x%04x\n", __FUNCTION__,
+                            rotate_angle, x, y, pix, ref[y * view_width + x]);
+                    rv = -2;
+                    break;
+                }
+            }
+        }
+
+        frame_mode.width = FRAME_WIDTH;
+        frame_mode.height = FRAME_HEIGH;
+        compute_view();
+
+        t0 = now_ns();
+        for (k = 0; k < loops; k++)
+            render_rows(yuv, (unsigned char *)page, 0, view_height);
+        ns = (now_ns() - t0) / loops;
+
+        printf("rotate %3d  %ux%u  %7.3f ms/frame  %6.2f ns/pixel\n", rotate_angle, view_width, view_height,
+                ns / 1e6, ns / (view_width * view_height));
+    }
+
+cleanup:
+    rotate_angle = saved_angle;
+    scale_mode = saved_scale;
+    free(page);
+    free(ref);
+    return rv;
+}
+
+static void motion_quiet(int start, double ratio)
+{
+    (void)start;
+    (void)ratio;
+}
+
+/* 局部重画的自检和性能测试
+ * 阈值为 0 时，局部重画后的画面应与整帧转换逐位一致，变化的块数也应准确；
+ * 再比较 NEON 和标量 SAD，测静止画面、全部变化和整帧转换每帧的耗时
+ */
+static int selftest_damage(const unsigned char *yuv, unsigned int loops)
+{
+    unsigned char    *frame;
+    unsigned char    *page;
+    unsigned char    *ref;
+    unsigned int     frame_size = FRAME_WIDTH * 2 * FRAME_HEIGH;
+    unsigned int     page_size = LCD_WIDTH * 2 * LCD_HEIGH;
+    unsigned int     i, k, x, y;
+    int              rv = 0;
+    double           t0, ns;
+
+    fb_vinfo.xres = LCD_WIDTH;
+    fb_vinfo.yres = LCD_HEIGH;
+    fb_line_length = LCD_WIDTH * 2;
+    frame_mode.width = FRAME_WIDTH;
+    frame_mode.height = FRAME_HEIGH;
+    frame_stride = FRAME_WIDTH * 2;
+    v4l2_pixfmt = V4L2_PIX_FMT_YUYV;
+    compute_view();
+
+    frame = malloc(frame_size);
+    page = malloc(page_size);
+    ref = malloc(page_size);
+    if( !frame || !page || !ref )
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        rv = -1;
+        goto cleanup;
+    }
+
+    memset(page, 0x0, page_size);
+    screen_base = page;
+    motion_hook = motion_quiet;
+    if( damage_init(0) < 0 )
+    {
+        rv = -1;
+        goto cleanup;
+    }
+
+    /* 在第 6~8 列、第 3~4 行的块里改一块，再改最后一个块的一个像素，共 7 个块变化 */
+    memcpy(frame, yuv, frame_size);
+    for (y = 50; y < 70; y++)
+        for (x = 100; x < 140; x++)
+            frame[y * frame_stride + x * 2] ^= 0x55;
+    frame[frame_size - 2] ^= 0x01;
+
+    damage_render(yuv, 0);
+    damage_render(frame, 0);
+    memset(ref, 0x0, page_size);
+    render_rows(frame, ref, 0, view_height);
+
+    if( memcmp(page, ref, page_size) )
+    {
+        printf("%s : damage redraw differs from full conversion\n", __FUNCTION__);
+        rv = -2;
+    }
+    if( (unsigned int)(damage.ratio * damage.cols * damage.rows + 0.5) != 7 )
+    {
+        printf("%s : %.0f tiles changed, expect 7\n", __FUNCTION__, damage.ratio * damage.cols * damage.rows);
+        rv = -2;
+    }
+
+#ifdef HAVE_NEON
+    if( cpu_has_neon() )
+    {
+        unsigned char    luma[DAMAGE_TILE * DAMAGE_TILE];
+
+        for (i = 0; i < 1000; i++)
+        {
+            x = (rand() % (FRAME_WIDTH / DAMAGE_TILE)) * DAMAGE_TILE;
+            y = (rand() % (FRAME_HEIGH / DAMAGE_TILE)) * DAMAGE_TILE;
+            if( tile_sad_neon(yuv + y * frame_stride + x * 2, frame_stride, frame + i, FRAME_WIDTH, luma, DAMAGE_TILE, DAMAGE_TILE) !=
+                tile_sad_scalar(yuv + y * frame_stride + x * 2, frame_stride, frame + i, FRAME_WIDTH, luma, DAMAGE_TILE, DAMAGE_TILE) )
+            {
+                printf("%s : neon SAD mismatch at %u,%u\n", __FUNCTION__, x, y);
+                rv = -2;
+                break;
+            }
+        }
+    }
+#endif
+
+    /* 静止画面只做 SAD，全部变化时 SAD 加整帧转换 */
+    t0 = now_ns();
+    for (k = 0; k < loops; k++)
+        damage_render(frame, 0);
+    ns = (now_ns() - t0) / loops;
+    printf("damage static   %7.3f ms/frame  changed %.2f\n", ns / 1e6, damage.ratio);
+
+    for (i = 0; i < frame_size; i += 2)
+        frame[i] = ~frame[i];
+    t0 = now_ns();
+    for (k = 0; k < loops; k++)
+        damage_render(k & 1 ? frame : yuv, 0);
+    ns = (now_ns() - t0) / loops;
+    printf("damage changing %7.3f ms/frame  changed %.2f\n", ns / 1e6, damage.ratio);
+
+    t0 = now_ns();
+    for (k = 0; k < loops; k++)
+        render_rows(frame, page, 0, view_height);
+    ns = (now_ns() - t0) / loops;
+    printf("damage off      %7.3f ms/frame\n", ns / 1e6);
+
+cleanup:
+    damage.threshold = -1;
+    motion_hook = motion_event;
+    screen_base = NULL;
+    free(frame);
+    free(page);
+    free(ref);
+    return rv;
+}
+
+/* 由字库点阵直接算出文字框 (cx, cy) 处的像素，不经过字形条 */
+static unsigned int selftest_osd_pixel(const osd_item_t *it, unsigned int cx, unsigned int cy)
+{
+    unsigned int     s = osd_font.scale;
+    unsigned int     k = cx / (6 * s);
+    unsigned int     gx = cx % (6 * s) / s;
+    unsigned int     gy = cy / s;
+    unsigned int     g = k < it->len ? it->glyph[k] : 0;
+    unsigned int     v = gx >= 1 && gy >= 1 && gy <= 7 && (osd_glyphs[g][gy - 1] >> (5 - gx) & 1) ? OSD_FG : OSD_BG;
+
+    return fb_pack(&fb_formats[fb_fmt], v, v, v);
+}
+
+/* 视图坐标 (x, y) 在一页显存上的像素，按 rotate_angle 转到屏幕坐标 */
+static unsigned char *selftest_view_pixel(unsigned char *page, unsigned int x, unsigned int y)
+{
+    unsigned char    *out = page + view_dst_offset;
+    unsigned int     w = fb_line_length / fb_bytes;
+
+    switch(rotate_angle)
+    {
+        case 90:  return out + (x * w + (view_height - 1 - y)) * fb_bytes;
+        case 180: return out + ((view_height - 1 - y) * w + (view_width - 1 - x)) * fb_bytes;
+        case 270: return out + ((view_width - 1 - x) * w + y) * fb_bytes;
+        default:  return out + (y * w + x) * fb_bytes;
+    }
+}
+
+/* 把当前的文字框逐个像素贴到一页显存上 */
+static void selftest_osd_paste(unsigned char *ref)
+{
+    unsigned int     i, cx, cy;
+
+    for (i = 0; i < osd->cnt; i++)
+    {
+        const osd_item_t   *it = &osd->item[i];
+
+        for (cy = 0; cy < it->h; cy++)
+            for (cx = 0; cx < it->w; cx++)
+                fb_store(selftest_view_pixel(ref, it->x + cx, it->y + cy), selftest_osd_pixel(it, cx, cy));
+    }
+}
+
+/* 不打开 OSD 把 frame 画到 ref 上，再贴上文字框，作为打开 OSD 时应得的结果 */
+static void selftest_osd_expect(const unsigned char *frame, unsigned char *ref, unsigned int page_size)
+{
+    osd_t            saved = *osd;
+
+    memset(ref, 0x0, page_size);
+    osd->cnt = 0;
+    render_rows(frame, ref, 0, view_height);
+    *osd = saved;
+    selftest_osd_paste(ref);
+}
+
+/* OSD 的自检和性能测试
+ * 打开 OSD 画出的一页应等于不打开时画的一页贴上文字框，覆盖不缩放、缩放、旋转和局部重画；
+ * 局部重画时文字变化和框下面的画面变化都要画对，再测更新文字和画一帧多花的时间
+ */
+static int selftest_osd(const unsigned char *yuv, unsigned int loops)
+{
+    static const struct { const char *name; int scale; int angle; unsigned int w, h; } cases[] = {
+        { "none",     SCALE_NONE, 0,  640, 480 },
+        { "fit",      SCALE_FIT,  0,  470, 330 },
+        { "rotate90", SCALE_NONE, 90, 640, 480 },
+    };
+    unsigned char    *frame;
+    unsigned char    *page;
+    unsigned char    *ref;
+    unsigned int     frame_size = FRAME_WIDTH * 2 * FRAME_HEIGH;
+    unsigned int     page_size = LCD_WIDTH * 2 * LCD_HEIGH;
+    unsigned int     saved_items = osd_items;
+    unsigned int     i, k, n;
+    int              saved_scale = scale_mode;
+    int              saved_angle = rotate_angle;
+    int              saved_bilinear = scale_bilinear;
+    int              rv = 0;
+    double           t0, ns, ns_off;
+
+    fb_vinfo.xres = LCD_WIDTH;
+    fb_vinfo.yres = LCD_HEIGH;
+    fb_line_length = LCD_WIDTH * 2;
+    frame_stride = FRAME_WIDTH * 2;
+    v4l2_pixfmt = V4L2_PIX_FMT_YUYV;
+    osd = &osd_ctx[0];
+
+    frame = malloc(frame_size);
+    page = malloc(page_size);
+    ref = malloc(page_size);
+    if( !frame || !page || !ref )
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        rv = -1;
+        goto cleanup;
+    }
+
+    for (n = 0; n < sizeof(cases) / sizeof(cases[0]) && !rv; n++)
+    {
+        scale_mode = cases[n].scale;
+        rotate_angle = cases[n].angle;
+        scale_bilinear = 1;
+        frame_mode.width = cases[n].w;
+        frame_mode.height = cases[n].h;
+
+        osd_items = 0;
+        compute_view();
+        t0 = now_ns();
+        for (k = 0; k < loops; k++)
+            render_rows(yuv, page, 0, view_height);
+        ns_off = (now_ns() - t0) / loops;
+
+        osd_items = OSD_TIME | OSD_FPS | OSD_LABEL;
+        snprintf(osd_label, sizeof(osd_label), "selftest %s", cases[n].name);
+        compute_view();
+        if( osd->cnt != OSD_ITEMS )
+        {
+            printf("%s : %s: %u of %d boxes placed\n", __FUNCTION__, cases[n].name, osd->cnt, OSD_ITEMS);
+            rv = -2;
+            break;
+        }
+
+        osd_update();
+        memset(page, 0x0, page_size);
+        render_rows(yuv, page, 0, view_height);
+        selftest_osd_expect(yuv, ref, page_size);
+        if( memcmp(page, ref, page_size) )
+        {
+            printf("%s : %s: overlay differs from the frame with boxes pasted on\n", __FUNCTION__, cases[n].name);
+            rv = -2;
+        }
+
+        t0 = now_ns();
+        for (k = 0; k < loops; k++)
+        {
+            osd_update();
+            render_rows(yuv, page, 0, view_height);
+        }
+        ns = (now_ns() - t0) / loops;
+
+        printf("osd %-8s  %ux%u  %7.3f ms/frame  off %7.3f ms/frame\n", cases[n].name, view_width, view_height,
+                ns / 1e6, ns_off / 1e6);
+    }
+
+    /* 局部重画：先画满一页，再分别改文字、改左上角框下面的画面 */
+    scale_mode = SCALE_NONE;
+    rotate_angle = 0;
+    frame_mode.width = FRAME_WIDTH;
+    frame_mode.height = FRAME_HEIGH;
+    compute_view();
+    memset(page, 0x0, page_size);
+    screen_base = page;
+    motion_hook = motion_quiet;
+    if( !rv && damage_init(0) < 0 )
+        rv = -1;
+
+    memcpy(frame, yuv, frame_size);
+    for (k = 0; k < 3 && !rv; k++)
+    {
+        if( k == 1 )
+            osd_text(&osd->item[0], "0123456789:.-/%?+_");
+        if( k == 2 )
+        {
+            for (i = 0; i < 40 * frame_stride; i++)
+                frame[view_src_offset + i] ^= 0x5A;
+        }
+
+        damage_render(frame, 0);
+        selftest_osd_expect(frame, ref, page_size);
+        if( memcmp(page, ref, page_size) )
+        {
+            printf("%s : damage step %u: overlay differs from the frame with boxes pasted on\n", __FUNCTION__, k);
+            rv = -2;
+        }
+    }
+
+    /* 每帧都换一次文字，测更新的开销 */
+    t0 = now_ns();
+    for (k = 0; k < loops * 100; k++)
+    {
+        osd_text(&osd->item[0], k & 1 ? "2026-01-01 00:00:00" : "2026-12-31 23:59:59");
+        osd_update();
+    }
+    ns = (now_ns() - t0) / (loops * 100);
+    printf("osd update  %7.1f ns\n", ns);
+
+cleanup:
+    damage.threshold = -1;
+    motion_hook = motion_event;
+    screen_base = NULL;
+    osd_items = saved_items;
+    osd_label[0] = '\0';
+    scale_mode = saved_scale;
+    rotate_angle = saved_angle;
+    scale_bilinear = saved_bilinear;
+    frame_mode.width = FRAME_WIDTH;
+    frame_mode.height = FRAME_HEIGH;
+    compute_view();
+    free(frame);
+    free(page);
+    free(ref);
+    return rv;
+}
+
+#ifdef HAVE_JPEG
+/* 把 RGB888 图像压缩成和 UVC 摄像头一样的 4:2:2 JPEG，返回 malloc 的数据 */
+static unsigned char *selftest_jpeg_encode(const unsigned char *rgb, unsigned int width, unsigned int height,
+                                           unsigned long *size)
+{
+    struct jpeg_compress_struct  cinfo;
+    struct jpeg_error_mgr        jerr;
+    unsigned char                *data = NULL;
+    JSAMPROW                     row;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &data, size);
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 85, TRUE);
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 1;
+
+    jpeg_start_compress(&cinfo, TRUE);
+    while(cinfo.next_scanline < height)
+    {
+        row = (JSAMPROW)(rgb + cinfo.next_scanline * width * 3);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    return data;
+}
+
+/* MJPEG 解码的自检和性能测试
+ * 用平滑渐变加少量噪声的图像压缩成 JPEG，1:1 解码后和原图比较平均误差，
+ * 再测 640x480 (1:1) 和 1280x960 (DCT 缩小 1/2) 每帧的解码耗时，可以和上面 YUYV 转换的耗时对比
+ */
+/* 一页显存上解码出的画面和原图每个分量的平均误差，分量按当前格式的位宽截断后比较 */
+static double selftest_mjpeg_error(const unsigned char *page, const unsigned char *rgb, unsigned int w)
+{
+    const fb_format_t *f = &fb_formats[fb_fmt];
+    const unsigned char *o;
+    unsigned long    err = 0;
+    unsigned int     x, y, v;
+
+    for (y = 0; y < view_height; y++)
+    {
+        for (x = 0; x < view_width; x++)
+        {
+            v = fb_load(page + view_dst_offset + y * fb_line_length + x * fb_bytes);
+            o = rgb + ((y + mjpeg->crop_y) * w + x + mjpeg->crop_x) * 3;
+            err += abs((int)(selftest_fb_channel(v, f->r_len, f->r_off, f->r_len) << (8 - f->r_len)) - (o[0] >> (8 - f->r_len) << (8 - f->r_len)));
+            err += abs((int)(selftest_fb_channel(v, f->g_len, f->g_off, f->g_len) << (8 - f->g_len)) - (o[1] >> (8 - f->g_len) << (8 - f->g_len)));
+            err += abs((int)(selftest_fb_channel(v, f->b_len, f->b_off, f->b_len) << (8 - f->b_len)) - (o[2] >> (8 - f->b_len) << (8 - f->b_len)));
+        }
+    }
+
+    return (double)err / (3 * view_width * view_height);
+}
+
+static int selftest_mjpeg(unsigned int loops)
+{
+    static const unsigned int sizes[][2] = {
+        {  640, 480 },
+        { 1280, 960 },
+    };
+    unsigned char    *rgb;
+    unsigned char    *jpeg;
+    unsigned char    *ref;
+    unsigned char    *page;
+    unsigned long    size;
+    unsigned int     w, h, x, y, k, n, i;
+    int              rv = 0;
+    double           t0, ns, err;
+
+    fb_vinfo.xres = LCD_WIDTH;
+    fb_vinfo.yres = LCD_HEIGH;
+    fb_line_length = LCD_WIDTH * 2;
+
+    rgb = malloc(1280 * 960 * 3);
+    page = malloc(LCD_WIDTH * 4 * LCD_HEIGH);
+    ref = malloc(LCD_WIDTH * 2 * LCD_HEIGH);
+    if( !rgb || !page || !ref )
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        rv = -1;
+        goto cleanup;
+    }
+    memset(page, 0x0, LCD_WIDTH * 2 * LCD_HEIGH);
+
+    for (n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++)
+    {
+        w = sizes[n][0];
+        h = sizes[n][1];
+        for (y = 0; y < h; y++)
+        {
+            for (x = 0; x < w; x++)
+            {
+                rgb[(y * w + x) * 3 + 0] = x * 255 / w;
+                rgb[(y * w + x) * 3 + 1] = y * 255 / h;
+                rgb[(y * w + x) * 3 + 2] = ((x + y) * 255 / (w + h)) ^ (rand() & 0x7);
+            }
+        }
+
+        jpeg = selftest_jpeg_encode(rgb, w, h, &size);
+        frame_mode.width = w;
+        frame_mode.height = h;
+        if( !jpeg || mjpeg_setup() < 0 )
+        {
+            free(jpeg);
+            rv = -1;
+            goto cleanup;
+        }
+
+        /* 1:1 解码时每种显存格式都和原图比较，量化加上 JPEG 压缩，每个分量平均误差应在几个单位内 */
+        for (i = mjpeg->scale_denom == 1 ? FB_FORMAT_CNT : 1; i > 0 && !rv; i--)
+        {
+            fb_format_use(&fb_formats[i - 1]);
+            fb_line_length = LCD_WIDTH * fb_bytes;
+            memset(page, 0x0, LCD_WIDTH * 4 * LCD_HEIGH);
+            if( mjpeg_setup() < 0 )
+            {
+                rv = -1;
+                break;
+            }
 
-    /* 在内核中申请帧缓冲区
-     * 并获取缓冲区信息，用以将用户空间的内存映射到内核空间
+            if( mjpeg_decode(jpeg, size, page) < 0 )
+            {
+                printf("%s : decode %ux%u to %s failed\n", __FUNCTION__, w, h, fb_format->name);
+                rv = -2;
+            }
+            else if( mjpeg->scale_denom == 1 && (err = selftest_mjpeg_error(page, rgb, w)) > 8 )
+            {
+                printf("%s : decoded %ux%u to %s differs from source, mean error %.2f\n", __FUNCTION__, w, h,
+                        fb_format->name, err);
+                rv = -2;
+            }
+        }
+
+        /* 打开 OSD 解码，应等于不打开时解码的结果贴上文字框 */
+        if( !rv )
+        {
+            memcpy(ref, page, LCD_WIDTH * 2 * LCD_HEIGH);
+            osd_items = OSD_TIME | OSD_FPS | OSD_LABEL;
+            if( mjpeg_setup() < 0 )
+                rv = -1;
+            osd_update();
+            mjpeg_decode(jpeg, size, (unsigned char *)page);
+            selftest_osd_paste(ref);
+            if( !rv && memcmp(page, ref, LCD_WIDTH * 2 * LCD_HEIGH) )
+            {
+                printf("%s : %ux%u with osd differs from the frame with boxes pasted on\n", __FUNCTION__, w, h);
+                rv = -2;
+            }
+
+            osd_items = 0;
+            mjpeg_setup();
+            memcpy(page, ref, LCD_WIDTH * 2 * LCD_HEIGH);
+        }
+
+        t0 = now_ns();
+        for (k = 0; k < loops; k++)
+            mjpeg_decode(jpeg, size, (unsigned char *)page);
+        ns = (now_ns() - t0) / loops;
+
+        printf("mjpeg %4ux%-4u 1/%u -> %ux%u  %7.3f ms/frame  %6.2f ns/pixel  %4lu KiB/frame\n", w, h,
+                mjpeg->scale_denom, view_width, view_height, ns / 1e6, ns / (view_width * view_height), size / 1024);
+
+        free(jpeg);
+    }
+
+cleanup:
+    fb_format_use(&fb_formats[FB_FMT_rgb565]);
+    fb_line_length = LCD_WIDTH * 2;
+    frame_mode.width = FRAME_WIDTH;
+    frame_mode.height = FRAME_HEIGH;
+    free(rgb);
+    free(page);
+    free(ref);
+    return rv;
+}
+#endif
+
+/* 转换实现的自检和性能测试
+ * 先和标量参考版本逐位比对，再在 FRAME_WIDTH x FRAME_HEIGH 的随机帧上测量每像素耗时和周期数
+ */
+int run_selftest(unsigned int loops)
+{
+    unsigned char    *yuv;
+    unsigned char    *rgb;
+    unsigned int     pixels = FRAME_WIDTH * FRAME_HEIGH;
+    unsigned int     i, n;
+    int              perf_fd;
+    int              failed = 0;
+    double           ghz, t0, ns;
+    long long        c0, cycles;
+
+    yuv = malloc(pixels * 2);
+    rgb = malloc(pixels * 2);
+    if( !yuv || !rgb )
+    {
+        printf("%s : malloc error\n", __FUNCTION__);
+        free(yuv);
+        free(rgb);
+        return -1;
+    }
+
+    srand(0x5EED);
+    for (i = 0; i < pixels * 2; i++)
+        yuv[i] = rand() & 0xFF;
+
+    perf_fd = perf_cycles_open();
+    ghz = cpu_freq_ghz();
+
+    printf("selftest: %dx%d frame, %u loops, cycles from %s\n", FRAME_WIDTH, FRAME_HEIGH, loops,
+            perf_fd >= 0 ? "perf counter" : (ghz > 0 ? "cpufreq estimate" : "n/a"));
+
+    for (n = 0; n < CONVERTER_CNT; n++)
+    {
+        const converter_t  *conv = &converters[n];
+
+        if( !converter_usable(conv) )
+        {
+            printf("%-10s not supported by this CPU\n", conv->name);
+            continue;
+        }
+
+        if( conv->grey ? selftest_grey(conv) < 0 : conv->fn != yuv422_rgb565 && selftest_exact(conv) < 0 )
+        {
+            failed++;
+            continue;
+        }
+
+        conv->fn(yuv, FRAME_WIDTH * 2, rgb, FRAME_WIDTH * 2, FRAME_WIDTH, FRAME_HEIGH);
+
+        c0 = perf_cycles_read(perf_fd);
+        t0 = now_ns();
+        for (i = 0; i < loops; i++)
+            conv->fn(yuv, FRAME_WIDTH * 2, rgb, FRAME_WIDTH * 2, FRAME_WIDTH, FRAME_HEIGH);
+        ns = (now_ns() - t0) / loops;
+        cycles = perf_cycles_read(perf_fd);
+
+        printf("%-10s %s  %7.3f ms/frame  %6.2f ns/pixel  %5.1f KiB tables  ", conv->name,
+                conv->grey ? "grey-only" : (conv->fn == yuv422_rgb565 ? "reference" : "bit-exact"), ns / 1e6, ns / pixels, conv->footprint / 1024.0);
+        if( c0 >= 0 && cycles >= 0 )
+            printf("%6.2f cycles/pixel\n", (double)(cycles - c0) / loops / pixels);
+        else if( ghz > 0 )
+            printf("%6.2f cycles/pixel (est)\n", ns * ghz / pixels);
+        else
+            printf("   n/a cycles/pixel\n");
+    }
+
+    if( selftest_csc(yuv, loops) < 0 )
+        failed++;
+    selftest_display(yuv, loops);
+    if( selftest_fb_format(yuv, loops) < 0 )
+        failed++;
+    if( selftest_scale(loops) < 0 )
+        failed++;
+    if( selftest_rotate(yuv, loops) < 0 )
+        failed++;
+    if( selftest_damage(yuv, loops) < 0 )
+        failed++;
+    if( selftest_osd(yuv, loops) < 0 )
+        failed++;
+#ifdef HAVE_JPEG
+    if( selftest_mjpeg(loops) < 0 )
+        failed++;
+#endif
+
+    if( perf_fd >= 0 )
+        close(perf_fd);
+    free(yuv);
+    free(rgb);
+
+    return failed ? -2 : 0;
+}
+
+static void program_usage(char *progname)
+{
+    printf("Usage: %s [OPTION]...\n", progname);
+    printf(" %s is a program to show camera video on LCD screen\n", progname);
+
+    printf("\nMandatory arguments to long options are mandatory for short options too:\n");
+    printf(" -d[device  ]  Specify camera device, repeat to show up to %d cameras with -L, such as: -d /dev/video2\n", CAMERA_MAX);
+    printf(" -f[fb      ]  Specify framebuffer device, such as: -f /dev/fb0\n");
+#ifdef HAVE_DRM
+    printf(" -D[drm     ]  Show on a DRM/KMS device instead of the framebuffer, flip %d pages on vblank, such as: -D /dev/dri/card0\n", DRM_PAGES);
+#endif
+    printf(" -c[convert ]  Select YUV to RGB565 converter: auto, neon, table, scalar, or grey for a Y-only monochrome preview, such as: -c grey\n");
+    printf(" -C[matrix  ]  YUV color matrix instead of the one reported by the camera: bt601-full, bt601-limited, bt709-full or bt709-limited, such as: -C bt709-limited\n");
+    printf(" -b[double  ]  Double buffer the framebuffer and flip pages with FBIOPAN_DISPLAY\n");
+    printf(" -w[vsync   ]  Wait for vertical sync after each page flip, use with -b\n");
+    printf(" -s[scale   ]  Scale frames to the panel: none, fit (keep aspect ratio) or stretch, such as: -s fit\n");
+    printf(" -r[rotate  ]  Rotate the picture clockwise for portrait-mounted panels: 0, 90, 180 or 270, such as: -r 90\n");
+    printf(" -i[filter  ]  Scale filter: nearest or bilinear, such as: -i bilinear\n");
+    printf(" -e[format  ]  Capture pixel format: auto (MJPEG if the camera has it), yuyv or mjpeg, such as: -e yuyv\n");
+#ifdef HAVE_JPEG
+    printf(" -o[record  ]  Record the preview to an MJPEG AVI file in the background, such as: -o video.avi\n");
+#endif
+    printf(" -m[memory  ]  Capture buffer strategy: mmap, or userptr to let the camera write RGB565 into framebuffer pages\n");
+    printf(" -n[buffers ]  Number of capture buffers (%d~%d), more buffers favour throughput, such as: -n 8\n", BUFFER_MIN, BUFFER_MAX);
+    printf(" -l[latest  ]  Low latency: drain all ready buffers and only show the newest frame\n");
+    printf(" -g[g2g     ]  Measure glass-to-glass latency by toggling an LED seen in the picture center, such as: -g /sys/class/leds/red/brightness\n");
+    printf(" -a[damage  ]  Only redraw 16x16 tiles whose mean luma difference exceeds N, such as: -a 4\n");
+    printf(" -k[motion  ]  Run a command on motion start/end detected by -a, with \"start\"|\"end\" and the changed-tile ratio as $1 $2\n");
+    printf(" -p[pipeline]  Run capture, convert and display in separate threads with N convert threads (0: one per CPU), such as: -p 0\n");
+    printf(" -L[layout  ]  Multi-camera layout: side, pip, or x,y,w,h per camera joined by ':', later ones on top, such as: -L pip\n");
+    printf(" -X[exposure]  Auto exposure from the luma histogram, target mean luma 1~254, such as: -X 110\n");
+    printf(" -Z[zoom    ]  Digital zoom: level >= 1 or a region x,y,w,h of the frame, cropped by the camera if it can, scaled to fit unless -s is given, such as: -Z 2\n");
+    printf(" -O[osd     ]  Overlay text drawn in the same pass as the picture: time, fps, label or label=text joined by ',', such as: -O time,fps\n");
+    printf(" -S[share   ]  Publish captured frames in a shared-memory ring for other processes, add ,dmabuf to also export the capture buffers, such as: -S /video2lcd,dmabuf\n");
+    printf(" -H[hist    ]  Collect luma statistics with 64 or 256 histogram bins, dumped by SIGUSR1, such as: -H 64\n");
+    printf(" -t[selftest]  Check converters against the scalar reference and benchmark them, such as: -t 100\n");
+    printf(" -B[bench   ]  Replay a raw YUYV file or \"synthetic\" frames into a file-backed framebuffer (-f) or a DRM device (-D), such as: -B synthetic\n");
+    printf(" -F[fbformat]  Framebuffer format of the -B file: rgb565, bgr565, rgb888, bgr888, xrgb8888, argb8888, xbgr8888 or abgr8888, such as: -F xrgb8888\n");
+    printf(" -z[size    ]  Frame size of the -B YUYV file, such as: -z 640x480\n");
+    printf(" -K[baseline]  Compare -B results with a baseline file, save it if missing, such as: -K bench.baseline\n");
+    printf(" -h[help    ]  Display this help information\n");
+    printf(" -v[version ]  Display the program version\n");
+
+    printf("\n%s version %s\n", progname, PROG_VERSION);
+    return;
+}
+
+int main(int argc, char **argv)
+{
+    char             *progname = NULL;
+    char             *conv_name = NULL;
+    int              selftest_loops = 0;
+    int              pipeline_threads = -1;
+    int              zero_copy = 0;
+    int              opt;
+    char             *record_path = NULL;
+    char             *drm_path = NULL;
+    char             *g2g_path = NULL;
+    int              damage_threshold = -1;
+    char             *bench_src = NULL;
+    char             *bench_baseline_path = NULL;
+    char             *layout = "side";
+    char             *p = NULL;
+    int              ae_target = 0;
+    int              scale_set = 0;
+    unsigned int     flip_pages = 1;
+    unsigned int     i;
+
+    struct option long_options[] = {
+        {"device", required_argument, NULL, 'd'},
+        {"fb", required_argument, NULL, 'f'},
+        {"drm", required_argument, NULL, 'D'},
+        {"convert", required_argument, NULL, 'c'},
+        {"matrix", required_argument, NULL, 'C'},
+        {"double", no_argument, NULL, 'b'},
+        {"vsync", no_argument, NULL, 'w'},
+        {"pipeline", required_argument, NULL, 'p'},
+        {"buffers", required_argument, NULL, 'n'},
+        {"latest", no_argument, NULL, 'l'},
+        {"g2g", required_argument, NULL, 'g'},
+        {"damage", required_argument, NULL, 'a'},
+        {"motion", required_argument, NULL, 'k'},
+        {"memory", required_argument, NULL, 'm'},
+        {"format", required_argument, NULL, 'e'},
+        {"record", required_argument, NULL, 'o'},
+        {"scale", required_argument, NULL, 's'},
+        {"filter", required_argument, NULL, 'i'},
+        {"rotate", required_argument, NULL, 'r'},
+        {"selftest", required_argument, NULL, 't'},
+        {"layout", required_argument, NULL, 'L'},
+        {"exposure", required_argument, NULL, 'X'},
+        {"zoom", required_argument, NULL, 'Z'},
+        {"osd", required_argument, NULL, 'O'},
+        {"share", required_argument, NULL, 'S'},
+        {"hist", required_argument, NULL, 'H'},
+        {"bench", required_argument, NULL, 'B'},
+        {"size", required_argument, NULL, 'z'},
+        {"fbformat", required_argument, NULL, 'F'},
+        {"baseline", required_argument, NULL, 'K'},
+        {"version", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    progname = (char *)basename(argv[0]);
+
+    while ((opt = getopt_long(argc, argv, "d:f:D:c:C:bwp:n:lg:a:k:m:e:o:s:i:r:L:X:Z:O:S:H:t:B:z:F:K:vh", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'd': /* Set camera device, repeat for more cameras */
+                if(camera_cnt >= CAMERA_MAX)
+                {
+                    printf("too many cameras, at most %d\n", CAMERA_MAX);
+                    return 1;
+                }
+                cameras[camera_cnt++].dev = optarg;
+                break;
+
+            case 'f': /* Set framebuffer device */
+                fb_dev = optarg;
+                break;
+
+            case 'c': /* Select converter */
+                conv_name = optarg;
+                break;
+
+            case 'D': /* DRM device */
+                drm_path = optarg;
+                break;
+
+            case 'C': /* Color matrix */
+                csc = csc_find(optarg);
+                if(!csc)
+                    return 1;
+                csc_forced = 1;
+                break;
+
+            case 'b': /* Double buffer */
+                fb_pages = 2;
+                break;
+
+            case 'w': /* Wait for vsync */
+                fb_vsync = 1;
+                break;
+
+            case 'm': /* Capture buffer strategy */
+                if(strcmp(optarg, "mmap") && strcmp(optarg, "userptr"))
+                {
+                    printf("invalid memory %s, use mmap or userptr\n", optarg);
+                    return 1;
+                }
+                zero_copy = !strcmp(optarg, "userptr");
+                break;
+
+            case 'e': /* Capture pixel format */
+                capture_pref = !strcmp(optarg, "yuyv") ? V4L2_PIX_FMT_YUYV : (!strcmp(optarg, "mjpeg") ? V4L2_PIX_FMT_MJPEG : 0);
+                break;
+
+            case 'o': /* Record file */
+                record_path = optarg;
+                break;
+
+            case 's': /* Scale mode */
+                if(strcmp(optarg, "none") && strcmp(optarg, "fit") && strcmp(optarg, "stretch"))
+                {
+                    printf("invalid scale %s, use none, fit or stretch\n", optarg);
+                    return 1;
+                }
+                scale_set = 1;
+                scale_mode = !strcmp(optarg, "fit") ? SCALE_FIT : (!strcmp(optarg, "stretch") ? SCALE_STRETCH : SCALE_NONE);
+                break;
+
+            case 'i': /* Scale filter */
+                if(strcmp(optarg, "nearest") && strcmp(optarg, "bilinear"))
+                {
+                    printf("invalid filter %s, use nearest or bilinear\n", optarg);
+                    return 1;
+                }
+                scale_bilinear = !strcmp(optarg, "bilinear");
+                break;
+
+            case 'r': /* Rotate angle */
+                rotate_angle = atoi(optarg);
+                if(rotate_angle != 0 && rotate_angle != 90 && rotate_angle != 180 && rotate_angle != 270)
+                {
+                    printf("invalid rotate angle %s, use 0, 90, 180 or 270\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'n': /* Capture buffer count */
+                buffer_cnt = atoi(optarg);
+                if(buffer_cnt < BUFFER_MIN || buffer_cnt > BUFFER_MAX)
+                {
+                    printf("invalid buffer count %s, use %d~%d\n", optarg, BUFFER_MIN, BUFFER_MAX);
+                    return 1;
+                }
+                break;
+
+            case 'l': /* Latest frame wins */
+                low_latency = 1;
+                break;
+
+            case 'g': /* Glass-to-glass LED */
+                g2g_path = optarg;
+                break;
+
+            case 'a': /* Damage redraw threshold */
+                damage_threshold = atoi(optarg) > 0 ? atoi(optarg) : 0;
+                break;
+
+            case 'k': /* Motion event command */
+                damage.motion_cmd = optarg;
+                break;
+
+            case 'p': /* Pipelined threads */
+                pipeline_threads = atoi(optarg);
+                break;
+
+            case 't': /* Converter selftest and benchmark */
+                selftest_loops = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+
+            case 'L': /* Multi-camera layout */
+                layout = optarg;
+                break;
+
+            case 'X': /* Auto exposure target */
+                ae_target = atoi(optarg);
+                if(ae_target < 1 || ae_target > 254)
+                {
+                    printf("invalid exposure target %s, use 1~254\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'Z': /* Zoom level or region of interest */
+                if(zoom_parse(optarg) < 0)
+                {
+                    printf("invalid zoom %s, use a level >= 1 such as 2, or a region x,y,w,h\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'O': /* On-screen overlay */
+                if(osd_parse(optarg) < 0)
+                {
+                    printf("invalid osd %s, use time, fps, label or label=text joined by ','\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'S': /* Share frames in shared memory */
+                p = strchr(optarg, ',');
+                if(optarg[0] != '/' || strchr(optarg + 1, '/') || (p && strcmp(p, ",dmabuf")) ||
+                   (p ? (size_t)(p - optarg) : strlen(optarg)) > 48)
+                {
+                    printf("invalid share %s, use /name or /name,dmabuf\n", optarg);
+                    return 1;
+                }
+                shm_dmabuf = p != NULL;
+                if(p)
+                    *p = '\0';
+                shm_name = optarg;
+                break;
+
+            case 'H': /* Luma histogram bins */
+                luma_bins = atoi(optarg);
+                if(luma_bins != 64 && luma_bins != LUMA_BINS)
+                {
+                    printf("invalid histogram bins %s, use 64 or 256\n", optarg);
+                    return 1;
+                }
+                luma_enabled = 1;
+                break;
+
+            case 'B': /* Hardware-free benchmark source */
+                bench_src = optarg;
+                break;
+
+            case 'z': /* Benchmark frame size */
+                if(sscanf(optarg, "%ux%u", &frame_mode.width, &frame_mode.height) != 2 ||
+                   frame_mode.width < 2 || frame_mode.height < 1 || frame_mode.width % 2)
+                {
+                    printf("invalid frame size %s, use an even width such as 640x480\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'F': /* Benchmark framebuffer format */
+                if(!fb_format_find(optarg))
+                    return 1;
+                fb_format_use(fb_format_find(optarg));
+                break;
+
+            case 'K': /* Benchmark baseline file */
+                bench_baseline_path = optarg;
+                break;
+
+            case 'v':  /* Get software version */
+                printf("%s version %s\n", progname, PROG_VERSION);
+                return 0;
+
+            case 'h':  /* Get help information */
+                program_usage(progname);
+                return 0;
+
+            default:
+                break;
+        }
+    }
+
+    convert_yuv = select_converter(conv_name);
+    if( !convert_yuv )
+        return 1;
+
+    if( selftest_loops )
+        return run_selftest(selftest_loops) < 0 ? 1 : 0;
+
+    /* 变焦要把区域放大显示，没指定 -s 时按比例缩放 */
+    if( zoom_level && !scale_set )
+        scale_mode = SCALE_FIT;
+
+    if( bench_src )
+    {
+        /* 回放到 DRM 设备时和实际显示一样多页轮流翻页 */
+#ifdef HAVE_DRM
+        drm_dev = drm_path;
+        if(drm_dev && fb_pages == 1)
+            fb_pages = DRM_PAGES;
+#endif
+        return run_bench(bench_src, bench_baseline_path, damage_threshold) < 0 ? 1 : 0;
+    }
+
+    if(!camera_cnt)
+        cameras[camera_cnt++].dev = camera_dev;
+    camera_dev = cameras[0].dev;
+
+    /* 摄像头直接写进显存时没法旋转，也没法录像或叠加文字 */
+    if(zero_copy && (rotate_angle || record_path || osd_items))
+    {
+        printf("zero copy can't rotate, record or draw the OSD, use mmap and convert YUYV\n");
+        zero_copy = 0;
+    }
+
+    /* 多个摄像头各自画在屏幕的一部分上，fbdev 只用单缓冲 (DRM 下面仍然翻页)，也不能零拷贝或用流水线 */
+    if(camera_cnt > 1)
+    {
+        if(fb_pages > 1 || zero_copy || pipeline_threads >= 0)
+            printf("%u cameras: single buffer, mmap and event loop only\n", camera_cnt);
+        fb_pages = 1;
+        zero_copy = 0;
+        pipeline_threads = -1;
+    }
+
+    /* DRM 输出默认三页轮流，提交翻页后不用等它完成就能画下一帧
+     * 流水线模式下显示线程翻页，零拷贝时翻页后旧页马上还给摄像头，都要等翻页完成
      */
-    v4l2_require_buffer();
-    v4l2_query_buffer();
+#ifdef HAVE_DRM
+    drm_dev = drm_path;
+    if(drm_dev && fb_pages == 1)
+        fb_pages = DRM_PAGES;
+    if(drm_dev && (pipeline_threads >= 0 || zero_copy))
+        drm.sync = 1;
+#else
+    if(drm_path)
+        printf("built without DRM, show on %s\n", fb_dev);
+#endif
+
+    /* 零拷贝时每个帧缓冲区占一页显存，不能零拷贝时再回到翻页用的页数 */
+    flip_pages = fb_pages;
+    if(zero_copy && fb_pages < buffer_cnt)
+        fb_pages = buffer_cnt;
+
+    /* 要在创建任何线程和子进程之前屏蔽信号 */
+    if(install_signal() < 0)
+        return 1;
+
+    if(init_lcd() < 0 || camera_setup(layout) < 0)
+        return 1;
+
+    for(i=0; i<camera_cnt; i++)
+    {
+        camera_switch(i);
+        if(v4l2_open() < 0)
+            return 1;
+
+        /* 获取设备的能力和帧数据格式，并设置数据格式
+         * 不能零拷贝时退回 MMAP 方式采集 YUYV 再转换
+         */
+        v4l2_query_capability();
+        v4l2_enum_format();
+        if(zero_copy && v4l2_setup_zero_copy() < 0)
+        {
+            printf("zero copy unavailable, use mmap and convert YUYV\n");
+            fb_pages = flip_pages < fb_pages ? flip_pages : fb_pages;
+            fb_back = fb_pages > 1 ? 1 : 0;
+            if(fb_pages < 2)
+                fb_vsync = 0;
+        }
+
+        /* 选择能放进屏幕 (或分到的区域) 且帧率最高的采集模式 */
+        v4l2_find_mode(v4l2_pixfmt, &frame_mode);
+        v4l2_set_format();
+        v4l2_get_format();
+
+        /* 亮度统计在转换时取样，摄像头直接写 RGB565 或 MJPEG 时没有 */
+        if(ae_target && exposure_init(ae_target) == 0 && (v4l2_memtype == V4L2_MEMORY_USERPTR ||
+           v4l2_pixfmt == V4L2_PIX_FMT_MJPEG))
+            printf("auto exposure needs YUYV frames converted by %s\n", progname);
+
+        /* 在内核中申请帧缓冲区
+         * 并获取缓冲区信息，用以将用户空间的内存映射到内核空间
+         */
+        v4l2_require_buffer();
+        if(v4l2_query_buffer() < 0)
+            return 1;
+
+        /* 把帧发布到共享内存，给本机的其他进程用 */
+        if(shm_name && shm_setup() < 0)
+            return 1;
+    }
+    camera_switch(0);
+
+#ifdef HAVE_DRM
+    if(drm_dev)
+        drm_crop_setup();
+#endif
+
+    /* 只录第 0 个摄像头 */
+#ifdef HAVE_JPEG
+    if(record_path && recorder_start(record_path) < 0)
+        return 1;
+#else
+    if(record_path)
+        printf("built without libjpeg, can't record\n");
+#endif
+
+    /* 统计每帧的分阶段延迟和丢帧，收到 SIGUSR1 和退出时输出 */
+    if(frame_stat_init(fb_pages) < 0)
+        return 1;
+    if(g2g_path && g2g_open(g2g_path) < 0)
+        return 1;
+    if(damage_threshold >= 0 && damage_init(damage_threshold) < -1)
+        return 1;
 
     /* 开始视频数据采集
-     * 使用 select 监听数据，有数据则从帧缓冲队列取出数据
-     * 采集结束后，停止采集，并解除映射，关闭文件描述符
+     * 用 epoll 等待所有摄像头的帧，没有帧时由看门狗重启采集
+     * 收到 SIGINT/SIGTERM 后，停止采集，并解除映射，关闭文件描述符
      */
-    v4l2_stream_on();
-    v4l2_select();
-    v4l2_stream_off();
-    v4l2_unmmap();
+    for(i=0; i<camera_cnt; i++)
+    {
+        camera_switch(i);
+        cameras[i].streaming = v4l2_stream_on() == 0;
+    }
+    camera_switch(0);
+
+    if(pipeline_threads >= 0 && v4l2_memtype == V4L2_MEMORY_MMAP)
+        v4l2_pipeline(pipeline_threads);
+    else
+        v4l2_event_loop();
+
+#ifdef HAVE_JPEG
+    recorder_stop();
+#endif
+    frame_stat_dump("exit");
 
-    close(fd_camera);
+    for(i=0; i<camera_cnt; i++)
+    {
+        camera_switch(i);
+        if(cameras[i].streaming)
+            v4l2_stream_off();
+        v4l2_unmmap();
+        close(fd_camera);
+    }
+    shm_destroy();
+#ifdef HAVE_DRM
+    drm_close();
+#endif
+    if(fd_lcd >= 0)
+        fb_restore_pages();
     close(fd_lcd);
 
     return 0;